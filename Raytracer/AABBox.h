@@ -4,6 +4,7 @@
 #include "MinMax.h"
 #include "Mesh.h"
 #include "VertexTraits.h"
+#include "Parallel.h"
 
 //
 // Axis-aligned bounding box
@@ -15,49 +16,179 @@ template<class N>
         N xMin; N xMax;
         N yMin; N yMax;
         N zMin; N zMax;
+
+        void extend(const AABBox &other)
+        {
+            xMin = Min(xMin, other.xMin);
+            yMin = Min(yMin, other.yMin);
+            zMin = Min(zMin, other.zMin);
+
+            xMax = Max(xMax, other.xMax);
+            yMax = Max(yMax, other.yMax);
+            zMax = Max(zMax, other.zMax);
+        }
+
+        GAL_imp::Point<N,3> getCenter() const
+        {
+            return GAL_imp::P3_<N>((xMin + xMax) / 2, (yMin + yMax) / 2, (zMin + zMax) / 2);
+        }
+
+        GAL_imp::Point<N,3> getSize() const
+        {
+            return GAL_imp::P3_<N>(xMax - xMin, yMax - yMin, zMax - zMin);
+        }
+
+        N getSurfaceArea() const
+        {
+            N x = xMax - xMin;
+            N y = yMax - yMin;
+            N z = zMax - zMin;
+
+            return 2 * (x * y + y * z + z * x);
+        }
+
+        bool operator == (const AABBox &other) const
+        {
+            return (xMin == other.xMin && yMin == other.yMin && zMin == other.zMin &&
+                    xMax == other.xMax && yMax == other.yMax && zMax == other.zMax);
+        }
+
+        bool operator != (const AABBox &other) const
+        {
+            return !(*this == other);
+        }
     };
 
+//
+// Test ray against box using slabs
+//
+// Ray is given by its start and inverse of its direction. Box is accepted
+// if it is entered before tMax, and entry distance is returned in tEntry
+// (zero if ray starts inside). Distances are in units of ray direction
+// length.
+//
+// Ray, which is parallel to slab and lies in plane of its face, gives 0 *
+// inf = NaN for that plane. Distances are reduced so that NaN is always
+// the first argument of Min() or Max(), which then returns the second one,
+// so that such slab is ignored, and the ray is tested as touching the box.
+//
+template<class N>
+    bool TestRayAABBox(
+        const GAL_imp::Point<N,3>   &start,
+        const GAL_imp::Point<N,3>   &invDirection,
+        const AABBox<N>             &box,
+        N                            tMax,
+        N                           &tEntry)
+    {
+        // Near and far plane of each slab by sign of direction
+        N nearX = ((0 <= invDirection[0] ? box.xMin : box.xMax) - start[0]) * invDirection[0];
+        N farX  = ((0 <= invDirection[0] ? box.xMax : box.xMin) - start[0]) * invDirection[0];
+        N nearY = ((0 <= invDirection[1] ? box.yMin : box.yMax) - start[1]) * invDirection[1];
+        N farY  = ((0 <= invDirection[1] ? box.yMax : box.yMin) - start[1]) * invDirection[1];
+        N nearZ = ((0 <= invDirection[2] ? box.zMin : box.zMax) - start[2]) * invDirection[2];
+        N farZ  = ((0 <= invDirection[2] ? box.zMax : box.zMin) - start[2]) * invDirection[2];
+
+        N tNear = Max(nearX, Max(nearY, Max(nearZ, N(0))));
+        N tFar  = Min(farX, Min(farY, Min(farZ, tMax)));
+
+        tEntry = tNear;
+
+        return (tNear <= tFar);
+    }
+
+//
+// Clip ray by box, i.e. find part [tEntry, tExit] of ray before tMax, which
+// is inside of box. See TestRayAABBox().
+//
+template<class N>
+    bool ClipRayAABBox(
+        const GAL_imp::Point<N,3>   &start,
+        const GAL_imp::Point<N,3>   &invDirection,
+        const AABBox<N>             &box,
+        N                            tMax,
+        N                           &tEntry,
+        N                           &tExit)
+    {
+        // Near and far plane of each slab by sign of direction
+        N nearX = ((0 <= invDirection[0] ? box.xMin : box.xMax) - start[0]) * invDirection[0];
+        N farX  = ((0 <= invDirection[0] ? box.xMax : box.xMin) - start[0]) * invDirection[0];
+        N nearY = ((0 <= invDirection[1] ? box.yMin : box.yMax) - start[1]) * invDirection[1];
+        N farY  = ((0 <= invDirection[1] ? box.yMax : box.yMin) - start[1]) * invDirection[1];
+        N nearZ = ((0 <= invDirection[2] ? box.zMin : box.zMax) - start[2]) * invDirection[2];
+        N farZ  = ((0 <= invDirection[2] ? box.zMax : box.zMin) - start[2]) * invDirection[2];
+
+        tEntry = Max(nearX, Max(nearY, Max(nearZ, N(0))));
+        tExit  = Min(farX, Min(farY, Min(farZ, tMax)));
+
+        return (tEntry <= tExit);
+    }
+
+//
+// Number of vertices processed by one thread at least
+//
+enum { BoundsGrainSize = 1 << 16 };
 
 template<class MeshType>
     void AABBoxFromMesh(const MeshType &mesh, AABBox<typename MeshType::NumericType> &aaBBox)
     {
+        typedef typename MeshType::VertexType     VertexType;
         typedef typename MeshType::AbstractVertex AbstractVertex;
         typedef typename MeshType::PointType      PointType;
         typedef typename MeshType::AbstractPoint  AbstractPoint;
         typedef typename MeshType::NumericType    NumericType;
+        typedef AABBox<NumericType>               AABBoxType;
 
         const VertexType *vertices = mesh.getVertexPointer();
         const size_t         count = mesh.getNumVertices();
 
         if (0 < count)
         {
-            const VertexType &vertex = vertices[0];
             const PointType &position = AbstractVertex::getPosition(vertices[0]);
 
-            aaBBox.xMin = AbstractPoint::getX(position);
-            aaBBox.yMin = AbstractPoint::getY(position);
-            aaBBox.zMin = AbstractPoint::getZ(position);
-            
-            aaBBox.xMax = AbstractPoint::getX(position);
-            aaBBox.yMax = AbstractPoint::getY(position);
-            aaBBox.zMax = AbstractPoint::getZ(position);
-
-            if (1 < count)
-            {
-                for (size_t i = 1; i != count; ++i)
+            AABBoxType initial;
+
+            initial.xMin = AbstractPoint::getX(position);
+            initial.yMin = AbstractPoint::getY(position);
+            initial.zMin = AbstractPoint::getZ(position);
+
+            initial.xMax = AbstractPoint::getX(position);
+            initial.yMax = AbstractPoint::getY(position);
+            initial.zMax = AbstractPoint::getZ(position);
+
+            //
+            // Each thread reduces its chunk in local variables, so that
+            // the loop can be vectorized.
+            //
+            aaBBox = ParallelReduce(count, BoundsGrainSize, initial,
+                [vertices](size_t begin, size_t end, AABBoxType &box)
+                {
+                    NumericType xMin = box.xMin, yMin = box.yMin, zMin = box.zMin;
+                    NumericType xMax = box.xMax, yMax = box.yMax, zMax = box.zMax;
+
+                    for (size_t i = begin; i != end; ++i)
+                    {
+                        const PointType &position = AbstractVertex::getPosition(vertices[i]);
+
+                        const NumericType x = AbstractPoint::getX(position);
+                        const NumericType y = AbstractPoint::getY(position);
+                        const NumericType z = AbstractPoint::getZ(position);
+
+                        xMin = (x < xMin ? x : xMin);
+                        yMin = (y < yMin ? y : yMin);
+                        zMin = (z < zMin ? z : zMin);
+
+                        xMax = (x > xMax ? x : xMax);
+                        yMax = (y > yMax ? y : yMax);
+                        zMax = (z > zMax ? z : zMax);
+                    }
+
+                    box.xMin = xMin; box.yMin = yMin; box.zMin = zMin;
+                    box.xMax = xMax; box.yMax = yMax; box.zMax = zMax;
+                },
+                [](AABBoxType &box, const AABBoxType &other)
                 {
-                    const VertexType &vertex = vertices[i];
-                    const PointType &position = AbstractVertex::getPosition(vertex);
-
-                    aaBBox.xMin = Min(aaBBox.xMin, AbstractPoint::getX(position));
-                    aaBBox.yMin = Min(aaBBox.yMin, AbstractPoint::getY(position));
-                    aaBBox.zMin = Min(aaBBox.zMin, AbstractPoint::getZ(position));
-            
-                    aaBBox.xMax = Max(aaBBox.xMax, AbstractPoint::getX(position));
-                    aaBBox.yMax = Max(aaBBox.yMax, AbstractPoint::getY(position));
-                    aaBBox.zMax = Max(aaBBox.zMax, AbstractPoint::getZ(position));
-                }
-            }
+                    box.extend(other);
+                });
         }
         else
         {
@@ -68,4 +199,4 @@ template<class MeshType>
     }
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,832 @@
+#ifndef INCLUDED_BVH_H
+#define INCLUDED_BVH_H
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <chrono>
+#include <memory>
+
+#include "MinMax.h"
+#include "Intersect.h"
+#include "AABBox.h"
+#include "Parallel.h"
+
+//
+// Statistics of built hierarchy
+//
+template<class N>
+    struct BVHStats
+    {
+        double  buildTime;  // in seconds
+        size_t  numNodes;
+        size_t  numLeaves;
+        size_t  maxDepth;
+        size_t  maxLeafSize;
+        N       sahCost;    // expected cost of ray traversal relative to root
+    };
+
+//
+// Bounding volume hierarchy over primitives (e.g. triangles of mesh)
+//
+// Nodes are stored in depth-first order: left child immediately follows its
+// parent. Leaves reference consecutive ranges of primitive indices.
+//
+// Hierarchy is built by binned surface area heuristic (SAH). Subtrees are
+// built as parallel tasks, and primitives of large nodes at the top levels
+// are binned in parallel, as there are fewer nodes than threads.
+//
+template<class _NumericType>
+    class BVH
+    {
+    public:
+        typedef _NumericType                        NumericType;
+        typedef GAL_imp::Point<NumericType,3>       PointType;
+        typedef GAL_imp::Ray<NumericType,3>         RayType;
+        typedef AABBox<NumericType>                 AABBoxType;
+        typedef BVHStats<NumericType>               StatsType;
+
+        struct Node
+        {
+            AABBoxType  bounds;
+            size_t      offset;     // leaf: first primitive, inner: right child
+            size_t      count;      // leaf: number of primitives, inner: 0
+        };
+
+        enum
+        {
+            NumBins         = 16,
+            MaxLeafSize     = 8,        // exceeded by leaves at depth limit
+            MaxDepth        = 64,
+            BinningGrain    = 1 << 16,  // primitives binned by one thread at least
+            TaskGrain       = 1 << 12   // primitives of subtree built as separate task at least
+        };
+
+        BVH(): mNodePointer(0), mNumNodes(0)
+        {
+            mStats.buildTime = 0;
+            mStats.numNodes = mStats.numLeaves = mStats.maxDepth = mStats.maxLeafSize = 0;
+            mStats.sahCost = 0;
+        }
+
+        //
+        // Build hierarchy over primitives, where primitive i has bounds[i]
+        //
+        void build(const AABBoxType *bounds, size_t count)
+        {
+            std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+            mIndices.resize(count);
+            mNodes.clear();
+            useOwnNodes();
+
+            if (0 != count)
+            {
+                std::vector<PrimitiveRef> refs(count);
+
+                ParallelFor(count, BinningGrain,
+                    [bounds, &refs](size_t begin, size_t end)
+                    {
+                        for (size_t i = begin; i != end; ++i)
+                        {
+                            refs[i].bounds = bounds[i];
+                            refs[i].index = i;
+                        }
+                    });
+
+                //
+                // Subtree of k primitives is given 2k-1 node slots, so that
+                // tasks write to separate ranges. Unused slots are removed
+                // afterwards.
+                //
+                std::vector<Node> slots(2 * count - 1);
+
+                BuildTask task;
+                task.refs = &refs[0];
+                task.slots = &slots[0];
+                task.taskDepth = 1;
+
+                while ((size_t(1) << task.taskDepth) < 2 * GetAvailableThreads())
+                {
+                    ++task.taskDepth;
+                }
+
+                task.buildNode(0, 0, count, 0, calculateBounds(&refs[0], count));
+
+                ParallelFor(count, BinningGrain,
+                    [this, &refs](size_t begin, size_t end)
+                    {
+                        for (size_t i = begin; i != end; ++i)
+                        {
+                            mIndices[i] = refs[i].index;
+                        }
+                    });
+
+                compact(slots);
+                useOwnNodes();
+            }
+
+            std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+            updateStats();
+            mStats.buildTime = elapsed.count();
+        }
+
+        //
+        // Use hierarchy built before (e.g. stored in mapped file) instead of
+        // building it. Nodes are used in place, and owner keeps their memory
+        // alive as long as hierarchy refers to it.
+        //
+        template<class IndexIterator>
+            void assign(
+                const Node                         *nodes,
+                size_t                              numNodes,
+                IndexIterator                       indices,
+                size_t                              numIndices,
+                const StatsType                    &stats,
+                const std::shared_ptr<const void>  &owner)
+            {
+                std::vector<Node>().swap(mNodes);
+                mNodePointer = nodes;
+                mNumNodes = numNodes;
+                mNodeOwner = owner;
+
+                mIndices.assign(indices, indices + numIndices);
+                mStats = stats;
+            }
+
+        bool isEmpty() const
+        {
+            return (0 == mNumNodes);
+        }
+
+        const Node * getNodePointer() const
+        {
+            return mNodePointer;
+        }
+
+        size_t getNumNodes() const
+        {
+            return mNumNodes;
+        }
+
+        //
+        // Node access used to collapse hierarchy (see WideBVH)
+        //
+        bool isLeafNode(size_t index) const
+        {
+            return (0 != mNodePointer[index].count);
+        }
+
+        size_t getRightChild(size_t index) const
+        {
+            return mNodePointer[index].offset;
+        }
+
+        const AABBoxType & getNodeBounds(size_t index) const
+        {
+            return mNodePointer[index].bounds;
+        }
+
+        void getLeafRange(size_t index, size_t &begin, size_t &end) const
+        {
+            begin = mNodePointer[index].offset;
+            end = begin + mNodePointer[index].count;
+        }
+
+        //
+        // Primitives ordered as referenced by leaves
+        //
+        const std::vector<size_t> & getIndices() const
+        {
+            return mIndices;
+        }
+
+        const StatsType & getStats() const
+        {
+            return mStats;
+        }
+
+        //
+        // Memory used by nodes and primitive indices in bytes
+        //
+        size_t getMemorySize() const
+        {
+            return mNumNodes * sizeof(Node) + mIndices.size() * sizeof(size_t);
+        }
+
+        //
+        // Release memory of nodes, when hierarchy was converted to other
+        // layout. Primitive indices and statistics are kept.
+        //
+        void releaseNodes()
+        {
+            std::vector<Node>().swap(mNodes);
+            useOwnNodes();
+        }
+
+        //
+        // Visit leaves, whose bounds are hit by ray, in near to far order.
+        //
+        // Calls visitor(begin, end, tMax) for range of positions in
+        // getIndices() for each such leaf, where tMax is distance of closest
+        // hit found so far, which visitor should lower when it finds closer
+        // hit. Distances are in units of ray direction length.
+        //
+        template<class Visitor>
+            void traverse(const RayType &ray, NumericType tMax, Visitor &visitor) const
+            {
+                traverseNodes(mNodePointer, mNumNodes, ray, tMax, visitor);
+            }
+
+        //
+        // Visit leaves of nodes in layout of this hierarchy, which are not
+        // owned by any (e.g. subtree, see PagedMesh). See traverse().
+        //
+        template<class Visitor>
+            static void traverseNodes(const Node *nodes, size_t numNodes, const RayType &ray, NumericType tMax, Visitor &visitor)
+            {
+                if (0 == numNodes)
+                {
+                    return;
+                }
+
+                PointType invDirection;
+
+                for (int i = 0; i != 3; ++i)
+                {
+                    invDirection[i] = 1 / ray.direction[i];
+                }
+
+                NumericType tEntry;
+
+                if (!TestRayAABBox(ray.start, invDirection, nodes[0].bounds, tMax, tEntry))
+                {
+                    return;
+                }
+
+                size_t stack[MaxDepth];
+                size_t stackSize = 0;
+                size_t index = 0;
+
+                for (;;)
+                {
+                    const Node &node = nodes[index];
+
+                    if (0 != node.count)
+                    {
+                        visitor(node.offset, node.offset + node.count, tMax);
+                    }
+                    else
+                    {
+                        NumericType tLeft, tRight;
+
+                        bool hitLeft  = TestRayAABBox(ray.start, invDirection, nodes[index + 1].bounds, tMax, tLeft);
+                        bool hitRight = TestRayAABBox(ray.start, invDirection, nodes[node.offset].bounds, tMax, tRight);
+
+                        if (hitLeft && hitRight)
+                        {
+                            // Visit nearer child first
+                            if (tLeft <= tRight)
+                            {
+                                stack[stackSize++] = node.offset;
+                                index = index + 1;
+                            }
+                            else
+                            {
+                                stack[stackSize++] = index + 1;
+                                index = node.offset;
+                            }
+
+                            continue;
+                        }
+                        else if (hitLeft)
+                        {
+                            index = index + 1;
+                            continue;
+                        }
+                        else if (hitRight)
+                        {
+                            index = node.offset;
+                            continue;
+                        }
+                    }
+
+                    // Pop nodes, which are still hit closer than tMax
+                    for (;;)
+                    {
+                        if (0 == stackSize)
+                        {
+                            return;
+                        }
+
+                        index = stack[--stackSize];
+
+                        if (TestRayAABBox(ray.start, invDirection, nodes[index].bounds, tMax, tEntry))
+                        {
+                            break;
+                        }
+                    }
+                }
+            }
+
+    private:
+        std::vector<Node>           mNodes;         // unless nodes are external
+        const Node                 *mNodePointer;
+        size_t                      mNumNodes;
+        std::shared_ptr<const void> mNodeOwner;     // of external nodes
+        std::vector<size_t>         mIndices;
+        StatsType                   mStats;
+
+        void useOwnNodes()
+        {
+            mNodePointer = (mNodes.empty() ? 0 : &mNodes[0]);
+            mNumNodes = mNodes.size();
+            mNodeOwner.reset();
+        }
+
+        BVH(const BVH &);
+        BVH &operator = (const BVH &);
+
+        //
+        // Primitive being sorted into hierarchy
+        //
+        // Bounds are moved together with index, so that the build does not
+        // gather bounds through indices.
+        //
+        struct PrimitiveRef
+        {
+            AABBoxType  bounds;
+            size_t      index;
+
+            NumericType getCentroid(int axis) const
+            {
+                return (0 == axis ? bounds.xMin + bounds.xMax :
+                       (1 == axis ? bounds.yMin + bounds.yMax : bounds.zMin + bounds.zMax)) / 2;
+            }
+        };
+
+        //
+        // Bounds of primitives and their centroids within node
+        //
+        struct NodeBounds
+        {
+            AABBoxType  bounds;
+            AABBoxType  centroids;
+
+            void extend(const PrimitiveRef &ref)
+            {
+                bounds.extend(ref.bounds);
+                extendCentroids(ref);
+            }
+
+            void extendCentroids(const PrimitiveRef &ref)
+            {
+                const NumericType x = ref.getCentroid(0);
+                const NumericType y = ref.getCentroid(1);
+                const NumericType z = ref.getCentroid(2);
+
+                centroids.xMin = Min(centroids.xMin, x); centroids.xMax = Max(centroids.xMax, x);
+                centroids.yMin = Min(centroids.yMin, y); centroids.yMax = Max(centroids.yMax, y);
+                centroids.zMin = Min(centroids.zMin, z); centroids.zMax = Max(centroids.zMax, z);
+            }
+
+            void extend(const NodeBounds &other)
+            {
+                bounds.extend(other.bounds);
+                centroids.extend(other.centroids);
+            }
+        };
+
+        struct Bin
+        {
+            AABBoxType  bounds;
+            size_t      count;
+        };
+
+        //
+        // Bins along each of three axes
+        //
+        struct Bins
+        {
+            Bin bins[3][NumBins];
+        };
+
+        static AABBoxType emptyBox()
+        {
+            AABBoxType box;
+            box.xMin = box.yMin = box.zMin =  (std::numeric_limits<NumericType>::max)();
+            box.xMax = box.yMax = box.zMax = -(std::numeric_limits<NumericType>::max)();
+            return box;
+        }
+
+        static NodeBounds emptyNodeBounds()
+        {
+            NodeBounds nodeBounds;
+            nodeBounds.bounds = emptyBox();
+            nodeBounds.centroids = emptyBox();
+            return nodeBounds;
+        }
+
+        static NumericType boxMin(const AABBoxType &box, int axis)
+        {
+            return (0 == axis ? box.xMin : (1 == axis ? box.yMin : box.zMin));
+        }
+
+        //
+        // Calls accumulate(begin, end, result) in parallel, if count is large
+        //
+        template<class ResultType, class Accumulate, class Combine>
+            static ResultType reduce(size_t count, const ResultType &identity, Accumulate accumulate, Combine combine)
+            {
+                if (count < BinningGrain)
+                {
+                    ResultType result = identity;
+                    accumulate(0, count, result);
+                    return result;
+                }
+
+                return ParallelReduce(count, BinningGrain, identity, accumulate, combine);
+            }
+
+        static NodeBounds calculateBounds(const PrimitiveRef *refs, size_t count)
+        {
+            return reduce(count, emptyNodeBounds(),
+                [refs](size_t begin, size_t end, NodeBounds &result)
+                {
+                    for (size_t i = begin; i != end; ++i)
+                    {
+                        result.extend(refs[i]);
+                    }
+                },
+                [](NodeBounds &result, const NodeBounds &other)
+                {
+                    result.extend(other);
+                });
+        }
+
+        struct BuildTask
+        {
+            PrimitiveRef       *refs;
+            Node               *slots;
+            size_t              taskDepth;  // subtrees above this depth are built in parallel
+
+            //
+            // Build subtree of primitives in [begin, end) at given slot
+            //
+            // Bounds of children are found while binning primitives of their
+            // parent, so primitives are read only twice per level: once when
+            // binned, and once when partitioned.
+            //
+            void buildNode(size_t slot, size_t begin, size_t end, size_t depth, const NodeBounds &nodeBounds)
+            {
+                const size_t count = end - begin;
+
+                Node &node = slots[slot];
+                node.bounds = nodeBounds.bounds;
+
+                size_t middle = begin;
+                NodeBounds leftBounds, rightBounds;
+
+                if (count <= 1 || size_t(MaxDepth - 2) <= depth ||
+                    !split(nodeBounds, begin, end, middle, leftBounds, rightBounds))
+                {
+                    node.offset = begin;
+                    node.count = count;
+                    return;
+                }
+
+                const size_t left = slot + 1;
+                const size_t right = slot + 2 * (middle - begin);
+
+                node.offset = right;
+                node.count = 0;
+
+                if (depth < taskDepth && TaskGrain <= count)
+                {
+                    BuildTask *self = this;
+
+                    ParallelInvoke(
+                        [self, left, begin, middle, depth, &leftBounds]() { self->buildNode(left, begin, middle, depth + 1, leftBounds); },
+                        [self, right, middle, end, depth, &rightBounds]() { self->buildNode(right, middle, end, depth + 1, rightBounds); });
+                }
+                else
+                {
+                    buildNode(left, begin, middle, depth + 1, leftBounds);
+                    buildNode(right, middle, end, depth + 1, rightBounds);
+                }
+            }
+
+            //
+            // Find split of lowest SAH cost, and partition primitives.
+            //
+            // Returns false if leaf is cheaper than any split.
+            //
+            bool split(
+                const NodeBounds   &nodeBounds,
+                size_t              begin,
+                size_t              end,
+                size_t             &middle,
+                NodeBounds         &leftBounds,
+                NodeBounds         &rightBounds)
+            {
+                const size_t count = end - begin;
+                const PointType extent = nodeBounds.centroids.getSize();
+
+                NumericType scale[3];
+                NumericType offset[3];
+
+                for (int axis = 0; axis != 3; ++axis)
+                {
+                    offset[axis] = boxMin(nodeBounds.centroids, axis);
+                    scale[axis] = (0 < extent[axis] ? NumericType(NumBins) * NumericType(0.9999) / extent[axis] : 0);
+                }
+
+                if (0 == scale[0] && 0 == scale[1] && 0 == scale[2])
+                {
+                    // All centroids coincide
+                    if (count <= MaxLeafSize)
+                    {
+                        return false;
+                    }
+
+                    middle = begin + count / 2;
+                    leftBounds = calculateBounds(refs + begin, middle - begin);
+                    rightBounds = calculateBounds(refs + middle, end - middle);
+                    return true;
+                }
+
+                //
+                // Small nodes use fewer bins, as there are fewer candidate
+                // split planes anyway
+                //
+                const int numBins = int(Min<size_t>(NumBins, Max<size_t>(4, count)));
+
+                for (int axis = 0; axis != 3; ++axis)
+                {
+                    scale[axis] *= NumericType(numBins) / NumericType(NumBins);
+                }
+
+                //
+                // Large nodes at the top levels are binned along all axes,
+                // as this is done in parallel and matters most for quality.
+                // Other nodes are binned only along axis of largest extent
+                // of centroids.
+                //
+                int axes[3] = { 0, 1, 2 };
+                int numAxes = 3;
+
+                if (count < BinningGrain)
+                {
+                    axes[0] = (extent[0] < extent[1] ? (extent[1] < extent[2] ? 2 : 1) : (extent[0] < extent[2] ? 2 : 0));
+                    numAxes = 1;
+                }
+
+                Bins binned;
+
+                for (int a = 0; a != numAxes; ++a)
+                {
+                    const int axis = axes[a];
+
+                    for (int bin = 0; bin != numBins; ++bin)
+                    {
+                        binned.bins[axis][bin].bounds = emptyBox();
+                        binned.bins[axis][bin].count = 0;
+                    }
+                }
+
+                const PrimitiveRef *refs = this->refs + begin;
+
+                auto accumulate = [refs, &scale, &offset, &axes, numAxes](size_t begin, size_t end, Bins &result)
+                    {
+                        for (size_t i = begin; i != end; ++i)
+                        {
+                            for (int a = 0; a != numAxes; ++a)
+                            {
+                                const int axis = axes[a];
+                                int bin = int((refs[i].getCentroid(axis) - offset[axis]) * scale[axis]);
+
+                                result.bins[axis][bin].bounds.extend(refs[i].bounds);
+                                result.bins[axis][bin].count++;
+                            }
+                        }
+                    };
+
+                // Bins are large, so they are not copied for small nodes
+                if (count < BinningGrain)
+                {
+                    accumulate(0, count, binned);
+                }
+                else
+                {
+                    binned = ParallelReduce(count, BinningGrain, binned, accumulate,
+                        [numBins](Bins &result, const Bins &other)
+                        {
+                            for (int axis = 0; axis != 3; ++axis)
+                            {
+                                for (int bin = 0; bin != numBins; ++bin)
+                                {
+                                    result.bins[axis][bin].bounds.extend(other.bins[axis][bin].bounds);
+                                    result.bins[axis][bin].count += other.bins[axis][bin].count;
+                                }
+                            }
+                        });
+                }
+
+                //
+                // Sweep bins from right to left accumulating areas, and then
+                // from left to right evaluating cost of each split plane.
+                //
+                NumericType bestCost = (std::numeric_limits<NumericType>::max)();
+                int bestAxis = -1;
+                int bestBin = 0;
+
+                for (int a = 0; a != numAxes; ++a)
+                {
+                    const int axis = axes[a];
+
+                    if (0 == scale[axis])
+                    {
+                        continue;
+                    }
+
+                    const Bin *bins = binned.bins[axis];
+                    NumericType rightArea[NumBins];
+                    size_t rightCount[NumBins];
+                    AABBoxType box = emptyBox();
+                    size_t n = 0;
+
+                    for (int bin = numBins - 1; bin != 0; --bin)
+                    {
+                        box.extend(bins[bin].bounds);
+                        n += bins[bin].count;
+                        rightArea[bin] = (0 != n ? box.getSurfaceArea() : 0);
+                        rightCount[bin] = n;
+                    }
+
+                    box = emptyBox();
+                    n = 0;
+
+                    for (int bin = 1; bin != numBins; ++bin)
+                    {
+                        box.extend(bins[bin - 1].bounds);
+                        n += bins[bin - 1].count;
+
+                        if (0 == n || 0 == rightCount[bin])
+                        {
+                            continue;
+                        }
+
+                        NumericType cost = box.getSurfaceArea() * NumericType(n) + rightArea[bin] * NumericType(rightCount[bin]);
+
+                        if (cost < bestCost)
+                        {
+                            bestCost = cost;
+                            bestAxis = axis;
+                            bestBin = bin;
+                        }
+                    }
+                }
+
+                //
+                // Cost of traversal step is assumed to equal cost of
+                // intersecting a primitive
+                //
+                const NumericType area = nodeBounds.bounds.getSurfaceArea();
+
+                if (-1 == bestAxis ||
+                    (0 < area && count <= MaxLeafSize && NumericType(count) <= 1 + bestCost / area))
+                {
+                    return false;
+                }
+
+                leftBounds = emptyNodeBounds();
+                rightBounds = emptyNodeBounds();
+
+                for (int bin = 0; bin != numBins; ++bin)
+                {
+                    (bin < bestBin ? leftBounds : rightBounds).bounds.extend(binned.bins[bestAxis][bin].bounds);
+                }
+
+                //
+                // Partition primitives, and find bounds of centroids of both
+                // children on the way
+                //
+                const NumericType axisOffset = offset[bestAxis];
+                const NumericType axisScale = scale[bestAxis];
+
+                PrimitiveRef *first = this->refs + begin;
+                PrimitiveRef *last  = this->refs + end;
+
+                for (;;)
+                {
+                    while (first != last && int((first->getCentroid(bestAxis) - axisOffset) * axisScale) < bestBin)
+                    {
+                        leftBounds.extendCentroids(*first);
+                        ++first;
+                    }
+
+                    while (first != last && !(int(((last - 1)->getCentroid(bestAxis) - axisOffset) * axisScale) < bestBin))
+                    {
+                        --last;
+                        rightBounds.extendCentroids(*last);
+                    }
+
+                    if (first == last)
+                    {
+                        break;
+                    }
+
+                    --last;
+                    std::swap(*first, *last);
+
+                    leftBounds.extendCentroids(*first);
+                    rightBounds.extendCentroids(*last);
+                    ++first;
+                }
+
+                middle = first - this->refs;
+
+                return true;
+            }
+        };
+
+        //
+        // Remove unused slots keeping depth-first order
+        //
+        void compact(const std::vector<Node> &slots)
+        {
+            std::vector<size_t> pending;    // right children, and their parents in compacted array
+            size_t slot = 0;
+
+            mNodes.reserve(slots.size());
+
+            for (;;)
+            {
+                mNodes.push_back(slots[slot]);
+
+                if (0 == slots[slot].count)
+                {
+                    pending.push_back(slots[slot].offset);
+                    pending.push_back(mNodes.size() - 1);
+                    slot = slot + 1;
+                    continue;
+                }
+
+                if (pending.empty())
+                {
+                    break;
+                }
+
+                mNodes[pending.back()].offset = mNodes.size();
+                pending.pop_back();
+
+                slot = pending.back();
+                pending.pop_back();
+            }
+
+            std::vector<Node>(mNodes).swap(mNodes);
+        }
+
+        void updateStats()
+        {
+            mStats.numNodes = mNumNodes;
+            mStats.numLeaves = 0;
+            mStats.maxDepth = 0;
+            mStats.maxLeafSize = 0;
+            mStats.sahCost = 0;
+
+            if (0 == mNumNodes)
+            {
+                return;
+            }
+
+            const NumericType rootArea = mNodePointer[0].bounds.getSurfaceArea();
+            std::vector<size_t> depths(mNumNodes, 0);
+
+            for (size_t i = 0; i != mNumNodes; ++i)
+            {
+                const Node &node = mNodePointer[i];
+                const NumericType relativeArea = (0 < rootArea ? node.bounds.getSurfaceArea() / rootArea : 1);
+
+                mStats.maxDepth = Max(mStats.maxDepth, depths[i]);
+
+                if (0 != node.count)
+                {
+                    mStats.numLeaves++;
+                    mStats.maxLeafSize = Max(mStats.maxLeafSize, node.count);
+                    mStats.sahCost += relativeArea * NumericType(node.count);
+                }
+                else
+                {
+                    depths[i + 1] = depths[node.offset] = depths[i] + 1;
+                    mStats.sahCost += relativeArea;
+                }
+            }
+        }
+    };
+
+typedef BVH<float>  BVH3f;
+typedef BVH<double> BVH3d;
+
+#endif
@@ -1,9 +1,365 @@
 #ifndef INCLUDED_BOUNDING_SPHERE
 #define INCLUDED_BOUNDING_SPHERE
 
+#include <limits>
+
 #include "MinMax.h"
 #include "Mesh.h"
 #include "VertexTraits.h"
+#include "AABBox.h"
+#include "Parallel.h"
+
+//
+// Bounding sphere
+//
+// Negative radius means that bounds are unknown, i.e. infinite.
+//
+template<class N>
+    struct BoundingSphere
+    {
+        GAL_imp::Point<N,3> center;
+        N                   radius;
+
+        BoundingSphere(): radius(-1)
+        {
+        }
+
+        bool isInfinite() const
+        {
+            return (radius < 0);
+        }
+    };
+
+typedef BoundingSphere<float>  BoundingSphere3f;
+typedef BoundingSphere<double> BoundingSphere3d;
+
+//
+// Upper bound of factor by which matrix can scale length of a vector.
+//
+// It is square root of Gershgorin bound of largest eigenvalue of M^T M,
+// which is exactly 1 for orthogonal matrices.
+//
+template<class N>
+    N MaxScaleOfTransform(const GAL_imp::Matrix<N,3> &ltm)
+    {
+        N maxRowSum = 0;
+
+        for (int i = 0; i != 3; ++i)
+        {
+            N rowSum = 0;
+
+            for (int j = 0; j != 3; ++j)
+            {
+                N mtm = 0;
+
+                for (int k = 0; k != 3; ++k)
+                {
+                    mtm += ltm.x[k][i] * ltm.x[k][j];
+                }
+
+                rowSum += fabs(mtm);
+            }
+
+            maxRowSum = Max(maxRowSum, rowSum);
+        }
+
+        return sqrt(maxRowSum);
+    }
+
+//
+// Transform bounding sphere by: p' = ltm * p + translation
+//
+template<class N>
+    void TransformBoundingSphere(
+        const BoundingSphere<N>         &sphere,
+        const GAL_imp::Matrix<N,3>      &ltm,
+        const GAL_imp::Point<N,3>       &translation,
+        BoundingSphere<N>               &out)
+    {
+        if (sphere.isInfinite())
+        {
+            out = sphere;
+            return;
+        }
+
+        out.center = (ltm * sphere.center) + translation;
+        out.radius = sphere.radius * MaxScaleOfTransform(ltm);
+    }
+
+//
+// Bounding sphere of union of bounding spheres
+//
+template<class IteratorType, class N>
+    void BoundingSphereFromSpheres(IteratorType begin, IteratorType end, BoundingSphere<N> &out)
+    {
+        out.radius = -1;
+
+        if (begin == end)
+        {
+            return;
+        }
+
+        GAL_imp::Point<N,3> minPoint = begin->center;
+        GAL_imp::Point<N,3> maxPoint = begin->center;
+
+        for (IteratorType it = begin; it != end; ++it)
+        {
+            if (it->isInfinite())
+            {
+                // union with infinite sphere is infinite
+                return;
+            }
+
+            for (int i = 0; i != 3; ++i)
+            {
+                minPoint[i] = Min(minPoint[i], it->center[i] - it->radius);
+                maxPoint[i] = Max(maxPoint[i], it->center[i] + it->radius);
+            }
+        }
+
+        out.center = (minPoint + maxPoint) * N(0.5);
+        out.radius = 0;
+
+        for (IteratorType it = begin; it != end; ++it)
+        {
+            out.radius = Max(out.radius, GAL::Distance(out.center, it->center) + it->radius);
+        }
+    }
+
+//
+// Grow sphere to the smallest sphere containing both spheres
+//
+template<class N>
+    void MergeBoundingSpheres(BoundingSphere<N> &sphere, const BoundingSphere<N> &other)
+    {
+        GAL_imp::Point<N,3> direction = other.center - sphere.center;
+        N distance = GAL::Len(direction);
+
+        if (distance + other.radius <= sphere.radius)
+        {
+            // other sphere is inside
+            return;
+        }
+
+        if (distance + sphere.radius <= other.radius)
+        {
+            // sphere is inside of other
+            sphere = other;
+            return;
+        }
+
+        N radius = (distance + sphere.radius + other.radius) / 2;
+
+        sphere.center += direction * ((radius - sphere.radius) / distance);
+        sphere.radius = radius;
+    }
+
+//
+// Axis-aligned box containing finite bounding sphere
+//
+template<class N>
+    void AABBoxFromBoundingSphere(const BoundingSphere<N> &sphere, AABBox<N> &box)
+    {
+        box.xMin = sphere.center[0] - sphere.radius; box.xMax = sphere.center[0] + sphere.radius;
+        box.yMin = sphere.center[1] - sphere.radius; box.yMax = sphere.center[1] + sphere.radius;
+        box.zMin = sphere.center[2] - sphere.radius; box.zMax = sphere.center[2] + sphere.radius;
+    }
+
+//
+// Bounding sphere of axis-aligned box
+//
+template<class N>
+    void BoundingSphereFromAABBox(const AABBox<N> &box, BoundingSphere<N> &sphere)
+    {
+        sphere.center = box.getCenter();
+        sphere.radius = GAL::Len(box.getSize()) / 2;
+    }
+
+//
+// Tight bounding sphere of mesh vertices
+//
+// Ritter's algorithm is run in parallel: extreme points along axes give
+// initial sphere, then each thread grows its own copy over its chunk of
+// vertices, and partial spheres are merged. Result is compared with sphere
+// centered in axis-aligned bounding box, and the smaller one is chosen.
+//
+template<class MeshType>
+    void BoundingSphereFromMesh(const MeshType &mesh, BoundingSphere<typename MeshType::NumericType> &sphere)
+    {
+        typedef typename MeshType::VertexType     VertexType;
+        typedef typename MeshType::AbstractVertex AbstractVertex;
+        typedef typename MeshType::PointType      PointType;
+        typedef typename MeshType::NumericType    NumericType;
+        typedef BoundingSphere<NumericType>       BoundingSphereType;
+
+        const VertexType *vertices = mesh.getVertexPointer();
+        const size_t         count = mesh.getNumVertices();
+
+        if (0 == count)
+        {
+            sphere.center = PointType();
+            sphere.radius = 0;
+            return;
+        }
+
+        //
+        // Find extreme points along each axis
+        //
+        struct Extremes
+        {
+            size_t minIndex[3];
+            size_t maxIndex[3];
+        };
+
+        Extremes initial;
+
+        for (int axis = 0; axis != 3; ++axis)
+        {
+            initial.minIndex[axis] = initial.maxIndex[axis] = 0;
+        }
+
+        Extremes extremes = ParallelReduce(count, BoundsGrainSize, initial,
+            [vertices](size_t begin, size_t end, Extremes &result)
+            {
+                for (int axis = 0; axis != 3; ++axis)
+                {
+                    size_t minIndex = result.minIndex[axis];
+                    size_t maxIndex = result.maxIndex[axis];
+                    NumericType minValue = AbstractVertex::getPosition(vertices[minIndex])[axis];
+                    NumericType maxValue = AbstractVertex::getPosition(vertices[maxIndex])[axis];
+
+                    for (size_t i = begin; i != end; ++i)
+                    {
+                        const NumericType value = AbstractVertex::getPosition(vertices[i])[axis];
+
+                        if (value < minValue)
+                        {
+                            minValue = value;
+                            minIndex = i;
+                        }
+
+                        if (value > maxValue)
+                        {
+                            maxValue = value;
+                            maxIndex = i;
+                        }
+                    }
+
+                    result.minIndex[axis] = minIndex;
+                    result.maxIndex[axis] = maxIndex;
+                }
+            },
+            [vertices](Extremes &result, const Extremes &other)
+            {
+                for (int axis = 0; axis != 3; ++axis)
+                {
+                    if (AbstractVertex::getPosition(vertices[other.minIndex[axis]])[axis] <
+                        AbstractVertex::getPosition(vertices[result.minIndex[axis]])[axis])
+                    {
+                        result.minIndex[axis] = other.minIndex[axis];
+                    }
+
+                    if (AbstractVertex::getPosition(vertices[other.maxIndex[axis]])[axis] >
+                        AbstractVertex::getPosition(vertices[result.maxIndex[axis]])[axis])
+                    {
+                        result.maxIndex[axis] = other.maxIndex[axis];
+                    }
+                }
+            });
+
+        //
+        // Initial sphere spans the most distant pair of extreme points
+        //
+        BoundingSphereType ritter;
+        ritter.radius = -1;
+
+        for (int axis = 0; axis != 3; ++axis)
+        {
+            const PointType &pMin = AbstractVertex::getPosition(vertices[extremes.minIndex[axis]]);
+            const PointType &pMax = AbstractVertex::getPosition(vertices[extremes.maxIndex[axis]]);
+
+            NumericType radius = GAL::Distance(pMin, pMax) / 2;
+
+            if (ritter.radius < radius)
+            {
+                ritter.center = (pMin + pMax) * NumericType(0.5);
+                ritter.radius = radius;
+            }
+        }
+
+        //
+        // Grow sphere to include all vertices
+        //
+        ritter = ParallelReduce(count, BoundsGrainSize, ritter,
+            [vertices](size_t begin, size_t end, BoundingSphereType &result)
+            {
+                PointType   center = result.center;
+                NumericType radius = result.radius;
+                NumericType sqrRadius = radius * radius;
+
+                for (size_t i = begin; i != end; ++i)
+                {
+                    const PointType &position = AbstractVertex::getPosition(vertices[i]);
+
+                    NumericType sqrDistance = GAL::SqrDistance(position, center);
+
+                    if (sqrRadius < sqrDistance)
+                    {
+                        NumericType distance = sqrt(sqrDistance);
+                        NumericType newRadius = (radius + distance) / 2;
+
+                        center += (position - center) * ((newRadius - radius) / distance);
+                        radius = newRadius;
+                        sqrRadius = radius * radius;
+                    }
+                }
+
+                result.center = center;
+                result.radius = radius;
+            },
+            [](BoundingSphereType &result, const BoundingSphereType &other)
+            {
+                MergeBoundingSpheres(result, other);
+            });
+
+        //
+        // Sphere centered in axis-aligned bounding box
+        //
+        BoundingSphereType centered;
+
+        for (int axis = 0; axis != 3; ++axis)
+        {
+            centered.center[axis] = (
+                AbstractVertex::getPosition(vertices[extremes.minIndex[axis]])[axis] +
+                AbstractVertex::getPosition(vertices[extremes.maxIndex[axis]])[axis]) / 2;
+        }
+
+        PointType center = centered.center;
+
+        NumericType sqrRadius = ParallelReduce(count, BoundsGrainSize, NumericType(0),
+            [vertices, center](size_t begin, size_t end, NumericType &result)
+            {
+                NumericType sqrRadius = result;
+
+                for (size_t i = begin; i != end; ++i)
+                {
+                    sqrRadius = Max(sqrRadius, GAL::SqrDistance(AbstractVertex::getPosition(vertices[i]), center));
+                }
+
+                result = sqrRadius;
+            },
+            [](NumericType &result, const NumericType &other)
+            {
+                result = Max(result, other);
+            });
+
+        centered.radius = sqrt(sqrRadius);
+
+        sphere = (ritter.radius < centered.radius ? ritter : centered);
+
+        // Compensate rounding errors of growing and merging
+        sphere.radius += sphere.radius * std::numeric_limits<NumericType>::epsilon() * 16;
+    }
 
 template<class MeshType>
     typename MeshType::NumericType BoundingSphereRadiusFromMesh(const MeshType &mesh)
@@ -11,7 +367,6 @@ template<class MeshType>
         typedef typename MeshType::VertexType     VertexType;
         typedef typename MeshType::AbstractVertex AbstractVertex;
         typedef typename MeshType::PointType      PointType;
-        typedef typename MeshType::AbstractPoint  AbstractPoint;
         typedef typename MeshType::NumericType    NumericType;
 
         const VertexType *vertices = mesh.getVertexPointer();
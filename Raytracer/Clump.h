@@ -3,11 +3,27 @@
 
 #include <memory>
 #include <list>
+#include <map>
+#include <limits>
+#include <vector>
 
 #include "Geometry.h"
+#include "GeometryStore.h"
+#include "GeometryBVH.h"
+#include "WideBVH.h"
+#include "QuantizedBVH.h"
 
+//
+// Group of geometries with bounding volume hierarchy over them.
+//
+// Geometries notify clump when they move, and update() refits hierarchy
+// only for those, which have moved since last update. Hierarchy is built
+// from scratch only after geometries were added.
+//
+// Until update() is called, rays are tested against all geometries.
+//
 template<class _NumericType>
-    class Clump
+    class Clump : public GeometryListener<_NumericType>
     {
     public:
         typedef _NumericType                        NumericType;
@@ -15,58 +31,457 @@ template<class _NumericType>
         typedef GAL_imp::Matrix<NumericType,3>      TransformType;
         typedef GAL_imp::Ray<NumericType,3>         RayType;
         typedef IntersectionPoint<NumericType,3>    IntersectionPointType;
+        typedef BoundingSphere<NumericType>         BoundingSphereType;
+        typedef AABBox<NumericType>                 AABBoxType;
         typedef Geometry<NumericType>               GeomertryType;
         typedef std::shared_ptr<GeomertryType>      GeomertryPtr;
         typedef std::list<GeomertryPtr>             ListType;
+        typedef GeometryStore<NumericType>          StoreType;
+        typedef typename StoreType::GeometryRef     GeometryRef;
+        typedef typename StoreType::ClosestHit      ClosestHit;
+        typedef GeometryBVH<NumericType>            BVHType;
+        typedef WideBVH<NumericType, 4>             Wide4BVHType;
+        typedef WideBVH<NumericType, 8>             Wide8BVHType;
+        typedef QuantizedBVH<NumericType, 4>        Quantized4BVHType;
+        typedef QuantizedBVH<NumericType, 8>        Quantized8BVHType;
 
-        void addGeometry(const GeomertryPtr &geometry)
+        Clump(): mLayout(BinaryBVHLayout), mStructureDirty(false)
         {
-            mList.push_back(geometry);
         }
 
-        bool intersectRay(RayType ray, IntersectionPointType &out)
+        ~Clump()
         {
-            // TODO: Clump could have bounding sphere and LTM
+            for (size_t i = 0; i != mGeometries.size(); ++i)
+            {
+                mGeometries[i]->removeListener(this);
+            }
+        }
 
-            return doIntersectRay(ray, out);
+        //
+        // Built-in geometry types are stored by their exact type, so that
+        // they are intersected without virtual calls (see GeometryStore).
+        //
+        template<class GeometryType>
+            void addGeometry(const std::shared_ptr<GeometryType> &geometry)
+            {
+                mIndexOf[geometry.get()] = mGeometries.size();
+                mRefs.push_back(mStore.addGeometry(geometry));
+                mGeometries.push_back(geometry);
+                geometry->addListener(this);
+                mStructureDirty = true;
+            }
+
+        //
+        // See GeometryBVH::setRebuildThreshold()
+        //
+        void setRebuildThreshold(NumericType threshold)
+        {
+            mBVH.setRebuildThreshold(threshold);
         }
 
-    protected:
-        bool doIntersectRay(const RayType &ray, IntersectionPointType &out)
+        //
+        // Layout of hierarchy used for intersection.
+        //
+        // Binary hierarchy is always kept for refitting, and wide layouts are
+        // collapsed from it in update(), which adds cost proportional to
+        // number of all geometries.
+        //
+        void setBVHLayout(BVHLayout layout)
+        {
+            mLayout = layout;
+            buildWideBVH();
+        }
+
+        BVHLayout getBVHLayout() const
+        {
+            return mLayout;
+        }
+
+        //
+        // Update hierarchy and bounds after geometries were added or moved.
+        //
+        // Cost is proportional to number of geometries moved since last
+        // update, unless geometries were added, or moved to infinity, in
+        // which case hierarchy is built from scratch.
+        //
+        void update()
         {
-            typedef typename ListType::const_iterator IteratorType;
-            
-            IntersectionPointType tmp;
-            IteratorType closest = mList.end();
-            out.distance = -1;
+            const bool changed = (mStructureDirty || !mMoved.empty());
 
-            for (IteratorType it = mList.begin(); it != mList.end(); ++it)
+            if (!mStructureDirty)
             {
-                if (!(*it)->intersectRay(ray, tmp))
+                for (size_t i = 0; i != mMoved.size(); ++i)
                 {
-                    continue;
+                    const size_t index = mMoved[i];
+                    const BoundingSphereType &bounds = mGeometries[index]->getWorldBounds();
+
+                    mMovedFlags[index] = false;
+
+                    if (bounds.isInfinite() || size_t(NotInHierarchy) == mItemOf[index])
+                    {
+                        mStructureDirty = true;
+                        continue;
+                    }
+
+                    AABBoxType box;
+                    AABBoxFromBoundingSphere(bounds, box);
+                    mBVH.updateItem(mItemOf[index], box);
+                }
+
+                mMoved.clear();
+                mBVH.rebuildDegraded();
+            }
+
+            if (mStructureDirty)
+            {
+                buildHierarchy();
+            }
+
+            if (changed)
+            {
+                buildWideBVH();
+            }
+
+            if (mInfinite.empty() && !mBVH.isEmpty())
+            {
+                BoundingSphereFromAABBox(mBVH.getBounds(), mBounds);
+            }
+            else
+            {
+                mBounds.radius = -1;
+            }
+        }
+
+        //
+        // Sphere around all geometries, as of last update(). Rays and
+        // collectors are tested against it, while hierarchy is up to date.
+        //
+        const BoundingSphereType & getBounds() const
+        {
+            return mBounds;
+        }
+
+        bool intersectRay(RayType ray, IntersectionPointType &out, bool withTangent = false)
+        {
+            // TODO: Clump could have LTM
+
+            ClosestHit closest;
+            StoreType::beginClosestHit(closest, out);
+
+            hitRay(ray, closest, out);
+
+            return endClosestHit(closest, ray, out, withTangent);
+        }
+
+        //
+        // Search for closest hit as by GeometryStore::hitGeometry(), which
+        // may continue search of other clumps, so that attributes are
+        // resolved only for the closest hit of all by endClosestHit() of
+        // its clump. Geometries beyond closest hit found so far are
+        // skipped.
+        //
+        void hitRay(const RayType &ray, ClosestHit &closest, IntersectionPointType &out)
+        {
+            if (mStructureDirty || !mMoved.empty())
+            {
+                // Hierarchy is not up to date
+                mStore.hitGeometries(ray, closest, out);
+                return;
+            }
+
+            if (!mBounds.isInfinite() && !GAL::TestRaySphere(ray, mBounds.center, mBounds.radius))
+            {
+                return;
+            }
+
+            doHitRay(ray, closest, out);
+        }
+
+        bool endClosestHit(const ClosestHit &closest, const RayType &ray, IntersectionPointType &out, bool withTangent)
+        {
+            return mStore.endClosestHit(closest, ray, out, withTangent);
+        }
+
+        //
+        // Add geometries, whose bounds may touch volume of collector, to
+        // it. Collector has testBounds(BoundingSphereType), testAABBox(AABBoxType)
+        // and addGeometry(GeomertryType *) (e.g. ShadowPacket).
+        //
+        template<class Collector>
+            void collectGeometries(Collector &collector)
+            {
+                if (mStructureDirty || !mMoved.empty())
+                {
+                    // Hierarchy is not up to date
+                    for (size_t i = 0; i != mGeometries.size(); ++i)
+                    {
+                        if (collector.testBounds(mGeometries[i]->getWorldBounds()))
+                        {
+                            collector.addGeometry(mGeometries[i].get());
+                        }
+                    }
+
+                    return;
+                }
+
+                if (!collector.testBounds(mBounds))
+                {
+                    return;
+                }
+
+                for (size_t i = 0; i != mInfinite.size(); ++i)
+                {
+                    collector.addGeometry(mGeometries[mInfinite[i]].get());
                 }
 
-                if (-1 == out.distance || tmp.distance < out.distance)
+                if (mBVH.isEmpty())
                 {
-                    out = tmp;
-                    closest = it;
+                    return;
+                }
+
+                size_t stack[BVHType::MaxDepth + 1];
+                size_t stackSize = 0;
+
+                stack[stackSize++] = 0;
+
+                while (0 != stackSize)
+                {
+                    const size_t index = stack[--stackSize];
+
+                    if (!collector.testAABBox(mBVH.getNodeBounds(index)))
+                    {
+                        continue;
+                    }
+
+                    if (mBVH.isLeafNode(index))
+                    {
+                        size_t begin, end;
+                        mBVH.getLeafRange(index, begin, end);
+
+                        for (; begin != end; ++begin)
+                        {
+                            collector.addGeometry(mGeometries[mGeometryOfItem[begin]].get());
+                        }
+                    }
+                    else
+                    {
+                        stack[stackSize++] = mBVH.getRightChild(index);
+                        stack[stackSize++] = index + 1;
+                    }
                 }
             }
 
-            if (closest == mList.end())
+        void geometryBoundsChanged(GeomertryType &geometry)
+        {
+            if (mStructureDirty)
+            {
+                return;
+            }
+
+            // Geometry may be copied with its listeners
+            typename std::map<const GeomertryType *, size_t>::const_iterator it = mIndexOf.find(&geometry);
+
+            if (mIndexOf.end() == it)
+            {
+                return;
+            }
+
+            const size_t index = it->second;
+
+            if (!mMovedFlags[index])
             {
-                return false;
+                mMovedFlags[index] = true;
+                mMoved.push_back(index);
             }
+        }
+
+    protected:
+        void doHitRay(const RayType &ray, ClosestHit &closest, IntersectionPointType &out)
+        {
+            for (size_t i = 0; i != mInfinite.size(); ++i)
+            {
+                mStore.hitGeometry(mRefs[mInfinite[i]], ray, closest, out);
+            }
+
+            HitVisitor visitor = { this, &ray, &closest, &out };
+            const NumericType distance = StoreType::getClosestDistance(closest, out);
+            const NumericType tMax = (-1 != distance ? distance : (std::numeric_limits<NumericType>::max)());
+
+            switch (mLayout)
+            {
+            case BinaryBVHLayout:
+                mBVH.traverse(ray, tMax, visitor);
+                break;
+            case Wide4BVHLayout:
+                mWide4BVH.traverse(ray, tMax, visitor);
+                break;
+            case Wide8BVHLayout:
+                mWide8BVH.traverse(ray, tMax, visitor);
+                break;
+            case Quantized4BVHLayout:
+                if (mQuantized4BVH.isEmpty())
+                {
+                    // See buildWideBVH()
+                    mWide4BVH.traverse(ray, tMax, visitor);
+                    break;
+                }
+
+                mQuantized4BVH.traverse(ray, tMax, visitor);
+                break;
+            case Quantized8BVHLayout:
+                if (mQuantized8BVH.isEmpty())
+                {
+                    // See buildWideBVH()
+                    mWide8BVH.traverse(ray, tMax, visitor);
+                    break;
+                }
 
-            return true;
+                mQuantized8BVH.traverse(ray, tMax, visitor);
+                break;
+            }
         }
 
     private:
-        ListType mList;
+        enum { NotInHierarchy = -1 };
+
+        //
+        // Intersects geometries in leaves of hierarchy
+        //
+        struct HitVisitor
+        {
+            Clump                  *clump;
+            const RayType          *ray;
+            ClosestHit             *closest;
+            IntersectionPointType  *out;
+
+            void operator () (size_t item, NumericType &tMax)
+            {
+                const GeometryRef &ref = clump->mRefs[clump->mGeometryOfItem[item]];
+
+                NumericType distance = clump->mStore.hitGeometry(ref, *ray, *closest, *out);
+
+                if (-1 != distance)
+                {
+                    tMax = distance;
+                }
+            }
+
+            void operator () (size_t begin, size_t end, NumericType &tMax)
+            {
+                for (size_t item = begin; item != end; ++item)
+                {
+                    (*this)(item, tMax);
+                }
+            }
+        };
+
+        StoreType                   mStore;
+        std::vector<GeomertryPtr>   mGeometries;
+        std::vector<GeometryRef>    mRefs;
+        std::map<const GeomertryType *, size_t> mIndexOf;
+
+        BVHType                     mBVH;
+        Wide4BVHType                mWide4BVH;
+        Wide8BVHType                mWide8BVH;
+        Quantized4BVHType           mQuantized4BVH;
+        Quantized8BVHType           mQuantized8BVH;
+        BVHLayout                   mLayout;
+        std::vector<size_t>         mItemOf;            // item of geometry in hierarchy
+        std::vector<size_t>         mGeometryOfItem;    // geometry of item in hierarchy
+        std::vector<size_t>         mInfinite;          // geometries outside of hierarchy
+        std::vector<size_t>         mMoved;
+        std::vector<bool>           mMovedFlags;
+        BoundingSphereType          mBounds;
+        bool                        mStructureDirty;
+
+        void buildHierarchy()
+        {
+            std::vector<AABBoxType> boxes;
+
+            mItemOf.resize(mGeometries.size());
+            mGeometryOfItem.clear();
+            mInfinite.clear();
+
+            for (size_t i = 0; i != mGeometries.size(); ++i)
+            {
+                const BoundingSphereType &bounds = mGeometries[i]->getWorldBounds();
+
+                if (bounds.isInfinite())
+                {
+                    mItemOf[i] = size_t(NotInHierarchy);
+                    mInfinite.push_back(i);
+                    continue;
+                }
+
+                AABBoxType box;
+                AABBoxFromBoundingSphere(bounds, box);
+
+                mItemOf[i] = boxes.size();
+                mGeometryOfItem.push_back(i);
+                boxes.push_back(box);
+            }
+
+            mBVH.build(boxes);
+
+            mMoved.clear();
+            mMovedFlags.assign(mGeometries.size(), false);
+            mStructureDirty = false;
+        }
+
+        void buildWideBVH()
+        {
+            mWide4BVH.clear();
+            mWide8BVH.clear();
+            mQuantized4BVH.clear();
+            mQuantized8BVH.clear();
+
+            if (mStructureDirty)
+            {
+                return;
+            }
+
+            switch (mLayout)
+            {
+            case Wide4BVHLayout:
+                mWide4BVH.build(mBVH);
+                break;
+            case Wide8BVHLayout:
+                mWide8BVH.build(mBVH);
+                break;
+            case Quantized4BVHLayout:
+                {
+                    Wide4BVHType wide;
+                    wide.build(mBVH);
+
+                    if (!mQuantized4BVH.build(wide))
+                    {
+                        // Does not fit into quantized nodes
+                        mWide4BVH = wide;
+                    }
+                }
+                break;
+            case Quantized8BVHLayout:
+                {
+                    Wide8BVHType wide;
+                    wide.build(mBVH);
+
+                    if (!mQuantized8BVH.build(wide))
+                    {
+                        // Does not fit into quantized nodes
+                        mWide8BVH = wide;
+                    }
+                }
+                break;
+            default:
+                break;
+            }
+        }
+
+        Clump(const Clump &);
+        Clump &operator = (const Clump &);
     };
     
     typedef Clump<float>  Clump3f;
     typedef Clump<double> Clump3d;
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,596 @@
+#ifndef INCLUDED_CLUSTERED_MESH_H
+#define INCLUDED_CLUSTERED_MESH_H
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "MinMax.h"
+#include "Mesh.h"
+#include "Parallel.h"
+
+//
+// Encoding of vertex attributes other than position into 16-bit words
+//
+template<class VertexType>
+    struct VertexCodec
+    {
+        // specialize for each vertex type
+    };
+
+template<class N, int I>
+    struct VertexCodec< GAL_imp::Point<N, I> >
+    {
+        typedef GAL_imp::Point<N, I> VertexType;
+        typedef GAL_imp::Point<N, I> PointType;
+
+        enum { NumWords = 0 };
+
+        static void encode(const VertexType &, unsigned short *)
+        {
+        }
+
+        static void decode(const PointType &position, const unsigned short *, VertexType &vertex)
+        {
+            vertex = position;
+        }
+    };
+
+//
+// Normal is encoded by octahedral mapping into two 16-bit numbers
+//
+template<class N, int I>
+    struct VertexCodec< Vertex<N, I> >
+    {
+        typedef Vertex<N, I>         VertexType;
+        typedef GAL_imp::Point<N, I> PointType;
+
+        enum { NumWords = 2 };
+
+        static void encode(const VertexType &vertex, unsigned short *words)
+        {
+            const PointType &normal = vertex.normal;
+
+            N length = std::fabs(normal[0]) + std::fabs(normal[1]) + std::fabs(normal[2]);
+            N x = (0 < length ? normal[0] / length : 0);
+            N y = (0 < length ? normal[1] / length : 0);
+
+            if (normal[2] < 0)
+            {
+                // Fold lower hemisphere over diagonals
+                N foldedX = (1 - std::fabs(y)) * sign(x);
+                N foldedY = (1 - std::fabs(x)) * sign(y);
+
+                x = foldedX;
+                y = foldedY;
+            }
+
+            words[0] = encodeSnorm(x);
+            words[1] = encodeSnorm(y);
+        }
+
+        static void decode(const PointType &position, const unsigned short *words, VertexType &vertex)
+        {
+            N x = decodeSnorm(words[0]);
+            N y = decodeSnorm(words[1]);
+            N z = 1 - std::fabs(x) - std::fabs(y);
+
+            if (z < 0)
+            {
+                N unfoldedX = (1 - std::fabs(y)) * sign(x);
+                N unfoldedY = (1 - std::fabs(x)) * sign(y);
+
+                x = unfoldedX;
+                y = unfoldedY;
+            }
+
+            vertex.position = position;
+            vertex.normal[0] = x;
+            vertex.normal[1] = y;
+            vertex.normal[2] = z;
+            vertex.normal /= GAL::Len(vertex.normal);
+        }
+
+    private:
+        static N sign(N x)
+        {
+            return (0 <= x ? N(1) : N(-1));
+        }
+
+        static unsigned short encodeSnorm(N x)
+        {
+            return (unsigned short)(short)std::floor(Min(Max(x, N(-1)), N(1)) * 32767 + N(0.5));
+        }
+
+        static N decodeSnorm(unsigned short word)
+        {
+            return Max(N(short(word)) / 32767, N(-1));
+        }
+    };
+
+//
+// Compressed read-only copy of mesh
+//
+// Triangles are grouped into clusters of up to ClusterSize consecutive
+// triangles, which reference vertices by 8-bit indices local to cluster.
+// Vertex positions are snapped to grid shared by whole mesh, and stored as
+// 16-bit offsets from grid coordinates of cluster. Hence vertex shared by
+// several clusters decodes to the same position in each of them, and mesh
+// stays watertight. Other vertex attributes are stored by VertexCodec.
+//
+// Grid step is power of two, chosen so that mesh spans at most 2^GridBits
+// steps, and every triangle fits into 16-bit range of cluster. Positions
+// of mesh should be snapped by snapPositions() before the mesh is used to
+// build anything depending on exact positions (bounds, hierarchy).
+//
+template<class _VertexType, class _IndexType = int>
+    class ClusteredMesh
+    {
+    public:
+        typedef _VertexType                         VertexType;
+        typedef _IndexType                          IndexType;
+        typedef Mesh<VertexType, IndexType>         MeshType;
+        typedef typename MeshType::AbstractVertex   AbstractVertex;
+        typedef typename MeshType::PointType        PointType;
+        typedef typename MeshType::NumericType      NumericType;
+        typedef VertexCodec<VertexType>             Codec;
+
+        enum
+        {
+            ClusterSize = 64,       // triangles, so that local indices fit 8 bits
+            GridBits    = 20,
+            MaxOffset   = 65535,
+            NumWords    = Codec::NumWords
+        };
+
+        struct Cluster
+        {
+            int             base[3];        // grid coordinates of cluster origin
+            unsigned int    firstTriangle;
+            unsigned int    firstVertex;
+        };
+
+        ClusteredMesh(): mStep(1), mNumTriangles(0)
+        {
+            mOrigin[0] = mOrigin[1] = mOrigin[2] = 0;
+        }
+
+        //
+        // Snap vertex positions of mesh to grid, which will be used to
+        // compress it
+        //
+        void snapPositions(MeshType &mesh)
+        {
+            calculateGrid(mesh);
+
+            VertexType *vertices = mesh.getWritableVertexPointer();
+
+            ParallelFor(mesh.getNumVertices(), 1 << 14,
+                [this, vertices](size_t begin, size_t end)
+                {
+                    for (size_t i = begin; i != end; ++i)
+                    {
+                        PointType &position = AbstractVertex::getPosition(vertices[i]);
+
+                        for (int a = 0; a != 3; ++a)
+                        {
+                            position[a] = decodeCoordinate(a, gridCoordinate(a, position[a]));
+                        }
+                    }
+                });
+        }
+
+        //
+        // Compress triangles of snapped mesh in given order
+        //
+        void build(const MeshType &mesh, const size_t *ordering)
+        {
+            const VertexType  *vertices = mesh.getVertexPointer();
+            const IndexType   *indices  = mesh.getIndexPointer();
+
+            mNumTriangles = mesh.getNumIndices() / 3;
+
+            //
+            // Split ordered triangles into clusters, which fit into range
+            // of offsets
+            //
+            std::vector<int> grid(3 * mesh.getNumVertices());
+
+            ParallelFor(mesh.getNumVertices(), 1 << 14,
+                [this, vertices, &grid](size_t begin, size_t end)
+                {
+                    for (size_t i = begin; i != end; ++i)
+                    {
+                        const PointType &position = AbstractVertex::getPosition(vertices[i]);
+
+                        for (int a = 0; a != 3; ++a)
+                        {
+                            grid[3*i+a] = gridCoordinate(a, position[a]);
+                        }
+                    }
+                });
+
+            mClusters.clear();
+
+            int low[3], high[3];
+
+            for (size_t i = 0; i != mNumTriangles; ++i)
+            {
+                const size_t triangle = ordering[i];
+
+                int triangleLow[3], triangleHigh[3];
+                bool fits = (!mClusters.empty() && ClusterSize != i - mClusters.back().firstTriangle);
+
+                for (int a = 0; a != 3; ++a)
+                {
+                    const int g0 = grid[3*indices[3*triangle]+a];
+                    const int g1 = grid[3*indices[3*triangle+1]+a];
+                    const int g2 = grid[3*indices[3*triangle+2]+a];
+
+                    triangleLow[a]  = Min(g0, Min(g1, g2));
+                    triangleHigh[a] = Max(g0, Max(g1, g2));
+
+                    fits = fits && (Max(high[a], triangleHigh[a]) - Min(low[a], triangleLow[a]) <= MaxOffset);
+                }
+
+                if (!fits)
+                {
+                    Cluster cluster;
+                    cluster.firstTriangle = (unsigned int)i;
+                    cluster.firstVertex = 0;
+                    mClusters.push_back(cluster);
+
+                    for (int a = 0; a != 3; ++a)
+                    {
+                        low[a] = triangleLow[a];
+                        high[a] = triangleHigh[a];
+                    }
+                }
+                else
+                {
+                    for (int a = 0; a != 3; ++a)
+                    {
+                        low[a] = Min(low[a], triangleLow[a]);
+                        high[a] = Max(high[a], triangleHigh[a]);
+                    }
+                }
+            }
+
+            const size_t numClusters = mClusters.size();
+
+            // Sentinel
+            Cluster end;
+            end.firstTriangle = (unsigned int)mNumTriangles;
+            end.firstVertex = 0;
+            mClusters.push_back(end);
+
+            //
+            // Count unique vertices of clusters, then encode them
+            //
+            std::vector<size_t> numVertices(numClusters);
+
+            ParallelFor(numClusters, 64,
+                [this, indices, ordering, &numVertices](size_t begin, size_t end)
+                {
+                    std::vector<IndexType> unique;
+
+                    for (size_t c = begin; c != end; ++c)
+                    {
+                        gatherVertices(c, indices, ordering, unique);
+                        numVertices[c] = unique.size();
+                    }
+                });
+
+            size_t totalVertices = 0;
+
+            for (size_t c = 0; c != numClusters; ++c)
+            {
+                mClusters[c].firstVertex = (unsigned int)totalVertices;
+                totalVertices += numVertices[c];
+            }
+
+            mClusters.back().firstVertex = (unsigned int)totalVertices;
+
+            mPositions.resize(3 * totalVertices);
+            mAttributes.resize(NumWords * totalVertices);
+            mIndices.resize(3 * mNumTriangles);
+
+            ParallelFor(numClusters, 64,
+                [this, vertices, indices, ordering, &grid](size_t begin, size_t end)
+                {
+                    std::vector<IndexType> unique;
+
+                    for (size_t c = begin; c != end; ++c)
+                    {
+                        encodeCluster(c, vertices, indices, ordering, grid, unique);
+                    }
+                });
+
+            //
+            // Cluster of every ClusterSize-th triangle speeds up lookup
+            //
+            mClusterOfBlock.resize((mNumTriangles + ClusterSize - 1) / ClusterSize);
+
+            for (size_t c = 0, block = 0; block != mClusterOfBlock.size(); ++block)
+            {
+                while (mClusters[c + 1].firstTriangle <= block * ClusterSize)
+                {
+                    ++c;
+                }
+
+                mClusterOfBlock[block] = (unsigned int)c;
+            }
+        }
+
+        //
+        // Replace mesh by decompressed triangles, vertices shared between
+        // clusters are duplicated
+        //
+        void decompress(MeshType &mesh) const
+        {
+            mesh.clear();
+
+            for (size_t c = 0; c + 1 < mClusters.size(); ++c)
+            {
+                for (size_t i = mClusters[c].firstVertex; i != mClusters[c + 1].firstVertex; ++i)
+                {
+                    VertexType vertex;
+                    decodeVertex(mClusters[c], i - mClusters[c].firstVertex, vertex);
+                    mesh.addVertex(vertex);
+                }
+
+                for (size_t i = mClusters[c].firstTriangle; i != mClusters[c + 1].firstTriangle; ++i)
+                {
+                    for (int k = 0; k != 3; ++k)
+                    {
+                        mesh.addIndex(IndexType(mClusters[c].firstVertex + mIndices[3*i+k]));
+                    }
+                }
+            }
+        }
+
+        //
+        // Release memory
+        //
+        void clear()
+        {
+            std::vector<Cluster>().swap(mClusters);
+            std::vector<unsigned int>().swap(mClusterOfBlock);
+            std::vector<unsigned short>().swap(mPositions);
+            std::vector<unsigned short>().swap(mAttributes);
+            std::vector<unsigned char>().swap(mIndices);
+            mNumTriangles = 0;
+        }
+
+        bool isEmpty() const
+        {
+            return (0 == mNumTriangles);
+        }
+
+        size_t getNumTriangles() const
+        {
+            return mNumTriangles;
+        }
+
+        //
+        // Memory used in bytes
+        //
+        size_t getMemorySize() const
+        {
+            return mClusters.size() * sizeof(Cluster)
+                + mClusterOfBlock.size() * sizeof(unsigned int)
+                + mPositions.size() * sizeof(unsigned short)
+                + mAttributes.size() * sizeof(unsigned short)
+                + mIndices.size();
+        }
+
+        //
+        // Cluster containing triangle, clusters of consecutive triangles
+        // are found faster by passing previous cluster as hint
+        //
+        size_t findCluster(size_t triangle) const
+        {
+            return advanceCluster(mClusterOfBlock[triangle / ClusterSize], triangle);
+        }
+
+        size_t advanceCluster(size_t cluster, size_t triangle) const
+        {
+            while (mClusters[cluster + 1].firstTriangle <= triangle)
+            {
+                ++cluster;
+            }
+
+            return cluster;
+        }
+
+        //
+        // Decode positions of triangle in given cluster
+        //
+        void getTrianglePositions(size_t cluster, size_t triangle, PointType &a, PointType &b, PointType &c) const
+        {
+            const Cluster       &record  = mClusters[cluster];
+            const unsigned char *indices = &mIndices[3 * triangle];
+
+            decodePosition(record, indices[0], a);
+            decodePosition(record, indices[1], b);
+            decodePosition(record, indices[2], c);
+        }
+
+        void getTriangleVertices(size_t triangle, VertexType &a, VertexType &b, VertexType &c) const
+        {
+            const Cluster       &record  = mClusters[findCluster(triangle)];
+            const unsigned char *indices = &mIndices[3 * triangle];
+
+            decodeVertex(record, indices[0], a);
+            decodeVertex(record, indices[1], b);
+            decodeVertex(record, indices[2], c);
+        }
+
+    private:
+        NumericType                 mOrigin[3];
+        NumericType                 mStep;
+        size_t                      mNumTriangles;
+        std::vector<Cluster>        mClusters;          // with sentinel
+        std::vector<unsigned int>   mClusterOfBlock;
+        std::vector<unsigned short> mPositions;         // 3 offsets per vertex
+        std::vector<unsigned short> mAttributes;        // NumWords per vertex
+        std::vector<unsigned char>  mIndices;           // 3 local indices per triangle
+
+        //
+        // Grid spans whole mesh, and its step is large enough for any
+        // triangle to fit into cluster
+        //
+        void calculateGrid(const MeshType &mesh)
+        {
+            const VertexType  *vertices = mesh.getVertexPointer();
+            const IndexType   *indices  = mesh.getIndexPointer();
+            const size_t numVertices = mesh.getNumVertices();
+            const size_t numTriangles = mesh.getNumIndices() / 3;
+
+            NumericType low[3], high[3];
+
+            for (int a = 0; a != 3; ++a)
+            {
+                low[a] = high[a] = (0 != numVertices ? AbstractVertex::getPosition(vertices[0])[a] : 0);
+            }
+
+            for (size_t i = 1; i < numVertices; ++i)
+            {
+                const PointType &position = AbstractVertex::getPosition(vertices[i]);
+
+                for (int a = 0; a != 3; ++a)
+                {
+                    low[a] = Min(low[a], position[a]);
+                    high[a] = Max(high[a], position[a]);
+                }
+            }
+
+            NumericType extent = 0;
+
+            for (int a = 0; a != 3; ++a)
+            {
+                mOrigin[a] = low[a];
+                extent = Max(extent, high[a] - low[a]);
+            }
+
+            NumericType triangleExtent = 0;
+
+            for (size_t i = 0; i != numTriangles; ++i)
+            {
+                const PointType &pA = AbstractVertex::getPosition(vertices[indices[3*i]]);
+                const PointType &pB = AbstractVertex::getPosition(vertices[indices[3*i+1]]);
+                const PointType &pC = AbstractVertex::getPosition(vertices[indices[3*i+2]]);
+
+                for (int a = 0; a != 3; ++a)
+                {
+                    triangleExtent = Max(triangleExtent, Max(pA[a], Max(pB[a], pC[a])) - Min(pA[a], Min(pB[a], pC[a])));
+                }
+            }
+
+            //
+            // Rounding to grid may widen triangle by one step, hence
+            // MaxOffset - 1 steps
+            //
+            const NumericType step = Max(extent / NumericType(1 << GridBits), triangleExtent / NumericType(MaxOffset - 1));
+
+            int exponent = 0;
+            std::frexp(step, &exponent);
+
+            mStep = (0 < step ? std::ldexp(NumericType(1), exponent) : NumericType(1));
+        }
+
+        int gridCoordinate(int axis, NumericType value) const
+        {
+            return int(std::floor((value - mOrigin[axis]) / mStep + NumericType(0.5)));
+        }
+
+        NumericType decodeCoordinate(int axis, int coordinate) const
+        {
+            return mOrigin[axis] + NumericType(coordinate) * mStep;
+        }
+
+        void decodePosition(const Cluster &cluster, size_t local, PointType &position) const
+        {
+            const unsigned short *offsets = &mPositions[3 * (cluster.firstVertex + local)];
+
+            position[0] = decodeCoordinate(0, cluster.base[0] + int(offsets[0]));
+            position[1] = decodeCoordinate(1, cluster.base[1] + int(offsets[1]));
+            position[2] = decodeCoordinate(2, cluster.base[2] + int(offsets[2]));
+        }
+
+        void decodeVertex(const Cluster &cluster, size_t local, VertexType &vertex) const
+        {
+            PointType position;
+            decodePosition(cluster, local, position);
+
+            Codec::decode(position, 0 != NumWords ? &mAttributes[NumWords * (cluster.firstVertex + local)] : 0, vertex);
+        }
+
+        //
+        // Sorted unique vertices of cluster
+        //
+        void gatherVertices(size_t cluster, const IndexType *indices, const size_t *ordering, std::vector<IndexType> &unique) const
+        {
+            unique.clear();
+
+            for (size_t i = mClusters[cluster].firstTriangle; i != mClusters[cluster + 1].firstTriangle; ++i)
+            {
+                const size_t triangle = ordering[i];
+
+                unique.push_back(indices[3*triangle]);
+                unique.push_back(indices[3*triangle+1]);
+                unique.push_back(indices[3*triangle+2]);
+            }
+
+            std::sort(unique.begin(), unique.end());
+            unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+        }
+
+        void encodeCluster(
+            size_t                   cluster,
+            const VertexType        *vertices,
+            const IndexType         *indices,
+            const size_t            *ordering,
+            const std::vector<int>  &grid,
+            std::vector<IndexType>  &unique)
+        {
+            gatherVertices(cluster, indices, ordering, unique);
+
+            Cluster &record = mClusters[cluster];
+
+            for (int a = 0; a != 3; ++a)
+            {
+                record.base[a] = grid[3*unique[0]+a];
+
+                for (size_t k = 1; k != unique.size(); ++k)
+                {
+                    record.base[a] = Min(record.base[a], grid[3*unique[k]+a]);
+                }
+            }
+
+            for (size_t k = 0; k != unique.size(); ++k)
+            {
+                const size_t vertex = record.firstVertex + k;
+
+                for (int a = 0; a != 3; ++a)
+                {
+                    mPositions[3*vertex+a] = (unsigned short)(grid[3*unique[k]+a] - record.base[a]);
+                }
+
+                Codec::encode(vertices[unique[k]], 0 != NumWords ? &mAttributes[NumWords * vertex] : 0);
+            }
+
+            for (size_t i = record.firstTriangle; i != mClusters[cluster + 1].firstTriangle; ++i)
+            {
+                const size_t triangle = ordering[i];
+
+                for (int k = 0; k != 3; ++k)
+                {
+                    const IndexType index = indices[3*triangle+k];
+                    mIndices[3*i+k] = (unsigned char)(std::lower_bound(unique.begin(), unique.end(), index) - unique.begin());
+                }
+            }
+        }
+    };
+
+#endif
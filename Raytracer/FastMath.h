@@ -0,0 +1,284 @@
+#ifndef INCLUDED_FAST_MATH_H
+#define INCLUDED_FAST_MATH_H
+
+#include <math.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "Linear.h"
+
+//
+// Math functions with selectable precision
+//
+// Precision is chosen by policy given as template argument: PreciseMath
+// calls C library, FastMath uses approximations below. DefaultMath is the
+// policy used by ray tracing code, which is FastMath if GAL_FAST_MATH is
+// defined, and PreciseMath otherwise.
+//
+// Error bounds of FastMath for normal numbers (relative unless noted):
+//
+//  RSqrt, Sqrt - float 5e-6,  double 4e-11 (2 and 3 Newton steps)
+//  Acos        - absolute 3e-8 in addition to error of Sqrt
+//  Pow         - 2e-7 * (1 + |y log2(x)|), for 0 <= x
+//
+// Batched functions apply the same policy to arrays by loops, which are
+// vectorized by compiler.
+//
+namespace GAL_imp {
+
+    //
+    // Layout of IEEE 754 numbers
+    //
+    template<class N> struct FloatBits;
+
+    template<>
+        struct FloatBits<float>
+        {
+            typedef unsigned int IntType;
+
+            enum
+            {
+                MantissaBits    = 23,
+                ExponentBias    = 127,
+                NumNewtonSteps  = 2
+            };
+
+            static IntType getRSqrtMagic() { return 0x5f375a86U; }
+        };
+
+    template<>
+        struct FloatBits<double>
+        {
+            typedef unsigned long long IntType;
+
+            enum
+            {
+                MantissaBits    = 52,
+                ExponentBias    = 1023,
+                NumNewtonSteps  = 3
+            };
+
+            static IntType getRSqrtMagic() { return 0x5fe6eb50c7b537a9ULL; }
+        };
+
+    template<class N>
+        typename FloatBits<N>::IntType GetBits(N x)
+        {
+            typename FloatBits<N>::IntType bits;
+            memcpy(&bits, &x, sizeof(N));
+            return bits;
+        }
+
+    template<class N>
+        N FromBits(typename FloatBits<N>::IntType bits)
+        {
+            N x;
+            memcpy(&x, &bits, sizeof(N));
+            return x;
+        }
+
+} // namespace GAL_imp
+
+namespace GAL {
+
+    struct PreciseMath
+    {
+        template<class N>
+            static N Sqrt(N x)
+            {
+                return sqrt(x);
+            }
+
+        template<class N>
+            static N RSqrt(N x)
+            {
+                return 1 / sqrt(x);
+            }
+
+        template<class N>
+            static N Acos(N x)
+            {
+                return acos(x);
+            }
+
+        template<class N>
+            static N Pow(N x, N y)
+            {
+                return pow(x, y);
+            }
+    };
+
+    struct FastMath
+    {
+        //
+        // Initial estimate from halved exponent refined by Newton steps
+        //
+        template<class N>
+            static N RSqrt(N x)
+            {
+                typedef GAL_imp::FloatBits<N> Bits;
+
+                const N half = N(0.5) * x;
+                N y = GAL_imp::FromBits<N>(Bits::getRSqrtMagic() - (GAL_imp::GetBits(x) >> 1));
+
+                for (int i = 0; i != Bits::NumNewtonSteps; ++i)
+                {
+                    y = y * (N(1.5) - half * y * y);
+                }
+
+                return y;
+            }
+
+        template<class N>
+            static N Sqrt(N x)
+            {
+                return (0 < x ? x * RSqrt(x) : N(0));
+            }
+
+        //
+        // Abramowitz and Stegun 4.4.46
+        //
+        template<class N>
+            static N Acos(N x)
+            {
+                const N a = (x < 0 ? -x : x);
+
+                const N p = N(1.5707963050) + a * (N(-0.2145988016) + a * (N(0.0889789874) +
+                    a * (N(-0.0501743046) + a * (N(0.0308918810) + a * (N(-0.0170881256) +
+                    a * (N(0.0066700901) + a * N(-0.0012624911)))))));
+
+                const N r = Sqrt(N(1) - a) * p;
+
+                return (x < 0 ? N(3.14159265358979323846) - r : r);
+            }
+
+        template<class N>
+            static N Pow(N x, N y)
+            {
+                return (0 < x ? Exp2(y * Log2(x)) : N(0));
+            }
+
+        //
+        // Exponent plus log2 of mantissa reduced to [sqrt(1/2), sqrt(2)),
+        // given by series of 2 atanh((m - 1) / (m + 1)) / ln(2)
+        //
+        template<class N>
+            static N Log2(N x)
+            {
+                typedef GAL_imp::FloatBits<N> Bits;
+                typedef typename Bits::IntType IntType;
+
+                const IntType bits = GAL_imp::GetBits(x);
+                const IntType mantissaMask = (IntType(1) << Bits::MantissaBits) - 1;
+
+                int exponent = int(bits >> Bits::MantissaBits) - Bits::ExponentBias;
+                N m = GAL_imp::FromBits<N>((bits & mantissaMask) | (IntType(Bits::ExponentBias) << Bits::MantissaBits));
+
+                const bool reduce = (N(1.41421356237309504880) < m);
+
+                m = (reduce ? N(0.5) * m : m);
+                exponent += (reduce ? 1 : 0);
+
+                const N z = (m - 1) / (m + 1);
+                const N z2 = z * z;
+
+                const N series = z * (N(2.88539008177792681) + z2 * (N(0.961796693925975604) +
+                    z2 * (N(0.577078016355585363) + z2 * (N(0.412198583111132402) + z2 * N(0.320598897975325202)))));
+
+                return N(exponent) + series;
+            }
+
+        //
+        // Power of two of nearest integer put into exponent, times Taylor
+        // series of exp(f ln(2)) for remainder f in [-1/2, 1/2]
+        //
+        template<class N>
+            static N Exp2(N x)
+            {
+                typedef GAL_imp::FloatBits<N> Bits;
+                typedef typename Bits::IntType IntType;
+
+                const N limit = N(Bits::ExponentBias - 1);
+                x = (x < -limit ? -limit : (limit < x ? limit : x));
+
+                const int rounded = int(x + (x < 0 ? N(-0.5) : N(0.5)));
+                const N t = (x - N(rounded)) * N(0.693147180559945309);
+
+                const N p = N(1) + t * (N(1) + t * (N(1.0 / 2) + t * (N(1.0 / 6) + t * (N(1.0 / 24) +
+                    t * (N(1.0 / 120) + t * (N(1.0 / 720) + t * N(1.0 / 5040)))))));
+
+                const IntType scale = IntType(rounded + Bits::ExponentBias) << Bits::MantissaBits;
+
+                return p * GAL_imp::FromBits<N>(scale);
+            }
+    };
+
+#ifdef GAL_FAST_MATH
+    typedef FastMath    DefaultMath;
+#else
+    typedef PreciseMath DefaultMath;
+#endif
+
+    template< class Math, class N, int I >
+        N Len( const GAL_imp::Point<N,I> &u )
+        {
+            return Math::Sqrt( SqrLen(u) );
+        }
+
+    template< class Math, class N, int I >
+        GAL_imp::Point<N,I> Normalize( const GAL_imp::Point<N,I> &u )
+        {
+            return u * Math::RSqrt( SqrLen(u) );
+        }
+
+    //
+    // Batched versions, out may be the same as input
+    //
+    template< class Math, class N >
+        void SqrtArray( const N *x, N *out, size_t count )
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                out[i] = Math::Sqrt(x[i]);
+            }
+        }
+
+    template< class Math, class N >
+        void RSqrtArray( const N *x, N *out, size_t count )
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                out[i] = Math::RSqrt(x[i]);
+            }
+        }
+
+    template< class Math, class N >
+        void AcosArray( const N *x, N *out, size_t count )
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                out[i] = Math::Acos(x[i]);
+            }
+        }
+
+    template< class Math, class N >
+        void PowArray( const N *x, N y, N *out, size_t count )
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                out[i] = Math::Pow(x[i], y);
+            }
+        }
+
+    template< class Math, class N, int I >
+        void NormalizeArray( GAL_imp::Point<N,I> *points, size_t count )
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                points[i] = Normalize<Math>(points[i]);
+            }
+        }
+
+} // namespace GAL
+
+#endif
@@ -1,24 +1,34 @@
 #ifndef INCLUDED_GEOMETRY_H
 #define INCLUDED_GEOMETRY_H
 
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "Intersect.h"
+#include "IntersectionPoint.h"
 #include "Mesh.h"
 #include "AABBox.h"
 #include "BoundingSphere.h"
+#include "MeshResource.h"
+
+template<class _NumericType> class Geometry;
 
-template<class N, int I>
-    struct IntersectionPoint
+//
+// Receives notifications about changes of geometry
+//
+template<class _NumericType>
+    class GeometryListener
     {
-        GAL_imp::Point<N,I> position;
-        GAL_imp::Point<N,I> normal;
-        GAL_imp::Point<N,I> tangent;
-        GAL_imp::Point<N,4> color;
-        N                   distance;
-        bool                isReflective;
-    };
+    public:
+        virtual ~GeometryListener() {}
 
-typedef IntersectionPoint<float,3>  IntersectionPoint3f;
-typedef IntersectionPoint<double,3> IntersectionPoint3d;
+        //
+        // World bounds of geometry have changed
+        //
+        virtual void geometryBoundsChanged(Geometry<_NumericType> &geometry) = 0;
+    };
 
 template<class _NumericType>
     class Geometry
@@ -30,8 +40,11 @@ template<class _NumericType>
         typedef GAL_imp::Matrix<NumericType,3>      TransformType;
         typedef GAL_imp::Ray<NumericType,3>         RayType;
         typedef IntersectionPoint<NumericType,3>    IntersectionPointType;
+        typedef RayHit<NumericType>                 RayHitType;
+        typedef BoundingSphere<NumericType>         BoundingSphereType;
+        typedef GeometryListener<NumericType>       ListenerType;
 
-        Geometry(): mFlags(0), mReflective(false)
+        Geometry(): mFlags(0), mReflective(false), mPrimitiveColors(false), mConvex(false)
         {
             mLTM.Row(0) = GAL_imp::P3_<NumericType>(1,0,0);
             mLTM.Row(1) = GAL_imp::P3_<NumericType>(0,1,0);
@@ -40,42 +53,97 @@ template<class _NumericType>
 
         bool intersectRay(RayType ray, IntersectionPointType &out)
         {
-            // If matrix is orthogonal, then its inverse is simply transposition
-            //
-            // TODO: mFlags should say whether matrix is or is not orthogonal
-            //
-            TransformType inverseLTM = mLTM.T();
+            if (!testBounds(ray))
+            {
+                return false;
+            }
 
-            // Transform ray to object local coordinates
-            ray.start      = inverseLTM * (ray.start - mTranslation);
-            ray.direction  = inverseLTM * ray.direction;
+            transformRayToLocal(ray);
 
             if (!doIntersectRay(ray, out))
             {
                 return false;
             }
 
-            // Transform result to original coordinates
-            out.position = (mLTM * out.position) + mTranslation;
-            out.normal   = mLTM * out.normal;
-            out.tangent  = mLTM * out.tangent;
+            transformResultToWorld(out, true);
+            return true;
+        }
 
-            // Simplified material properties
-            out.color = mColor;
-            out.isReflective = mReflective;
+        //
+        // Statically dispatched intersection in two phases.
+        //
+        // GeometryType must be the exact type of this object. Its non-virtual
+        // hitLocalRay() and resolveLocalHit() are called directly, so that
+        // the intersection kernels can be inlined into the traversal loop.
+        //
+        // hitRayAs() finds distance and primitive only, and resolveHitAs()
+        // should be called once for the closest hit to calculate position,
+        // normal and material. Tangent is calculated only if requested.
+        //
+        // Rays missing world bounds are rejected before any transformation.
+        //
+        template<class GeometryType>
+            bool hitRayAs(RayType ray, RayHitType &hit)
+            {
+                if (!testBounds(ray))
+                {
+                    return false;
+                }
 
-            return true;
+                transformRayToLocal(ray);
+
+                return static_cast<const GeometryType *>(this)->hitLocalRay(ray, hit);
+            }
+
+        template<class GeometryType>
+            void resolveHitAs(RayType ray, const RayHitType &hit, IntersectionPointType &out, bool withTangent)
+            {
+                transformRayToLocal(ray);
+
+                static_cast<const GeometryType *>(this)->resolveLocalHit(ray, hit, out, withTangent);
+
+                transformResultToWorld(out, withTangent);
+            }
+
+        //
+        // Quick rejection test against world bounds
+        //
+        bool testBounds(const RayType &ray) const
+        {
+            return (mWorldBounds.isInfinite() ||
+                GAL::TestRaySphere(ray, mWorldBounds.center, mWorldBounds.radius));
         }
 
         void setTranslation(const PointType &translation)
         {
             mTranslation = translation;
+            updateWorldBounds();
         }
 
         void setLocalTransform(const TransformType &ltm, unsigned long flags)
         {
             mLTM = ltm;
             mFlags = flags;
+            updateWorldBounds();
+        }
+
+        const BoundingSphereType & getWorldBounds() const
+        {
+            return mWorldBounds;
+        }
+
+        //
+        // Listeners are notified when world bounds change, e.g. each clump,
+        // which contains the geometry
+        //
+        void addListener(ListenerType *listener)
+        {
+            mListeners.push_back(listener);
+        }
+
+        void removeListener(ListenerType *listener)
+        {
+            mListeners.erase(std::remove(mListeners.begin(), mListeners.end(), listener), mListeners.end());
         }
 
         void setColor(const ColorType &color)
@@ -83,6 +151,11 @@ template<class _NumericType>
             mColor = color;
         }
 
+        const ColorType & getColor() const
+        {
+            return mColor;
+        }
+
         void setReflective(bool val)
         {
             mReflective = val;
@@ -93,27 +166,124 @@ template<class _NumericType>
             return mReflective;
         }
 
+        //
+        // Geometry is convex solid, so that segment between any two of its
+        // points lies in it (see ShadowPacket)
+        //
+        bool isConvex() const
+        {
+            return mConvex;
+        }
+
     protected:
         virtual bool doIntersectRay(const RayType &ray, IntersectionPointType &out) = 0;
 
+        //
+        // Derived classes should set bounds in object local coordinates,
+        // otherwise geometry is assumed to be infinite and is never culled.
+        //
+        void setLocalBounds(const BoundingSphereType &bounds)
+        {
+            mLocalBounds = bounds;
+            updateWorldBounds();
+        }
+
+        //
+        // Derived classes, whose resolveLocalHit() sets color of primitive,
+        // should enable it, so that color of geometry is not applied
+        //
+        void setPrimitiveColors(bool enable)
+        {
+            mPrimitiveColors = enable;
+        }
+
+        void setConvex(bool convex)
+        {
+            mConvex = convex;
+        }
+
     private:
+        void updateWorldBounds()
+        {
+            TransformBoundingSphere(mLocalBounds, mLTM, mTranslation, mWorldBounds);
+
+            for (size_t i = 0; i != mListeners.size(); ++i)
+            {
+                mListeners[i]->geometryBoundsChanged(*this);
+            }
+        }
+
+        void transformRayToLocal(RayType &ray)
+        {
+            // If matrix is orthogonal, then its inverse is simply transposition
+            //
+            // TODO: mFlags should say whether matrix is or is not orthogonal
+            //
+            TransformType inverseLTM = mLTM.T();
+
+            // Transform ray to object local coordinates
+            ray.start      = inverseLTM * (ray.start - mTranslation);
+            ray.direction  = inverseLTM * ray.direction;
+        }
+
+        void transformResultToWorld(IntersectionPointType &out, bool withTangent)
+        {
+            // Transform result to original coordinates
+            out.position = (mLTM * out.position) + mTranslation;
+            out.normal   = mLTM * out.normal;
+
+            if (withTangent)
+            {
+                out.tangent = mLTM * out.tangent;
+            }
+
+            // Simplified material properties
+            if (!mPrimitiveColors)
+            {
+                out.color = mColor;
+            }
+
+            out.isReflective = mReflective;
+            out.geometry = this;
+        }
+
         PointType       mTranslation;
         TransformType   mLTM;
         unsigned long   mFlags;
         ColorType       mColor;
         bool            mReflective;
+        bool            mPrimitiveColors;
+        bool            mConvex;
+        BoundingSphereType  mLocalBounds;
+        BoundingSphereType  mWorldBounds;
+        std::vector<ListenerType*> mListeners;
     };
 
 template<class _NumericType>
     class SphereGeometry : public Geometry<_NumericType>
     {
     public:
+        typedef Geometry<_NumericType>                  BaseType;
+        typedef typename BaseType::NumericType          NumericType;
+        typedef typename BaseType::PointType            PointType;
+        typedef typename BaseType::RayType              RayType;
+        typedef typename BaseType::IntersectionPointType IntersectionPointType;
+        typedef typename BaseType::RayHitType           RayHitType;
+
+        typedef typename BaseType::BoundingSphereType   BoundingSphereType;
+
         SphereGeometry(NumericType radius): mRadius(radius)
         {
+            BoundingSphereType bounds;
+            bounds.radius = mRadius;
+            this->setLocalBounds(bounds);
+            this->setConvex(true);
         }
 
-    protected:
-        bool doIntersectRay(const RayType &ray, IntersectionPointType &out)
+        //
+        // Intersect ray given in object local coordinates
+        //
+        bool hitLocalRay(const RayType &ray, RayHitType &hit) const
         {
             GAL_imp::Solution<NumericType,2> solution;
 
@@ -129,11 +299,36 @@ template<class _NumericType>
                 return false;
             }
 
-            out.distance = t;
-            out.position = ray.start + ray.direction * t;
+            hit.distance = t;
+            hit.u = hit.v = 0;
+            hit.primitive = 0;
+
+            return true;
+        }
+
+        void resolveLocalHit(const RayType &ray, const RayHitType &hit, IntersectionPointType &out, bool withTangent) const
+        {
+            out.distance = hit.distance;
+            out.position = ray.start + ray.direction * hit.distance;
             out.normal = out.position;
-            out.tangent = GAL::Orthogonal(out.normal);
 
+            if (withTangent)
+            {
+                out.tangent = GAL::Orthogonal(out.normal);
+            }
+        }
+
+    protected:
+        bool doIntersectRay(const RayType &ray, IntersectionPointType &out)
+        {
+            RayHitType hit;
+
+            if (!hitLocalRay(ray, hit))
+            {
+                return false;
+            }
+
+            resolveLocalHit(ray, hit, out, true);
             return true;
         }
 
@@ -149,12 +344,36 @@ template<class _NumericType>
     class CylinderGeometry : public Geometry<_NumericType>
     {
     public:
+        typedef Geometry<_NumericType>                  BaseType;
+        typedef typename BaseType::NumericType          NumericType;
+        typedef typename BaseType::PointType            PointType;
+        typedef typename BaseType::RayType              RayType;
+        typedef typename BaseType::IntersectionPointType IntersectionPointType;
+        typedef typename BaseType::RayHitType           RayHitType;
+        typedef typename BaseType::BoundingSphereType   BoundingSphereType;
+
+        //
+        // Primitive ids of cylinder surfaces
+        //
+        enum
+        {
+            SideSurface = 0,
+            BottomCap   = 1,
+            TopCap      = 2
+        };
+
         CylinderGeometry(NumericType radius, const PointType &height): mRadius(radius), mHeight(height)
         {
+            BoundingSphereType bounds;
+            bounds.center = mHeight * NumericType(0.5);
+            bounds.radius = sqrt(mRadius * mRadius + GAL::SqrLen(bounds.center));
+            this->setLocalBounds(bounds);
         }
 
-    protected:
-        bool doIntersectRay(const RayType &ray, IntersectionPointType &out)
+        //
+        // Intersect ray given in object local coordinates
+        //
+        bool hitLocalRay(const RayType &ray, RayHitType &hit) const
         {
             GAL_imp::Solution<NumericType,2> solution;
 
@@ -175,20 +394,18 @@ template<class _NumericType>
                     // Both intersection points are below cylinder
                     return false;
                 }
-                else if (!GAL::IntersectRayPlane(ray, mHeight, out.distance))
+                else if (!GAL::IntersectRayPlane(ray, mHeight, hit.distance))
                 {
                     // Ray is parallel to cylinder bottom
                     return false;
                 }
-                else if (out.distance < 0)
+                else if (hit.distance < 0)
                 {
                     // Plane is behind th ray
                     return false;
                 }
 
-                out.position = ray.start + ray.direction * out.distance;
-                out.normal   = -mHeight;
-                out.tangent  = GAL::ProjectToPlane(out.normal, out.position);
+                hit.primitive = BottomCap;
             }
             // Check whether intersectoin point is above cylinder
             else if (0 < GAL::Dot(p1 - mHeight, mHeight))
@@ -205,19 +422,18 @@ template<class _NumericType>
                 ray2.start = ray.start - mHeight;
                 ray2.direction = ray.direction;
 
-                if (!GAL::IntersectRayPlane(ray2, mHeight, out.distance))
+                if (!GAL::IntersectRayPlane(ray2, mHeight, hit.distance))
                 {
                     // Ray is parallel to cylinder top
                     return false;
                 }
-                else if (out.distance < 0)
+                else if (hit.distance < 0)
                 {
                     // Plane is behind th ray
                     return false;
                 }
-                out.position = ray.start + ray.direction * out.distance;
-                out.normal = mHeight;
-                out.tangent = GAL::ProjectToPlane(out.normal, out.position);
+
+                hit.primitive = TopCap;
             }
             // Intersection point was on cylinder
             else
@@ -232,19 +448,72 @@ template<class _NumericType>
                 {
                     // First intersection point is behind ray, thus
                     // ray must be inside of cylinder
-                    out.distance = solution.x[1];
-                    out.position = ray.start + ray.direction * out.distance;
+                    PointType p2 = ray.start + ray.direction * solution.x[1];
+
+                    if (GAL::Dot(p2, mHeight) < 0 || 0 < GAL::Dot(p2 - mHeight, mHeight))
+                    {
+                        // Ray leaves infinite cylinder below or above
+                        // finite one
+                        return false;
+                    }
+
+                    hit.distance = solution.x[1];
                 }
                 else
                 {
                     // Generic case
-                    out.distance = solution.x[0];
-                    out.position = p1;
+                    hit.distance = solution.x[0];
                 }
 
+                hit.primitive = SideSurface;
+            }
+
+            hit.u = hit.v = 0;
+            return true;
+        }
+
+        void resolveLocalHit(const RayType &ray, const RayHitType &hit, IntersectionPointType &out, bool withTangent) const
+        {
+            out.distance = hit.distance;
+            out.position = ray.start + ray.direction * hit.distance;
+
+            switch (hit.primitive)
+            {
+            case BottomCap:
+                out.normal = -mHeight;
+                if (withTangent)
+                {
+                    out.tangent = GAL::ProjectToPlane(out.normal, out.position);
+                }
+                break;
+            case TopCap:
+                out.normal = mHeight;
+                if (withTangent)
+                {
+                    out.tangent = GAL::ProjectToPlane(out.normal, out.position);
+                }
+                break;
+            default:
                 out.normal = GAL::ProjectToPlane(mHeight, out.position);
-                out.tangent = mHeight;
+                if (withTangent)
+                {
+                    out.tangent = mHeight;
+                }
+                break;
+            }
+        }
+
+    protected:
+        bool doIntersectRay(const RayType &ray, IntersectionPointType &out)
+        {
+            RayHitType hit;
+
+            if (!hitLocalRay(ray, hit))
+            {
+                return false;
             }
+
+            resolveLocalHit(ray, hit, out, true);
             return true;
         }
 
@@ -258,112 +527,223 @@ typedef CylinderGeometry<double> CylinderGeometry3d;
 
 
 template<class _VertexType, class _IndexType = int>
-    class MeshGeometry : public Geometry< typename Mesh<_VertexType, _IndexType>::NumericType >
+    class MeshGeometry : public Geometry< typename Mesh<_VertexType, _IndexType>::NumericType >, private MeshResourceListener
     {
     public:
+        typedef Geometry< typename Mesh<_VertexType, _IndexType>::NumericType > BaseType;
+        typedef typename BaseType::NumericType          NumericType;
+        typedef typename BaseType::PointType            PointType;
+        typedef typename BaseType::RayType              RayType;
+        typedef typename BaseType::IntersectionPointType IntersectionPointType;
+        typedef typename BaseType::RayHitType           RayHitType;
+        typedef typename BaseType::BoundingSphereType   BoundingSphereType;
         typedef _VertexType                         VertexType;
         typedef _IndexType                          IndexType;
         typedef Mesh<VertexType, IndexType>         MeshType;
         typedef typename MeshType::AbstractVertex   AbstractVertex;
+        typedef MeshResource<VertexType, IndexType> MeshResourceType;
+        typedef std::shared_ptr<MeshResourceType>   MeshResourcePtr;
+
+        MeshGeometry(): mResource(new MeshResourceType())
+        {
+            mResource->addListener(this);
+        }
+
+        //
+        // Instance of mesh resource shared with other geometries
+        //
+        // Geometry carries only its own transformation and material. Bounds
+        // of all instances are updated, when resource is rebuilt through
+        // any of them.
+        //
+        MeshGeometry(const MeshResourcePtr &resource): mResource(resource)
+        {
+            mResource->addListener(this);
+            this->setLocalBounds(mResource->getBounds());
+        }
 
-        MeshGeometry()
+        ~MeshGeometry()
         {
+            mResource->removeListener(this);
+        }
+
+        const MeshResourcePtr & getResource() const
+        {
+            return mResource;
         }
 
         MeshType & getMesh()
         {
-            return mMesh;
+            return mResource->getMesh();
         }
 
         const MeshType & getMesh() const
         {
-            return mMesh;
+            return mResource->getMesh();
         }
 
-        void meshChanged()
+        //
+        // See MeshResource::setPrecomputeTriangles()
+        //
+        void setPrecomputeTriangles(bool val)
         {
-            mBoundingSphereRadius = BoundingSphereRadiusFromMesh(mMesh);
+            mResource->setPrecomputeTriangles(val);
         }
 
-    protected:
-        bool doIntersectRay(const RayType &ray, IntersectionPointType &out)
+        bool isPrecomputeTriangles() const
+        {
+            return mResource->isPrecomputeTriangles();
+        }
+
+        //
+        // See MeshResource::setCompressMesh()
+        //
+        void setCompressMesh(bool val)
         {
-            GAL_imp::Solution<NumericType,2> solution2;
+            mResource->setCompressMesh(val);
+        }
 
-            if (!GAL::IntersectRaySphere(ray, mBoundingSphereRadius, solution2))
-            {
-                // Ray doesn't intersect bounding sphere
-                return false;
-            }
+        bool isCompressMesh() const
+        {
+            return mResource->isCompressMesh();
+        }
 
-            const VertexType  *vertices = mMesh.getVertexPointer();
-            const IndexType   *indices  = mMesh.getIndexPointer();
-            size_t num = mMesh.getNumIndices();
+        //
+        // See MeshResource::setOptimizeMeshLayout()
+        //
+        void setOptimizeMeshLayout(bool val)
+        {
+            mResource->setOptimizeMeshLayout(val);
+        }
 
-            GAL_imp::Solution<NumericType, 3> closestSolution3;
-            closestSolution3.x[0] = -1;
-            const VertexType *v0;
-            const VertexType *v1;
-            const VertexType *v2;
+        bool isOptimizeMeshLayout() const
+        {
+            return mResource->isOptimizeMeshLayout();
+        }
 
-            for (size_t i = 0; i < num; i += 3)
-            {
-                const VertexType &vA = vertices[indices[i]];
-                const VertexType &vB = vertices[indices[i+1]];
-                const VertexType &vC = vertices[indices[i+2]];
+        //
+        // See MeshResource::setBVHLayout()
+        //
+        void setBVHLayout(BVHLayout layout)
+        {
+            mResource->setBVHLayout(layout);
+        }
 
-                const PointType &pA = AbstractVertex::getPosition(vA);
-                const PointType &pB = AbstractVertex::getPosition(vB);
-                const PointType &pC = AbstractVertex::getPosition(vC);
+        //
+        // Rebuild mesh resource after mesh was modified. Bounds of other
+        // instances sharing the resource are updated too.
+        //
+        void meshChanged()
+        {
+            mResource->meshChanged();
+        }
 
-                GAL_imp::Solution<NumericType, 3> solution3;
+        //
+        // See MeshResource::loadMeshFile()
+        //
+        bool loadMeshFile(const char *path)
+        {
+            return mResource->loadMeshFile(path);
+        }
 
-                if (!GAL::IntersectRayTriangleByPoints(ray, pA, pB, pC, solution3))
-                {
-                    // No intersection at all
-                    continue;
-                }
+        //
+        // See MeshResource::setLazyBuild()
+        //
+        void setLazyBuild(bool val)
+        {
+            mResource->setLazyBuild(val);
+        }
 
-                if (solution3.x[0] < 0.0001)
-                {
-                    // Intersection was behind ray
-                    continue;
-                }
+        bool isLazyBuild() const
+        {
+            return mResource->isLazyBuild();
+        }
 
-                if (-1 == closestSolution3.x[0] || solution3.x[0] < closestSolution3.x[0])
-                {
-                    closestSolution3 = solution3;
-                    v0 = &vA;
-                    v1 = &vB;
-                    v2 = &vC;
-                }
-            }
+        //
+        // See MeshResource::setCacheDirectory()
+        //
+        void setCacheDirectory(const std::string &directory)
+        {
+            mResource->setCacheDirectory(directory);
+        }
 
-            if (-1 == closestSolution3.x[0])
-            {
-                return false;
-            }
+        const std::string & getCacheDirectory() const
+        {
+            return mResource->getCacheDirectory();
+        }
+
+        //
+        // See MeshResource::importMesh()
+        //
+        bool importMesh(const char *path)
+        {
+            return mResource->importMesh(path);
+        }
+
+        //
+        // See MeshResource::openPagedMesh()
+        //
+        bool openPagedMesh(const char *path, size_t memoryBudget)
+        {
+            return mResource->openPagedMesh(path, memoryBudget);
+        }
 
-            NumericType u1 = closestSolution3.x[1];
-            NumericType u2 = closestSolution3.x[2];
+        //
+        // See MeshResource::savePagedMesh()
+        //
+        bool savePagedMesh(const char *path) const
+        {
+            return mResource->savePagedMesh(path);
+        }
+
+        //
+        // See MeshResource::saveMeshFile()
+        //
+        bool saveMeshFile(const char *path) const
+        {
+            return mResource->saveMeshFile(path);
+        }
 
-            out.normal = AbstractVertex::getNormal(*v0, *v1, *v2, u1, u2);
-            out.tangent = AbstractVertex::getTangent(*v0, *v1, *v2, u1, u2);
+        //
+        // Intersect ray given in object local coordinates
+        //
+        bool hitLocalRay(const RayType &ray, RayHitType &hit) const
+        {
+            return mResource->hitLocalRay(ray, hit);
+        }
 
-            // distance is in unit of ray lengths
-            out.distance = closestSolution3.x[0];
+        void resolveLocalHit(const RayType &ray, const RayHitType &hit, IntersectionPointType &out, bool withTangent) const
+        {
+            mResource->resolveLocalHit(ray, hit, out, withTangent);
+        }
 
-            out.position = ray.start + ray.direction * out.distance;
+    protected:
+        bool doIntersectRay(const RayType &ray, IntersectionPointType &out)
+        {
+            RayHitType hit;
 
-            // based on v0, v1, and v2 also texture coordinates could be calculated
-            // if there was any texture
+            if (!hitLocalRay(ray, hit))
+            {
+                return false;
+            }
 
+            resolveLocalHit(ray, hit, out, true);
             return true;
         }
 
     private:
-        MeshType    mMesh;
-        NumericType mBoundingSphereRadius;
+        MeshResourcePtr mResource;
+
+        //
+        // Shared mesh resource was rebuilt
+        //
+        void resourceChanged()
+        {
+            this->setLocalBounds(mResource->getBounds());
+        }
+
+        MeshGeometry(const MeshGeometry &);
+        MeshGeometry &operator = (const MeshGeometry &);
     };
 
     typedef MeshGeometry<GAL::P3f::PointType> MeshGeometry3f;
@@ -0,0 +1,457 @@
+#ifndef INCLUDED_GEOMETRY_BVH_H
+#define INCLUDED_GEOMETRY_BVH_H
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#include "MinMax.h"
+#include "Intersect.h"
+#include "AABBox.h"
+
+//
+// Bounding volume hierarchy over scene objects, one object per leaf.
+//
+// Nodes are stored in depth-first order: left child immediately follows its
+// parent, and subtree of node with k objects occupies 2k-1 consecutive
+// nodes. Hence any subtree can be rebuilt in place without touching the
+// rest of the tree.
+//
+// When objects move, updateItem() refits bounds on the path from the leaf
+// to the root, so that the cost of an update is proportional to number of
+// moved objects times depth of the tree. Nodes whose surface area grew
+// beyond threshold times area they had when built are remembered, and
+// rebuildDegraded() rebuilds only those subtrees.
+//
+// Rebuilding a subtree cannot move objects out of it, so the sum of surface
+// areas of inner nodes (proportional to SAH cost of traversal) is tracked
+// too, and whole tree is rebuilt once it grows beyond threshold times the
+// sum after last full build.
+//
+template<class _NumericType>
+    class GeometryBVH
+    {
+    public:
+        typedef _NumericType                        NumericType;
+        typedef GAL_imp::Point<NumericType,3>       PointType;
+        typedef GAL_imp::Ray<NumericType,3>         RayType;
+        typedef AABBox<NumericType>                 AABBoxType;
+
+        struct Node
+        {
+            AABBoxType  bounds;
+            NumericType buildArea;  // surface area when subtree was built
+            size_t      parent;     // root is its own parent
+            size_t      right;      // right child, left child is next node
+            size_t      numItems;   // number of objects in subtree
+            size_t      item;       // object of leaf node
+        };
+
+        //
+        // Maximum depth of tree built by median splits
+        //
+        enum { MaxDepth = 64 };
+
+        GeometryBVH(): mTotalArea(0), mBuildTotalArea(0), mRebuildThreshold(2)
+        {
+        }
+
+        //
+        // Subtree is rebuilt when its surface area grows more than threshold
+        // times since it was built
+        //
+        void setRebuildThreshold(NumericType threshold)
+        {
+            mRebuildThreshold = threshold;
+        }
+
+        NumericType getRebuildThreshold() const
+        {
+            return mRebuildThreshold;
+        }
+
+        //
+        // Build tree over objects, where object i has bounds[i]
+        //
+        void build(const std::vector<AABBoxType> &bounds)
+        {
+            const size_t numItems = bounds.size();
+
+            mItemBounds = bounds;
+            mLeafOfItem.resize(numItems);
+            mNodes.resize(0 == numItems ? 0 : 2 * numItems - 1);
+            mDegraded.clear();
+            mTotalArea = 0;
+
+            if (0 != numItems)
+            {
+                std::vector<size_t> items(numItems);
+
+                for (size_t i = 0; i != numItems; ++i)
+                {
+                    items[i] = i;
+                }
+
+                buildSubtree(0, 0, &items[0], &items[0] + numItems);
+            }
+
+            mBuildTotalArea = mTotalArea;
+        }
+
+        size_t getNumItems() const
+        {
+            return mItemBounds.size();
+        }
+
+        bool isEmpty() const
+        {
+            return mNodes.empty();
+        }
+
+        //
+        // Node access used to collapse hierarchy (see WideBVH)
+        //
+        // Leaf range consists of single object.
+        //
+        bool isLeafNode(size_t index) const
+        {
+            return (1 == mNodes[index].numItems);
+        }
+
+        size_t getRightChild(size_t index) const
+        {
+            return mNodes[index].right;
+        }
+
+        const AABBoxType & getNodeBounds(size_t index) const
+        {
+            return mNodes[index].bounds;
+        }
+
+        void getLeafRange(size_t index, size_t &begin, size_t &end) const
+        {
+            begin = mNodes[index].item;
+            end = begin + 1;
+        }
+
+        //
+        // Ratio of current SAH cost of the tree to the cost after last full
+        // build
+        //
+        NumericType getDegradation() const
+        {
+            return (0 < mBuildTotalArea ? mTotalArea / mBuildTotalArea : 1);
+        }
+
+        //
+        // Bounds of all objects
+        //
+        const AABBoxType & getBounds() const
+        {
+            return mNodes[0].bounds;
+        }
+
+        //
+        // Refit tree after object has moved
+        //
+        // Bounds of nodes on the path to the root are recalculated from their
+        // children, until some node does not change.
+        //
+        void updateItem(size_t item, const AABBoxType &bounds)
+        {
+            mItemBounds[item] = bounds;
+
+            size_t index = mLeafOfItem[item];
+            mNodes[index].bounds = bounds;
+
+            while (0 != index)
+            {
+                index = mNodes[index].parent;
+
+                Node &node = mNodes[index];
+
+                AABBoxType refitted = mNodes[index + 1].bounds;
+                refitted.extend(mNodes[node.right].bounds);
+
+                if (refitted == node.bounds)
+                {
+                    break;
+                }
+
+                const NumericType area = refitted.getSurfaceArea();
+
+                mTotalArea += area - node.bounds.getSurfaceArea();
+                node.bounds = refitted;
+
+                if (node.buildArea * mRebuildThreshold < area)
+                {
+                    mDegraded.push_back(index);
+                }
+            }
+        }
+
+        //
+        // Rebuild subtrees, which were degraded by updateItem()
+        //
+        // Only the topmost of nested degraded subtrees is rebuilt, unless
+        // the whole tree is degraded. Returns number of rebuilt subtrees.
+        //
+        size_t rebuildDegraded()
+        {
+            if (mBuildTotalArea * mRebuildThreshold < mTotalArea)
+            {
+                build(mItemBounds);
+                return 1;
+            }
+
+            if (mDegraded.empty())
+            {
+                return 0;
+            }
+
+            std::sort(mDegraded.begin(), mDegraded.end());
+
+            std::vector<size_t> items;
+            size_t numRebuilt = 0;
+            size_t rebuiltEnd = 0;
+
+            for (size_t i = 0; i != mDegraded.size(); ++i)
+            {
+                const size_t index = mDegraded[i];
+
+                if (index < rebuiltEnd)
+                {
+                    // Already rebuilt as part of enclosing subtree
+                    continue;
+                }
+
+                const Node &node = mNodes[index];
+
+                if (node.bounds.getSurfaceArea() <= node.buildArea * mRebuildThreshold)
+                {
+                    // Object has moved back since
+                    continue;
+                }
+
+                rebuiltEnd = index + 2 * node.numItems - 1;
+
+                items.clear();
+
+                for (size_t j = index; j != rebuiltEnd; ++j)
+                {
+                    if (1 == mNodes[j].numItems)
+                    {
+                        items.push_back(mNodes[j].item);
+                    }
+                }
+
+                mTotalArea -= subtreeArea(index);
+                buildSubtree(index, node.parent, &items[0], &items[0] + items.size());
+                ++numRebuilt;
+            }
+
+            mDegraded.clear();
+
+            return numRebuilt;
+        }
+
+        //
+        // Visit objects, whose bounds are hit by ray, in near to far order.
+        //
+        // Calls visitor(item, tMax) for each such object, where tMax is
+        // distance of closest hit found so far, which visitor should lower
+        // when it finds closer hit. Distances are in units of ray direction
+        // length, and objects beyond initial tMax are skipped.
+        //
+        template<class Visitor>
+            void traverse(const RayType &ray, NumericType tMax, Visitor &visitor) const
+            {
+                if (mNodes.empty())
+                {
+                    return;
+                }
+
+                PointType invDirection;
+
+                for (int i = 0; i != 3; ++i)
+                {
+                    invDirection[i] = 1 / ray.direction[i];
+                }
+
+                NumericType tEntry;
+
+                if (!TestRayAABBox(ray.start, invDirection, mNodes[0].bounds, tMax, tEntry))
+                {
+                    return;
+                }
+
+                size_t stack[MaxDepth];
+                size_t stackSize = 0;
+                size_t index = 0;
+
+                for (;;)
+                {
+                    const Node &node = mNodes[index];
+
+                    if (1 == node.numItems)
+                    {
+                        visitor(node.item, tMax);
+                    }
+                    else
+                    {
+                        NumericType tLeft, tRight;
+
+                        bool hitLeft  = TestRayAABBox(ray.start, invDirection, mNodes[index + 1].bounds, tMax, tLeft);
+                        bool hitRight = TestRayAABBox(ray.start, invDirection, mNodes[node.right].bounds, tMax, tRight);
+
+                        if (hitLeft && hitRight)
+                        {
+                            // Visit nearer child first
+                            if (tLeft <= tRight)
+                            {
+                                stack[stackSize++] = node.right;
+                                index = index + 1;
+                            }
+                            else
+                            {
+                                stack[stackSize++] = index + 1;
+                                index = node.right;
+                            }
+
+                            continue;
+                        }
+                        else if (hitLeft)
+                        {
+                            index = index + 1;
+                            continue;
+                        }
+                        else if (hitRight)
+                        {
+                            index = node.right;
+                            continue;
+                        }
+                    }
+
+                    // Pop nodes, which are still hit closer than tMax
+                    for (;;)
+                    {
+                        if (0 == stackSize)
+                        {
+                            return;
+                        }
+
+                        index = stack[--stackSize];
+
+                        if (TestRayAABBox(ray.start, invDirection, mNodes[index].bounds, tMax, tEntry))
+                        {
+                            break;
+                        }
+                    }
+                }
+            }
+
+    private:
+        std::vector<Node>       mNodes;
+        std::vector<AABBoxType> mItemBounds;
+        std::vector<size_t>     mLeafOfItem;
+        std::vector<size_t>     mDegraded;
+        NumericType             mTotalArea;         // of inner nodes
+        NumericType             mBuildTotalArea;
+        NumericType             mRebuildThreshold;
+
+        NumericType subtreeArea(size_t index) const
+        {
+            NumericType area = 0;
+            const size_t end = index + 2 * mNodes[index].numItems - 1;
+
+            for (size_t i = index; i != end; ++i)
+            {
+                if (1 != mNodes[i].numItems)
+                {
+                    area += mNodes[i].bounds.getSurfaceArea();
+                }
+            }
+
+            return area;
+        }
+
+        //
+        // Orders objects by centroid along axis
+        //
+        struct CentroidLess
+        {
+            const AABBoxType   *bounds;
+            int                 axis;
+
+            bool operator () (size_t a, size_t b) const
+            {
+                return (bounds[a].getCenter()[axis] < bounds[b].getCenter()[axis]);
+            }
+        };
+
+        //
+        // Build subtree at given node over objects in [begin, end)
+        //
+        // Objects are split in halves by median of centroids along axis of
+        // largest extent, so depth of the tree is logarithmic.
+        //
+        void buildSubtree(size_t index, size_t parent, size_t *begin, size_t *end)
+        {
+            const size_t numItems = end - begin;
+
+            Node &node = mNodes[index];
+            node.parent = parent;
+            node.numItems = numItems;
+
+            if (1 == numItems)
+            {
+                node.item = *begin;
+                node.bounds = mItemBounds[*begin];
+                node.buildArea = node.bounds.getSurfaceArea();
+                mLeafOfItem[*begin] = index;
+                return;
+            }
+
+            AABBoxType centroids;
+            PointType center = mItemBounds[*begin].getCenter();
+
+            centroids.xMin = centroids.xMax = center[0];
+            centroids.yMin = centroids.yMax = center[1];
+            centroids.zMin = centroids.zMax = center[2];
+
+            for (size_t *it = begin + 1; it != end; ++it)
+            {
+                center = mItemBounds[*it].getCenter();
+
+                centroids.xMin = Min(centroids.xMin, center[0]); centroids.xMax = Max(centroids.xMax, center[0]);
+                centroids.yMin = Min(centroids.yMin, center[1]); centroids.yMax = Max(centroids.yMax, center[1]);
+                centroids.zMin = Min(centroids.zMin, center[2]); centroids.zMax = Max(centroids.zMax, center[2]);
+            }
+
+            PointType size = centroids.getSize();
+
+            CentroidLess less;
+            less.bounds = &mItemBounds[0];
+            less.axis = (size[0] < size[1] ? (size[1] < size[2] ? 2 : 1) : (size[0] < size[2] ? 2 : 0));
+
+            size_t *middle = begin + numItems / 2;
+            std::nth_element(begin, middle, end, less);
+
+            const size_t right = index + 2 * (middle - begin);
+
+            buildSubtree(index + 1, index, begin, middle);
+            buildSubtree(right, index, middle, end);
+
+            node.right = right;
+            node.bounds = mNodes[index + 1].bounds;
+            node.bounds.extend(mNodes[right].bounds);
+            node.buildArea = node.bounds.getSurfaceArea();
+
+            mTotalArea += node.buildArea;
+        }
+    };
+
+typedef GeometryBVH<float>  GeometryBVH3f;
+typedef GeometryBVH<double> GeometryBVH3d;
+
+#endif
@@ -0,0 +1,352 @@
+#ifndef INCLUDED_GEOMETRY_STORE_H
+#define INCLUDED_GEOMETRY_STORE_H
+
+#include <memory>
+#include <typeinfo>
+#include <vector>
+
+#include "Geometry.h"
+#include "HeightfieldGeometry.h"
+#include "SDFGeometry.h"
+#include "SphereSetGeometry.h"
+
+//
+// Container of geometries with static dispatch of intersection kernels.
+//
+// Built-in geometry types are kept in separate per-type containers, and are
+// intersected through Geometry::hitRayAs<>(), hence there is no virtual
+// call and intersection kernels can be inlined into the traversal loops.
+// Attributes of intersection are resolved only once for the closest hit.
+//
+// Geometry is kept by its dynamic type, which must be exactly one of the
+// built-in types. Any other geometry (including classes derived from
+// built-in types, which might override doIntersectRay) is kept in separate
+// container and it is intersected through the virtual
+// Geometry::intersectRay().
+//
+// Of hits at equal distance, hit of built-in type wins over hit of other
+// geometry, and otherwise the first one found wins. intersectRay() tests
+// built-in types in order of GeometryKind, then other geometries, each in
+// order they were added.
+//
+// Geometries can also be intersected one by one through references returned
+// by addGeometry(), which is used by acceleration structures built on top
+// of the store.
+//
+template<class _NumericType>
+    class GeometryStore
+    {
+    public:
+        typedef _NumericType                        NumericType;
+        typedef GAL_imp::Point<NumericType,3>       PointType;
+        typedef GAL_imp::Ray<NumericType,3>         RayType;
+        typedef IntersectionPoint<NumericType,3>    IntersectionPointType;
+        typedef RayHit<NumericType>                 RayHitType;
+        typedef Geometry<NumericType>               GeometryType;
+        typedef SphereGeometry<NumericType>         SphereGeometryType;
+        typedef CylinderGeometry<NumericType>       CylinderGeometryType;
+        typedef HeightfieldGeometry<NumericType>    HeightfieldGeometryType;
+        typedef SphereSetGeometry<NumericType>      SphereSetGeometryType;
+        typedef SDFGeometry<NumericType>            SDFGeometryType;
+        typedef MeshGeometry<PointType>             PointMeshGeometryType;
+        typedef MeshGeometry< Vertex<NumericType,3> > VertexMeshGeometryType;
+
+        //
+        // Containers of built-in geometry types
+        //
+        enum GeometryKind
+        {
+            Spheres,
+            Cylinders,
+            Heightfields,
+            SphereSets,
+            SDFs,
+            PointMeshes,
+            VertexMeshes,
+            Others,
+            NoGeometry
+        };
+
+        //
+        // Reference to geometry within store
+        //
+        struct GeometryRef
+        {
+            int     kind;
+            size_t  index;
+        };
+
+        //
+        // Closest hit found so far, and geometry it belongs to
+        //
+        struct ClosestHit
+        {
+            RayHitType  hit;
+            int         kind;
+            size_t      index;
+        };
+
+        //
+        // Add geometry to container of its dynamic type, regardless of type
+        // of pointer it is given by
+        //
+        GeometryRef addGeometry(const std::shared_ptr<GeometryType> &geometry)
+        {
+            const std::type_info &type = typeid(*geometry);
+
+            if (typeid(SphereGeometryType) == type)
+            {
+                return addTo(mSpheres, Spheres, std::static_pointer_cast<SphereGeometryType>(geometry));
+            }
+
+            if (typeid(CylinderGeometryType) == type)
+            {
+                return addTo(mCylinders, Cylinders, std::static_pointer_cast<CylinderGeometryType>(geometry));
+            }
+
+            if (typeid(HeightfieldGeometryType) == type)
+            {
+                return addTo(mHeightfields, Heightfields, std::static_pointer_cast<HeightfieldGeometryType>(geometry));
+            }
+
+            if (typeid(SphereSetGeometryType) == type)
+            {
+                return addTo(mSphereSets, SphereSets, std::static_pointer_cast<SphereSetGeometryType>(geometry));
+            }
+
+            if (typeid(SDFGeometryType) == type)
+            {
+                return addTo(mSDFs, SDFs, std::static_pointer_cast<SDFGeometryType>(geometry));
+            }
+
+            if (typeid(PointMeshGeometryType) == type)
+            {
+                return addTo(mPointMeshes, PointMeshes, std::static_pointer_cast<PointMeshGeometryType>(geometry));
+            }
+
+            if (typeid(VertexMeshGeometryType) == type)
+            {
+                return addTo(mVertexMeshes, VertexMeshes, std::static_pointer_cast<VertexMeshGeometryType>(geometry));
+            }
+
+            return addTo(mOthers, Others, geometry);
+        }
+
+        size_t getNumGeometries() const
+        {
+            return mSpheres.size() + mCylinders.size() + mHeightfields.size() +
+                mSphereSets.size() + mSDFs.size() + mPointMeshes.size() + mVertexMeshes.size() + mOthers.size();
+        }
+
+        //
+        // Find closest intersection among all geometries
+        //
+        // Tangent is calculated only if requested.
+        //
+        bool intersectRay(const RayType &ray, IntersectionPointType &out, bool withTangent = false)
+        {
+            ClosestHit closest;
+            beginClosestHit(closest, out);
+
+            hitGeometries(ray, closest, out);
+
+            return endClosestHit(closest, ray, out, withTangent);
+        }
+
+        //
+        // Search for closest hit among selected geometries.
+        //
+        // Search starts with beginClosestHit(), then hitGeometry() is called
+        // for each geometry, and endClosestHit() resolves attributes of the
+        // closest hit into out.
+        //
+        static void beginClosestHit(ClosestHit &closest, IntersectionPointType &out)
+        {
+            closest.hit.distance = -1;
+            closest.kind = NoGeometry;
+            out.distance = -1;
+        }
+
+        //
+        // Distance of closest hit found so far, or -1 if none
+        //
+        static NumericType getClosestDistance(const ClosestHit &closest, const IntersectionPointType &out)
+        {
+            if (NoGeometry != closest.kind &&
+                (-1 == out.distance || closest.hit.distance <= out.distance))
+            {
+                return closest.hit.distance;
+            }
+
+            return out.distance;
+        }
+
+        //
+        // Returns distance of closest hit found so far, or -1 if none
+        //
+        NumericType hitGeometry(const GeometryRef &ref, const RayType &ray, ClosestHit &closest, IntersectionPointType &out)
+        {
+            switch (ref.kind)
+            {
+            case Spheres:
+                hitOne(*mSpheres[ref.index], Spheres, ref.index, ray, closest);
+                break;
+            case Cylinders:
+                hitOne(*mCylinders[ref.index], Cylinders, ref.index, ray, closest);
+                break;
+            case Heightfields:
+                hitOne(*mHeightfields[ref.index], Heightfields, ref.index, ray, closest);
+                break;
+            case SphereSets:
+                hitOne(*mSphereSets[ref.index], SphereSets, ref.index, ray, closest);
+                break;
+            case SDFs:
+                hitOne(*mSDFs[ref.index], SDFs, ref.index, ray, closest);
+                break;
+            case PointMeshes:
+                hitOne(*mPointMeshes[ref.index], PointMeshes, ref.index, ray, closest);
+                break;
+            case VertexMeshes:
+                hitOne(*mVertexMeshes[ref.index], VertexMeshes, ref.index, ray, closest);
+                break;
+            case Others:
+                hitVirtual(*mOthers[ref.index], ray, out);
+                break;
+            }
+
+            return getClosestDistance(closest, out);
+        }
+
+        //
+        // Search all geometries, as by hitGeometry() for each
+        //
+        void hitGeometries(const RayType &ray, ClosestHit &closest, IntersectionPointType &out)
+        {
+            hitStatic(mSpheres, Spheres, ray, closest);
+            hitStatic(mCylinders, Cylinders, ray, closest);
+            hitStatic(mHeightfields, Heightfields, ray, closest);
+            hitStatic(mSphereSets, SphereSets, ray, closest);
+            hitStatic(mSDFs, SDFs, ray, closest);
+            hitStatic(mPointMeshes, PointMeshes, ray, closest);
+            hitStatic(mVertexMeshes, VertexMeshes, ray, closest);
+
+            // Other geometries resolve attributes immediately
+            for (size_t i = 0; i != mOthers.size(); ++i)
+            {
+                hitVirtual(*mOthers[i], ray, out);
+            }
+        }
+
+        bool endClosestHit(const ClosestHit &closest, const RayType &ray, IntersectionPointType &out, bool withTangent)
+        {
+            if (NoGeometry != closest.kind &&
+                (-1 == out.distance || closest.hit.distance <= out.distance))
+            {
+                resolveHit(closest, ray, out, withTangent);
+            }
+
+            return (-1 != out.distance);
+        }
+
+    private:
+        std::vector< std::shared_ptr<SphereGeometryType> >      mSpheres;
+        std::vector< std::shared_ptr<CylinderGeometryType> >    mCylinders;
+        std::vector< std::shared_ptr<HeightfieldGeometryType> > mHeightfields;
+        std::vector< std::shared_ptr<SphereSetGeometryType> >   mSphereSets;
+        std::vector< std::shared_ptr<SDFGeometryType> >         mSDFs;
+        std::vector< std::shared_ptr<PointMeshGeometryType> >   mPointMeshes;
+        std::vector< std::shared_ptr<VertexMeshGeometryType> >  mVertexMeshes;
+        std::vector< std::shared_ptr<GeometryType> >            mOthers;
+
+        template<class ContainerType, class PtrType>
+            static GeometryRef addTo(ContainerType &container, int kind, const PtrType &geometry)
+            {
+                GeometryRef ref;
+                ref.kind = kind;
+                ref.index = container.size();
+
+                container.push_back(geometry);
+                return ref;
+            }
+
+        template<class ConcreteGeometryType>
+            static void hitOne(
+                ConcreteGeometryType   &geometry,
+                int                     kind,
+                size_t                  index,
+                const RayType          &ray,
+                ClosestHit             &closest)
+            {
+                RayHitType tmp;
+
+                if (!geometry.template hitRayAs<ConcreteGeometryType>(ray, tmp))
+                {
+                    return;
+                }
+
+                if (-1 == closest.hit.distance || tmp.distance < closest.hit.distance)
+                {
+                    closest.hit = tmp;
+                    closest.kind = kind;
+                    closest.index = index;
+                }
+            }
+
+        template<class ConcreteGeometryType>
+            static void hitStatic(
+                const std::vector< std::shared_ptr<ConcreteGeometryType> > &geometries,
+                int                                                         kind,
+                const RayType                                              &ray,
+                ClosestHit                                                 &closest)
+            {
+                for (size_t i = 0; i != geometries.size(); ++i)
+                {
+                    hitOne(*geometries[i], kind, i, ray, closest);
+                }
+            }
+
+        void resolveHit(const ClosestHit &closest, const RayType &ray, IntersectionPointType &out, bool withTangent)
+        {
+            switch (closest.kind)
+            {
+            case Spheres:
+                mSpheres[closest.index]->template resolveHitAs<SphereGeometryType>(ray, closest.hit, out, withTangent);
+                break;
+            case Cylinders:
+                mCylinders[closest.index]->template resolveHitAs<CylinderGeometryType>(ray, closest.hit, out, withTangent);
+                break;
+            case Heightfields:
+                mHeightfields[closest.index]->template resolveHitAs<HeightfieldGeometryType>(ray, closest.hit, out, withTangent);
+                break;
+            case SphereSets:
+                mSphereSets[closest.index]->template resolveHitAs<SphereSetGeometryType>(ray, closest.hit, out, withTangent);
+                break;
+            case SDFs:
+                mSDFs[closest.index]->template resolveHitAs<SDFGeometryType>(ray, closest.hit, out, withTangent);
+                break;
+            case PointMeshes:
+                mPointMeshes[closest.index]->template resolveHitAs<PointMeshGeometryType>(ray, closest.hit, out, withTangent);
+                break;
+            case VertexMeshes:
+                mVertexMeshes[closest.index]->template resolveHitAs<VertexMeshGeometryType>(ray, closest.hit, out, withTangent);
+                break;
+            }
+        }
+
+        static void hitVirtual(GeometryType &geometry, const RayType &ray, IntersectionPointType &out)
+        {
+            IntersectionPointType tmp;
+
+            if (!geometry.intersectRay(ray, tmp))
+            {
+                return;
+            }
+
+            if (-1 == out.distance || tmp.distance < out.distance)
+            {
+                out = tmp;
+            }
+        }
+    };
+
+#endif
@@ -0,0 +1,519 @@
+#ifndef INCLUDED_HEIGHTFIELD_GEOMETRY_H
+#define INCLUDED_HEIGHTFIELD_GEOMETRY_H
+
+#include <limits>
+#include <vector>
+
+#include "MinMax.h"
+#include "AABBox.h"
+#include "BoundingSphere.h"
+#include "Geometry.h"
+#include "Parallel.h"
+
+//
+// Surface z = height(x, y) given by regular grid of samples
+//
+// Samples are placed at numX by numY points spanning rectangle [xMin, xMax]
+// by [yMin, yMax], where xMin < xMax and yMin < yMax. Each cell between four neighbouring samples is split into
+// two triangles along diagonal from sample (i+1, j) to sample (i, j+1), the
+// same way as tessellated meshes of grids are, but neither vertices nor
+// indices are stored.
+//
+// Rays are intersected by descending min/max mip levels of heights front to
+// back: node of level l spans 2^l by 2^l cells and holds lowest and highest
+// height within them, hence its box is skipped whole when ray passes above
+// or below it, and cells are visited in order in which ray crosses them, as
+// by 2D DDA. Number of visited nodes is close to logarithmic in number of
+// cells for surfaces, which do not run parallel to ray. Ranges of single
+// cells are not stored, so memory is one height per sample plus third of
+// pair of heights per cell.
+//
+// Ray is intersected in grid space, where cells are of unit size, because
+// triangle test rejects triangles with small determinant, which would miss
+// cells of fine grids in object space. Distances and barycentric
+// coordinates do not change with scale.
+//
+template<class _NumericType>
+    class HeightfieldGeometry : public Geometry<_NumericType>
+    {
+    public:
+        typedef Geometry<_NumericType>                  BaseType;
+        typedef typename BaseType::NumericType          NumericType;
+        typedef typename BaseType::PointType            PointType;
+        typedef typename BaseType::RayType              RayType;
+        typedef typename BaseType::IntersectionPointType IntersectionPointType;
+        typedef typename BaseType::RayHitType           RayHitType;
+        typedef typename BaseType::BoundingSphereType   BoundingSphereType;
+        typedef AABBox<NumericType>                     AABBoxType;
+
+        //
+        // Flat heightfield, heights are set by setHeight() or sample()
+        //
+        HeightfieldGeometry(size_t numX, size_t numY, NumericType xMin, NumericType xMax, NumericType yMin, NumericType yMax)
+            : mNumX(Max<size_t>(numX, 2)), mNumY(Max<size_t>(numY, 2)), mXMin(xMin), mYMin(yMin)
+        {
+            mDX = (xMax - xMin) / NumericType(mNumX - 1);
+            mDY = (yMax - yMin) / NumericType(mNumY - 1);
+            mScaleZ = 1 / sqrt(mDX * mDY);
+            mHeights.resize(mNumX * mNumY, NumericType(0));
+
+            heightsChanged();
+        }
+
+        size_t getNumX() const
+        {
+            return mNumX;
+        }
+
+        size_t getNumY() const
+        {
+            return mNumY;
+        }
+
+        NumericType getHeight(size_t ix, size_t iy) const
+        {
+            return mHeights[iy * mNumX + ix];
+        }
+
+        //
+        // heightsChanged() should be called after heights are set
+        //
+        void setHeight(size_t ix, size_t iy, NumericType height)
+        {
+            mHeights[iy * mNumX + ix] = height;
+        }
+
+        //
+        // Heights of samples row by row, i.e. sample (ix, iy) is at
+        // iy * getNumX() + ix
+        //
+        NumericType * getWritableHeightPointer()
+        {
+            return &mHeights[0];
+        }
+
+        const NumericType * getHeightPointer() const
+        {
+            return &mHeights[0];
+        }
+
+        //
+        // Set heights of all samples to function(x, y), which is called
+        // concurrently from several threads
+        //
+        template<class Function>
+            void sample(Function function)
+            {
+                ParallelFor(mNumY, 1,
+                    [this, &function](size_t begin, size_t end)
+                    {
+                        for (size_t iy = begin; iy != end; ++iy)
+                        {
+                            for (size_t ix = 0; ix != mNumX; ++ix)
+                            {
+                                mHeights[iy * mNumX + ix] = NumericType(function(getX(ix), getY(iy)));
+                            }
+                        }
+                    });
+
+                heightsChanged();
+            }
+
+        //
+        // Rebuild mip levels and bounds after heights were changed
+        //
+        void heightsChanged()
+        {
+            buildLevels();
+
+            const Range root = getRange(mLevels.size() - 1, 0, 0);
+
+            AABBoxType box;
+            box.xMin = getX(0);
+            box.xMax = getX(mNumX - 1);
+            box.yMin = getY(0);
+            box.yMax = getY(mNumY - 1);
+            box.zMin = root.low;
+            box.zMax = root.high;
+
+            BoundingSphereType bounds;
+            BoundingSphereFromAABBox(box, bounds);
+            this->setLocalBounds(bounds);
+        }
+
+        //
+        // Memory used by heights and mip levels in bytes
+        //
+        size_t getMemorySize() const
+        {
+            size_t size = mHeights.size() * sizeof(NumericType);
+
+            for (size_t l = 0; l != mLevels.size(); ++l)
+            {
+                size += mLevels[l].size() * sizeof(Range);
+            }
+
+            return size;
+        }
+
+        //
+        // Intersect ray given in object local coordinates
+        //
+        // Primitive of hit is 2 * (iy * (getNumX() - 1) + ix) for lower
+        // triangle of cell (ix, iy), and one more for its upper triangle.
+        //
+        bool hitLocalRay(const RayType &ray, RayHitType &hit) const
+        {
+            RayType gridRay;
+            gridRay.start[0] = (ray.start[0] - mXMin) / mDX;
+            gridRay.start[1] = (ray.start[1] - mYMin) / mDY;
+            gridRay.start[2] = ray.start[2] * mScaleZ;
+            gridRay.direction[0] = ray.direction[0] / mDX;
+            gridRay.direction[1] = ray.direction[1] / mDY;
+            gridRay.direction[2] = ray.direction[2] * mScaleZ;
+
+            PointType invDirection;
+
+            for (int i = 0; i != 3; ++i)
+            {
+                invDirection[i] = 1 / gridRay.direction[i];
+            }
+
+            // Children are visited in order in which ray crosses quadrants
+            const size_t flipX = (ray.direction[0] < 0 ? 1 : 0);
+            const size_t flipY = (ray.direction[1] < 0 ? 1 : 0);
+
+            struct Entry
+            {
+                size_t  level;
+                size_t  i;
+                size_t  j;
+            };
+
+            // Each level leaves at most three siblings on stack
+            Entry stack[3 * 64 + 1];
+            size_t stackSize = 0;
+
+            stack[stackSize].level = mLevels.size() - 1;
+            stack[stackSize].i = stack[stackSize].j = 0;
+            ++stackSize;
+
+            NumericType tMax = (std::numeric_limits<NumericType>::max)();
+            hit.distance = -1;
+
+            while (0 != stackSize)
+            {
+                const Entry entry = stack[--stackSize];
+
+                AABBoxType box;
+                getNodeBox(entry.level, entry.i, entry.j, box);
+
+                NumericType tEntry;
+
+                if (!TestRayAABBox(gridRay.start, invDirection, box, tMax, tEntry))
+                {
+                    continue;
+                }
+
+                if (0 == entry.level)
+                {
+                    if (hitCell(gridRay, entry.i, entry.j, hit))
+                    {
+                        // Nodes still on stack are farther, unless ray
+                        // touches their boxes at the same distance
+                        tMax = hit.distance;
+                    }
+
+                    continue;
+                }
+
+                const size_t level = entry.level - 1;
+                const size_t width = mLevelWidth[level], height = mLevelHeight[level];
+
+                // Push farthest child first
+                for (int k = 3; k >= 0; --k)
+                {
+                    const size_t i = 2 * entry.i + (size_t(k & 1) ^ flipX);
+                    const size_t j = 2 * entry.j + (size_t(k >> 1) ^ flipY);
+
+                    if (i < width && j < height)
+                    {
+                        stack[stackSize].level = level;
+                        stack[stackSize].i = i;
+                        stack[stackSize].j = j;
+                        ++stackSize;
+                    }
+                }
+            }
+
+            return (-1 != hit.distance);
+        }
+
+        void resolveLocalHit(const RayType &ray, const RayHitType &hit, IntersectionPointType &out, bool withTangent) const
+        {
+            size_t corners[3][2];
+            getTriangle(hit.primitive, corners);
+
+            const NumericType s = 1 - hit.u - hit.v;
+
+            out.distance = hit.distance;
+            out.position = ray.start + ray.direction * hit.distance;
+            out.normal =
+                getSampleNormal(corners[0][0], corners[0][1]) * s +
+                getSampleNormal(corners[1][0], corners[1][1]) * hit.u +
+                getSampleNormal(corners[2][0], corners[2][1]) * hit.v;
+
+            if (withTangent)
+            {
+                out.tangent = getSample(corners[1][0], corners[1][1]) - getSample(corners[0][0], corners[0][1]);
+            }
+        }
+
+    protected:
+        bool doIntersectRay(const RayType &ray, IntersectionPointType &out)
+        {
+            RayHitType hit;
+
+            if (!hitLocalRay(ray, hit))
+            {
+                return false;
+            }
+
+            resolveLocalHit(ray, hit, out, true);
+            return true;
+        }
+
+    private:
+        struct Range
+        {
+            NumericType low;
+            NumericType high;
+        };
+
+        size_t      mNumX;
+        size_t      mNumY;
+        NumericType mXMin;
+        NumericType mYMin;
+        NumericType mDX;
+        NumericType mDY;
+        NumericType mScaleZ;
+
+        std::vector<NumericType>          mHeights;
+        std::vector< std::vector<Range> > mLevels;          // level 0 is empty
+        std::vector<size_t>               mLevelWidth;
+        std::vector<size_t>               mLevelHeight;
+
+        NumericType getX(size_t ix) const
+        {
+            return mXMin + NumericType(ix) * mDX;
+        }
+
+        NumericType getY(size_t iy) const
+        {
+            return mYMin + NumericType(iy) * mDY;
+        }
+
+        PointType getSample(size_t ix, size_t iy) const
+        {
+            PointType sample;
+            sample[0] = getX(ix);
+            sample[1] = getY(iy);
+            sample[2] = getHeight(ix, iy);
+
+            return sample;
+        }
+
+        //
+        // Normal from central differences, or one-sided ones at borders
+        //
+        PointType getSampleNormal(size_t ix, size_t iy) const
+        {
+            const size_t x0 = (0 != ix ? ix - 1 : ix), x1 = Min(ix + 1, mNumX - 1);
+            const size_t y0 = (0 != iy ? iy - 1 : iy), y1 = Min(iy + 1, mNumY - 1);
+
+            const NumericType dzdx = (getHeight(x1, iy) - getHeight(x0, iy)) / (NumericType(x1 - x0) * mDX);
+            const NumericType dzdy = (getHeight(ix, y1) - getHeight(ix, y0)) / (NumericType(y1 - y0) * mDY);
+
+            PointType normal;
+            normal[0] = -dzdx;
+            normal[1] = -dzdy;
+            normal[2] = 1;
+
+            return normal / GAL::Len(normal);
+        }
+
+        //
+        // Samples at corners of triangle in order of its barycentric
+        // coordinates
+        //
+        void getTriangle(size_t primitive, size_t corners[3][2]) const
+        {
+            const size_t cell = primitive / 2;
+            const size_t ix = cell % (mNumX - 1), iy = cell / (mNumX - 1);
+
+            if (0 == primitive % 2)
+            {
+                corners[0][0] = ix;     corners[0][1] = iy;
+                corners[1][0] = ix + 1; corners[1][1] = iy;
+                corners[2][0] = ix;     corners[2][1] = iy + 1;
+            }
+            else
+            {
+                corners[0][0] = ix;     corners[0][1] = iy + 1;
+                corners[1][0] = ix + 1; corners[1][1] = iy;
+                corners[2][0] = ix + 1; corners[2][1] = iy + 1;
+            }
+        }
+
+        Range getRange(size_t level, size_t i, size_t j) const
+        {
+            if (0 != level)
+            {
+                return mLevels[level][j * mLevelWidth[level] + i];
+            }
+
+            const NumericType h00 = getHeight(i, j),     h10 = getHeight(i + 1, j);
+            const NumericType h01 = getHeight(i, j + 1), h11 = getHeight(i + 1, j + 1);
+
+            Range range;
+            range.low  = Min(Min(h00, h10), Min(h01, h11));
+            range.high = Max(Max(h00, h10), Max(h01, h11));
+
+            return range;
+        }
+
+        //
+        // Box of node in grid space
+        //
+        void getNodeBox(size_t level, size_t i, size_t j, AABBoxType &box) const
+        {
+            const Range range = getRange(level, i, j);
+
+            box.xMin = NumericType(i << level);
+            box.xMax = NumericType(Min((i + 1) << level, mLevelWidth[0]));
+            box.yMin = NumericType(j << level);
+            box.yMax = NumericType(Min((j + 1) << level, mLevelHeight[0]));
+            box.zMin = range.low * mScaleZ;
+            box.zMax = range.high * mScaleZ;
+        }
+
+        PointType getGridSample(size_t ix, size_t iy) const
+        {
+            PointType sample;
+            sample[0] = NumericType(ix);
+            sample[1] = NumericType(iy);
+            sample[2] = getHeight(ix, iy) * mScaleZ;
+
+            return sample;
+        }
+
+        //
+        // Intersect both triangles of cell with ray in grid space, returns
+        // true if hit got closer
+        //
+        bool hitCell(const RayType &gridRay, size_t ix, size_t iy, RayHitType &hit) const
+        {
+            const PointType p00 = getGridSample(ix, iy);
+            const PointType p10 = getGridSample(ix + 1, iy);
+            const PointType p01 = getGridSample(ix, iy + 1);
+            const PointType p11 = getGridSample(ix + 1, iy + 1);
+
+            const size_t primitive = 2 * (iy * (mNumX - 1) + ix);
+            bool closer = false;
+
+            GAL_imp::Solution<NumericType, 3> solution;
+
+            if (GAL::IntersectRayTriangleByPoints(gridRay, p00, p10, p01, solution))
+            {
+                closer |= updateClosestHit(solution, primitive, hit);
+            }
+
+            if (GAL::IntersectRayTriangleByPoints(gridRay, p01, p10, p11, solution))
+            {
+                closer |= updateClosestHit(solution, primitive + 1, hit);
+            }
+
+            return closer;
+        }
+
+        static bool updateClosestHit(const GAL_imp::Solution<NumericType, 3> &solution, size_t primitive, RayHitType &hit)
+        {
+            if (solution.x[0] < 0.0001)
+            {
+                // Intersection was behind ray
+                return false;
+            }
+
+            if (-1 != hit.distance && hit.distance <= solution.x[0])
+            {
+                return false;
+            }
+
+            // distance is in unit of ray lengths
+            hit.distance = solution.x[0];
+            hit.u = solution.x[1];
+            hit.v = solution.x[2];
+            hit.primitive = primitive;
+
+            return true;
+        }
+
+        //
+        // Each level holds ranges of heights of 2 by 2 nodes of previous
+        // one, up to single root node. Level 0 are cells, whose ranges are
+        // taken from their samples.
+        //
+        void buildLevels()
+        {
+            size_t width = mNumX - 1, height = mNumY - 1;
+
+            mLevels.assign(1, std::vector<Range>());
+            mLevelWidth.assign(1, width);
+            mLevelHeight.assign(1, height);
+
+            while (1 < width || 1 < height)
+            {
+                const size_t level = mLevels.size();
+                const size_t childWidth = width, childHeight = height;
+
+                width = (width + 1) / 2;
+                height = (height + 1) / 2;
+
+                mLevels.push_back(std::vector<Range>(width * height));
+                mLevelWidth.push_back(width);
+                mLevelHeight.push_back(height);
+
+                std::vector<Range> &nodes = mLevels.back();
+
+                ParallelFor(height, 1 << 4,
+                    [this, &nodes, level, width, childWidth, childHeight](size_t begin, size_t end)
+                    {
+                        for (size_t j = begin; j != end; ++j)
+                        {
+                            for (size_t i = 0; i != width; ++i)
+                            {
+                                Range range = getRange(level - 1, 2 * i, 2 * j);
+
+                                for (size_t cj = 2 * j; cj != Min(2 * j + 2, childHeight); ++cj)
+                                {
+                                    for (size_t ci = 2 * i; ci != Min(2 * i + 2, childWidth); ++ci)
+                                    {
+                                        const Range child = getRange(level - 1, ci, cj);
+
+                                        range.low  = Min(range.low, child.low);
+                                        range.high = Max(range.high, child.high);
+                                    }
+                                }
+
+                                nodes[j * width + i] = range;
+                            }
+                        }
+                    });
+            }
+        }
+    };
+
+typedef HeightfieldGeometry<float>  HeightfieldGeometry3f;
+typedef HeightfieldGeometry<double> HeightfieldGeometry3d;
+
+#endif
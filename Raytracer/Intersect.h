@@ -2,6 +2,7 @@
 #define INCLUDED_INTERSECT_H
 
 #include "Linear.h"
+#include "FastMath.h"
 
 namespace GAL_imp {
 
@@ -74,7 +75,7 @@ namespace GAL {
                 return false;
             }
 
-            N sqrtDelta = sqrt(_B2 - _4AC);
+            N sqrtDelta = GAL::DefaultMath::Sqrt(_B2 - _4AC);
             N recip2A = 1 / (2*A);
 
             // Always: 0 < sqrtDelta, hence always: x[0] < x[1]
@@ -138,6 +139,42 @@ namespace GAL {
             return SolveQuadratic(a, b, c, solution);
         }
 
+    //
+    // Quick rejection test of ray against sphere with given center and radius.
+    //
+    // Returns false if sphere is entirely behind ray start, or if ray passes
+    // sphere by. Otherwise ray may intersect sphere. No square root is needed.
+    //
+    template<class N, int I>
+        bool TestRaySphere(const GAL_imp::Ray<N,I> &ray, const GAL_imp::Point<N,I> &center, N sphereRadius)
+        {
+            GAL_imp::Point<N,I> u = center - ray.start;
+
+            N uu = Dot(u, u);
+            N rr = sphereRadius * sphereRadius;
+
+            if (uu <= rr)
+            {
+                // ray starts inside of sphere
+                return true;
+            }
+
+            N uv = Dot(u, ray.direction);
+
+            if (uv <= 0)
+            {
+                // sphere is behind ray
+                return false;
+            }
+
+            //
+            // Square distance between center and ray line is: u.u - (u.v)^2 / v.v
+            //
+            N vv = Dot(ray.direction, ray.direction);
+
+            return ((uu - rr) * vv <= uv * uv);
+        }
+
     template<class N, int I>
         bool IntersectRayInfiniteCylinder(
             const GAL_imp::Ray<N,I>    &ray,
@@ -0,0 +1,42 @@
+#ifndef INCLUDED_INTERSECTION_POINT_H
+#define INCLUDED_INTERSECTION_POINT_H
+
+#include "Linear.h"
+
+template<class _NumericType> class Geometry;
+
+template<class N, int I>
+    struct IntersectionPoint
+    {
+        GAL_imp::Point<N,I> position;
+        GAL_imp::Point<N,I> normal;
+        GAL_imp::Point<N,I> tangent;
+        GAL_imp::Point<N,4> color;
+        N                   distance;
+        bool                isReflective;
+        const Geometry<N>  *geometry;       // which was hit
+    };
+
+typedef IntersectionPoint<float,3>  IntersectionPoint3f;
+typedef IntersectionPoint<double,3> IntersectionPoint3d;
+
+//
+// Result of cheap intersection phase.
+//
+// Only distance and primitive identification are computed while searching
+// for closest hit. Attributes (IntersectionPoint) are resolved later only
+// for the winning hit.
+//
+template<class N>
+    struct RayHit
+    {
+        N       distance;   // in units of ray direction length
+        N       u;          // barycentric coordinates within primitive
+        N       v;
+        size_t  primitive;  // primitive id within geometry
+    };
+
+typedef RayHit<float>  RayHit3f;
+typedef RayHit<double> RayHit3d;
+
+#endif
@@ -1,11 +1,117 @@
 #ifndef INCLUDED_LIGHT_H
 #define INCLUDED_LIGHT_H
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "MinMax.h"
 #include "Linear.h"
 #include "Intersect.h"
+#include "ShadowPacket.h"
 
 
 template<class _NumericType> class SceneGraph;
+template<class _NumericType> class Light;
+
+//
+// Receives notifications about changes of light
+//
+template<class _NumericType>
+    class LightListener
+    {
+    public:
+        virtual ~LightListener() {}
+
+        //
+        // Position or range of light has changed
+        //
+        virtual void lightMoved(Light<_NumericType> &light) = 0;
+
+        //
+        // Colors of light have changed
+        //
+        virtual void lightColorChanged(Light<_NumericType> &light) = 0;
+    };
+
+//
+// Falloff 1 / ((width * angle)^sharpness + 1) of light at given angle
+// between directions, tabulated so that it is looked up instead of calling
+// acos() and pow() for each sample
+//
+// Falloff depends only on cosine of angle. Table is indexed by sin(angle/2)
+// = sqrt((1 - cosine) / 2), which is cheap to get from cosine, and unlike
+// cosine itself is not flat near zero angle, so that linear interpolation
+// between NumEntries + 1 entries is within 1e-3 of exact falloff for width
+// 2 and sharpness 0.8, and within 3e-4 for width 4 and sharpness 16.
+//
+template<class _NumericType>
+    class FalloffTable
+    {
+    public:
+        typedef _NumericType NumericType;
+
+        enum
+        {
+            NumEntries = 1024
+        };
+
+        FalloffTable(NumericType width, NumericType sharpness)
+        {
+            build(width, sharpness);
+        }
+
+        void build(NumericType width, NumericType sharpness)
+        {
+            mWidth = width;
+            mSharpness = sharpness;
+            mValues.resize(NumEntries + 1);
+
+            for (size_t i = 0; i <= NumEntries; ++i)
+            {
+                const NumericType s = NumericType(i) / NumEntries;
+
+                mValues[i] = evaluate(width, sharpness, 1 - 2 * s * s);
+            }
+        }
+
+        NumericType getWidth() const
+        {
+            return mWidth;
+        }
+
+        NumericType getSharpness() const
+        {
+            return mSharpness;
+        }
+
+        //
+        // Interpolated falloff for cosine of angle
+        //
+        NumericType operator () (NumericType cosine) const
+        {
+            const NumericType x = GAL::DefaultMath::Sqrt(Max((1 - cosine) / 2, NumericType(0))) * NumEntries;
+            const size_t i = Min(size_t(x), size_t(NumEntries - 1));
+            const NumericType f = Min(x - NumericType(i), NumericType(1));
+
+            return mValues[i] + (mValues[i + 1] - mValues[i]) * f;
+        }
+
+        //
+        // Exact falloff for cosine of angle
+        //
+        static NumericType evaluate(NumericType width, NumericType sharpness, NumericType cosine)
+        {
+            const NumericType angle = acos(Min(Max(cosine, NumericType(-1)), NumericType(1)));
+
+            return 1 / (pow(width * angle, sharpness) + 1);
+        }
+
+    private:
+        NumericType                 mWidth;
+        NumericType                 mSharpness;
+        std::vector<NumericType>    mValues;
+    };
 
 template<class _NumericType>
     class Light
@@ -19,9 +125,14 @@ template<class _NumericType>
         typedef GAL_imp::Ray<NumericType,3>         RayType;
         typedef IntersectionPoint<NumericType,3>    IntersectionPointType;
         typedef SceneGraph<NumericType>             SceneGraphType;
+        typedef LightListener<NumericType>          ListenerType;
 
 
-        Light(): mShadow(false), mSoftShadowWidth(0)
+        typedef FalloffTable<NumericType>           FalloffTableType;
+        typedef ShadowPacket<NumericType>           ShadowPacketType;
+
+
+        Light(): mShadow(false), mSoftShadowWidth(0), mRange(0), mDiffuseFalloff(2, 0.8), mSpecularFalloff(4, 16)
         {
             NumericType coeff[3][3] =
             {
@@ -39,19 +150,64 @@ template<class _NumericType>
             }
         }
 
+        //
+        // Each scene graph listens to lights added to it, so that changes
+        // of position, colors and range take effect immediately (see
+        // LightBVH)
+        //
+        void addListener(ListenerType *listener)
+        {
+            mListeners.push_back(listener);
+        }
+
+        void removeListener(ListenerType *listener)
+        {
+            mListeners.erase(std::remove(mListeners.begin(), mListeners.end(), listener), mListeners.end());
+        }
+
         void setPosition(const PointType &t)
         {
             mPosition = t;
+
+            for (size_t i = 0; i != mListeners.size(); ++i)
+            {
+                mListeners[i]->lightMoved(*this);
+            }
+        }
+
+        const PointType & getPosition() const
+        {
+            return mPosition;
         }
 
         void setDiffuseColor(const LightColorType &c)
         {
             mDiffuseColor = c;
+
+            for (size_t i = 0; i != mListeners.size(); ++i)
+            {
+                mListeners[i]->lightColorChanged(*this);
+            }
+        }
+
+        const LightColorType & getDiffuseColor() const
+        {
+            return mDiffuseColor;
         }
 
         void setSpecularColor(const LightColorType &c)
         {
             mSpecularColor = c;
+
+            for (size_t i = 0; i != mListeners.size(); ++i)
+            {
+                mListeners[i]->lightColorChanged(*this);
+            }
+        }
+
+        const LightColorType & getSpecularColor() const
+        {
+            return mSpecularColor;
         }
 
         void setShadow(bool val)
@@ -74,23 +230,72 @@ template<class _NumericType>
             return mSoftShadowWidth;
         }
 
+        //
+        // Distance, at which light fades out. Light is attenuated by
+        // (1 - (distance / range)^2)^2, so that it reaches zero smoothly and
+        // does not light anything beyond its range. Zero range (default)
+        // means light is not attenuated.
+        //
+        void setRange(NumericType val)
+        {
+            mRange = val;
+
+            for (size_t i = 0; i != mListeners.size(); ++i)
+            {
+                mListeners[i]->lightMoved(*this);
+            }
+        }
+
+        NumericType getRange() const
+        {
+            return mRange;
+        }
+
+        NumericType getAttenuation(const PointType &position) const
+        {
+            if (0 == mRange)
+            {
+                return 1;
+            }
+
+            const PointType lightDir = mPosition - position;
+            const NumericType x = Min(GAL::Dot(lightDir, lightDir) / (mRange * mRange), NumericType(1));
+
+            return (1 - x) * (1 - x);
+        }
+
+        //
+        // Falloff of diffuse light with angle between light direction and
+        // normal, and of specular light with angle between light direction
+        // and reflected ray (see FalloffTable)
+        //
+        void setDiffuseFalloff(NumericType width, NumericType sharpness)
+        {
+            mDiffuseFalloff.build(width, sharpness);
+        }
+
+        void setSpecularFalloff(NumericType width, NumericType sharpness)
+        {
+            mSpecularFalloff.build(width, sharpness);
+        }
+
+        const FalloffTableType & getDiffuseFalloff() const
+        {
+            return mDiffuseFalloff;
+        }
+
+        const FalloffTableType & getSpecularFalloff() const
+        {
+            return mSpecularFalloff;
+        }
+
         ColorType illuminate(SceneGraphType &sceneGraph, RayType &ray, IntersectionPointType &intersectionPoint)
         {
-            NumericType intensity = 1.0;
+            NumericType intensity;
 
-            if (mShadow)
+            if (!getIntensity(sceneGraph, intersectionPoint, intensity))
             {
-                if (0 == mSoftShadowWidth)
-                {
-                    if (dropShadow(sceneGraph, mPosition, intersectionPoint))
-                    {
-                        return ColorType();
-                    }
-                }
-                else
-                {
-                    intensity = 1.0 - softShadow(sceneGraph, intersectionPoint);
-                }
+                return ColorType();
             }
 
             return processPointLight(
@@ -100,7 +305,70 @@ template<class _NumericType>
                     ray.direction,
                     mDiffuseColor * intensity,
                     mSpecularColor * intensity,
-                    2, 0.8, 4, 16);
+                    mDiffuseFalloff,
+                    mSpecularFalloff);
+        }
+
+        //
+        // Fraction of light reaching intersection point after attenuation
+        // and shadows. Returns false, if light does not reach it at all
+        // (out of range or in hard shadow).
+        //
+        bool getIntensity(SceneGraphType &sceneGraph, const IntersectionPointType &intersectionPoint, NumericType &intensity)
+        {
+            intensity = getAttenuation(intersectionPoint.position);
+
+            if (0 == intensity)
+            {
+                return false;
+            }
+
+            const NumericType visibility = getVisibility(sceneGraph, intersectionPoint);
+
+            if (0 == visibility)
+            {
+                return false;
+            }
+
+            intensity *= visibility;
+
+            return true;
+        }
+
+        //
+        // Fraction of light not blocked by shadows, 0 or 1 for hard shadow
+        //
+        NumericType getVisibility(SceneGraphType &sceneGraph, const IntersectionPointType &intersectionPoint)
+        {
+            if (!mShadow)
+            {
+                return 1;
+            }
+
+            if (0 == mSoftShadowWidth)
+            {
+                return (dropShadow(sceneGraph, mPosition, intersectionPoint) ? NumericType(0) : NumericType(1));
+            }
+
+            return NumericType(1 - softShadow(sceneGraph, intersectionPoint));
+        }
+
+        //
+        // Light reaching intersection point, when it is not shadowed
+        //
+        ColorType evaluate(const RayType &ray, const IntersectionPointType &intersectionPoint) const
+        {
+            const NumericType intensity = getAttenuation(intersectionPoint.position);
+
+            return processPointLight(
+                    mPosition,
+                    intersectionPoint.position,
+                    intersectionPoint.normal,
+                    ray.direction,
+                    mDiffuseColor * intensity,
+                    mSpecularColor * intensity,
+                    mDiffuseFalloff,
+                    mSpecularFalloff);
         }
 
         bool dropShadow(SceneGraphType &sceneGraph, const GAL::P3d &lightPosition, const IntersectionPointType &intersectionPoint)
@@ -115,11 +383,14 @@ template<class _NumericType>
                 return false;
             }
 
-            PointType distVect = (lightIntersectionPoint.position - intersectionPoint.position);
-
-            return (0.00001 < distVect.Sqr().Sum());
+            return ShadowPacketType::occludes(lightPosition, intersectionPoint.position, lightIntersectionPoint.position);
         }
 
+        //
+        // Rays from 3 x 3 points of light are traced as packet (see
+        // ShadowPacket), which is classified as not occluded or fully
+        // occluded without tracing them one by one, if possible
+        //
         double softShadow(SceneGraphType &sceneGraph, const IntersectionPointType &intersectionPoint)
         {
             NumericType shadowCoverage = 0.0;
@@ -131,6 +402,30 @@ template<class _NumericType>
             PointType lightX = GAL::Orthogonal(lightZ);
             PointType lightY = GAL::Cross(lightZ, lightX);
 
+            ShadowPacketType packet(intersectionPoint, mPosition, lightX * mSoftShadowWidth, lightY * mSoftShadowWidth);
+            sceneGraph.collectGeometries(packet);
+
+            if (!packet.isOverflow())
+            {
+                if (0 == packet.getNumGeometries())
+                {
+                    return 0;
+                }
+
+                if (packet.isFullyOccluded())
+                {
+                    for (int iy = 0; iy < 3; ++iy)
+                    {
+                        for (int ix = 0; ix < 3; ++ix)
+                        {
+                            shadowCoverage += mSoftShadowCoeff[ix][iy];
+                        }
+                    }
+
+                    return shadowCoverage;
+                }
+            }
+
             GAL::P3d tmpLightPosition;
 
             for (int iy = 0; iy < 3; ++iy)
@@ -142,7 +437,11 @@ template<class _NumericType>
                     
                     tmpLightPosition = mPosition + lightX * a + lightY * b;
 
-                    if (dropShadow(sceneGraph, tmpLightPosition, intersectionPoint))
+                    const bool occluded = (packet.isOverflow() ?
+                        dropShadow(sceneGraph, tmpLightPosition, intersectionPoint) :
+                        packet.isOccluded(tmpLightPosition));
+
+                    if (occluded)
                     {
                         shadowCoverage += mSoftShadowCoeff[ix][iy];
                     }
@@ -159,6 +458,10 @@ template<class _NumericType>
         bool            mShadow;
         NumericType     mSoftShadowWidth;
         NumericType     mSoftShadowCoeff[3][3];
+        NumericType     mRange;
+        FalloffTableType    mDiffuseFalloff;
+        FalloffTableType    mSpecularFalloff;
+        std::vector<ListenerType*> mListeners;
 
         //
         // FIXME: Change to use NumericType
@@ -170,10 +473,8 @@ template<class _NumericType>
 				 const PointType &rayDirNormalized,
 				 const PointType &diffuseColor,
 				 const PointType &specularColor,
-				 NumericType diffuseWidth,
-				 NumericType diffuseSharpness,
-				 NumericType specularWidth,
-				 NumericType specularSharpness)
+				 const FalloffTableType &diffuseFalloff,
+				 const FalloffTableType &specularFalloff)
         {
 
             // Light direction as intersection point
@@ -183,17 +484,15 @@ template<class _NumericType>
             NumericType sqrLightDistance = GAL::Dot(lightDir, lightDir);
 
             // Normalize lightDir and rayDir
-            PointType lightDirNormal = lightDir / sqrt(sqrLightDistance);
+            PointType lightDirNormal = lightDir * GAL::DefaultMath::RSqrt(sqrLightDistance);
 
             NumericType diffuseCos = GAL::Dot(lightDirNormal, intersectionNormal);
-            NumericType diffuseAngle = acos(diffuseCos);
-            NumericType diffuseLight = 1 / (pow(diffuseWidth*diffuseAngle, diffuseSharpness) + 1);
+            NumericType diffuseLight = diffuseFalloff(diffuseCos);
 
             PointType reflectedRayDir = GAL::Reflect(intersectionNormal, rayDirNormalized);
 
             NumericType specularCos = GAL::Dot(lightDirNormal, reflectedRayDir);
-            NumericType specularAngle = acos(specularCos);
-            NumericType specularLight = 1 / (pow(specularWidth*specularAngle, specularSharpness) + 1);
+            NumericType specularLight = specularFalloff(specularCos);
 
             return GAL_imp::P4_<NumericType>(
                     (diffuseColor.x[0] * diffuseLight) + (specularColor.x[0] * specularLight),
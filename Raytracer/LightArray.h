@@ -0,0 +1,153 @@
+#ifndef INCLUDED_LIGHT_ARRAY_H
+#define INCLUDED_LIGHT_ARRAY_H
+
+#include <vector>
+
+#include "Linear.h"
+#include "FastMath.h"
+#include "Light.h"
+
+//
+// Parameters of lights in structure of arrays form, shaded in batches
+//
+// Position, colors and falloff tables of lights are copied from Light
+// objects, so that array has to be assigned again after they are changed.
+// Batch of up to Width consecutive lights is shaded at once: light
+// directions and cosines are calculated for all lanes by plain loops over
+// the arrays, which compiler may vectorize, as no intrinsics are used,
+// falloff tables are looked up for each lane, and colors are added for
+// lanes set in mask of lights, which reach shading point (see
+// Light::getIntensity()).
+//
+template<class _NumericType>
+    class LightArray
+    {
+    public:
+        typedef _NumericType                        NumericType;
+        typedef GAL_imp::Point<NumericType,3>       PointType;
+        typedef GAL_imp::Point<NumericType,4>       ColorType;
+        typedef Light<NumericType>                  LightType;
+        typedef typename LightType::FalloffTableType FalloffTableType;
+
+        enum
+        {
+            Width = 8
+        };
+
+        typedef unsigned int MaskType;  // bit of each lane
+
+        void resize(size_t count)
+        {
+            mPositionX.resize(count);
+            mPositionY.resize(count);
+            mPositionZ.resize(count);
+            mDiffuseR.resize(count);
+            mDiffuseG.resize(count);
+            mDiffuseB.resize(count);
+            mSpecularR.resize(count);
+            mSpecularG.resize(count);
+            mSpecularB.resize(count);
+            mDiffuseFalloff.resize(count);
+            mSpecularFalloff.resize(count);
+        }
+
+        size_t size() const
+        {
+            return mPositionX.size();
+        }
+
+        void assign(size_t index, const LightType &light)
+        {
+            mPositionX[index] = light.getPosition()[0];
+            mPositionY[index] = light.getPosition()[1];
+            mPositionZ[index] = light.getPosition()[2];
+            mDiffuseR[index] = light.getDiffuseColor()[0];
+            mDiffuseG[index] = light.getDiffuseColor()[1];
+            mDiffuseB[index] = light.getDiffuseColor()[2];
+            mSpecularR[index] = light.getSpecularColor()[0];
+            mSpecularG[index] = light.getSpecularColor()[1];
+            mSpecularB[index] = light.getSpecularColor()[2];
+            mDiffuseFalloff[index] = &light.getDiffuseFalloff();
+            mSpecularFalloff[index] = &light.getSpecularFalloff();
+        }
+
+        //
+        // Add light of lights [begin, begin + count), count <= Width, to
+        // color. Lane i is added only if bit i of mask is set, scaled by
+        // intensity[i]. Normal and ray direction should be of unit length.
+        //
+        // Same as Light::illuminate() for each light, but shadows.
+        //
+        void shade(
+            size_t              begin,
+            size_t              count,
+            MaskType            mask,
+            const NumericType  *intensity,
+            const PointType    &position,
+            const PointType    &normal,
+            const PointType    &rayDirection,
+            ColorType          &color) const
+        {
+            const PointType reflected = GAL::Reflect(normal, rayDirection);
+
+            const NumericType *px = &mPositionX[begin];
+            const NumericType *py = &mPositionY[begin];
+            const NumericType *pz = &mPositionZ[begin];
+
+            NumericType diffuseCos[Width];
+            NumericType specularCos[Width];
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                const NumericType dx = px[i] - position[0];
+                const NumericType dy = py[i] - position[1];
+                const NumericType dz = pz[i] - position[2];
+                const NumericType scale = GAL::DefaultMath::RSqrt(dx * dx + dy * dy + dz * dz);
+
+                const NumericType nx = dx * scale, ny = dy * scale, nz = dz * scale;
+
+                diffuseCos[i] = nx * normal[0] + ny * normal[1] + nz * normal[2];
+                specularCos[i] = nx * reflected[0] + ny * reflected[1] + nz * reflected[2];
+            }
+
+            NumericType diffuseLight[Width];
+            NumericType specularLight[Width];
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                diffuseLight[i] = (*mDiffuseFalloff[begin + i])(diffuseCos[i]);
+                specularLight[i] = (*mSpecularFalloff[begin + i])(specularCos[i]);
+            }
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (0 == (mask & (MaskType(1) << i)))
+                {
+                    continue;
+                }
+
+                const size_t j = begin + i;
+
+                color += GAL_imp::P4_<NumericType>(
+                        (mDiffuseR[j] * intensity[i]) * diffuseLight[i] + (mSpecularR[j] * intensity[i]) * specularLight[i],
+                        (mDiffuseG[j] * intensity[i]) * diffuseLight[i] + (mSpecularG[j] * intensity[i]) * specularLight[i],
+                        (mDiffuseB[j] * intensity[i]) * diffuseLight[i] + (mSpecularB[j] * intensity[i]) * specularLight[i],
+                        1);
+            }
+        }
+
+    private:
+        std::vector<NumericType>                mPositionX;
+        std::vector<NumericType>                mPositionY;
+        std::vector<NumericType>                mPositionZ;
+        std::vector<NumericType>                mDiffuseR;
+        std::vector<NumericType>                mDiffuseG;
+        std::vector<NumericType>                mDiffuseB;
+        std::vector<NumericType>                mSpecularR;
+        std::vector<NumericType>                mSpecularG;
+        std::vector<NumericType>                mSpecularB;
+        std::vector<const FalloffTableType*>    mDiffuseFalloff;
+        std::vector<const FalloffTableType*>    mSpecularFalloff;
+    };
+
+#endif
@@ -0,0 +1,501 @@
+#ifndef INCLUDED_LIGHT_BVH_H
+#define INCLUDED_LIGHT_BVH_H
+
+#include <map>
+#include <vector>
+#include <memory>
+#include <string.h>
+
+#include "MinMax.h"
+#include "AABBox.h"
+#include "BVH.h"
+#include "IntersectionPoint.h"
+#include "Light.h"
+#include "LightArray.h"
+
+namespace LightBVH_imp {
+
+    //
+    // Random numbers for light selection at one shading point, seeded by
+    // hash of its position, so that threads need no shared state and image
+    // does not change between runs
+    //
+    class RandomSequence
+    {
+    public:
+        template<class N>
+            explicit RandomSequence(const GAL_imp::Point<N,3> &position): mState(2166136261U)
+            {
+                unsigned char bytes[3 * sizeof(N)];
+                memcpy(bytes, &position[0], sizeof(N));
+                memcpy(bytes + sizeof(N), &position[1], sizeof(N));
+                memcpy(bytes + 2 * sizeof(N), &position[2], sizeof(N));
+
+                for (size_t i = 0; i != sizeof(bytes); ++i)
+                {
+                    mState = (mState ^ bytes[i]) * 16777619U;
+                }
+
+                mState |= 1;
+            }
+
+        //
+        // Uniform in [0, 1)
+        //
+        template<class N>
+            N next()
+            {
+                mState ^= mState << 13;
+                mState ^= mState >> 17;
+                mState ^= mState << 5;
+
+                return N(mState >> 8) * N(1.0 / (1 << 24));
+            }
+
+    private:
+        unsigned int mState;
+    };
+
+} // namespace LightBVH_imp
+
+//
+// Lights of scene graph with hierarchy over their ranges
+//
+// Lights with range (see Light::setRange()) are put to hierarchy over boxes
+// of their ranges, and only those, whose range contains shading point, are
+// visited, so that cost of shading does not grow with number of lights,
+// which are far away. Lights without range are visited always.
+//
+// Parameters of lights are kept also in LightArray, in order in which
+// leaves reference them, so that lights visited together are shaded in
+// batches.
+//
+// Lights notify hierarchy when they change (see LightListener). New colors
+// are copied to the array at once. When light is added, moved or its range
+// is changed, hierarchy is marked as stale, and all lights are visited
+// until update() rebuilds it, so that changes take effect immediately,
+// and cost of rebuild is paid once per update.
+//
+// Light, whose contribution without shadow is at most cutoff, is skipped
+// before its shadow rays are traced.
+//
+// If number of samples is set, and more lights than that reach shading
+// point, only that many lights are chosen at random with probability
+// proportional to their contribution without shadow, and are weighted by
+// inverse of that probability, so that expected result is the same as of
+// all lights. Each sample is chosen by its own weighted reservoir in one
+// pass over lights, so that lights need not be stored.
+//
+template<class _NumericType>
+    class LightBVH : public LightListener<_NumericType>
+    {
+    public:
+        typedef _NumericType                        NumericType;
+        typedef GAL_imp::Point<NumericType,3>       PointType;
+        typedef GAL_imp::Point<NumericType,4>       ColorType;
+        typedef GAL_imp::Ray<NumericType,3>         RayType;
+        typedef IntersectionPoint<NumericType,3>    IntersectionPointType;
+        typedef Light<NumericType>                  LightType;
+        typedef std::shared_ptr<LightType>          LightPtr;
+        typedef SceneGraph<NumericType>             SceneGraphType;
+        typedef AABBox<NumericType>                 AABBoxType;
+        typedef BVH<NumericType>                    BVHType;
+        typedef LightArray<NumericType>             LightArrayType;
+
+        enum
+        {
+            MaxSamples = 8
+        };
+
+        LightBVH(): mNumUnboundedLights(0), mStale(false), mCutoff(0), mNumSamples(0)
+        {
+        }
+
+        ~LightBVH()
+        {
+            for (size_t i = 0; i != mLights.size(); ++i)
+            {
+                mLights[i]->removeListener(this);
+            }
+        }
+
+        void addLight(const LightPtr &light)
+        {
+            mIndexOf[light.get()] = mLights.size();
+            mLights.push_back(light);
+
+            mArray.resize(mLights.size());
+            mArray.assign(mLights.size() - 1, *light);
+
+            light->addListener(this);
+            mStale = true;
+        }
+
+        //
+        // Rebuild hierarchy, if lights were added, moved or their range
+        // was changed since last update
+        //
+        void update()
+        {
+            if (!mStale)
+            {
+                return;
+            }
+
+            std::vector<LightPtr> lights;
+            std::vector<LightPtr> bounded;
+            std::vector<AABBoxType> bounds;
+
+            lights.swap(mLights);
+
+            for (typename std::vector<LightPtr>::const_iterator it = lights.begin(); it != lights.end(); ++it)
+            {
+                const NumericType range = (*it)->getRange();
+
+                if (0 == range)
+                {
+                    mLights.push_back(*it);
+                    continue;
+                }
+
+                const PointType &position = (*it)->getPosition();
+
+                AABBoxType box;
+                box.xMin = position[0] - range; box.xMax = position[0] + range;
+                box.yMin = position[1] - range; box.yMax = position[1] + range;
+                box.zMin = position[2] - range; box.zMax = position[2] + range;
+
+                bounds.push_back(box);
+                bounded.push_back(*it);
+            }
+
+            mBVH.build(bounds.empty() ? 0 : &bounds[0], bounds.size());
+
+            // Lights with range follow in order of leaves
+            mNumUnboundedLights = mLights.size();
+
+            for (size_t i = 0; i != bounded.size(); ++i)
+            {
+                mLights.push_back(bounded[mBVH.getIndices()[i]]);
+            }
+
+            for (size_t i = 0; i != mLights.size(); ++i)
+            {
+                mIndexOf[mLights[i].get()] = i;
+                mArray.assign(i, *mLights[i]);
+            }
+
+            mStale = false;
+        }
+
+        void lightMoved(LightType &light)
+        {
+            if (assignLight(light))
+            {
+                mStale = true;
+            }
+        }
+
+        void lightColorChanged(LightType &light)
+        {
+            assignLight(light);
+        }
+
+        size_t getNumLights() const
+        {
+            return mLights.size();
+        }
+
+        void setCutoff(NumericType cutoff)
+        {
+            mCutoff = cutoff;
+        }
+
+        NumericType getCutoff() const
+        {
+            return mCutoff;
+        }
+
+        //
+        // Number of lights chosen at each shading point, 0 (default) to use
+        // all lights. At most MaxSamples.
+        //
+        void setNumSamples(size_t numSamples)
+        {
+            mNumSamples = Min(numSamples, size_t(MaxSamples));
+        }
+
+        size_t getNumSamples() const
+        {
+            return mNumSamples;
+        }
+
+        ColorType shade(SceneGraphType &sceneGraph, RayType &ray, IntersectionPointType &intersectionPoint) const
+        {
+            if (mLights.empty())
+            {
+                return ColorType();
+            }
+
+            if (0 == mCutoff && 0 == mNumSamples)
+            {
+                AllLights visitor;
+                visitor.lights = &mLights[0];
+                visitor.array = &mArray;
+                visitor.sceneGraph = &sceneGraph;
+                visitor.ray = &ray;
+                visitor.intersectionPoint = &intersectionPoint;
+
+                visitLights(intersectionPoint.position, visitor);
+
+                return visitor.color;
+            }
+
+            SampledLights visitor(mCutoff, mNumSamples, intersectionPoint.position);
+            visitor.lights = &mLights[0];
+            visitor.sceneGraph = &sceneGraph;
+            visitor.ray = &ray;
+            visitor.intersectionPoint = &intersectionPoint;
+
+            visitLights(intersectionPoint.position, visitor);
+            visitor.shadeChosen();
+
+            return visitor.color;
+        }
+
+    private:
+        std::vector<LightPtr>   mLights;                // without range first, then in order of leaves
+        size_t                  mNumUnboundedLights;
+        std::map<const LightType*, size_t>  mIndexOf;   // in mLights
+        LightArrayType          mArray;                 // parameters of mLights
+        BVHType                 mBVH;
+        bool                    mStale;                 // hierarchy does not match lights
+        NumericType             mCutoff;
+        size_t                  mNumSamples;
+
+        //
+        // Copy parameters of light to array, returns false for light,
+        // which is not in hierarchy
+        //
+        bool assignLight(const LightType &light)
+        {
+            typename std::map<const LightType*, size_t>::const_iterator it = mIndexOf.find(&light);
+
+            if (mIndexOf.end() == it)
+            {
+                return false;
+            }
+
+            mArray.assign(it->second, light);
+            return true;
+        }
+
+        //
+        // Shade by all lights reaching point in batches, where shadows of
+        // lights give mask of lanes
+        //
+        struct AllLights
+        {
+            const LightPtr         *lights;
+            const LightArrayType   *array;
+            SceneGraphType         *sceneGraph;
+            RayType                *ray;
+            IntersectionPointType  *intersectionPoint;
+            ColorType               color;
+
+            void operator () (size_t begin, size_t end)
+            {
+                typedef typename LightArrayType::MaskType MaskType;
+
+                for (; begin < end; begin += LightArrayType::Width)
+                {
+                    const size_t count = Min(end - begin, size_t(LightArrayType::Width));
+
+                    NumericType intensity[LightArrayType::Width];
+                    MaskType mask = 0;
+
+                    for (size_t i = 0; i != count; ++i)
+                    {
+                        if (lights[begin + i]->getIntensity(*sceneGraph, *intersectionPoint, intensity[i]))
+                        {
+                            mask |= MaskType(1) << i;
+                        }
+                    }
+
+                    if (0 != mask)
+                    {
+                        array->shade(begin, count, mask, intensity,
+                            intersectionPoint->position, intersectionPoint->normal, ray->direction, color);
+                    }
+                }
+            }
+        };
+
+        //
+        // Shade by lights above cutoff, or by samples of them
+        //
+        struct SampledLights
+        {
+            const LightPtr                 *lights;
+            SceneGraphType                 *sceneGraph;
+            RayType                        *ray;
+            IntersectionPointType          *intersectionPoint;
+            ColorType                       color;
+            NumericType                     cutoff;
+            size_t                          numSamples;
+            size_t                          numLights;      // above cutoff
+            NumericType                     totalEstimate;
+            LightBVH_imp::RandomSequence    random;
+            LightType                      *first[MaxSamples];      // used if there are at most numSamples lights
+            ColorType                       firstColor[MaxSamples];
+            LightType                      *chosen[MaxSamples];     // reservoirs
+            ColorType                       chosenColor[MaxSamples];
+            NumericType                     chosenEstimate[MaxSamples];
+
+            SampledLights(NumericType _cutoff, size_t _numSamples, const PointType &position):
+                cutoff(_cutoff),
+                numSamples(_numSamples),
+                numLights(0),
+                totalEstimate(0),
+                random(position)
+            {
+            }
+
+            void operator () (size_t begin, size_t end)
+            {
+                for (size_t i = begin; i != end; ++i)
+                {
+                    visit(lights[i].get());
+                }
+            }
+
+            //
+            // Unshadowed light is evaluated once, to estimate it and to shade
+            // by it, when it is chosen, after shadow test
+            //
+            void visit(LightType *light)
+            {
+                const ColorType c = light->evaluate(*ray, *intersectionPoint);
+                const NumericType estimate = Max(Max(c[0], c[1]), c[2]);
+
+                if (estimate <= cutoff)
+                {
+                    return;
+                }
+
+                if (0 == numSamples)
+                {
+                    color += c * light->getVisibility(*sceneGraph, *intersectionPoint);
+                    return;
+                }
+
+                if (numLights < numSamples)
+                {
+                    first[numLights] = light;
+                    firstColor[numLights] = c;
+                }
+
+                ++numLights;
+                totalEstimate += estimate;
+
+                for (size_t i = 0; i != numSamples; ++i)
+                {
+                    if (random.template next<NumericType>() * totalEstimate < estimate)
+                    {
+                        chosen[i] = light;
+                        chosenColor[i] = c;
+                        chosenEstimate[i] = estimate;
+                    }
+                }
+            }
+
+            //
+            // Shade by lights chosen after all were visited
+            //
+            void shadeChosen()
+            {
+                if (numLights <= numSamples)
+                {
+                    for (size_t i = 0; i != numLights; ++i)
+                    {
+                        color += firstColor[i] * first[i]->getVisibility(*sceneGraph, *intersectionPoint);
+                    }
+
+                    return;
+                }
+
+                // Light was chosen with probability estimate / totalEstimate
+                for (size_t i = 0; i != numSamples; ++i)
+                {
+                    const NumericType weight = totalEstimate / (chosenEstimate[i] * numSamples);
+
+                    color += chosenColor[i] * (chosen[i]->getVisibility(*sceneGraph, *intersectionPoint) * weight);
+                }
+            }
+        };
+
+        //
+        // Call visitor(begin, end) for ranges of mLights, whose range
+        // contains position
+        //
+        template<class Visitor>
+            void visitLights(const PointType &position, Visitor &visitor) const
+            {
+                if (mStale)
+                {
+                    // Lights out of range are skipped by visitor
+                    visitor(0, mLights.size());
+                    return;
+                }
+
+                if (0 != mNumUnboundedLights)
+                {
+                    visitor(0, mNumUnboundedLights);
+                }
+
+                if (mBVH.isEmpty())
+                {
+                    return;
+                }
+
+                size_t stack[BVHType::MaxDepth + 1];
+                size_t stackSize = 0;
+
+                stack[stackSize++] = 0;
+
+                while (0 != stackSize)
+                {
+                    const size_t index = stack[--stackSize];
+
+                    if (!containsPoint(mBVH.getNodeBounds(index), position))
+                    {
+                        continue;
+                    }
+
+                    if (mBVH.isLeafNode(index))
+                    {
+                        size_t begin, end;
+                        mBVH.getLeafRange(index, begin, end);
+
+                        visitor(mNumUnboundedLights + begin, mNumUnboundedLights + end);
+                    }
+                    else
+                    {
+                        stack[stackSize++] = mBVH.getRightChild(index);
+                        stack[stackSize++] = index + 1;
+                    }
+                }
+            }
+
+        static bool containsPoint(const AABBoxType &box, const PointType &p)
+        {
+            return (box.xMin <= p[0] && p[0] <= box.xMax &&
+                    box.yMin <= p[1] && p[1] <= box.yMax &&
+                    box.zMin <= p[2] && p[2] <= box.zMax);
+        }
+
+        LightBVH(const LightBVH &);
+        LightBVH &operator = (const LightBVH &);
+    };
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef INCLUDED_MAPPED_FILE_H
+#define INCLUDED_MAPPED_FILE_H
+
+#include <cstddef>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//
+// File mapped read-only into memory
+//
+// Pages are loaded on first access and shared through page cache by all
+// processes mapping the same file.
+//
+class MappedFile
+{
+public:
+    MappedFile(): mData(0), mSize(0)
+    {
+    }
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    //
+    // Map whole file, returns false if it cannot be opened or is empty
+    //
+    bool open(const char *path)
+    {
+        close();
+
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+
+        if (INVALID_HANDLE_VALUE == file)
+        {
+            return false;
+        }
+
+        LARGE_INTEGER size;
+
+        if (!GetFileSizeEx(file, &size) || 0 == size.QuadPart)
+        {
+            CloseHandle(file);
+            return false;
+        }
+
+        HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+        CloseHandle(file);
+
+        if (0 == mapping)
+        {
+            return false;
+        }
+
+        // View keeps mapping alive
+        mData = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+
+        if (0 == mData)
+        {
+            return false;
+        }
+
+        mSize = size_t(size.QuadPart);
+#else
+        int file = ::open(path, O_RDONLY);
+
+        if (-1 == file)
+        {
+            return false;
+        }
+
+        struct stat status;
+
+        if (0 != fstat(file, &status) || 0 == status.st_size)
+        {
+            ::close(file);
+            return false;
+        }
+
+        void *data = mmap(0, size_t(status.st_size), PROT_READ, MAP_SHARED, file, 0);
+        ::close(file);
+
+        if (MAP_FAILED == data)
+        {
+            return false;
+        }
+
+        mData = data;
+        mSize = size_t(status.st_size);
+#endif
+
+        return true;
+    }
+
+    void close()
+    {
+        if (0 == mData)
+        {
+            return;
+        }
+
+#ifdef _WIN32
+        UnmapViewOfFile(mData);
+#else
+        munmap(mData, mSize);
+#endif
+
+        mData = 0;
+        mSize = 0;
+    }
+
+    bool isOpen() const
+    {
+        return (0 != mData);
+    }
+
+    const char * getData() const
+    {
+        return static_cast<const char *>(mData);
+    }
+
+    size_t getSize() const
+    {
+        return mSize;
+    }
+
+private:
+    void   *mData;
+    size_t  mSize;
+
+    MappedFile(const MappedFile &);
+    MappedFile &operator = (const MappedFile &);
+};
+
+#endif
@@ -2,11 +2,15 @@
 #define INCLUDED_MESH_H
 
 #include <vector>
+#include <memory>
 #include "VertexTraits.h"
 
 //
 // Mesh made of vertices and indices
 //
+// Mesh either owns its vertices and indices, or it is read-only view of
+// external ones (see setView()).
+//
 template<class _VertexType, class _IndexType = int>
     class Mesh
     {
@@ -18,42 +22,60 @@ template<class _VertexType, class _IndexType = int>
         typedef PointTraits<PointType>              AbstractPoint;
         typedef typename AbstractPoint::NumericType NumericType;
 
-        Mesh()
+        Mesh(): mIsView(false), mVertexView(0), mIndexView(0), mNumViewVertices(0), mNumViewIndices(0)
         {
         }
 
         void addVertex(const VertexType &v)
         {
+            detach();
             mVertices.push_back(v);
         }
 
         void addIndex(const IndexType &i)
         {
+            detach();
             mIndices.push_back(i);
         }
 
         const VertexType * getVertexPointer() const
         {
+            return (mIsView ? mVertexView : &mVertices[0]);
+        }
+
+        //
+        // Pointer for modification of vertices
+        //
+        VertexType * getWritableVertexPointer()
+        {
+            detach();
             return &mVertices[0];
         }
 
         const IndexType * getIndexPointer() const
         {
+            return (mIsView ? mIndexView : &mIndices[0]);
+        }
+
+        IndexType * getWritableIndexPointer()
+        {
+            detach();
             return &mIndices[0];
         }
 
         size_t getNumVertices() const
         {
-            return mVertices.size();
+            return (mIsView ? mNumViewVertices : mVertices.size());
         }
 
         size_t getNumIndices() const
         {
-            return mIndices.size();
+            return (mIsView ? mNumViewIndices : mIndices.size());
         }
 
         void addVertices(VertexType *pointer, size_t number)
         {
+            detach();
             mVertices.reserve(mVertices.size() + number);
 
             for (size_t i = 0; i != number; ++i)
@@ -64,6 +86,7 @@ template<class _VertexType, class _IndexType = int>
 
         void addIndices(IndexType *pointer, size_t number)
         {
+            detach();
             mIndices.reserve(mIndices.size() + number);
 
             for (size_t i = 0; i != number; ++i)
@@ -72,9 +95,90 @@ template<class _VertexType, class _IndexType = int>
             }
         }
 
+        //
+        // Set number of vertices and indices, e.g. to fill them in parallel
+        // through writable pointers
+        //
+        void resize(size_t numVertices, size_t numIndices)
+        {
+            detach();
+            mVertices.resize(numVertices);
+            mIndices.resize(numIndices);
+        }
+
+        //
+        // Remove all vertices and indices, and release their memory
+        //
+        void clear()
+        {
+            std::vector<VertexType>().swap(mVertices);
+            std::vector<IndexType>().swap(mIndices);
+            resetView();
+        }
+
+        //
+        // Use external vertices and indices without copying them (e.g. from
+        // mapped file, see MeshFile). Owner keeps their memory alive as long
+        // as mesh refers to it.
+        //
+        // View is read-only: it is copied into mesh on first modification,
+        // or when writable pointer is requested.
+        //
+        void setView(
+            const VertexType                   *vertices,
+            size_t                              numVertices,
+            const IndexType                    *indices,
+            size_t                              numIndices,
+            const std::shared_ptr<const void>  &owner)
+        {
+            clear();
+
+            mIsView = true;
+            mVertexView = vertices;
+            mIndexView = indices;
+            mNumViewVertices = numVertices;
+            mNumViewIndices = numIndices;
+            mViewOwner = owner;
+        }
+
+        bool isView() const
+        {
+            return mIsView;
+        }
+
     private:
         std::vector<VertexType>  mVertices;
         std::vector<IndexType>   mIndices;
+
+        bool                        mIsView;
+        const VertexType           *mVertexView;
+        const IndexType            *mIndexView;
+        size_t                      mNumViewVertices;
+        size_t                      mNumViewIndices;
+        std::shared_ptr<const void> mViewOwner;
+
+        void detach()
+        {
+            if (!mIsView)
+            {
+                return;
+            }
+
+            mVertices.assign(mVertexView, mVertexView + mNumViewVertices);
+            mIndices.assign(mIndexView, mIndexView + mNumViewIndices);
+
+            resetView();
+        }
+
+        void resetView()
+        {
+            mIsView = false;
+            mVertexView = 0;
+            mIndexView = 0;
+            mNumViewVertices = 0;
+            mNumViewIndices = 0;
+            mViewOwner.reset();
+        }
     };
 
     typedef Mesh<GAL::P3f::PointType, short> Mesh3f;
@@ -0,0 +1,206 @@
+#ifndef INCLUDED_MESH_CACHE_H
+#define INCLUDED_MESH_CACHE_H
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Mesh.h"
+#include "BVH.h"
+#include "BoundingSphere.h"
+#include "MeshFile.h"
+#include "Parallel.h"
+
+//
+// Cache of meshes with their hierarchies on disk
+//
+// Entries are mesh files (see MeshFile) named by hash of content of source
+// mesh, i.e. of its vertices and indices before anything was derived from
+// them, mixed with a seed of options, which change what is derived. Mesh,
+// whose entry exists, is mapped from it together with its hierarchy and
+// bounds instead of being rebuilt, so that its loading is bound by I/O.
+//
+// Hash is stored also in header of entry, and is checked when entry is
+// opened.
+//
+class MeshCache
+{
+public:
+    MeshCache()
+    {
+    }
+
+    //
+    // Directory of entries, which has to exist. Cache is disabled while
+    // directory is empty.
+    //
+    void setDirectory(const std::string &directory)
+    {
+        mDirectory = directory;
+    }
+
+    const std::string & getDirectory() const
+    {
+        return mDirectory;
+    }
+
+    bool isEnabled() const
+    {
+        return !mDirectory.empty();
+    }
+
+    //
+    // Hash of vertices and indices of mesh
+    //
+    // FNV-1a is applied to 64-bit words instead of bytes, with high half of
+    // hash folded into low one after each word, as multiplication alone
+    // does not carry high bits of word to low bits of hash. Blocks of
+    // BlockSize bytes are hashed in parallel and their hashes are hashed
+    // again, so that result does not depend on number of threads.
+    //
+    template<class MeshType>
+        static unsigned long long hash(const MeshType &mesh, unsigned long long seed)
+        {
+            typedef typename MeshType::VertexType   VertexType;
+            typedef typename MeshType::IndexType    IndexType;
+
+            const unsigned long long header[] =
+            {
+                seed, sizeof(VertexType), sizeof(IndexType), mesh.getNumVertices(), mesh.getNumIndices()
+            };
+
+            unsigned long long result = hashBytes(header, sizeof(header), OffsetBasis);
+
+            result = hashBlocks(mesh.getVertexPointer(), mesh.getNumVertices() * sizeof(VertexType), result);
+            result = hashBlocks(mesh.getIndexPointer(), mesh.getNumIndices() * sizeof(IndexType), result);
+
+            // 0 marks mesh files without hash
+            return (0 != result ? result : 1);
+        }
+
+    //
+    // Path of entry for hash
+    //
+    std::string getPath(unsigned long long key) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.rtmf", key);
+
+        std::string path = mDirectory;
+
+        if ('/' != path[path.size() - 1] && '\\' != path[path.size() - 1])
+        {
+            path += '/';
+        }
+
+        return path + name;
+    }
+
+    //
+    // Map entry, returns false if there is none, or it is not of given hash
+    //
+    bool open(unsigned long long key, MeshFile &file) const
+    {
+        return (isEnabled() && file.open(getPath(key).c_str()) && key == file.getHeader()->contentHash);
+    }
+
+    //
+    // Write entry of mesh with its hierarchy and bounds
+    //
+    // Entry is written under temporary name, and then renamed, so that
+    // processes sharing the cache never map partially written entry.
+    // Returns false if cache is disabled, or entry cannot be written.
+    //
+    template<class MeshType, class NumericType>
+        bool store(unsigned long long key, const MeshType &mesh, const BVH<NumericType> &bvh, const BoundingSphere<NumericType> &bounds) const
+        {
+            if (!isEnabled())
+            {
+                return false;
+            }
+
+            const std::string path = getPath(key);
+
+            char suffix[64];
+            snprintf(suffix, sizeof(suffix), ".%llx.tmp",
+                (unsigned long long)std::chrono::steady_clock::now().time_since_epoch().count() ^ (unsigned long long)std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+            const std::string temporary = path + suffix;
+
+            if (!MeshFile::write(temporary.c_str(), mesh, &bvh, &bounds, key))
+            {
+                std::remove(temporary.c_str());
+                return false;
+            }
+
+            // Rename does not replace existing file on all platforms
+            std::remove(path.c_str());
+
+            if (0 != std::rename(temporary.c_str(), path.c_str()))
+            {
+                std::remove(temporary.c_str());
+                return false;
+            }
+
+            return true;
+        }
+
+private:
+    enum
+    {
+        BlockSize = 1 << 20
+    };
+
+    static const unsigned long long OffsetBasis = 0xcbf29ce484222325ULL;
+    static const unsigned long long Prime       = 0x100000001b3ULL;
+
+    std::string mDirectory;
+
+    static unsigned long long hashBytes(const void *data, size_t size, unsigned long long result)
+    {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        size_t i = 0;
+
+        for (; i + 8 <= size; i += 8)
+        {
+            unsigned long long word;
+            memcpy(&word, bytes + i, 8);
+
+            result = (result ^ word) * Prime;
+            result ^= result >> 32;
+        }
+
+        for (; i != size; ++i)
+        {
+            result = (result ^ bytes[i]) * Prime;
+        }
+
+        return result;
+    }
+
+    static unsigned long long hashBlocks(const void *data, size_t size, unsigned long long result)
+    {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        const size_t numBlocks = (size + BlockSize - 1) / BlockSize;
+
+        std::vector<unsigned long long> blocks(numBlocks);
+
+        ParallelFor(numBlocks, 1,
+            [bytes, size, &blocks](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i != end; ++i)
+                {
+                    const size_t offset = i * BlockSize;
+                    blocks[i] = hashBytes(bytes + offset, Min<size_t>(BlockSize, size - offset), OffsetBasis);
+                }
+            });
+
+        return hashBytes(blocks.empty() ? 0 : &blocks[0], numBlocks * sizeof(unsigned long long), result);
+    }
+};
+
+#endif
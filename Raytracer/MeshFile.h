@@ -0,0 +1,314 @@
+#ifndef INCLUDED_MESH_FILE_H
+#define INCLUDED_MESH_FILE_H
+
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#include "Mesh.h"
+#include "BVH.h"
+#include "BoundingSphere.h"
+#include "MappedFile.h"
+
+//
+// Header of binary mesh file
+//
+// File consists of header and sections of vertices, indices, and optionally
+// nodes and primitive ordering of hierarchy. Sections are stored in native
+// byte order and layout of their elements, and they are aligned to
+// MeshFile::Alignment bytes, so that they can be used directly from mapped
+// file.
+//
+// Header also keeps data, which would otherwise be calculated by reading
+// whole mesh or hierarchy: bounds of mesh and statistics of hierarchy.
+//
+struct MeshFileHeader
+{
+    char                magic[4];           // "RTMF"
+    unsigned int        version;
+    unsigned int        byteOrder;          // MeshFile::ByteOrder as written
+    unsigned int        numericSize;        // bytes per number
+    unsigned int        vertexSize;         // bytes per vertex
+    unsigned int        indexSize;          // bytes per index
+    unsigned int        nodeSize;           // bytes per node of hierarchy
+    unsigned int        reserved;
+    unsigned long long  numVertices;
+    unsigned long long  numIndices;
+    unsigned long long  numNodes;           // 0 if hierarchy is not stored
+    unsigned long long  vertexOffset;       // in bytes from start of file
+    unsigned long long  indexOffset;
+    unsigned long long  nodeOffset;
+    unsigned long long  primitiveOffset;    // one 64-bit index per triangle
+    unsigned long long  numLeaves;          // see BVHStats
+    unsigned long long  maxDepth;
+    unsigned long long  maxLeafSize;
+    double              sahCost;
+    double              buildTime;
+    double              boundsCenter[3];
+    double              boundsRadius;       // negative if bounds are not stored
+    unsigned long long  contentHash;        // of source mesh (see MeshCache), 0 if not set
+};
+
+//
+// Mesh file mapped into memory
+//
+// Mesh and hierarchy taken from file are read-only views of mapped
+// sections, so they are ready without parsing or copying, and memory of
+// the file is shared by all processes using it. Only primitive ordering of
+// hierarchy is copied, as it is kept in std::vector.
+//
+class MeshFile
+{
+public:
+    enum
+    {
+        Version     = 2,
+        ByteOrder   = 0x01020304,
+        Alignment   = 64
+    };
+
+    MeshFile(): mHeader(0)
+    {
+    }
+
+    //
+    // Map file and check its header, returns false if file cannot be mapped
+    // or it is not mesh file of this version and byte order
+    //
+    bool open(const char *path)
+    {
+        mHeader = 0;
+        mFile.reset(new MappedFile());
+
+        if (!mFile->open(path) || mFile->getSize() < sizeof(MeshFileHeader))
+        {
+            mFile.reset();
+            return false;
+        }
+
+        const MeshFileHeader *header = reinterpret_cast<const MeshFileHeader *>(mFile->getData());
+
+        if (0 != memcmp(header->magic, "RTMF", 4) || Version != header->version || ByteOrder != header->byteOrder
+            || !isInside(header->vertexOffset, header->numVertices * header->vertexSize)
+            || !isInside(header->indexOffset, header->numIndices * header->indexSize)
+            || !isInside(header->nodeOffset, header->numNodes * header->nodeSize)
+            || !isInside(header->primitiveOffset, (0 != header->numNodes ? header->numIndices / 3 * 8 : 0)))
+        {
+            mFile.reset();
+            return false;
+        }
+
+        mHeader = header;
+        return true;
+    }
+
+    bool isOpen() const
+    {
+        return (0 != mHeader);
+    }
+
+    const MeshFileHeader * getHeader() const
+    {
+        return mHeader;
+    }
+
+    //
+    // Make mesh view of vertices and indices in file, returns false if
+    // they are of different type than those of mesh
+    //
+    template<class MeshType>
+        bool getMesh(MeshType &mesh) const
+        {
+            typedef typename MeshType::VertexType   VertexType;
+            typedef typename MeshType::IndexType    IndexType;
+            typedef typename MeshType::NumericType  NumericType;
+
+            if (0 == mHeader || sizeof(NumericType) != mHeader->numericSize
+                || sizeof(VertexType) != mHeader->vertexSize || sizeof(IndexType) != mHeader->indexSize)
+            {
+                return false;
+            }
+
+            const char *data = mFile->getData();
+
+            mesh.setView(
+                reinterpret_cast<const VertexType *>(data + mHeader->vertexOffset), size_t(mHeader->numVertices),
+                reinterpret_cast<const IndexType *>(data + mHeader->indexOffset), size_t(mHeader->numIndices),
+                mFile);
+
+            return true;
+        }
+
+    //
+    // Make hierarchy view of nodes in file, returns false if there are none
+    //
+    template<class NumericType>
+        bool getBVH(BVH<NumericType> &bvh) const
+        {
+            typedef typename BVH<NumericType>::Node         Node;
+            typedef typename BVH<NumericType>::StatsType    StatsType;
+
+            if (0 == mHeader || 0 == mHeader->numNodes
+                || sizeof(NumericType) != mHeader->numericSize || sizeof(Node) != mHeader->nodeSize)
+            {
+                return false;
+            }
+
+            StatsType stats;
+            stats.buildTime = mHeader->buildTime;
+            stats.numNodes = size_t(mHeader->numNodes);
+            stats.numLeaves = size_t(mHeader->numLeaves);
+            stats.maxDepth = size_t(mHeader->maxDepth);
+            stats.maxLeafSize = size_t(mHeader->maxLeafSize);
+            stats.sahCost = NumericType(mHeader->sahCost);
+
+            const char *data = mFile->getData();
+
+            bvh.assign(
+                reinterpret_cast<const Node *>(data + mHeader->nodeOffset), size_t(mHeader->numNodes),
+                reinterpret_cast<const unsigned long long *>(data + mHeader->primitiveOffset), size_t(mHeader->numIndices / 3),
+                stats, mFile);
+
+            return true;
+        }
+
+    //
+    // Bounds of mesh, returns false if they are not stored
+    //
+    template<class NumericType>
+        bool getBounds(BoundingSphere<NumericType> &bounds) const
+        {
+            if (0 == mHeader || mHeader->boundsRadius < 0)
+            {
+                return false;
+            }
+
+            for (int i = 0; i != 3; ++i)
+            {
+                bounds.center[i] = NumericType(mHeader->boundsCenter[i]);
+            }
+
+            bounds.radius = NumericType(mHeader->boundsRadius);
+            return true;
+        }
+
+    //
+    // Write mesh, and its hierarchy and bounds unless they are null
+    //
+    template<class MeshType, class NumericType>
+        static bool write(
+            const char                         *path,
+            const MeshType                     &mesh,
+            const BVH<NumericType>             *bvh,
+            const BoundingSphere<NumericType>  *bounds,
+            unsigned long long                  contentHash = 0)
+        {
+            typedef typename MeshType::VertexType   VertexType;
+            typedef typename MeshType::IndexType    IndexType;
+            typedef typename BVH<NumericType>::Node Node;
+
+            const size_t numTriangles = mesh.getNumIndices() / 3;
+
+            if (0 != bvh && (bvh->isEmpty() || bvh->getIndices().size() != numTriangles))
+            {
+                bvh = 0;
+            }
+
+            MeshFileHeader header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, "RTMF", 4);
+
+            header.version = Version;
+            header.byteOrder = ByteOrder;
+            header.numericSize = sizeof(NumericType);
+            header.vertexSize = sizeof(VertexType);
+            header.indexSize = sizeof(IndexType);
+            header.nodeSize = sizeof(Node);
+            header.numVertices = mesh.getNumVertices();
+            header.numIndices = mesh.getNumIndices();
+            header.numNodes = (0 != bvh ? bvh->getNumNodes() : 0);
+            header.boundsRadius = -1;
+            header.contentHash = contentHash;
+
+            if (0 != bvh)
+            {
+                const typename BVH<NumericType>::StatsType &stats = bvh->getStats();
+
+                header.numLeaves = stats.numLeaves;
+                header.maxDepth = stats.maxDepth;
+                header.maxLeafSize = stats.maxLeafSize;
+                header.sahCost = double(stats.sahCost);
+                header.buildTime = stats.buildTime;
+            }
+
+            if (0 != bounds)
+            {
+                for (int i = 0; i != 3; ++i)
+                {
+                    header.boundsCenter[i] = double(bounds->center[i]);
+                }
+
+                header.boundsRadius = double(bounds->radius);
+            }
+
+            header.vertexOffset = align(sizeof(header));
+            header.indexOffset = align(header.vertexOffset + header.numVertices * sizeof(VertexType));
+            header.nodeOffset = align(header.indexOffset + header.numIndices * sizeof(IndexType));
+            header.primitiveOffset = align(header.nodeOffset + header.numNodes * sizeof(Node));
+
+            std::ofstream stream(path, std::ios::out | std::ios::binary | std::ios::trunc);
+
+            if (!stream)
+            {
+                return false;
+            }
+
+            unsigned long long position = 0;
+
+            writeSection(stream, position, 0, &header, sizeof(header));
+            writeSection(stream, position, header.vertexOffset, mesh.getVertexPointer(), size_t(header.numVertices * sizeof(VertexType)));
+            writeSection(stream, position, header.indexOffset, mesh.getIndexPointer(), size_t(header.numIndices * sizeof(IndexType)));
+
+            if (0 != bvh)
+            {
+                const std::vector<size_t> &indices = bvh->getIndices();
+                std::vector<unsigned long long> primitives(indices.begin(), indices.end());
+
+                writeSection(stream, position, header.nodeOffset, bvh->getNodePointer(), size_t(header.numNodes * sizeof(Node)));
+                writeSection(stream, position, header.primitiveOffset, primitives.empty() ? 0 : &primitives[0], primitives.size() * sizeof(unsigned long long));
+            }
+
+            return stream.good();
+        }
+
+private:
+    std::shared_ptr<MappedFile> mFile;
+    const MeshFileHeader       *mHeader;
+
+    //
+    // Empty sections are not written, so their offsets may be past end of
+    // file
+    //
+    bool isInside(unsigned long long offset, unsigned long long size) const
+    {
+        return (0 == size || (0 == offset % Alignment && offset <= mFile->getSize() && size <= mFile->getSize() - offset));
+    }
+
+    static unsigned long long align(unsigned long long offset)
+    {
+        return (offset + Alignment - 1) / Alignment * Alignment;
+    }
+
+    static void writeSection(std::ofstream &stream, unsigned long long &position, unsigned long long offset, const void *data, size_t size)
+    {
+        static const char padding[Alignment] = { 0 };
+
+        stream.write(padding, std::streamsize(offset - position));
+        stream.write(static_cast<const char *>(data), std::streamsize(size));
+
+        position = offset + size;
+    }
+};
+
+#endif
@@ -0,0 +1,1226 @@
+#ifndef INCLUDED_MESH_IMPORT_H
+#define INCLUDED_MESH_IMPORT_H
+
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "Mesh.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+
+//
+// Importers of meshes from OBJ and binary PLY files
+//
+// File is mapped into memory and split into chunks, which are parsed on all
+// hardware threads. First pass counts elements of each chunk, so that second
+// pass can parse every chunk directly into its place in vertices and indices
+// of mesh.
+//
+
+namespace MeshImport_imp
+{
+    inline bool IsSpace(char c)
+    {
+        return (' ' == c || '\t' == c || '\r' == c);
+    }
+
+    inline const char * SkipSpaces(const char *p, const char *end)
+    {
+        while (p != end && IsSpace(*p))
+        {
+            ++p;
+        }
+
+        return p;
+    }
+
+    //
+    // Pointer past end of line
+    //
+    inline const char * SkipLine(const char *p, const char *end)
+    {
+        const void *newLine = memchr(p, '\n', size_t(end - p));
+
+        return (0 != newLine ? static_cast<const char *>(newLine) + 1 : end);
+    }
+
+    inline const char * SkipToken(const char *p, const char *end)
+    {
+        while (p != end && !IsSpace(*p) && '\n' != *p)
+        {
+            ++p;
+        }
+
+        return p;
+    }
+
+    //
+    // First start of line at or after position
+    //
+    inline size_t LineStart(const char *data, size_t size, size_t position)
+    {
+        if (0 == position || size <= position || '\n' == data[position - 1])
+        {
+            return Min(position, size);
+        }
+
+        return size_t(SkipLine(data + position, data + size) - data);
+    }
+
+    inline bool IsDigit(char c)
+    {
+        return ('0' <= c && c <= '9');
+    }
+
+    //
+    // Parse integer, returns p if there is none
+    //
+    inline const char * ParseInteger(const char *p, const char *end, long long &value)
+    {
+        const char *start = p;
+        bool negative = false;
+
+        if (p != end && ('-' == *p || '+' == *p))
+        {
+            negative = ('-' == *p);
+            ++p;
+        }
+
+        if (p == end || !IsDigit(*p))
+        {
+            return start;
+        }
+
+        long long result = 0;
+
+        for (; p != end && IsDigit(*p); ++p)
+        {
+            result = 10 * result + (*p - '0');
+        }
+
+        value = (negative ? -result : result);
+        return p;
+    }
+
+    //
+    // Parse decimal number, returns p if there is none
+    //
+    // First 19 significant digits are accumulated as integer, which is then
+    // scaled by power of ten, so result may differ from strtod() in the last
+    // bit of double.
+    //
+    inline const char * ParseReal(const char *p, const char *end, double &value)
+    {
+        const char *start = p;
+        bool negative = false;
+
+        if (p != end && ('-' == *p || '+' == *p))
+        {
+            negative = ('-' == *p);
+            ++p;
+        }
+
+        unsigned long long mantissa = 0;
+        int numDigits = 0;
+        int exponent = 0;
+        bool hasDigits = false;
+
+        for (; p != end && IsDigit(*p); ++p, hasDigits = true)
+        {
+            if (numDigits < 19)
+            {
+                mantissa = 10 * mantissa + unsigned(*p - '0');
+                numDigits += (0 != mantissa);
+            }
+            else
+            {
+                ++exponent;
+            }
+        }
+
+        if (p != end && '.' == *p)
+        {
+            for (++p; p != end && IsDigit(*p); ++p, hasDigits = true)
+            {
+                if (numDigits < 19)
+                {
+                    mantissa = 10 * mantissa + unsigned(*p - '0');
+                    numDigits += (0 != mantissa);
+                    --exponent;
+                }
+            }
+        }
+
+        if (!hasDigits)
+        {
+            return start;
+        }
+
+        if (p != end && ('e' == *p || 'E' == *p))
+        {
+            long long power = 0;
+            const char *next = ParseInteger(p + 1, end, power);
+
+            if (next != p + 1)
+            {
+                exponent += int(Max(Min(power, 1000LL), -1000LL));
+                p = next;
+            }
+        }
+
+        static const double powers[] =
+        {
+            1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        double result = double(mantissa);
+
+        if (0 <= exponent && exponent <= 22)
+        {
+            result *= powers[exponent];
+        }
+        else if (exponent < 0 && -22 <= exponent)
+        {
+            result /= powers[-exponent];
+        }
+        else
+        {
+            result *= std::pow(10.0, double(exponent));
+        }
+
+        value = (negative ? -result : result);
+        return p;
+    }
+
+    //
+    // Counts and results of single chunk of OBJ file
+    //
+    struct ObjChunk
+    {
+        const char *begin;
+        const char *end;
+        size_t      numPositions;
+        size_t      numNormals;
+        size_t      numTriangles;
+        size_t      firstPosition;  // counts of preceding chunks
+        size_t      firstNormal;
+        size_t      firstTriangle;
+        bool        failed;
+        bool        missingNormals; // some corner has no normal
+    };
+
+    enum ObjLineType
+    {
+        ObjOther,
+        ObjPosition,
+        ObjNormal,
+        ObjFace
+    };
+
+    //
+    // Type of line, p is moved to its first argument
+    //
+    inline ObjLineType GetObjLineType(const char *&p, const char *end)
+    {
+        p = SkipSpaces(p, end);
+
+        if (p == end)
+        {
+            return ObjOther;
+        }
+
+        if ('v' == p[0] && 1 < end - p && IsSpace(p[1]))
+        {
+            p += 2;
+            return ObjPosition;
+        }
+
+        if ('v' == p[0] && 2 < end - p && 'n' == p[1] && IsSpace(p[2]))
+        {
+            p += 3;
+            return ObjNormal;
+        }
+
+        if ('f' == p[0] && 1 < end - p && IsSpace(p[1]))
+        {
+            p += 2;
+            return ObjFace;
+        }
+
+        return ObjOther;
+    }
+
+    //
+    // Resolve 1-based or negative (relative to count of preceding elements)
+    // OBJ index to 0-based one, returns false if it is out of range
+    //
+    inline bool ResolveObjIndex(long long index, size_t numPreceding, size_t numTotal, size_t &result)
+    {
+        if (0 < index)
+        {
+            result = size_t(index - 1);
+        }
+        else if (index < 0 && size_t(-index) <= numPreceding)
+        {
+            result = numPreceding - size_t(-index);
+        }
+        else
+        {
+            return false;
+        }
+
+        return (result < numTotal);
+    }
+
+    enum PLYType
+    {
+        PLYInvalid,
+        PLYInt8,
+        PLYUInt8,
+        PLYInt16,
+        PLYUInt16,
+        PLYInt32,
+        PLYUInt32,
+        PLYFloat32,
+        PLYFloat64
+    };
+
+    inline PLYType GetPLYType(const std::string &name)
+    {
+        if ("char" == name   || "int8" == name)    return PLYInt8;
+        if ("uchar" == name  || "uint8" == name)   return PLYUInt8;
+        if ("short" == name  || "int16" == name)   return PLYInt16;
+        if ("ushort" == name || "uint16" == name)  return PLYUInt16;
+        if ("int" == name    || "int32" == name)   return PLYInt32;
+        if ("uint" == name   || "uint32" == name)  return PLYUInt32;
+        if ("float" == name  || "float32" == name) return PLYFloat32;
+        if ("double" == name || "float64" == name) return PLYFloat64;
+
+        return PLYInvalid;
+    }
+
+    inline size_t GetPLYTypeSize(PLYType type)
+    {
+        static const size_t sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+
+        return sizes[type];
+    }
+
+    //
+    // Read binary value, swapping its bytes if file is of other byte order
+    //
+    inline double ReadPLYValue(const char *p, PLYType type, bool swap)
+    {
+        char bytes[8] = { 0 };
+        const size_t size = GetPLYTypeSize(type);
+
+        for (size_t i = 0; i != size; ++i)
+        {
+            bytes[i] = p[swap ? size - 1 - i : i];
+        }
+
+        switch (type)
+        {
+        case PLYInt8:    { signed char v;        memcpy(&v, bytes, 1); return v; }
+        case PLYUInt8:   { unsigned char v;      memcpy(&v, bytes, 1); return v; }
+        case PLYInt16:   { short v;              memcpy(&v, bytes, 2); return v; }
+        case PLYUInt16:  { unsigned short v;     memcpy(&v, bytes, 2); return v; }
+        case PLYInt32:   { int v;                memcpy(&v, bytes, 4); return v; }
+        case PLYUInt32:  { unsigned int v;       memcpy(&v, bytes, 4); return v; }
+        case PLYFloat32: { float v;              memcpy(&v, bytes, 4); return v; }
+        case PLYFloat64: { double v;             memcpy(&v, bytes, 8); return v; }
+        default:         return 0;
+        }
+    }
+
+    struct PLYProperty
+    {
+        std::string name;
+        PLYType     type;           // type of items of list
+        PLYType     countType;      // PLYInvalid unless property is list
+        size_t      offset;         // from start of element, if it has no lists
+    };
+
+    struct PLYElement
+    {
+        std::string                 name;
+        size_t                      count;
+        std::vector<PLYProperty>    properties;
+        size_t                      size;       // bytes per item, 0 if it has lists
+
+        int findProperty(const char *name) const
+        {
+            for (size_t i = 0; i != properties.size(); ++i)
+            {
+                if (properties[i].name == name)
+                {
+                    return int(i);
+                }
+            }
+
+            return -1;
+        }
+    };
+
+    //
+    // Parse header of binary PLY file, data is moved past it
+    //
+    inline bool ParsePLYHeader(const char *&data, const char *end, std::vector<PLYElement> &elements, bool &bigEndian)
+    {
+        const char *p = data;
+        bool hasFormat = false;
+
+        elements.clear();
+
+        for (int line = 0; p != end; ++line)
+        {
+            const char *lineEnd = SkipLine(p, end);
+            std::vector<std::string> words;
+
+            for (const char *q = SkipSpaces(p, lineEnd); q != lineEnd && '\n' != *q; q = SkipSpaces(q, lineEnd))
+            {
+                const char *next = SkipToken(q, lineEnd);
+                words.push_back(std::string(q, next));
+                q = next;
+            }
+
+            p = lineEnd;
+
+            if (0 == line)
+            {
+                if (1 != words.size() || "ply" != words[0])
+                {
+                    return false;
+                }
+            }
+            else if (words.empty() || "comment" == words[0] || "obj_info" == words[0])
+            {
+                continue;
+            }
+            else if ("format" == words[0] && 3 == words.size())
+            {
+                if ("binary_little_endian" != words[1] && "binary_big_endian" != words[1])
+                {
+                    return false;
+                }
+
+                bigEndian = ("binary_big_endian" == words[1]);
+                hasFormat = true;
+            }
+            else if ("element" == words[0] && 3 == words.size())
+            {
+                PLYElement element;
+                element.name = words[1];
+                element.count = size_t(strtoull(words[2].c_str(), 0, 10));
+                element.size = 0;
+                elements.push_back(element);
+            }
+            else if ("property" == words[0] && !elements.empty())
+            {
+                PLYProperty property;
+
+                if (5 == words.size() && "list" == words[1])
+                {
+                    property.countType = GetPLYType(words[2]);
+                    property.type = GetPLYType(words[3]);
+                    property.name = words[4];
+
+                    if (PLYInvalid == property.countType || PLYFloat32 == property.countType || PLYFloat64 == property.countType)
+                    {
+                        return false;
+                    }
+                }
+                else if (3 == words.size())
+                {
+                    property.countType = PLYInvalid;
+                    property.type = GetPLYType(words[1]);
+                    property.name = words[2];
+                }
+                else
+                {
+                    return false;
+                }
+
+                if (PLYInvalid == property.type)
+                {
+                    return false;
+                }
+
+                property.offset = 0;
+                elements.back().properties.push_back(property);
+            }
+            else if ("end_header" == words[0])
+            {
+                data = p;
+                break;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        if (!hasFormat || data != p)
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i != elements.size(); ++i)
+        {
+            PLYElement &element = elements[i];
+            size_t offset = 0;
+
+            for (size_t j = 0; j != element.properties.size(); ++j)
+            {
+                if (PLYInvalid != element.properties[j].countType)
+                {
+                    offset = 0;
+                    break;
+                }
+
+                element.properties[j].offset = offset;
+                offset += GetPLYTypeSize(element.properties[j].type);
+            }
+
+            element.size = offset;
+        }
+
+        return true;
+    }
+
+    //
+    // Pointer past single item of element with lists, or 0 if it exceeds
+    // data. Count of list property with index list is stored into count.
+    //
+    inline const char * ScanPLYItem(const char *p, const char *end, const PLYElement &element, int list, size_t &count, bool swap)
+    {
+        for (size_t i = 0; i != element.properties.size(); ++i)
+        {
+            const PLYProperty &property = element.properties[i];
+
+            if (PLYInvalid == property.countType)
+            {
+                p += GetPLYTypeSize(property.type);
+                continue;
+            }
+
+            const size_t countSize = GetPLYTypeSize(property.countType);
+
+            if (end < p || size_t(end - p) < countSize)
+            {
+                return 0;
+            }
+
+            const size_t numItems = size_t(Max(ReadPLYValue(p, property.countType, swap), 0.0));
+            p += countSize;
+
+            if (size_t(end - p) / GetPLYTypeSize(property.type) < numItems)
+            {
+                return 0;
+            }
+
+            p += numItems * GetPLYTypeSize(property.type);
+
+            if (int(i) == list)
+            {
+                count = numItems;
+            }
+        }
+
+        return (p <= end ? p : 0);
+    }
+}
+
+//
+// Compute normals of vertices as area weighted average of normals of
+// triangles sharing them. Nothing is done for vertices without normals.
+//
+// Normals of triangles are calculated and normalized in parallel, only their
+// accumulation into vertices, which are shared by triangles of different
+// chunks, is serial.
+//
+template<class MeshType>
+    void ComputeVertexNormals(MeshType &mesh)
+    {
+        typedef typename MeshType::VertexType     VertexType;
+        typedef typename MeshType::IndexType      IndexType;
+        typedef typename MeshType::AbstractVertex AbstractVertex;
+        typedef typename MeshType::PointType      PointType;
+        typedef typename MeshType::NumericType    NumericType;
+
+        if (!AbstractVertex::HasNormal || 0 == mesh.getNumVertices())
+        {
+            return;
+        }
+
+        VertexType      *vertices = mesh.getWritableVertexPointer();
+        const IndexType *indices  = mesh.getIndexPointer();
+        const size_t numVertices  = mesh.getNumVertices();
+        const size_t numTriangles = mesh.getNumIndices() / 3;
+
+        std::vector<PointType> faceNormals(numTriangles);
+
+        ParallelFor(numTriangles, 1 << 14,
+            [vertices, indices, &faceNormals](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i != end; ++i)
+                {
+                    const PointType &pA = AbstractVertex::getPosition(vertices[indices[3*i]]);
+                    const PointType &pB = AbstractVertex::getPosition(vertices[indices[3*i+1]]);
+                    const PointType &pC = AbstractVertex::getPosition(vertices[indices[3*i+2]]);
+
+                    const NumericType e1[3] = { pB[0] - pA[0], pB[1] - pA[1], pB[2] - pA[2] };
+                    const NumericType e2[3] = { pC[0] - pA[0], pC[1] - pA[1], pC[2] - pA[2] };
+
+                    // Length of cross product is twice the area
+                    faceNormals[i][0] = e1[1] * e2[2] - e1[2] * e2[1];
+                    faceNormals[i][1] = e1[2] * e2[0] - e1[0] * e2[2];
+                    faceNormals[i][2] = e1[0] * e2[1] - e1[1] * e2[0];
+                }
+            });
+
+        std::vector<PointType> normals(numVertices);
+
+        for (size_t i = 0; i != numVertices; ++i)
+        {
+            normals[i][0] = normals[i][1] = normals[i][2] = 0;
+        }
+
+        for (size_t i = 0; i != numTriangles; ++i)
+        {
+            for (int k = 0; k != 3; ++k)
+            {
+                PointType &normal = normals[size_t(indices[3*i+k])];
+
+                normal[0] += faceNormals[i][0];
+                normal[1] += faceNormals[i][1];
+                normal[2] += faceNormals[i][2];
+            }
+        }
+
+        ParallelFor(numVertices, 1 << 14,
+            [vertices, &normals](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i != end; ++i)
+                {
+                    PointType &normal = normals[i];
+                    const NumericType length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+                    if (0 < length)
+                    {
+                        normal[0] /= length;
+                        normal[1] /= length;
+                        normal[2] /= length;
+                    }
+
+                    AbstractVertex::setNormal(vertices[i], normal);
+                }
+            });
+    }
+
+//
+// Import triangles of OBJ file into mesh, replacing its contents
+//
+// Only positions, normals and faces are read, polygons are triangulated as
+// fans. Mesh has single index per corner, so vertex takes normal of its last
+// corner, which has one. Normals are computed (see ComputeVertexNormals())
+// unless every corner has one. Returns false if file cannot be mapped,
+// indices are out of range, or number of vertices exceeds range of
+// IndexType.
+//
+template<class MeshType>
+    bool ImportOBJ(const char *path, MeshType &mesh)
+    {
+        using namespace MeshImport_imp;
+
+        typedef typename MeshType::VertexType     VertexType;
+        typedef typename MeshType::IndexType      IndexType;
+        typedef typename MeshType::AbstractVertex AbstractVertex;
+        typedef typename MeshType::PointType      PointType;
+        typedef typename MeshType::NumericType    NumericType;
+
+        MappedFile file;
+
+        if (!file.open(path))
+        {
+            return false;
+        }
+
+        const char  *data = file.getData();
+        const size_t size = file.getSize();
+
+        //
+        // Chunks start at beginnings of lines
+        //
+        const size_t numChunks = GetNumChunks(size, 1 << 20);
+        std::vector<ObjChunk> chunks(numChunks);
+
+        for (size_t i = 0; i != numChunks; ++i)
+        {
+            chunks[i].begin = data + LineStart(data, size, size * i / numChunks);
+            chunks[i].end = data + LineStart(data, size, size * (i + 1) / numChunks);
+        }
+
+        ParallelForChunks(numChunks, numChunks,
+            [&chunks](size_t, size_t begin, size_t end)
+            {
+                for (size_t c = begin; c != end; ++c)
+                {
+                    ObjChunk &chunk = chunks[c];
+                    chunk.numPositions = chunk.numNormals = chunk.numTriangles = 0;
+
+                    for (const char *p = chunk.begin; p != chunk.end; p = SkipLine(p, chunk.end))
+                    {
+                        switch (GetObjLineType(p, chunk.end))
+                        {
+                        case ObjPosition:
+                            ++chunk.numPositions;
+                            break;
+
+                        case ObjNormal:
+                            ++chunk.numNormals;
+                            break;
+
+                        case ObjFace:
+                        {
+                            size_t numCorners = 0;
+
+                            for (p = SkipSpaces(p, chunk.end); p != chunk.end && '\n' != *p; p = SkipSpaces(p, chunk.end))
+                            {
+                                p = SkipToken(p, chunk.end);
+                                ++numCorners;
+                            }
+
+                            chunk.numTriangles += (2 < numCorners ? numCorners - 2 : 0);
+
+                            break;
+                        }
+
+                        default:
+                            break;
+                        }
+                    }
+                }
+            });
+
+        size_t numPositions = 0, numNormals = 0, numTriangles = 0;
+
+        for (size_t i = 0; i != numChunks; ++i)
+        {
+            chunks[i].firstPosition = numPositions;
+            chunks[i].firstNormal = numNormals;
+            chunks[i].firstTriangle = numTriangles;
+            chunks[i].failed = false;
+            chunks[i].missingNormals = false;
+
+            numPositions += chunks[i].numPositions;
+            numNormals += chunks[i].numNormals;
+            numTriangles += chunks[i].numTriangles;
+        }
+
+        if (size_t((std::numeric_limits<IndexType>::max)()) < numPositions)
+        {
+            return false;
+        }
+
+        mesh.clear();
+        mesh.resize(numPositions, 3 * numTriangles);
+
+        if (0 == numPositions || 0 == numTriangles)
+        {
+            return (0 == numTriangles);
+        }
+
+        const bool readNormals = (AbstractVertex::HasNormal && 0 != numNormals);
+
+        std::vector<PointType>  normals(readNormals ? numNormals : 0);
+        std::vector<size_t>     cornerNormals(readNormals ? 3 * numTriangles : 0);  // index into normals per corner
+
+        VertexType  *vertices = mesh.getWritableVertexPointer();
+        IndexType   *indices  = mesh.getWritableIndexPointer();
+
+        ParallelForChunks(numChunks, numChunks,
+            [&chunks, &normals, &cornerNormals, vertices, indices, readNormals, numPositions, numNormals](size_t, size_t begin, size_t end)
+            {
+                std::vector<size_t> positionIndices, normalIndices;
+
+                for (size_t c = begin; c != end; ++c)
+                {
+                    ObjChunk &chunk = chunks[c];
+
+                    size_t position = chunk.firstPosition;
+                    size_t normal = chunk.firstNormal;
+                    size_t triangle = chunk.firstTriangle;
+
+                    for (const char *p = chunk.begin; p != chunk.end && !chunk.failed; p = SkipLine(p, chunk.end))
+                    {
+                        switch (GetObjLineType(p, chunk.end))
+                        {
+                        case ObjPosition:
+                        {
+                            PointType &point = AbstractVertex::getPosition(vertices[position++]);
+
+                            for (int a = 0; a != 3; ++a)
+                            {
+                                double value = 0;
+                                p = ParseReal(SkipSpaces(p, chunk.end), chunk.end, value);
+                                point[a] = NumericType(value);
+                            }
+                            break;
+                        }
+
+                        case ObjNormal:
+                        {
+                            if (!readNormals)
+                            {
+                                ++normal;
+                                break;
+                            }
+
+                            PointType &point = normals[normal++];
+
+                            for (int a = 0; a != 3; ++a)
+                            {
+                                double value = 0;
+                                p = ParseReal(SkipSpaces(p, chunk.end), chunk.end, value);
+                                point[a] = NumericType(value);
+                            }
+                            break;
+                        }
+
+                        case ObjFace:
+                        {
+                            positionIndices.clear();
+                            normalIndices.clear();
+
+                            //
+                            // Corner is v, v/vt, v/vt/vn or v//vn
+                            //
+                            for (p = SkipSpaces(p, chunk.end); p != chunk.end && '\n' != *p; p = SkipSpaces(p, chunk.end))
+                            {
+                                long long index = 0;
+                                size_t resolved = 0;
+                                const char *next = ParseInteger(p, chunk.end, index);
+
+                                if (next == p || !ResolveObjIndex(index, position, numPositions, resolved))
+                                {
+                                    chunk.failed = true;
+                                    break;
+                                }
+
+                                positionIndices.push_back(resolved);
+                                resolved = size_t(-1);
+                                p = next;
+
+                                if (p != chunk.end && '/' == *p)
+                                {
+                                    p = ParseInteger(p + 1, chunk.end, index);
+
+                                    if (p != chunk.end && '/' == *p)
+                                    {
+                                        next = ParseInteger(p + 1, chunk.end, index);
+
+                                        if (next != p + 1 && !ResolveObjIndex(index, normal, numNormals, resolved))
+                                        {
+                                            chunk.failed = true;
+                                            break;
+                                        }
+
+                                        p = next;
+                                    }
+                                }
+
+                                normalIndices.push_back(resolved);
+                                p = SkipToken(p, chunk.end);
+                            }
+
+                            if (chunk.failed)
+                            {
+                                break;
+                            }
+
+                            for (size_t k = 2; k < positionIndices.size(); ++k, ++triangle)
+                            {
+                                const size_t corners[3] = { 0, k - 1, k };
+
+                                for (int j = 0; j != 3; ++j)
+                                {
+                                    indices[3*triangle+j] = IndexType(positionIndices[corners[j]]);
+
+                                    if (readNormals)
+                                    {
+                                        cornerNormals[3*triangle+j] = normalIndices[corners[j]];
+                                        chunk.missingNormals |= (size_t(-1) == normalIndices[corners[j]]);
+                                    }
+                                }
+                            }
+
+                            break;
+                        }
+
+                        default:
+                            break;
+                        }
+                    }
+                }
+            });
+
+        bool missingNormals = !readNormals;
+
+        for (size_t i = 0; i != numChunks; ++i)
+        {
+            if (chunks[i].failed)
+            {
+                mesh.clear();
+                return false;
+            }
+
+            missingNormals |= chunks[i].missingNormals;
+        }
+
+        if (missingNormals)
+        {
+            ComputeVertexNormals(mesh);
+        }
+        else
+        {
+            for (size_t i = 0; i != cornerNormals.size(); ++i)
+            {
+                AbstractVertex::setNormal(vertices[size_t(indices[i])], normals[cornerNormals[i]]);
+            }
+        }
+
+        return true;
+    }
+
+//
+// Import triangles of binary PLY file (either byte order) into mesh,
+// replacing its contents
+//
+// Positions are read from x, y, z properties of vertex element, normals
+// from nx, ny, nz if there are all of them, otherwise they are computed
+// (see ComputeVertexNormals()). Faces are read from vertex_indices (or
+// vertex_index) list of face element and triangulated as fans. Other
+// elements and properties are skipped.
+//
+// Vertices are of fixed size and parsed in parallel. Faces are of variable
+// size, so their chunks are located by serial scan of list counts, after
+// which they are parsed in parallel. Returns false if file cannot be
+// mapped, it is ASCII PLY, it is truncated, indices are out of range, or
+// number of vertices exceeds range of IndexType.
+//
+template<class MeshType>
+    bool ImportPLY(const char *path, MeshType &mesh)
+    {
+        using namespace MeshImport_imp;
+
+        typedef typename MeshType::VertexType     VertexType;
+        typedef typename MeshType::IndexType      IndexType;
+        typedef typename MeshType::AbstractVertex AbstractVertex;
+        typedef typename MeshType::PointType      PointType;
+        typedef typename MeshType::NumericType    NumericType;
+
+        MappedFile file;
+
+        if (!file.open(path))
+        {
+            return false;
+        }
+
+        const char *data = file.getData();
+        const char *end = data + file.getSize();
+
+        std::vector<PLYElement> elements;
+        bool bigEndian = false;
+
+        if (!ParsePLYHeader(data, end, elements, bigEndian))
+        {
+            return false;
+        }
+
+        const unsigned int one = 1;
+        const bool swap = (bigEndian == (1 == *reinterpret_cast<const unsigned char *>(&one)));
+
+        const PLYElement *vertexElement = 0, *faceElement = 0;
+        const char *vertexData = 0, *faceData = 0;
+
+        //
+        // Locate data of vertices and faces
+        //
+        for (size_t i = 0; i != elements.size(); ++i)
+        {
+            const PLYElement &element = elements[i];
+
+            if ("vertex" == element.name && 0 == vertexElement)
+            {
+                vertexElement = &element;
+                vertexData = data;
+            }
+            else if ("face" == element.name && 0 == faceElement)
+            {
+                faceElement = &element;
+                faceData = data;
+            }
+
+            if (0 != element.size)
+            {
+                if (size_t(end - data) / element.size < element.count)
+                {
+                    return false;
+                }
+
+                data += element.size * element.count;
+            }
+            else if (&element == faceElement && 0 != vertexElement)
+            {
+                // Skipped while faces are scanned
+                break;
+            }
+            else
+            {
+                for (size_t j = 0, count = 0; j != element.count && 0 != data; ++j)
+                {
+                    data = ScanPLYItem(data, end, element, -1, count, swap);
+                }
+
+                if (0 == data)
+                {
+                    return false;
+                }
+            }
+        }
+
+        if (0 == vertexElement || 0 == vertexElement->size)
+        {
+            return false;
+        }
+
+        const int x = vertexElement->findProperty("x");
+        const int y = vertexElement->findProperty("y");
+        const int z = vertexElement->findProperty("z");
+        const int nx = vertexElement->findProperty("nx");
+        const int ny = vertexElement->findProperty("ny");
+        const int nz = vertexElement->findProperty("nz");
+
+        if (x < 0 || y < 0 || z < 0)
+        {
+            return false;
+        }
+
+        const int list = (0 != faceElement ? Max(faceElement->findProperty("vertex_indices"), faceElement->findProperty("vertex_index")) : -1);
+
+        if (0 != faceElement && (list < 0 || PLYInvalid == faceElement->properties[size_t(list)].countType))
+        {
+            return false;
+        }
+
+        const size_t numVertices = vertexElement->count;
+        const size_t numFaces = (0 != faceElement ? faceElement->count : 0);
+
+        if (size_t((std::numeric_limits<IndexType>::max)()) < numVertices)
+        {
+            return false;
+        }
+
+        //
+        // Offsets and first triangles of chunks of faces
+        //
+        const size_t numChunks = GetNumChunks(numFaces, 1 << 16);
+        std::vector<const char *> chunkData(numChunks + 1);
+        std::vector<size_t> chunkTriangles(numChunks + 1);
+
+        size_t numTriangles = 0;
+
+        if (0 != faceElement)
+        {
+            const char *p = faceData;
+
+            for (size_t chunk = 0, i = 0; chunk != numChunks; ++chunk)
+            {
+                chunkData[chunk] = p;
+                chunkTriangles[chunk] = numTriangles;
+
+                for (const size_t last = numFaces * (chunk + 1) / numChunks; i != last; ++i)
+                {
+                    size_t numCorners = 0;
+                    const char *next = ScanPLYItem(p, end, *faceElement, list, numCorners, swap);
+
+                    if (0 == next)
+                    {
+                        return false;
+                    }
+
+                    numTriangles += (2 < numCorners ? numCorners - 2 : 0);
+
+                    p = next;
+                }
+            }
+
+            chunkData[numChunks] = p;
+            chunkTriangles[numChunks] = numTriangles;
+        }
+
+        mesh.clear();
+        mesh.resize(numVertices, 3 * numTriangles);
+
+        if (0 == numVertices)
+        {
+            return (0 == numTriangles);
+        }
+
+        VertexType *vertices = mesh.getWritableVertexPointer();
+        IndexType  *indices = (0 != numTriangles ? mesh.getWritableIndexPointer() : 0);
+
+        const bool readNormals = (AbstractVertex::HasNormal && 0 <= nx && 0 <= ny && 0 <= nz);
+
+        ParallelFor(numVertices, 1 << 16,
+            [vertexElement, vertexData, vertices, swap, readNormals, x, y, z, nx, ny, nz](size_t begin, size_t end)
+            {
+                const std::vector<PLYProperty> &properties = vertexElement->properties;
+                const int position[3] = { x, y, z };
+                const int normal[3] = { nx, ny, nz };
+
+                for (size_t i = begin; i != end; ++i)
+                {
+                    const char *item = vertexData + i * vertexElement->size;
+                    PointType &point = AbstractVertex::getPosition(vertices[i]);
+
+                    for (int a = 0; a != 3; ++a)
+                    {
+                        const PLYProperty &property = properties[size_t(position[a])];
+                        point[a] = NumericType(ReadPLYValue(item + property.offset, property.type, swap));
+                    }
+
+                    if (readNormals)
+                    {
+                        PointType n;
+
+                        for (int a = 0; a != 3; ++a)
+                        {
+                            const PLYProperty &property = properties[size_t(normal[a])];
+                            n[a] = NumericType(ReadPLYValue(item + property.offset, property.type, swap));
+                        }
+
+                        AbstractVertex::setNormal(vertices[i], n);
+                    }
+                }
+            });
+
+        if (0 != numTriangles)
+        {
+            std::vector<char> failed(numChunks, 0);
+
+            ParallelForChunks(numChunks, numChunks,
+                [faceElement, list, &chunkData, &chunkTriangles, &failed, indices, numVertices, swap, end](size_t, size_t begin, size_t last)
+                {
+                    const std::vector<PLYProperty> &properties = faceElement->properties;
+
+                    for (size_t chunk = begin; chunk != last; ++chunk)
+                    {
+                        size_t triangle = chunkTriangles[chunk];
+
+                        for (const char *p = chunkData[chunk]; p != chunkData[chunk + 1] && !failed[chunk]; )
+                        {
+                            for (size_t j = 0; j != properties.size(); ++j)
+                            {
+                                const PLYProperty &property = properties[j];
+                                const size_t itemSize = GetPLYTypeSize(property.type);
+
+                                if (PLYInvalid == property.countType)
+                                {
+                                    p += itemSize;
+                                    continue;
+                                }
+
+                                const size_t count = size_t(Max(ReadPLYValue(p, property.countType, swap), 0.0));
+                                p += GetPLYTypeSize(property.countType);
+
+                                if (int(j) == list && 2 < count)
+                                {
+                                    const double first = ReadPLYValue(p, property.type, swap);
+
+                                    for (size_t k = 2; k < count; ++k, ++triangle)
+                                    {
+                                        const double corners[3] =
+                                        {
+                                            first,
+                                            ReadPLYValue(p + (k - 1) * itemSize, property.type, swap),
+                                            ReadPLYValue(p + k * itemSize, property.type, swap)
+                                        };
+
+                                        for (int c = 0; c != 3; ++c)
+                                        {
+                                            if (corners[c] < 0 || double(numVertices) <= corners[c])
+                                            {
+                                                failed[chunk] = 1;
+                                            }
+
+                                            indices[3*triangle+c] = IndexType(corners[c]);
+                                        }
+                                    }
+                                }
+
+                                p += count * itemSize;
+                            }
+                        }
+                    }
+                });
+
+            for (size_t i = 0; i != numChunks; ++i)
+            {
+                if (failed[i])
+                {
+                    mesh.clear();
+                    return false;
+                }
+            }
+        }
+
+        if (!readNormals)
+        {
+            ComputeVertexNormals(mesh);
+        }
+
+        return true;
+    }
+
+//
+// Import mesh from OBJ or binary PLY file, chosen by extension of path
+//
+template<class MeshType>
+    bool ImportMesh(const char *path, MeshType &mesh)
+    {
+        const char *extension = strrchr(path, '.');
+
+        if (0 == extension)
+        {
+            return false;
+        }
+
+        std::string lower(extension + 1);
+
+        for (size_t i = 0; i != lower.size(); ++i)
+        {
+            lower[i] = char(tolower((unsigned char)lower[i]));
+        }
+
+        if ("obj" == lower)
+        {
+            return ImportOBJ(path, mesh);
+        }
+
+        if ("ply" == lower)
+        {
+            return ImportPLY(path, mesh);
+        }
+
+        return false;
+    }
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef INCLUDED_MESH_LAYOUT_H
+#define INCLUDED_MESH_LAYOUT_H
+
+#include <vector>
+#include <algorithm>
+
+#include "MinMax.h"
+#include "Mesh.h"
+#include "Parallel.h"
+
+//
+// Interleave lower 21 bits of coordinate with two zero bits after each bit
+//
+inline unsigned long long MortonSpread(unsigned long long x)
+{
+    x &= 0x1fffff;
+    x = (x | (x << 32)) & 0x001f00000000ffffULL;
+    x = (x | (x << 16)) & 0x001f0000ff0000ffULL;
+    x = (x | (x << 8))  & 0x100f00f00f00f00fULL;
+    x = (x | (x << 4))  & 0x10c30c30c30c30c3ULL;
+    x = (x | (x << 2))  & 0x1249249249249249ULL;
+
+    return x;
+}
+
+//
+// Order of triangles along Morton curve through their centroids
+//
+// Triangles close on the curve are close in space, hence consecutive
+// triangles of such order tend to share vertices and cache lines.
+//
+template<class MeshType>
+    void MortonOrderTriangles(const MeshType &mesh, std::vector<size_t> &order)
+    {
+        typedef typename MeshType::VertexType     VertexType;
+        typedef typename MeshType::IndexType      IndexType;
+        typedef typename MeshType::AbstractVertex AbstractVertex;
+        typedef typename MeshType::PointType      PointType;
+        typedef typename MeshType::NumericType    NumericType;
+
+        const VertexType *vertices = mesh.getVertexPointer();
+        const IndexType  *indices  = mesh.getIndexPointer();
+        const size_t numVertices  = mesh.getNumVertices();
+        const size_t numTriangles = mesh.getNumIndices() / 3;
+
+        order.resize(numTriangles);
+
+        if (0 == numTriangles)
+        {
+            return;
+        }
+
+        NumericType low[3], high[3];
+
+        for (int a = 0; a != 3; ++a)
+        {
+            low[a] = high[a] = AbstractVertex::getPosition(vertices[0])[a];
+        }
+
+        for (size_t i = 1; i < numVertices; ++i)
+        {
+            const PointType &position = AbstractVertex::getPosition(vertices[i]);
+
+            for (int a = 0; a != 3; ++a)
+            {
+                low[a] = Min(low[a], position[a]);
+                high[a] = Max(high[a], position[a]);
+            }
+        }
+
+        //
+        // Centroids are quantized to 21 bits per axis
+        //
+        NumericType scale[3];
+
+        for (int a = 0; a != 3; ++a)
+        {
+            scale[a] = (low[a] < high[a] ? NumericType(0x1fffff) / (high[a] - low[a]) : NumericType(0));
+        }
+
+        struct Key
+        {
+            unsigned long long  code;
+            size_t              triangle;
+
+            bool operator < (const Key &other) const
+            {
+                return (code < other.code || (code == other.code && triangle < other.triangle));
+            }
+        };
+
+        std::vector<Key> keys(numTriangles);
+
+        ParallelFor(numTriangles, 1 << 14,
+            [vertices, indices, &low, &scale, &keys](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i != end; ++i)
+                {
+                    const PointType &pA = AbstractVertex::getPosition(vertices[indices[3*i]]);
+                    const PointType &pB = AbstractVertex::getPosition(vertices[indices[3*i+1]]);
+                    const PointType &pC = AbstractVertex::getPosition(vertices[indices[3*i+2]]);
+
+                    unsigned long long code = 0;
+
+                    for (int a = 0; a != 3; ++a)
+                    {
+                        const NumericType centroid = (pA[a] + pB[a] + pC[a]) / 3;
+                        const unsigned long long x = (unsigned long long)Min(Max((centroid - low[a]) * scale[a], NumericType(0)), NumericType(0x1fffff));
+
+                        code |= MortonSpread(x) << a;
+                    }
+
+                    keys[i].code = code;
+                    keys[i].triangle = i;
+                }
+            });
+
+        std::sort(keys.begin(), keys.end());
+
+        for (size_t i = 0; i != numTriangles; ++i)
+        {
+            order[i] = keys[i].triangle;
+        }
+    }
+
+//
+// Reorder triangles of mesh, so that triangle i becomes order[i], and
+// renumber vertices in order of their first use by triangles. Vertices not
+// used by any triangle are moved to the end.
+//
+template<class MeshType>
+    void ReorderMesh(MeshType &mesh, const std::vector<size_t> &order)
+    {
+        typedef typename MeshType::VertexType     VertexType;
+        typedef typename MeshType::IndexType      IndexType;
+
+        VertexType  *vertices = mesh.getWritableVertexPointer();
+        IndexType   *indices  = mesh.getWritableIndexPointer();
+        const size_t numVertices  = mesh.getNumVertices();
+        const size_t numTriangles = order.size();
+
+        const size_t unused = size_t(-1);
+
+        std::vector<size_t>     newIndexOf(numVertices, unused);
+        std::vector<IndexType>  newIndices(3 * numTriangles);
+        std::vector<VertexType> newVertices;
+
+        newVertices.reserve(numVertices);
+
+        for (size_t i = 0; i != numTriangles; ++i)
+        {
+            for (int k = 0; k != 3; ++k)
+            {
+                const size_t vertex = size_t(indices[3*order[i]+k]);
+
+                if (unused == newIndexOf[vertex])
+                {
+                    newIndexOf[vertex] = newVertices.size();
+                    newVertices.push_back(vertices[vertex]);
+                }
+
+                newIndices[3*i+k] = IndexType(newIndexOf[vertex]);
+            }
+        }
+
+        for (size_t i = 0; i != numVertices; ++i)
+        {
+            if (unused == newIndexOf[i])
+            {
+                newVertices.push_back(vertices[i]);
+            }
+        }
+
+        std::copy(newVertices.begin(), newVertices.end(), vertices);
+        std::copy(newIndices.begin(), newIndices.end(), indices);
+    }
+
+//
+// Reorder triangles along Morton curve and vertices in order of first use,
+// so that intersection of spatially close triangles touches contiguous
+// memory
+//
+template<class MeshType>
+    void OptimizeMeshLayout(MeshType &mesh)
+    {
+        std::vector<size_t> order;
+
+        MortonOrderTriangles(mesh, order);
+        ReorderMesh(mesh, order);
+    }
+
+#endif
@@ -0,0 +1,989 @@
+#ifndef INCLUDED_MESH_RESOURCE_H
+#define INCLUDED_MESH_RESOURCE_H
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <atomic>
+
+#include "Intersect.h"
+#include "IntersectionPoint.h"
+#include "Mesh.h"
+#include "ClusteredMesh.h"
+#include "MeshLayout.h"
+#include "MeshFile.h"
+#include "MeshImport.h"
+#include "MeshCache.h"
+#include "PagedMesh.h"
+#include "BoundingSphere.h"
+#include "BVH.h"
+#include "WideBVH.h"
+#include "QuantizedBVH.h"
+#include "Parallel.h"
+
+//
+// Mesh with data derived from it, needed for ray intersection.
+//
+// Resource is meant to be shared by many MeshGeometry instances, each of
+// which adds only its own transformation and material. Memory and time
+// spent in meshChanged() scale with the number of unique meshes, not with
+// the number of placements.
+//
+// Instances register as listeners, so that they update their bounds when
+// resource is rebuilt or loaded again.
+//
+class MeshResourceListener
+{
+public:
+    virtual ~MeshResourceListener() {}
+
+    //
+    // Resource was rebuilt, its bounds may have changed
+    //
+    virtual void resourceChanged() = 0;
+};
+
+template<class _VertexType, class _IndexType = int>
+    class MeshResource
+    {
+    public:
+        typedef _VertexType                         VertexType;
+        typedef _IndexType                          IndexType;
+        typedef Mesh<VertexType, IndexType>         MeshType;
+        typedef ClusteredMesh<VertexType, IndexType> ClusteredMeshType;
+        typedef typename MeshType::AbstractVertex   AbstractVertex;
+        typedef typename MeshType::PointType        PointType;
+        typedef typename MeshType::NumericType      NumericType;
+        typedef GAL_imp::Ray<NumericType,3>         RayType;
+        typedef IntersectionPoint<NumericType,3>    IntersectionPointType;
+        typedef RayHit<NumericType>                 RayHitType;
+        typedef BoundingSphere<NumericType>         BoundingSphereType;
+        typedef AABBox<NumericType>                 AABBoxType;
+        typedef BVH<NumericType>                    BVHType;
+        typedef WideBVH<NumericType, 4>             Wide4BVHType;
+        typedef WideBVH<NumericType, 8>             Wide8BVHType;
+        typedef QuantizedBVH<NumericType, 4>        Quantized4BVHType;
+        typedef QuantizedBVH<NumericType, 8>        Quantized8BVHType;
+        typedef PagedMesh<VertexType, IndexType>    PagedMeshType;
+
+        //
+        // Triangle baked for intersection: first vertex and both edges
+        //
+        struct TriangleRecord
+        {
+            PointType position;
+            PointType edge1;
+            PointType edge2;
+        };
+
+        MeshResource(): mPrecomputeTriangles(false), mCompressMesh(false), mOptimizeMeshLayout(false), mLazyBuild(false),
+            mLayout(BinaryBVHLayout), mCacheKey(0), mBuildState(Built)
+        {
+        }
+
+        MeshType & getMesh()
+        {
+            return mMesh;
+        }
+
+        const MeshType & getMesh() const
+        {
+            return mMesh;
+        }
+
+        //
+        // When enabled, meshChanged() bakes contiguous array of triangles with
+        // precomputed edges, so that intersection does not need to gather
+        // vertices through index buffer, nor calculate edges for every ray.
+        //
+        // It costs 9 numbers per triangle.
+        //
+        void setPrecomputeTriangles(bool val)
+        {
+            mPrecomputeTriangles = val;
+        }
+
+        bool isPrecomputeTriangles() const
+        {
+            return mPrecomputeTriangles;
+        }
+
+        //
+        // When enabled, meshChanged() compresses mesh (see ClusteredMesh)
+        // and releases it, so that getMesh() is empty afterwards. Vertex
+        // positions are snapped to grid of compressed mesh before anything
+        // else is derived from them.
+        //
+        // Triangles are then numbered in order of hierarchy leaves (see
+        // RayHit::primitive), and they are not precomputed, which would
+        // cost more memory than the mesh itself.
+        //
+        void setCompressMesh(bool val)
+        {
+            mCompressMesh = val;
+        }
+
+        bool isCompressMesh() const
+        {
+            return mCompressMesh;
+        }
+
+        //
+        // When enabled, meshChanged() reorders triangles and vertices of
+        // mesh for locality of memory accesses (see OptimizeMeshLayout()),
+        // which renumbers them.
+        //
+        void setOptimizeMeshLayout(bool val)
+        {
+            mOptimizeMeshLayout = val;
+        }
+
+        bool isOptimizeMeshLayout() const
+        {
+            return mOptimizeMeshLayout;
+        }
+
+        //
+        // When enabled, meshChanged() leaves building of hierarchy and data
+        // derived from it to the first ray, which hits the mesh. Rays
+        // hitting the mesh before the hierarchy is built, including those
+        // of other threads while it is being built, intersect all triangles.
+        //
+        // Meshes, which are never hit, then cost only their bounds. Mesh is
+        // still optimized (see setOptimizeMeshLayout()) in meshChanged(),
+        // and compressed mesh is always built there, as it replaces mesh
+        // needed by intersection of all triangles.
+        //
+        void setLazyBuild(bool val)
+        {
+            mLazyBuild = val;
+        }
+
+        bool isLazyBuild() const
+        {
+            return mLazyBuild;
+        }
+
+        //
+        // Hierarchy is not built yet, see setLazyBuild()
+        //
+        bool isBuildPending() const
+        {
+            return (Built != mBuildState.load(std::memory_order_acquire));
+        }
+
+        //
+        // Directory of cache of hierarchies (see MeshCache), cache is not
+        // used while it is empty.
+        //
+        // When cache is used, meshChanged() looks for entry of the mesh by
+        // hash of its content and options, and maps mesh, its hierarchy and
+        // bounds from the entry instead of building them. Otherwise entry
+        // is written once hierarchy is built.
+        //
+        void setCacheDirectory(const std::string &directory)
+        {
+            mCache.setDirectory(directory);
+        }
+
+        const std::string & getCacheDirectory() const
+        {
+            return mCache.getDirectory();
+        }
+
+        //
+        // Register instance to be notified when resource changes. Listener
+        // has to be removed before it is destroyed.
+        //
+        void addListener(MeshResourceListener *listener)
+        {
+            mListeners.push_back(listener);
+        }
+
+        void removeListener(MeshResourceListener *listener)
+        {
+            mListeners.erase(std::remove(mListeners.begin(), mListeners.end(), listener), mListeners.end());
+        }
+
+        //
+        // Rebuild derived data after mesh was modified, and notify all
+        // instances
+        //
+        // Hierarchy of triangles is built in parallel, see getBVH() for
+        // build time and quality.
+        //
+        void meshChanged()
+        {
+            rebuild();
+            notifyListeners();
+        }
+
+        //
+        // Map mesh file (see MeshFile) into mesh, and use hierarchy and
+        // bounds stored in it instead of calculating them.
+        //
+        // Hierarchy is built, if there is none in the file, or if mesh is
+        // to be modified (see setOptimizeMeshLayout() and setCompressMesh()),
+        // which copies the mesh. Returns false if file cannot be mapped, or
+        // its vertices and indices are of different type.
+        //
+        bool loadMeshFile(const char *path)
+        {
+            MeshFile file;
+
+            if (!file.open(path) || !file.getMesh(mMesh))
+            {
+                return false;
+            }
+
+            mPagedMesh.close();
+
+            if (mOptimizeMeshLayout || mCompressMesh || !file.getBVH(mBVH))
+            {
+                meshChanged();
+                return true;
+            }
+
+            if (!file.getBounds(mBounds))
+            {
+                BoundingSphereFromMesh(mMesh, mBounds);
+            }
+
+            buildFromHierarchy();
+            mBuildState.store(Built, std::memory_order_release);
+
+            notifyListeners();
+            return true;
+        }
+
+        //
+        // Import mesh from OBJ or binary PLY file (see ImportMesh()) and
+        // rebuild derived data. Returns false if file cannot be imported,
+        // mesh is then empty.
+        //
+        bool importMesh(const char *path)
+        {
+            if (!ImportMesh(path, mMesh))
+            {
+                return false;
+            }
+
+            meshChanged();
+            return true;
+        }
+
+        //
+        // Open paged mesh file (see PagedMesh) instead of mesh, pages of
+        // which are read by rays reaching them, and kept in memoryBudget
+        // bytes. Mesh and hierarchy are released, until meshChanged() or
+        // loadMeshFile() replaces paged mesh. Returns false if file cannot
+        // be opened, or it is of different vertex type.
+        //
+        bool openPagedMesh(const char *path, size_t memoryBudget)
+        {
+            if (!mPagedMesh.open(path, memoryBudget))
+            {
+                return false;
+            }
+
+            mMesh.clear();
+            mBVH.build(0, 0);
+            buildWideBVH();
+            mTriangles.clear();
+            mClusteredMesh.clear();
+
+            mBounds = mPagedMesh.getBounds();
+            mBuildState.store(Built, std::memory_order_release);
+
+            notifyListeners();
+            return true;
+        }
+
+        //
+        // Write mesh and its binary hierarchy into paged mesh file with at
+        // most pageSize triangles per page. Returns false if mesh was
+        // released by compression, hierarchy nodes were released by
+        // quantized layout or are not built yet, or file cannot be written.
+        //
+        bool savePagedMesh(const char *path, size_t pageSize = PagedMeshType::DefaultPageSize) const
+        {
+            if (!mClusteredMesh.isEmpty() || mBVH.isEmpty())
+            {
+                return false;
+            }
+
+            return PagedMeshType::write(path, mMesh, mBVH, mBounds, pageSize);
+        }
+
+        const PagedMeshType & getPagedMesh() const
+        {
+            return mPagedMesh;
+        }
+
+        //
+        // Write mesh and its binary hierarchy (unless it was released by
+        // quantized layout) to file. Returns false if mesh was released by
+        // compression, or file cannot be written.
+        //
+        bool saveMeshFile(const char *path) const
+        {
+            if (!mClusteredMesh.isEmpty())
+            {
+                return false;
+            }
+
+            return MeshFile::write(path, mMesh, mBVH.isEmpty() ? 0 : &mBVH, &mBounds);
+        }
+
+        //
+        // Binary hierarchy, empty while its build is pending (see
+        // setLazyBuild())
+        //
+        const BVHType & getBVH() const
+        {
+            return mBVH;
+        }
+
+        //
+        // Layout of hierarchy used for intersection.
+        //
+        // Wide layouts are collapsed from binary hierarchy, hence layout can
+        // be switched at any time (e.g. to compare their performance).
+        // Quantized layouts release nodes of binary hierarchy to save memory,
+        // so it is rebuilt when switching from them, from decompressed mesh
+        // if it was compressed.
+        //
+        void setBVHLayout(BVHLayout layout)
+        {
+            mLayout = layout;
+
+            if (mBVH.isEmpty() && !mBVH.getIndices().empty())
+            {
+                if (!mClusteredMesh.isEmpty())
+                {
+                    mClusteredMesh.decompress(mMesh);
+                }
+
+                meshChanged();
+                return;
+            }
+
+            buildWideBVH();
+        }
+
+        BVHLayout getBVHLayout() const
+        {
+            return mLayout;
+        }
+
+        //
+        // Memory used by hierarchies in bytes
+        //
+        size_t getBVHMemorySize() const
+        {
+            return mBVH.getMemorySize()
+                + mWide4BVH.getMemorySize() + mWide8BVH.getMemorySize()
+                + mQuantized4BVH.getMemorySize() + mQuantized8BVH.getMemorySize();
+        }
+
+        //
+        // Memory used by mesh and triangles derived from it in bytes
+        //
+        size_t getMeshMemorySize() const
+        {
+            return mMesh.getNumVertices() * sizeof(VertexType)
+                + mMesh.getNumIndices() * sizeof(IndexType)
+                + mTriangles.size() * sizeof(TriangleRecord)
+                + mClusteredMesh.getMemorySize()
+                + mPagedMesh.getMemorySize();
+        }
+
+        //
+        // Bounds in mesh coordinates
+        //
+        const BoundingSphereType & getBounds() const
+        {
+            return mBounds;
+        }
+
+        //
+        // Intersect ray given in mesh coordinates
+        //
+        bool hitLocalRay(const RayType &ray, RayHitType &hit) const
+        {
+            hit.distance = -1;
+
+            if (mPagedMesh.isOpen())
+            {
+                PagedLeafVisitor visitor = { &ray, &hit };
+                mPagedMesh.traverse(ray, (std::numeric_limits<NumericType>::max)(), visitor);
+
+                return (-1 != hit.distance);
+            }
+
+            if (Built != mBuildState.load(std::memory_order_acquire) && !buildPending())
+            {
+                hitAllTriangles(ray, hit);
+                return (-1 != hit.distance);
+            }
+
+            LeafVisitor visitor = { this, &ray, &hit };
+            const NumericType tMax = (std::numeric_limits<NumericType>::max)();
+
+            switch (mLayout)
+            {
+            case BinaryBVHLayout:
+                mBVH.traverse(ray, tMax, visitor);
+                break;
+            case Wide4BVHLayout:
+                mWide4BVH.traverse(ray, tMax, visitor);
+                break;
+            case Wide8BVHLayout:
+                mWide8BVH.traverse(ray, tMax, visitor);
+                break;
+            case Quantized4BVHLayout:
+                if (mQuantized4BVH.isEmpty())
+                {
+                    // See buildWideBVH()
+                    mWide4BVH.traverse(ray, tMax, visitor);
+                    break;
+                }
+
+                mQuantized4BVH.traverse(ray, tMax, visitor);
+                break;
+            case Quantized8BVHLayout:
+                if (mQuantized8BVH.isEmpty())
+                {
+                    // See buildWideBVH()
+                    mWide8BVH.traverse(ray, tMax, visitor);
+                    break;
+                }
+
+                mQuantized8BVH.traverse(ray, tMax, visitor);
+                break;
+            }
+
+            return (-1 != hit.distance);
+        }
+
+        void resolveLocalHit(const RayType &ray, const RayHitType &hit, IntersectionPointType &out, bool withTangent) const
+        {
+            VertexType v0, v1, v2;
+            getTriangleVertices(hit.primitive, v0, v1, v2);
+
+            out.normal = AbstractVertex::getNormal(v0, v1, v2, hit.u, hit.v);
+
+            if (withTangent)
+            {
+                out.tangent = AbstractVertex::getTangent(v0, v1, v2, hit.u, hit.v);
+            }
+
+            out.distance = hit.distance;
+            out.position = ray.start + ray.direction * out.distance;
+
+            // based on v0, v1, and v2 also texture coordinates could be calculated
+            // if there was any texture
+        }
+
+    private:
+        enum BuildState
+        {
+            Built,
+            Pending,
+            Building
+        };
+
+        MeshType                    mMesh;
+        BoundingSphereType          mBounds;
+        std::vector<TriangleRecord> mTriangles;     // in order of hierarchy leaves
+        ClusteredMeshType           mClusteredMesh; // in order of hierarchy leaves
+        BVHType                     mBVH;
+        Wide4BVHType                mWide4BVH;
+        Wide8BVHType                mWide8BVH;
+        Quantized4BVHType           mQuantized4BVH;
+        Quantized8BVHType           mQuantized8BVH;
+        bool                        mPrecomputeTriangles;
+        bool                        mCompressMesh;
+        bool                        mOptimizeMeshLayout;
+        bool                        mLazyBuild;
+        BVHLayout                   mLayout;
+        MeshCache                   mCache;
+        PagedMeshType               mPagedMesh;
+        unsigned long long          mCacheKey;      // of pending build, 0 if cache is not used
+        mutable std::atomic<int>    mBuildState;
+        std::vector<MeshResourceListener*> mListeners;     // instances
+
+        //
+        // Rebuild derived data, see meshChanged()
+        //
+        void rebuild()
+        {
+            mPagedMesh.close();
+
+            const bool useCache = (mCache.isEnabled() && 0 != mMesh.getNumIndices() / 3);
+            unsigned long long key = 0;
+
+            if (useCache)
+            {
+                key = MeshCache::hash(mMesh, (mOptimizeMeshLayout ? 1 : 0) | (mCompressMesh ? 2 : 0));
+
+                if (loadFromCache(key))
+                {
+                    if (mCompressMesh)
+                    {
+                        // Snapping is repeated to set up grid of compression
+                        mClusteredMesh.snapPositions(mMesh);
+                    }
+
+                    buildFromHierarchy();
+                    mBuildState.store(Built, std::memory_order_release);
+                    return;
+                }
+            }
+
+            if (mOptimizeMeshLayout)
+            {
+                OptimizeMeshLayout(mMesh);
+            }
+
+            //
+            // Entry keeps mesh before snapping, since grid derived from
+            // snapped mesh may differ
+            //
+            MeshType unsnapped;
+
+            if (mCompressMesh)
+            {
+                if (useCache)
+                {
+                    unsnapped = mMesh;
+                }
+
+                mClusteredMesh.snapPositions(mMesh);
+            }
+
+            BoundingSphereFromMesh(mMesh, mBounds);
+
+            if (mLazyBuild && !mCompressMesh && 0 != mMesh.getNumIndices() / 3)
+            {
+                mCacheKey = key;
+
+                mBVH.build(0, 0);
+                buildWideBVH();
+                mTriangles.clear();
+                mClusteredMesh.clear();
+
+                mBuildState.store(Pending, std::memory_order_release);
+                return;
+            }
+
+            buildBVH();
+
+            if (useCache)
+            {
+                mCache.store(key, mCompressMesh ? unsnapped : mMesh, mBVH, mBounds);
+            }
+
+            buildFromHierarchy();
+            mBuildState.store(Built, std::memory_order_release);
+        }
+
+        void notifyListeners()
+        {
+            for (size_t i = 0; i != mListeners.size(); ++i)
+            {
+                mListeners[i]->resourceChanged();
+            }
+        }
+
+        //
+        // Intersects triangles in leaves of hierarchy
+        //
+        struct LeafVisitor
+        {
+            const MeshResource *resource;
+            const RayType      *ray;
+            RayHitType         *hit;
+
+            void operator () (size_t begin, size_t end, NumericType &tMax) const
+            {
+                if (!resource->mClusteredMesh.isEmpty())
+                {
+                    resource->hitClusteredTriangles(*ray, begin, end, *hit);
+                }
+                else if (resource->mTriangles.empty())
+                {
+                    resource->hitIndexedTriangles(*ray, begin, end, *hit);
+                }
+                else
+                {
+                    resource->hitPrecomputedTriangles(*ray, begin, end, *hit);
+                }
+
+                if (-1 != hit->distance)
+                {
+                    tMax = hit->distance;
+                }
+            }
+        };
+
+        //
+        // Map mesh, hierarchy and bounds from entry of cache, returns false
+        // if there is no complete entry of the key
+        //
+        bool loadFromCache(unsigned long long key)
+        {
+            MeshFile file;
+
+            // Mesh is taken last, so that it is kept unless all succeeds
+            return (mCache.open(key, file) && file.getBVH(mBVH) && file.getBounds(mBounds) && file.getMesh(mMesh));
+        }
+
+        //
+        // Intersects triangles in leaves of paged mesh
+        //
+        struct PagedLeafVisitor
+        {
+            const RayType  *ray;
+            RayHitType     *hit;
+
+            void operator () (const VertexType *vertices, size_t first, size_t count, NumericType &tMax) const
+            {
+                for (size_t i = 0; i != count; ++i)
+                {
+                    const PointType &pA = AbstractVertex::getPosition(vertices[3*i]);
+                    const PointType &pB = AbstractVertex::getPosition(vertices[3*i+1]);
+                    const PointType &pC = AbstractVertex::getPosition(vertices[3*i+2]);
+
+                    GAL_imp::Solution<NumericType, 3> solution3;
+
+                    if (!GAL::IntersectRayTriangleByPoints(*ray, pA, pB, pC, solution3))
+                    {
+                        // No intersection at all
+                        continue;
+                    }
+
+                    updateClosestHit(solution3, first + i, *hit);
+                }
+
+                if (-1 != hit->distance)
+                {
+                    tMax = hit->distance;
+                }
+            }
+        };
+
+        void buildBVH()
+        {
+            const VertexType  *vertices = mMesh.getVertexPointer();
+            const IndexType   *indices  = mMesh.getIndexPointer();
+            const size_t numTriangles = mMesh.getNumIndices() / 3;
+
+            std::vector<AABBoxType> bounds(numTriangles);
+
+            ParallelFor(numTriangles, 1 << 14,
+                [vertices, indices, &bounds](size_t begin, size_t end)
+                {
+                    for (size_t i = begin; i != end; ++i)
+                    {
+                        const PointType &pA = AbstractVertex::getPosition(vertices[indices[3*i]]);
+                        const PointType &pB = AbstractVertex::getPosition(vertices[indices[3*i+1]]);
+                        const PointType &pC = AbstractVertex::getPosition(vertices[indices[3*i+2]]);
+
+                        AABBoxType &box = bounds[i];
+
+                        box.xMin = Min(pA[0], Min(pB[0], pC[0])); box.xMax = Max(pA[0], Max(pB[0], pC[0]));
+                        box.yMin = Min(pA[1], Min(pB[1], pC[1])); box.yMax = Max(pA[1], Max(pB[1], pC[1]));
+                        box.zMin = Min(pA[2], Min(pB[2], pC[2])); box.zMax = Max(pA[2], Max(pB[2], pC[2]));
+                    }
+                });
+
+            mBVH.build(bounds.empty() ? 0 : &bounds[0], numTriangles);
+        }
+
+        //
+        // Build pending hierarchy, unless other thread does it already.
+        // Returns false if hierarchy is not ready.
+        //
+        // Building is logically const, as it does not change result of
+        // intersection, only its speed.
+        //
+        bool buildPending() const
+        {
+            int state = Pending;
+
+            if (!mBuildState.compare_exchange_strong(state, Building, std::memory_order_acquire))
+            {
+                return (Built == state);
+            }
+
+            MeshResource *self = const_cast<MeshResource *>(this);
+
+            self->buildBVH();
+
+            if (0 != mCacheKey)
+            {
+                mCache.store(mCacheKey, mMesh, mBVH, mBounds);
+            }
+
+            self->buildFromHierarchy();
+
+            mBuildState.store(Built, std::memory_order_release);
+            return true;
+        }
+
+        //
+        // Build data derived from hierarchy of triangles
+        //
+        void buildFromHierarchy()
+        {
+            buildWideBVH();
+
+            mTriangles.clear();
+            mClusteredMesh.clear();
+
+            if (mCompressMesh)
+            {
+                mClusteredMesh.build(mMesh, mBVH.getIndices().empty() ? 0 : &mBVH.getIndices()[0]);
+                mMesh.clear();
+            }
+            else if (mPrecomputeTriangles)
+            {
+                bakeTriangles();
+            }
+        }
+
+        //
+        // Only hierarchy of current layout is kept
+        //
+        void buildWideBVH()
+        {
+            mWide4BVH.clear();
+            mWide8BVH.clear();
+            mQuantized4BVH.clear();
+            mQuantized8BVH.clear();
+
+            switch (mLayout)
+            {
+            case Wide4BVHLayout:
+                mWide4BVH.build(mBVH);
+                break;
+            case Wide8BVHLayout:
+                mWide8BVH.build(mBVH);
+                break;
+            case Quantized4BVHLayout:
+                {
+                    Wide4BVHType wide;
+                    wide.build(mBVH);
+
+                    if (!mQuantized4BVH.build(wide))
+                    {
+                        // Does not fit into quantized nodes
+                        mWide4BVH = wide;
+                    }
+                    mBVH.releaseNodes();
+                }
+                break;
+            case Quantized8BVHLayout:
+                {
+                    Wide8BVHType wide;
+                    wide.build(mBVH);
+
+                    if (!mQuantized8BVH.build(wide))
+                    {
+                        // Does not fit into quantized nodes
+                        mWide8BVH = wide;
+                    }
+                    mBVH.releaseNodes();
+                }
+                break;
+            default:
+                break;
+            }
+        }
+
+        MeshResource(const MeshResource &);
+        MeshResource &operator = (const MeshResource &);
+
+        void getTriangleVertices(size_t triangle, VertexType &v0, VertexType &v1, VertexType &v2) const
+        {
+            if (mPagedMesh.isOpen())
+            {
+                mPagedMesh.getTriangleVertices(triangle, v0, v1, v2);
+                return;
+            }
+
+            if (!mClusteredMesh.isEmpty())
+            {
+                mClusteredMesh.getTriangleVertices(triangle, v0, v1, v2);
+                return;
+            }
+
+            const VertexType  *vertices = mMesh.getVertexPointer();
+            const IndexType   *indices  = mMesh.getIndexPointer() + triangle * 3;
+
+            v0 = vertices[indices[0]];
+            v1 = vertices[indices[1]];
+            v2 = vertices[indices[2]];
+        }
+
+        //
+        // Triangles are baked in order of hierarchy leaves
+        //
+        void bakeTriangles()
+        {
+            const VertexType  *vertices = mMesh.getVertexPointer();
+            const IndexType   *indices  = mMesh.getIndexPointer();
+            const size_t     *ordering  = (mBVH.getIndices().empty() ? 0 : &mBVH.getIndices()[0]);
+            const size_t numTriangles = mMesh.getNumIndices() / 3;
+
+            mTriangles.resize(numTriangles);
+
+            ParallelFor(numTriangles, 1 << 14,
+                [this, vertices, indices, ordering](size_t begin, size_t end)
+                {
+                    for (size_t i = begin; i != end; ++i)
+                    {
+                        const size_t triangle = ordering[i];
+
+                        const PointType &pA = AbstractVertex::getPosition(vertices[indices[3*triangle]]);
+                        const PointType &pB = AbstractVertex::getPosition(vertices[indices[3*triangle+1]]);
+                        const PointType &pC = AbstractVertex::getPosition(vertices[indices[3*triangle+2]]);
+
+                        mTriangles[i].position = pA;
+                        mTriangles[i].edge1 = pB - pA;
+                        mTriangles[i].edge2 = pC - pA;
+                    }
+                });
+        }
+
+        //
+        // Update closest hit with triangle intersection, if it is closer
+        //
+        static void updateClosestHit(const GAL_imp::Solution<NumericType, 3> &solution, size_t triangle, RayHitType &hit)
+        {
+            if (solution.x[0] < 0.0001)
+            {
+                // Intersection was behind ray
+                return;
+            }
+
+            if (-1 == hit.distance || solution.x[0] < hit.distance)
+            {
+                // distance is in unit of ray lengths
+                hit.distance = solution.x[0];
+                hit.u = solution.x[1];
+                hit.v = solution.x[2];
+                hit.primitive = triangle;
+            }
+        }
+
+        //
+        // Intersect triangles at positions [begin, end) of hierarchy ordering
+        //
+        void hitIndexedTriangles(const RayType &ray, size_t begin, size_t end, RayHitType &hit) const
+        {
+            const VertexType  *vertices = mMesh.getVertexPointer();
+            const IndexType   *indices  = mMesh.getIndexPointer();
+            const size_t      *ordering = &mBVH.getIndices()[0];
+
+            for (size_t i = begin; i != end; ++i)
+            {
+                const size_t triangle = ordering[i];
+
+                const PointType &pA = AbstractVertex::getPosition(vertices[indices[3*triangle]]);
+                const PointType &pB = AbstractVertex::getPosition(vertices[indices[3*triangle+1]]);
+                const PointType &pC = AbstractVertex::getPosition(vertices[indices[3*triangle+2]]);
+
+                GAL_imp::Solution<NumericType, 3> solution3;
+
+                if (!GAL::IntersectRayTriangleByPoints(ray, pA, pB, pC, solution3))
+                {
+                    // No intersection at all
+                    continue;
+                }
+
+                updateClosestHit(solution3, triangle, hit);
+            }
+        }
+
+        //
+        // Intersect all triangles of mesh, while there is no hierarchy
+        //
+        void hitAllTriangles(const RayType &ray, RayHitType &hit) const
+        {
+            const VertexType  *vertices = mMesh.getVertexPointer();
+            const IndexType   *indices  = mMesh.getIndexPointer();
+            const size_t numTriangles = mMesh.getNumIndices() / 3;
+
+            for (size_t triangle = 0; triangle != numTriangles; ++triangle)
+            {
+                const PointType &pA = AbstractVertex::getPosition(vertices[indices[3*triangle]]);
+                const PointType &pB = AbstractVertex::getPosition(vertices[indices[3*triangle+1]]);
+                const PointType &pC = AbstractVertex::getPosition(vertices[indices[3*triangle+2]]);
+
+                GAL_imp::Solution<NumericType, 3> solution3;
+
+                if (!GAL::IntersectRayTriangleByPoints(ray, pA, pB, pC, solution3))
+                {
+                    // No intersection at all
+                    continue;
+                }
+
+                updateClosestHit(solution3, triangle, hit);
+            }
+        }
+
+        //
+        // Triangles are decoded from cluster by cluster
+        //
+        void hitClusteredTriangles(const RayType &ray, size_t begin, size_t end, RayHitType &hit) const
+        {
+            size_t cluster = mClusteredMesh.findCluster(begin);
+
+            for (size_t i = begin; i != end; ++i)
+            {
+                cluster = mClusteredMesh.advanceCluster(cluster, i);
+
+                PointType pA, pB, pC;
+                mClusteredMesh.getTrianglePositions(cluster, i, pA, pB, pC);
+
+                GAL_imp::Solution<NumericType, 3> solution3;
+
+                if (!GAL::IntersectRayTriangleByPoints(ray, pA, pB, pC, solution3))
+                {
+                    // No intersection at all
+                    continue;
+                }
+
+                updateClosestHit(solution3, i, hit);
+            }
+        }
+
+        void hitPrecomputedTriangles(const RayType &ray, size_t begin, size_t end, RayHitType &hit) const
+        {
+            const TriangleRecord *triangles = &mTriangles[0];
+            const size_t         *ordering  = &mBVH.getIndices()[0];
+
+            for (size_t i = begin; i != end; ++i)
+            {
+                const TriangleRecord &triangle = triangles[i];
+
+                GAL_imp::Solution<NumericType, 3> solution3;
+
+                if (!GAL::IntersectRayTriangleByEdges(ray, triangle.position, triangle.edge1, triangle.edge2, solution3))
+                {
+                    // No intersection at all
+                    continue;
+                }
+
+                updateClosestHit(solution3, ordering[i], hit);
+            }
+        }
+    };
+
+    typedef MeshResource<GAL::P3f::PointType> MeshResource3f;
+    typedef MeshResource<GAL::P3d::PointType> MeshResource3d;
+
+#endif
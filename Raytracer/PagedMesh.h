@@ -0,0 +1,709 @@
+#ifndef INCLUDED_PAGED_MESH_H
+#define INCLUDED_PAGED_MESH_H
+
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Mesh.h"
+#include "AABBox.h"
+#include "BVH.h"
+#include "BoundingSphere.h"
+#include "MappedFile.h"
+
+//
+// Header of paged mesh file
+//
+// File consists of header, top of hierarchy, table of pages and pages.
+// Each page keeps subtree of hierarchy together with vertices of its
+// triangles, three per triangle, in order of leaves of the subtree.
+// Leaves of top of hierarchy reference pages. Pages are stored in order of
+// hierarchy and aligned to PagedMesh::Alignment bytes.
+//
+struct PagedMeshHeader
+{
+    char                magic[4];           // "RTPM"
+    unsigned int        version;
+    unsigned int        byteOrder;          // PagedMesh::ByteOrder as written
+    unsigned int        numericSize;        // bytes per number
+    unsigned int        vertexSize;         // bytes per vertex
+    unsigned int        nodeSize;           // bytes per node of hierarchy
+    unsigned long long  numTriangles;
+    unsigned long long  numPages;
+    unsigned long long  numTopNodes;
+    unsigned long long  topNodeOffset;      // in bytes from start of file
+    unsigned long long  pageTableOffset;
+    double              boundsCenter[3];
+    double              boundsRadius;
+};
+
+//
+// Mesh with hierarchy, which is kept in file and paged into memory
+//
+// Only top of hierarchy and table of pages are loaded by open(), pages are
+// read when rays reach them, and least recently used pages are evicted
+// when their memory exceeds budget, so that meshes larger than memory can
+// be rendered. Page, which is in use by ray, stays alive after eviction
+// until the ray is done with it.
+//
+// File is mapped into address space, so that rays of several threads read
+// pages at once without seeking shared stream. Mapping takes address
+// space, but not memory, beyond budget.
+//
+// Triangles are numbered by their position in order of leaves.
+//
+template<class _VertexType, class _IndexType = int>
+    class PagedMesh
+    {
+    public:
+        typedef _VertexType                         VertexType;
+        typedef _IndexType                          IndexType;
+        typedef Mesh<VertexType, IndexType>         MeshType;
+        typedef typename MeshType::AbstractVertex   AbstractVertex;
+        typedef typename MeshType::PointType        PointType;
+        typedef typename MeshType::NumericType      NumericType;
+        typedef GAL_imp::Ray<NumericType,3>         RayType;
+        typedef AABBox<NumericType>                 AABBoxType;
+        typedef BVH<NumericType>                    BVHType;
+        typedef typename BVHType::Node              Node;
+        typedef BoundingSphere<NumericType>         BoundingSphereType;
+
+        enum
+        {
+            Version             = 1,
+            ByteOrder           = 0x01020304,
+            Alignment           = 4096,
+            DefaultPageSize     = 1 << 14   // triangles per page at most
+        };
+
+        //
+        // Entry of table of pages
+        //
+        struct PageEntry
+        {
+            AABBoxType          bounds;
+            unsigned long long  offset;         // in bytes from start of file
+            unsigned long long  numNodes;
+            unsigned long long  firstTriangle;
+            unsigned long long  numTriangles;
+        };
+
+        PagedMesh(): mNumTriangles(0), mMemoryBudget(0), mResidentSize(0), mNumLoads(0)
+        {
+        }
+
+        //
+        // Open file and load top of hierarchy, pages will be kept in
+        // memoryBudget bytes. Returns false if file cannot be read, or it
+        // is not paged mesh of this version, byte order and VertexType.
+        //
+        bool open(const char *path, size_t memoryBudget)
+        {
+            close();
+
+            PagedMeshHeader header;
+
+            if (!mFile.open(path) || !readAt(0, &header, sizeof(header))
+                || 0 != memcmp(header.magic, "RTPM", 4) || Version != header.version || ByteOrder != header.byteOrder
+                || sizeof(NumericType) != header.numericSize || sizeof(VertexType) != header.vertexSize || sizeof(Node) != header.nodeSize
+                || 0 == header.numTopNodes || 0 == header.numPages)
+            {
+                close();
+                return false;
+            }
+
+            const unsigned long long size = mFile.getSize();
+
+            if (size < header.topNodeOffset || (size - header.topNodeOffset) / sizeof(Node) < header.numTopNodes
+                || size < header.pageTableOffset || (size - header.pageTableOffset) / sizeof(PageEntry) < header.numPages)
+            {
+                close();
+                return false;
+            }
+
+            mTopNodes.resize(size_t(header.numTopNodes));
+            mPages.resize(size_t(header.numPages));
+
+            if (!readAt(header.topNodeOffset, &mTopNodes[0], mTopNodes.size() * sizeof(Node))
+                || !readAt(header.pageTableOffset, &mPages[0], mPages.size() * sizeof(PageEntry)))
+            {
+                close();
+                return false;
+            }
+
+            for (size_t i = 0; i != mPages.size(); ++i)
+            {
+                const PageEntry &entry = mPages[i];
+
+                if (0 == entry.numNodes || 0 == entry.numTriangles
+                    || header.numTriangles < entry.numTriangles || 2 * entry.numTriangles < entry.numNodes
+                    || size < entry.offset || size - entry.offset < getPageSize(entry))
+                {
+                    close();
+                    return false;
+                }
+            }
+
+            for (int i = 0; i != 3; ++i)
+            {
+                mBounds.center[i] = NumericType(header.boundsCenter[i]);
+            }
+
+            mBounds.radius = NumericType(header.boundsRadius);
+            mNumTriangles = size_t(header.numTriangles);
+            mMemoryBudget = memoryBudget;
+            mSlots.resize(mPages.size());
+
+            return true;
+        }
+
+        //
+        // Close file and release all pages
+        //
+        void close()
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            mFile.close();
+
+            std::vector<Node>().swap(mTopNodes);
+            std::vector<PageEntry>().swap(mPages);
+            std::vector<Slot>().swap(mSlots);
+
+            mLRU.clear();
+            mResidentSize = 0;
+            mNumLoads = 0;
+            mNumTriangles = 0;
+        }
+
+        bool isOpen() const
+        {
+            return !mTopNodes.empty();
+        }
+
+        //
+        // Memory for pages in bytes, at least one page is always kept
+        //
+        void setMemoryBudget(size_t budget)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            mMemoryBudget = budget;
+            evict();
+        }
+
+        size_t getMemoryBudget() const
+        {
+            return mMemoryBudget;
+        }
+
+        //
+        // Memory used by top of hierarchy, table of pages, and resident
+        // pages in bytes
+        //
+        size_t getMemorySize() const
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            return mTopNodes.size() * sizeof(Node) + mPages.size() * (sizeof(PageEntry) + sizeof(Slot)) + mResidentSize;
+        }
+
+        //
+        // Number of pages read from file since open()
+        //
+        size_t getNumLoads() const
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            return mNumLoads;
+        }
+
+        size_t getNumTriangles() const
+        {
+            return mNumTriangles;
+        }
+
+        const BoundingSphereType & getBounds() const
+        {
+            return mBounds;
+        }
+
+        //
+        // Visit leaves, whose bounds are hit by ray, calling
+        // visitor(vertices, first, count, tMax) for count triangles at
+        // positions [first, first + count) with 3 * count vertices. See
+        // BVH::traverse() for tMax.
+        //
+        // Leaves of resident pages are visited in near to far order, while
+        // pages, which are not resident, are deferred until top of
+        // hierarchy is traversed. Only those of them, which are still
+        // nearer than tMax, are then read, nearest first, so that pages
+        // hidden behind hits in resident pages are not read at all.
+        //
+        template<class Visitor>
+            void traverse(const RayType &ray, NumericType tMax, Visitor &visitor) const
+            {
+                if (mTopNodes.empty())
+                {
+                    return;
+                }
+
+                std::vector<Deferred> deferred;
+                TopVisitor<Visitor> topVisitor = { this, &ray, &visitor, &deferred, &tMax };
+
+                BVHType::traverseNodes(&mTopNodes[0], mTopNodes.size(), ray, tMax, topVisitor);
+
+                std::sort(deferred.begin(), deferred.end());
+
+                for (size_t i = 0; i != deferred.size() && deferred[i].tNear <= tMax; ++i)
+                {
+                    const std::shared_ptr<const Page> page = getPage(deferred[i].page, true);
+
+                    if (0 != page)
+                    {
+                        traversePage(*page, mPages[deferred[i].page], ray, tMax, visitor);
+                    }
+                }
+            }
+
+        //
+        // Vertices of triangle at given position, page of which is read if
+        // it is not resident
+        //
+        void getTriangleVertices(size_t triangle, VertexType &v0, VertexType &v1, VertexType &v2) const
+        {
+            const size_t index = findPage(triangle);
+            const std::shared_ptr<const Page> page = getPage(index, true);
+
+            if (0 == page)
+            {
+                v0 = v1 = v2 = VertexType();
+                return;
+            }
+
+            const VertexType *vertices = &page->vertices[3 * size_t(triangle - mPages[index].firstTriangle)];
+
+            v0 = vertices[0];
+            v1 = vertices[1];
+            v2 = vertices[2];
+        }
+
+        //
+        // Write mesh with its hierarchy into paged file
+        //
+        // Hierarchy is cut into subtrees of at most pageSize triangles,
+        // which become pages. Returns false if hierarchy is empty or has
+        // released nodes, or file cannot be written.
+        //
+        static bool write(const char *path, const MeshType &mesh, const BVHType &bvh, const BoundingSphereType &bounds, size_t pageSize = DefaultPageSize)
+        {
+            const Node *nodes = bvh.getNodePointer();
+            const size_t numNodes = bvh.getNumNodes();
+            const std::vector<size_t> &indices = bvh.getIndices();
+
+            if (0 == numNodes || indices.size() != mesh.getNumIndices() / 3)
+            {
+                return false;
+            }
+
+            //
+            // Children follow their parents, so subtrees are known after
+            // their children
+            //
+            std::vector<size_t> subtreeSize(numNodes), firstTriangle(numNodes), numTriangles(numNodes);
+
+            for (size_t i = numNodes; 0 != i--; )
+            {
+                const Node &node = nodes[i];
+
+                if (0 != node.count)
+                {
+                    subtreeSize[i] = 1;
+                    firstTriangle[i] = node.offset;
+                    numTriangles[i] = node.count;
+                }
+                else
+                {
+                    subtreeSize[i] = 1 + subtreeSize[i + 1] + subtreeSize[node.offset];
+                    firstTriangle[i] = firstTriangle[i + 1];
+                    numTriangles[i] = numTriangles[i + 1] + numTriangles[node.offset];
+                }
+            }
+
+            std::vector<Node> topNodes;
+            std::vector<size_t> pageRoots;
+
+            cut(nodes, 0, Max<size_t>(pageSize, 1), numTriangles, topNodes, pageRoots);
+
+            PagedMeshHeader header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, "RTPM", 4);
+
+            header.version = Version;
+            header.byteOrder = ByteOrder;
+            header.numericSize = sizeof(NumericType);
+            header.vertexSize = sizeof(VertexType);
+            header.nodeSize = sizeof(Node);
+            header.numTriangles = indices.size();
+            header.numPages = pageRoots.size();
+            header.numTopNodes = topNodes.size();
+            header.topNodeOffset = align(sizeof(header));
+            header.pageTableOffset = align(header.topNodeOffset + topNodes.size() * sizeof(Node));
+
+            for (int i = 0; i != 3; ++i)
+            {
+                header.boundsCenter[i] = double(bounds.center[i]);
+            }
+
+            header.boundsRadius = double(bounds.radius);
+
+            std::vector<PageEntry> pages(pageRoots.size());
+            unsigned long long offset = align(header.pageTableOffset + pages.size() * sizeof(PageEntry));
+
+            for (size_t i = 0; i != pages.size(); ++i)
+            {
+                const size_t root = pageRoots[i];
+
+                pages[i].bounds = nodes[root].bounds;
+                pages[i].offset = offset;
+                pages[i].numNodes = subtreeSize[root];
+                pages[i].firstTriangle = firstTriangle[root];
+                pages[i].numTriangles = numTriangles[root];
+
+                offset = align(offset + pages[i].numNodes * sizeof(Node) + 3 * pages[i].numTriangles * sizeof(VertexType));
+            }
+
+            std::ofstream stream(path, std::ios::out | std::ios::binary | std::ios::trunc);
+
+            if (!stream)
+            {
+                return false;
+            }
+
+            unsigned long long position = 0;
+
+            writeSection(stream, position, 0, &header, sizeof(header));
+            writeSection(stream, position, header.topNodeOffset, &topNodes[0], topNodes.size() * sizeof(Node));
+            writeSection(stream, position, header.pageTableOffset, &pages[0], pages.size() * sizeof(PageEntry));
+
+            const VertexType *meshVertices = mesh.getVertexPointer();
+            const IndexType  *meshIndices  = mesh.getIndexPointer();
+
+            std::vector<Node>       pageNodes;
+            std::vector<VertexType> pageVertices;
+
+            for (size_t i = 0; i != pages.size() && stream.good(); ++i)
+            {
+                const size_t root = pageRoots[i];
+                const size_t first = firstTriangle[root];
+
+                //
+                // Subtree is contiguous, children are made relative to its
+                // root, and leaves to its first triangle
+                //
+                pageNodes.assign(nodes + root, nodes + root + subtreeSize[root]);
+
+                for (size_t j = 0; j != pageNodes.size(); ++j)
+                {
+                    pageNodes[j].offset -= (0 != pageNodes[j].count ? first : root);
+                }
+
+                pageVertices.resize(3 * numTriangles[root]);
+
+                for (size_t j = 0; j != numTriangles[root]; ++j)
+                {
+                    const size_t triangle = indices[first + j];
+
+                    for (int k = 0; k != 3; ++k)
+                    {
+                        pageVertices[3*j+k] = meshVertices[meshIndices[3*triangle+k]];
+                    }
+                }
+
+                writeSection(stream, position, pages[i].offset, &pageNodes[0], pageNodes.size() * sizeof(Node));
+                writeSection(stream, position, position, &pageVertices[0], pageVertices.size() * sizeof(VertexType));
+            }
+
+            return stream.good();
+        }
+
+    private:
+        //
+        // Page read into memory
+        //
+        struct Page
+        {
+            std::vector<Node>       nodes;
+            std::vector<VertexType> vertices;
+        };
+
+        //
+        // Resident page and its position in list of least recently used
+        //
+        struct Slot
+        {
+            std::shared_ptr<const Page>     page;
+            std::list<size_t>::iterator     position;
+        };
+
+        struct Deferred
+        {
+            size_t      page;
+            NumericType tNear;
+
+            bool operator < (const Deferred &other) const
+            {
+                return (tNear < other.tNear);
+            }
+        };
+
+        //
+        // Visits resident pages reached in top of hierarchy, and defers the
+        // others
+        //
+        template<class Visitor>
+            struct TopVisitor
+            {
+                const PagedMesh        *mesh;
+                const RayType          *ray;
+                Visitor                *visitor;
+                std::vector<Deferred>  *deferred;
+                NumericType            *closest;    // tMax of whole traversal
+
+                void operator () (size_t page, size_t, NumericType &tMax) const
+                {
+                    const std::shared_ptr<const Page> resident = mesh->getPage(page, false);
+
+                    if (0 != resident)
+                    {
+                        mesh->traversePage(*resident, mesh->mPages[page], *ray, tMax, *visitor);
+                        *closest = tMax;
+                        return;
+                    }
+
+                    PointType invDirection;
+
+                    for (int i = 0; i != 3; ++i)
+                    {
+                        invDirection[i] = 1 / ray->direction[i];
+                    }
+
+                    Deferred entry;
+                    entry.page = page;
+
+                    if (TestRayAABBox(ray->start, invDirection, mesh->mPages[page].bounds, tMax, entry.tNear))
+                    {
+                        deferred->push_back(entry);
+                    }
+                }
+            };
+
+        //
+        // Calls visitor with vertices of leaves of page
+        //
+        template<class Visitor>
+            struct PageVisitor
+            {
+                const Page     *page;
+                size_t          firstTriangle;
+                Visitor        *visitor;
+                NumericType    *closest;    // tMax of traversal of pages
+
+                void operator () (size_t begin, size_t end, NumericType &tMax) const
+                {
+                    (*visitor)(&page->vertices[3 * begin], firstTriangle + begin, end - begin, tMax);
+                    *closest = Min(*closest, tMax);
+                }
+            };
+
+        std::vector<Node>                   mTopNodes;  // leaves reference pages
+        std::vector<PageEntry>              mPages;
+        BoundingSphereType                  mBounds;
+        size_t                              mNumTriangles;
+        size_t                              mMemoryBudget;
+
+        mutable std::mutex                  mMutex;     // guards members below
+        mutable std::vector<Slot>           mSlots;     // per page
+        mutable std::list<size_t>           mLRU;       // resident pages, most recently used first
+        mutable size_t                      mResidentSize;
+        mutable size_t                      mNumLoads;
+
+        MappedFile                          mFile;
+
+        template<class Visitor>
+            void traversePage(const Page &page, const PageEntry &entry, const RayType &ray, NumericType &tMax, Visitor &visitor) const
+            {
+                PageVisitor<Visitor> pageVisitor = { &page, size_t(entry.firstTriangle), &visitor, &tMax };
+
+                BVHType::traverseNodes(&page.nodes[0], page.nodes.size(), ray, tMax, pageVisitor);
+            }
+
+        //
+        // Resident page, which is read unless load is false. Returns null
+        // if page is not resident and is not loaded, or it cannot be read.
+        //
+        std::shared_ptr<const Page> getPage(size_t index, bool load) const
+        {
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                Slot &slot = mSlots[index];
+
+                if (0 != slot.page)
+                {
+                    mLRU.splice(mLRU.begin(), mLRU, slot.position);
+                    return slot.page;
+                }
+            }
+
+            if (!load)
+            {
+                return std::shared_ptr<const Page>();
+            }
+
+            //
+            // Page is read without holding lock of pages, so that other
+            // rays can proceed with resident pages and read other ones
+            //
+            const PageEntry &entry = mPages[index];
+            std::shared_ptr<Page> page(new Page());
+
+            page->nodes.resize(size_t(entry.numNodes));
+            page->vertices.resize(3 * size_t(entry.numTriangles));
+
+            if (!readAt(entry.offset, &page->nodes[0], page->nodes.size() * sizeof(Node))
+                || !readAt(entry.offset + page->nodes.size() * sizeof(Node), &page->vertices[0], page->vertices.size() * sizeof(VertexType)))
+            {
+                return std::shared_ptr<const Page>();
+            }
+
+            std::lock_guard<std::mutex> lock(mMutex);
+            Slot &slot = mSlots[index];
+
+            if (0 != slot.page)
+            {
+                // Other ray has read it meanwhile
+                mLRU.splice(mLRU.begin(), mLRU, slot.position);
+                return slot.page;
+            }
+
+            slot.page = page;
+            mLRU.push_front(index);
+            slot.position = mLRU.begin();
+
+            mResidentSize += getPageSize(entry);
+            ++mNumLoads;
+
+            evict();
+
+            return page;
+        }
+
+        //
+        // Evict least recently used pages over budget, lock has to be held
+        //
+        void evict() const
+        {
+            while (mMemoryBudget < mResidentSize && 1 < mLRU.size())
+            {
+                const size_t index = mLRU.back();
+
+                mLRU.pop_back();
+                mSlots[index].page.reset();
+                mResidentSize -= getPageSize(mPages[index]);
+            }
+        }
+
+        //
+        // Page containing triangle at given position
+        //
+        size_t findPage(size_t triangle) const
+        {
+            size_t low = 0, high = mPages.size();
+
+            while (1 < high - low)
+            {
+                const size_t middle = (low + high) / 2;
+
+                if (triangle < mPages[middle].firstTriangle)
+                {
+                    high = middle;
+                }
+                else
+                {
+                    low = middle;
+                }
+            }
+
+            return low;
+        }
+
+        static size_t getPageSize(const PageEntry &entry)
+        {
+            return size_t(entry.numNodes * sizeof(Node) + 3 * entry.numTriangles * sizeof(VertexType));
+        }
+
+        bool readAt(unsigned long long offset, void *data, size_t size) const
+        {
+            if (mFile.getSize() < offset || mFile.getSize() - offset < size)
+            {
+                return false;
+            }
+
+            memcpy(data, mFile.getData() + size_t(offset), size);
+            return true;
+        }
+
+        //
+        // Cut hierarchy into top and subtrees of pages, returns index of
+        // top node of given node
+        //
+        static size_t cut(
+            const Node                 *nodes,
+            size_t                      index,
+            size_t                      pageSize,
+            const std::vector<size_t>  &numTriangles,
+            std::vector<Node>          &topNodes,
+            std::vector<size_t>        &pageRoots)
+        {
+            const size_t topIndex = topNodes.size();
+            topNodes.push_back(nodes[index]);
+
+            if (0 != nodes[index].count || numTriangles[index] <= pageSize)
+            {
+                topNodes[topIndex].offset = pageRoots.size();
+                topNodes[topIndex].count = numTriangles[index];
+                pageRoots.push_back(index);
+                return topIndex;
+            }
+
+            cut(nodes, index + 1, pageSize, numTriangles, topNodes, pageRoots);
+            topNodes[topIndex].offset = cut(nodes, nodes[index].offset, pageSize, numTriangles, topNodes, pageRoots);
+
+            return topIndex;
+        }
+
+        static unsigned long long align(unsigned long long offset)
+        {
+            return (offset + Alignment - 1) / Alignment * Alignment;
+        }
+
+        static void writeSection(std::ofstream &stream, unsigned long long &position, unsigned long long offset, const void *data, size_t size)
+        {
+            static const char padding[Alignment] = { 0 };
+
+            stream.write(padding, std::streamsize(offset - position));
+            stream.write(static_cast<const char *>(data), std::streamsize(size));
+
+            position = offset + size;
+        }
+
+        PagedMesh(const PagedMesh &);
+        PagedMesh &operator = (const PagedMesh &);
+    };
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef INCLUDED_PARALLEL_H
+#define INCLUDED_PARALLEL_H
+
+#include <thread>
+#include <vector>
+
+#include "MinMax.h"
+
+//
+// Fork-join helpers built on std::thread
+//
+// Work of given size is split into consecutive chunks, at most one chunk per
+// available thread, and at least grainSize items per chunk, so small inputs
+// are processed on calling thread only. Last chunk is always processed on
+// calling thread.
+//
+// Nested parallel work shares threads of its caller: each chunk of
+// ParallelForChunks() runs its nested work on its own thread only, and the
+// two tasks of ParallelInvoke() split threads available to caller between
+// them. Hence nested calls (e.g. binning within subtrees built in
+// parallel) do not start more threads than there are hardware threads.
+//
+
+namespace Parallel_imp {
+
+    //
+    // Threads available to parallel work started by this thread, 0 for
+    // all hardware threads
+    //
+    inline size_t & GetThreadBudget()
+    {
+        static thread_local size_t budget = 0;
+        return budget;
+    }
+
+    //
+    // Sets thread budget of calling thread until destroyed
+    //
+    class BudgetScope
+    {
+    public:
+        explicit BudgetScope(size_t budget): mSaved(GetThreadBudget())
+        {
+            GetThreadBudget() = budget;
+        }
+
+        ~BudgetScope()
+        {
+            GetThreadBudget() = mSaved;
+        }
+
+    private:
+        size_t mSaved;
+
+        BudgetScope(const BudgetScope &);
+        BudgetScope &operator = (const BudgetScope &);
+    };
+
+} // namespace Parallel_imp
+
+inline size_t GetNumThreads()
+{
+    size_t numThreads = std::thread::hardware_concurrency();
+
+    return (0 == numThreads ? 1 : numThreads);
+}
+
+//
+// Threads available to calling thread, all of them unless it runs nested
+// parallel work
+//
+inline size_t GetAvailableThreads()
+{
+    const size_t budget = Parallel_imp::GetThreadBudget();
+
+    return (0 == budget ? GetNumThreads() : budget);
+}
+
+inline size_t GetNumChunks(size_t count, size_t grainSize)
+{
+    if (0 == grainSize)
+    {
+        grainSize = 1;
+    }
+
+    size_t numChunks = (count + grainSize - 1) / grainSize;
+
+    return Max<size_t>(1, Min(numChunks, GetAvailableThreads()));
+}
+
+//
+// Calls function(chunk, begin, end) for each of numChunks chunks of [0, count),
+// where numChunks should be given by GetNumChunks()
+//
+template<class Function>
+    void ParallelForChunks(size_t count, size_t numChunks, Function function)
+    {
+        if (numChunks <= 1)
+        {
+            function(0, 0, count);
+            return;
+        }
+
+        std::vector<std::thread> threads;
+        threads.reserve(numChunks - 1);
+
+        for (size_t chunk = 0; chunk + 1 < numChunks; ++chunk)
+        {
+            const size_t begin = count * chunk / numChunks;
+            const size_t end = count * (chunk + 1) / numChunks;
+
+            threads.push_back(std::thread(
+                [&function, chunk, begin, end]()
+                {
+                    Parallel_imp::BudgetScope scope(1);
+                    function(chunk, begin, end);
+                }));
+        }
+
+        {
+            Parallel_imp::BudgetScope scope(1);
+            function(numChunks - 1, count * (numChunks - 1) / numChunks, count);
+        }
+
+        for (size_t i = 0; i != threads.size(); ++i)
+        {
+            threads[i].join();
+        }
+    }
+
+//
+// Calls function(begin, end) for chunks of [0, count) in parallel
+//
+template<class Function>
+    void ParallelFor(size_t count, size_t grainSize, Function function)
+    {
+        ParallelForChunks(count, GetNumChunks(count, grainSize),
+            [&function](size_t, size_t begin, size_t end)
+            {
+                function(begin, end);
+            });
+    }
+
+//
+// Calls first() on new thread and second() on calling thread, and waits
+// until both finish. Used for task parallelism of recursive algorithms,
+// which should limit depth of recursion, at which tasks are created.
+//
+template<class First, class Second>
+    void ParallelInvoke(First first, Second second)
+    {
+        const size_t budget = GetAvailableThreads();
+        const size_t firstBudget = Max<size_t>(1, budget / 2);
+        const size_t secondBudget = Max<size_t>(1, budget - firstBudget);
+
+        std::thread thread(
+            [&first, firstBudget]()
+            {
+                Parallel_imp::BudgetScope scope(firstBudget);
+                first();
+            });
+
+        {
+            Parallel_imp::BudgetScope scope(secondBudget);
+            second();
+        }
+
+        thread.join();
+    }
+
+//
+// Parallel reduction
+//
+// Calls function(begin, end, result) for chunks of [0, count) in parallel,
+// where each chunk accumulates into its own copy of identity. Partial results
+// are then merged in order on calling thread by combine(result, partial).
+//
+template<class ResultType, class Function, class Combine>
+    ResultType ParallelReduce(size_t count, size_t grainSize, const ResultType &identity, Function function, Combine combine)
+    {
+        size_t numChunks = GetNumChunks(count, grainSize);
+        std::vector<ResultType> partial(numChunks, identity);
+
+        ParallelForChunks(count, numChunks,
+            [&function, &partial](size_t chunk, size_t begin, size_t end)
+            {
+                function(begin, end, partial[chunk]);
+            });
+
+        ResultType result = partial[0];
+
+        for (size_t i = 1; i < numChunks; ++i)
+        {
+            combine(result, partial[i]);
+        }
+
+        return result;
+    }
+
+#endif
@@ -0,0 +1,324 @@
+#ifndef INCLUDED_QUANTIZED_BVH_H
+#define INCLUDED_QUANTIZED_BVH_H
+
+#include <vector>
+#include <limits>
+#include <cmath>
+
+#include "MinMax.h"
+#include "Intersect.h"
+#include "AABBox.h"
+#include "WideBVH.h"
+
+//
+// Compressed form of wide bounding volume hierarchy
+//
+// Bounds of children are quantized to 8 bits per plane on grid spanning
+// bounds of their parent, and children are referenced by 32-bit indices.
+// Node is about 4 times smaller than node of WideBVH, so that more of
+// the hierarchy fits into cache. Planes are decoded during traversal.
+//
+// Grid step is power of two, so that q * step is exact, and quantized
+// bounds are rounded outwards, so they always contain original bounds of
+// children.
+//
+template<class _NumericType, int _Width>
+    class QuantizedBVH
+    {
+    public:
+        typedef _NumericType                        NumericType;
+        typedef GAL_imp::Point<NumericType,3>       PointType;
+        typedef GAL_imp::Ray<NumericType,3>         RayType;
+        typedef AABBox<NumericType>                 AABBoxType;
+        typedef WideBVH<NumericType, _Width>        WideBVHType;
+
+        enum
+        {
+            Width       = _Width,
+            MaxDepth    = WideBVHType::MaxDepth,
+            MaxLevel    = 255,  // highest quantized plane
+            MaxCount    = 255   // most primitives in leaf
+        };
+
+        //
+        // Plane of child on axis a is origin[a] + q * scale[a], where q is
+        // qMin[a][i] or qMax[a][i]. Child is leaf if count is not zero, see
+        // WideBVH::Node. Unused children have empty bounds.
+        //
+        struct Node
+        {
+            NumericType     origin[3];
+            NumericType     scale[3];
+            unsigned char   qMin[3][Width];
+            unsigned char   qMax[3][Width];
+            unsigned int    child[Width];
+            unsigned char   count[Width];
+        };
+
+        //
+        // Compress wide hierarchy, nodes keep their indices
+        //
+        // Returns false and leaves hierarchy empty, if number of nodes or
+        // primitives does not fit into 32 bits, or leaf has more than
+        // MaxCount primitives (binary hierarchy may stop splitting at its
+        // depth limit, see BVH). Wide hierarchy should be used then.
+        //
+        bool build(const WideBVHType &bvh)
+        {
+            const std::vector<typename WideBVHType::Node> &nodes = bvh.getNodes();
+
+            clear();
+
+            for (size_t i = 0; i != nodes.size(); ++i)
+            {
+                for (int j = 0; j != Width; ++j)
+                {
+                    if (size_t(MaxCount) < nodes[i].count[j] ||
+                        size_t((std::numeric_limits<unsigned int>::max)()) < nodes[i].child[j])
+                    {
+                        return false;
+                    }
+                }
+            }
+
+            mNodes.resize(nodes.size());
+
+            for (size_t i = 0; i != nodes.size(); ++i)
+            {
+                compress(nodes[i], mNodes[i]);
+            }
+
+            std::vector<Node>(mNodes).swap(mNodes);
+            return true;
+        }
+
+        //
+        // Release memory of nodes
+        //
+        void clear()
+        {
+            std::vector<Node>().swap(mNodes);
+        }
+
+        bool isEmpty() const
+        {
+            return mNodes.empty();
+        }
+
+        //
+        // Memory used by nodes in bytes
+        //
+        size_t getMemorySize() const
+        {
+            return mNodes.size() * sizeof(Node);
+        }
+
+        //
+        // Visit leaves, whose bounds are hit by ray, in near to far order.
+        //
+        // See WideBVH::traverse()
+        //
+        template<class Visitor>
+            void traverse(const RayType &ray, NumericType tMax, Visitor &visitor) const
+            {
+                if (mNodes.empty())
+                {
+                    return;
+                }
+
+                PointType invDirection;
+
+                for (int i = 0; i != 3; ++i)
+                {
+                    invDirection[i] = 1 / ray.direction[i];
+                }
+
+                StackEntry stack[MaxDepth * Width];
+                size_t stackSize = 0;
+
+                stack[stackSize].child = 0;
+                stack[stackSize].count = 0;
+                stack[stackSize].tNear = 0;
+                ++stackSize;
+
+                while (0 != stackSize)
+                {
+                    const StackEntry entry = stack[--stackSize];
+
+                    if (tMax < entry.tNear)
+                    {
+                        continue;
+                    }
+
+                    if (0 != entry.count)
+                    {
+                        visitor(size_t(entry.child), size_t(entry.child) + entry.count, tMax);
+                        continue;
+                    }
+
+                    const Node &node = mNodes[entry.child];
+
+                    NumericType tNear[Width];
+                    bool        hit[Width];
+
+                    testChildren(node, ray.start, invDirection, tMax, tNear, hit);
+
+                    //
+                    // Push children far to near, so that nearest is popped
+                    // first
+                    //
+                    const size_t first = stackSize;
+
+                    for (int i = 0; i != Width; ++i)
+                    {
+                        if (!hit[i])
+                        {
+                            continue;
+                        }
+
+                        StackEntry child;
+                        child.child = node.child[i];
+                        child.count = node.count[i];
+                        child.tNear = tNear[i];
+
+                        size_t j = stackSize++;
+
+                        for (; first != j && stack[j - 1].tNear < child.tNear; --j)
+                        {
+                            stack[j] = stack[j - 1];
+                        }
+
+                        stack[j] = child;
+                    }
+                }
+            }
+
+    private:
+        std::vector<Node> mNodes;
+
+        struct StackEntry
+        {
+            unsigned int    child;
+            unsigned int    count;
+            NumericType     tNear;
+        };
+
+        //
+        // Slab test of all children at once
+        //
+        // Distance to plane (origin + q * scale - start) / direction is
+        // evaluated as a + q * b with a and b per node and axis, so decoding
+        // costs single multiply-add per plane.
+        //
+        static void testChildren(
+            const Node         &node,
+            const PointType    &start,
+            const PointType    &invDirection,
+            NumericType         tMax,
+            NumericType        *tNear,
+            bool               *hit)
+        {
+            const NumericType ax = (node.origin[0] - start[0]) * invDirection[0], bx = node.scale[0] * invDirection[0];
+            const NumericType ay = (node.origin[1] - start[1]) * invDirection[1], by = node.scale[1] * invDirection[1];
+            const NumericType az = (node.origin[2] - start[2]) * invDirection[2], bz = node.scale[2] * invDirection[2];
+
+            const unsigned char *nearX = (0 <= invDirection[0] ? node.qMin[0] : node.qMax[0]);
+            const unsigned char *farX  = (0 <= invDirection[0] ? node.qMax[0] : node.qMin[0]);
+            const unsigned char *nearY = (0 <= invDirection[1] ? node.qMin[1] : node.qMax[1]);
+            const unsigned char *farY  = (0 <= invDirection[1] ? node.qMax[1] : node.qMin[1]);
+            const unsigned char *nearZ = (0 <= invDirection[2] ? node.qMin[2] : node.qMax[2]);
+            const unsigned char *farZ  = (0 <= invDirection[2] ? node.qMax[2] : node.qMin[2]);
+
+            for (int i = 0; i != Width; ++i)
+            {
+                // NaN of ray parallel to axis is ignored (see TestRayAABBox())
+                NumericType tn = Max(ax + NumericType(nearX[i]) * bx, Max(ay + NumericType(nearY[i]) * by, Max(az + NumericType(nearZ[i]) * bz, NumericType(0))));
+                NumericType tf = Min(ax + NumericType(farX[i]) * bx, Min(ay + NumericType(farY[i]) * by, Min(az + NumericType(farZ[i]) * bz, tMax)));
+
+                tNear[i] = tn;
+                hit[i] = (tn <= tf);
+            }
+        }
+
+        //
+        // Quantize planes of children on single axis
+        //
+        static void quantizeAxis(
+            const NumericType  *mins,
+            const NumericType  *maxs,
+            NumericType        &origin,
+            NumericType        &scale,
+            unsigned char      *qMin,
+            unsigned char      *qMax)
+        {
+            NumericType low = (std::numeric_limits<NumericType>::max)();
+            NumericType high = -(std::numeric_limits<NumericType>::max)();
+
+            for (int i = 0; i != Width; ++i)
+            {
+                if (mins[i] <= maxs[i])
+                {
+                    low = Min(low, mins[i]);
+                    high = Max(high, maxs[i]);
+                }
+            }
+
+            if (high < low)
+            {
+                // No children
+                low = high = 0;
+            }
+
+            //
+            // Smallest power of two step, for which MaxLevel - 1 steps
+            // cover the extent, leaving one step for rounding of origin
+            //
+            int exponent = 0;
+            std::frexp((high - low) / NumericType(MaxLevel - 1), &exponent);
+
+            origin = low;
+            scale = (low < high ? std::ldexp(NumericType(1), exponent) : NumericType(1));
+
+            for (int i = 0; i != Width; ++i)
+            {
+                if (maxs[i] < mins[i])
+                {
+                    qMin[i] = MaxLevel;
+                    qMax[i] = 0;
+                    continue;
+                }
+
+                int lower = int(Min(Max(std::floor((mins[i] - origin) / scale), NumericType(0)), NumericType(MaxLevel)));
+                int upper = int(Min(Max(std::ceil ((maxs[i] - origin) / scale), NumericType(0)), NumericType(MaxLevel)));
+
+                // Correct rounding of division, so that decoded bounds contain original ones
+                while (0 < lower && mins[i] < origin + NumericType(lower) * scale)
+                {
+                    --lower;
+                }
+
+                while (upper < MaxLevel && origin + NumericType(upper) * scale < maxs[i])
+                {
+                    ++upper;
+                }
+
+                qMin[i] = (unsigned char)lower;
+                qMax[i] = (unsigned char)upper;
+            }
+        }
+
+        static void compress(const typename WideBVHType::Node &wide, Node &node)
+        {
+            quantizeAxis(wide.xMin, wide.xMax, node.origin[0], node.scale[0], node.qMin[0], node.qMax[0]);
+            quantizeAxis(wide.yMin, wide.yMax, node.origin[1], node.scale[1], node.qMin[1], node.qMax[1]);
+            quantizeAxis(wide.zMin, wide.zMax, node.origin[2], node.scale[2], node.qMin[2], node.qMax[2]);
+
+            for (int i = 0; i != Width; ++i)
+            {
+                node.child[i] = (unsigned int)wide.child[i];
+                node.count[i] = (unsigned char)wide.count[i];
+            }
+        }
+    };
+
+#endif
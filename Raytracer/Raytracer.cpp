@@ -94,71 +94,6 @@ double manifoldFunction(double x, double y)
     return -0.5 * x * x - 0.75 * y * y;
 }
 
-void manifold(Mesh<Vertex3d> &mesh, const int N)
-{
-    const int M = N - 1;
-    const double L = ((double)N) / 2.0;
-
-    std::vector<Vertex3d> vertices{}; 
-    std::vector<int> indices{};
-    
-    vertices.resize(N * N);
-    indices.resize(M* M * 6);
-
-    int index = 0;
-
-    for (int ix = 0; ix < N; ++ix)
-    {
-        for (int iy = 0; iy < N; ++iy)
-        {
-            double x = (1.0 * ix - L + 0.5) / L;
-            double y = (1.0 * iy - L + 0.5) / L;
-            double z = manifoldFunction(x,y);
-
-
-            double xdx = x + 0.01;
-            double ydy = y + 0.01;
-            double zdx = manifoldFunction(xdx, y);
-            double zdy = manifoldFunction(x, ydy);
-
-            GAL::P3d p0(x,y,z);
-            GAL::P3d pdx(xdx, y, zdx);
-            GAL::P3d pdy(x, ydy, zdy);
-
-            GAL::P3d nor = GAL::Cross(pdx - p0, pdy - p0);
-            
-            vertices[index].position = p0;
-            vertices[index].normal = nor / GAL::Len(nor);
-            ++index;
-        }
-    }
-
-    index = 0;
-
-    for (int n = 0; n < M; ++n)
-    {
-        for (int m = 0; m < M; ++m)
-        {
-            int i0 = n * N + m;
-            int i1 = i0 + 1;
-            int i2 = i0 + N;
-            int i3 = i0 + N + 1;
-
-            indices[index++] = i0;
-            indices[index++] = i2;
-            indices[index++] = i1;
-
-            indices[index++] = i1;
-            indices[index++] = i2;
-            indices[index++] = i3;
-        }
-    }
-
-    mesh.addVertices(vertices.data(), vertices.size());
-    mesh.addIndices(indices.data(), indices.size());
-}
-
-
 Raytracer::Raytracer(int iNumThreads, int iTextureSize, int iManifoldDetail): texture(0), textureSize(iTextureSize), numThreads(iNumThreads)
 {
     std::shared_ptr<Clump3d> clump(new Clump3d);
@@ -169,13 +104,13 @@ Raytracer::Raytracer(int iNumThreads, int iTextureSize, int iManifoldDetail): te
 
     std::shared_ptr<MeshGeometry3d> geom1(new MeshGeometry3d());
     cube(geom1->getMesh());
+    geom1->setPrecomputeTriangles(true);
     geom1->meshChanged();
     geom1->setColor(GAL::P4d(1.0, 0.0, 0.0, 1.0));
     geom1->setReflective(true);
 
-    std::shared_ptr<MeshGeometry3d> geom5(new MeshGeometry3d());
-    cube(geom5->getMesh());
-    geom5->meshChanged();
+    // Second cube is an instance sharing mesh resource of the first one
+    std::shared_ptr<MeshGeometry3d> geom5(new MeshGeometry3d(geom1->getResource()));
     geom5->setColor(GAL::P4d(0.0, 0.7, 1.0, 1.0));
     geom5->setReflective(true);
 
@@ -183,9 +118,14 @@ Raytracer::Raytracer(int iNumThreads, int iTextureSize, int iManifoldDetail): te
     // Manifold
     //
 
-    std::shared_ptr<MeshGeometry<Vertex3d> > geom3(new MeshGeometry<Vertex3d>());
-    manifold(geom3->getMesh(), iManifoldDetail);
-    geom3->meshChanged();
+    // Samples are placed at centers of N by N cells covering [-1, 1] by [-1, 1]
+    const double extent = 1.0 - 1.0 / iManifoldDetail;
+
+    std::shared_ptr<HeightfieldGeometry3d> geom3(new HeightfieldGeometry3d(iManifoldDetail, iManifoldDetail, -extent, extent, -extent, extent));
+    geom3->sample(manifoldFunction);
+
+    Console::Out() << "Manifold heightfield of " << geom3->getNumX() << " x " << geom3->getNumY()
+        << " samples, memory: " << geom3->getMemorySize() << " bytes";
     geom3->setColor(GAL::P4d(1.0, 1.0, 0.0, 1.0));
     geom3->setReflective(true);
 
@@ -414,6 +354,8 @@ void Raytracer::startRaytrace()
     threads.clear();
     needRedraw = false;
 
+    scene.update();
+
     if (textureSize)
     {
         prepareTargetBuffer(textureSize, textureSize);
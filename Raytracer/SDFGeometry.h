@@ -0,0 +1,565 @@
+#ifndef INCLUDED_SDF_GEOMETRY_H
+#define INCLUDED_SDF_GEOMETRY_H
+
+#include <cmath>
+#include <vector>
+#include <limits>
+
+#include "MinMax.h"
+#include "AABBox.h"
+#include "BoundingSphere.h"
+#include "BVH.h"
+#include "Geometry.h"
+#include "Parallel.h"
+
+//
+// Surface given by signed distance field sampled on sparse voxel grid
+//
+// Samples are placed at numX by numY by numZ points of grid with spacing
+// voxelSize starting at origin. Distance is negative inside of surface.
+// Grid is split into bricks of BrickSize^3 voxels, and only bricks, which
+// surface crosses, are stored, each with its own (BrickSize + 1)^3 samples,
+// so that it is interpolated without access to its neighbours.
+//
+// Hierarchy is built over bricks, so that empty space between them is
+// skipped, and ray is sphere traced only through bricks it enters, nearest
+// first. Steps are at most one voxel long, and crossing of surface found
+// between two steps is refined by bisection, hence fields, which are not
+// exact distances (e.g. densities of volumetric scan minus iso-level),
+// are traced as well. Normal is gradient of trilinearly interpolated field.
+//
+// Rays hit surface only from outside, as triangles of meshes are hit only
+// from front. Primitive of hit is brick.
+//
+template<class _NumericType>
+    class SDFGeometry : public Geometry<_NumericType>
+    {
+    public:
+        typedef Geometry<_NumericType>                  BaseType;
+        typedef typename BaseType::NumericType          NumericType;
+        typedef typename BaseType::PointType            PointType;
+        typedef typename BaseType::RayType              RayType;
+        typedef typename BaseType::IntersectionPointType IntersectionPointType;
+        typedef typename BaseType::RayHitType           RayHitType;
+        typedef typename BaseType::BoundingSphereType   BoundingSphereType;
+        typedef AABBox<NumericType>                     AABBoxType;
+        typedef BVH<NumericType>                        BVHType;
+
+        enum
+        {
+            BrickSize       = 8,
+            BrickSamples    = BrickSize + 1,
+            SamplesPerBrick = BrickSamples * BrickSamples * BrickSamples,
+            MinStepDivisor  = 16,   // shortest step is voxel size divided by it
+            NumRefineSteps  = 16
+        };
+
+        //
+        // Empty field, samples are set by sample() or setSamples()
+        //
+        SDFGeometry(size_t numX, size_t numY, size_t numZ, const PointType &origin, NumericType voxelSize)
+            : mOrigin(origin), mVoxelSize(voxelSize)
+        {
+            mNumSamples[0] = Max<size_t>(numX, 2);
+            mNumSamples[1] = Max<size_t>(numY, 2);
+            mNumSamples[2] = Max<size_t>(numZ, 2);
+
+            samplesChanged();
+        }
+
+        size_t getNumX() const
+        {
+            return mNumSamples[0];
+        }
+
+        size_t getNumY() const
+        {
+            return mNumSamples[1];
+        }
+
+        size_t getNumZ() const
+        {
+            return mNumSamples[2];
+        }
+
+        size_t getNumBricks() const
+        {
+            return mBricks.size();
+        }
+
+        //
+        // Set samples to function(x, y, z), which is called concurrently
+        // from several threads
+        //
+        // Function should not exceed distance to surface, as bricks are
+        // skipped without being sampled, when distance at their center is
+        // larger than distance to their farthest corner.
+        //
+        template<class Function>
+            void sample(Function function)
+            {
+                buildBricks(
+                    [this, &function](size_t ix, size_t iy, size_t iz)
+                    {
+                        return NumericType(function(
+                            mOrigin[0] + NumericType(ix) * mVoxelSize,
+                            mOrigin[1] + NumericType(iy) * mVoxelSize,
+                            mOrigin[2] + NumericType(iz) * mVoxelSize));
+                    },
+                    true);
+            }
+
+        //
+        // Set samples from dense grid, where sample (ix, iy, iz) is at
+        // (iz * getNumY() + iy) * getNumX() + ix
+        //
+        void setSamples(const NumericType *samples)
+        {
+            const size_t numX = mNumSamples[0], numY = mNumSamples[1];
+
+            buildBricks(
+                [samples, numX, numY](size_t ix, size_t iy, size_t iz)
+                {
+                    return samples[(iz * numY + iy) * numX + ix];
+                },
+                false);
+        }
+
+        const BVHType & getBVH() const
+        {
+            return mBVH;
+        }
+
+        //
+        // Memory used by bricks and hierarchy in bytes
+        //
+        size_t getMemorySize() const
+        {
+            return mSamples.size() * sizeof(NumericType) + mBricks.size() * sizeof(Brick) + mBVH.getMemorySize();
+        }
+
+        //
+        // Intersect ray given in object local coordinates
+        //
+        bool hitLocalRay(const RayType &ray, RayHitType &hit) const
+        {
+            hit.distance = -1;
+
+            LeafVisitor visitor;
+            visitor.geometry = this;
+            visitor.ray = &ray;
+            visitor.hit = &hit;
+            visitor.rayLength = GAL::Len(ray.direction);
+
+            for (int i = 0; i != 3; ++i)
+            {
+                visitor.invDirection[i] = 1 / ray.direction[i];
+            }
+
+            mBVH.traverse(ray, (std::numeric_limits<NumericType>::max)(), visitor);
+
+            return (-1 != hit.distance);
+        }
+
+        void resolveLocalHit(const RayType &ray, const RayHitType &hit, IntersectionPointType &out, bool withTangent) const
+        {
+            const size_t brick = hit.primitive;
+
+            out.distance = hit.distance;
+            out.position = ray.start + ray.direction * hit.distance;
+
+            NumericType g[3];
+            getBrickCoordinates(brick, out.position, g);
+
+            out.normal = getGradient(&mSamples[brick * SamplesPerBrick], g);
+
+            const NumericType length = GAL::Len(out.normal);
+
+            if (0 < length)
+            {
+                out.normal = out.normal / length;
+            }
+
+            if (withTangent)
+            {
+                out.tangent = GAL::Orthogonal(out.normal);
+            }
+        }
+
+    protected:
+        bool doIntersectRay(const RayType &ray, IntersectionPointType &out)
+        {
+            RayHitType hit;
+
+            if (!hitLocalRay(ray, hit))
+            {
+                return false;
+            }
+
+            resolveLocalHit(ray, hit, out, true);
+            return true;
+        }
+
+    private:
+        //
+        // Brick by its first sample
+        //
+        struct Brick
+        {
+            size_t  x;
+            size_t  y;
+            size_t  z;
+        };
+
+        //
+        // Bricks found by one thread
+        //
+        struct BrickList
+        {
+            std::vector<Brick>          bricks;
+            std::vector<NumericType>    samples;
+        };
+
+        size_t      mNumSamples[3];
+        PointType   mOrigin;
+        NumericType mVoxelSize;
+
+        std::vector<Brick>          mBricks;
+        std::vector<NumericType>    mSamples;   // SamplesPerBrick per brick, x fastest
+        BVHType                     mBVH;
+
+        struct LeafVisitor
+        {
+            const SDFGeometry  *geometry;
+            const RayType      *ray;
+            RayHitType         *hit;
+            PointType           invDirection;
+            NumericType         rayLength;
+
+            void operator () (size_t begin, size_t end, NumericType &tMax) const
+            {
+                for (size_t i = begin; i != end; ++i)
+                {
+                    if (geometry->hitBrick(*ray, invDirection, rayLength, i, tMax, *hit))
+                    {
+                        tMax = hit->distance;
+                    }
+                }
+            }
+        };
+
+        //
+        // Find bricks crossed by surface, where evaluate(ix, iy, iz) returns
+        // sample. If field is distance bound, bricks far from surface are
+        // skipped by their center sample.
+        //
+        template<class Evaluate>
+            void buildBricks(Evaluate evaluate, bool distanceBound)
+            {
+                size_t numBricks[3];
+
+                for (int a = 0; a != 3; ++a)
+                {
+                    numBricks[a] = (mNumSamples[a] - 1 + BrickSize - 1) / BrickSize;
+                }
+
+                const size_t count = numBricks[0] * numBricks[1] * numBricks[2];
+                const NumericType halfDiagonal = NumericType(BrickSize) * mVoxelSize * NumericType(0.5 * sqrt(3.0));
+
+                BrickList result = ParallelReduce(count, 1 << 4, BrickList(),
+                    [this, &evaluate, &numBricks, distanceBound, halfDiagonal](size_t begin, size_t end, BrickList &list)
+                    {
+                        NumericType values[SamplesPerBrick];
+
+                        for (size_t b = begin; b != end; ++b)
+                        {
+                            Brick brick;
+                            brick.x = BrickSize * (b % numBricks[0]);
+                            brick.y = BrickSize * (b / numBricks[0] % numBricks[1]);
+                            brick.z = BrickSize * (b / numBricks[0] / numBricks[1]);
+
+                            if (distanceBound)
+                            {
+                                const NumericType center = evaluate(
+                                    Min<size_t>(brick.x + BrickSize / 2, mNumSamples[0] - 1),
+                                    Min<size_t>(brick.y + BrickSize / 2, mNumSamples[1] - 1),
+                                    Min<size_t>(brick.z + BrickSize / 2, mNumSamples[2] - 1));
+
+                                if (halfDiagonal < fabs(center))
+                                {
+                                    continue;
+                                }
+                            }
+
+                            NumericType low = (std::numeric_limits<NumericType>::max)();
+                            NumericType high = -low;
+                            size_t index = 0;
+
+                            // Samples beyond grid repeat its last ones
+                            for (size_t z = 0; z != BrickSamples; ++z)
+                            {
+                                const size_t iz = Min<size_t>(brick.z + z, mNumSamples[2] - 1);
+
+                                for (size_t y = 0; y != BrickSamples; ++y)
+                                {
+                                    const size_t iy = Min<size_t>(brick.y + y, mNumSamples[1] - 1);
+
+                                    for (size_t x = 0; x != BrickSamples; ++x)
+                                    {
+                                        const size_t ix = Min<size_t>(brick.x + x, mNumSamples[0] - 1);
+                                        const NumericType value = evaluate(ix, iy, iz);
+
+                                        values[index++] = value;
+                                        low = Min(low, value);
+                                        high = Max(high, value);
+                                    }
+                                }
+                            }
+
+                            if (0 < low || high <= 0)
+                            {
+                                // Brick is entirely outside or inside
+                                continue;
+                            }
+
+                            list.bricks.push_back(brick);
+                            list.samples.insert(list.samples.end(), values, values + SamplesPerBrick);
+                        }
+                    },
+                    [](BrickList &list, const BrickList &partial)
+                    {
+                        list.bricks.insert(list.bricks.end(), partial.bricks.begin(), partial.bricks.end());
+                        list.samples.insert(list.samples.end(), partial.samples.begin(), partial.samples.end());
+                    });
+
+                mBricks.swap(result.bricks);
+                mSamples.swap(result.samples);
+
+                samplesChanged();
+            }
+
+        //
+        // Rebuild hierarchy and bounds after bricks were changed, and
+        // reorder bricks in order of its leaves
+        //
+        void samplesChanged()
+        {
+            const size_t count = mBricks.size();
+
+            std::vector<AABBoxType> bounds(count);
+
+            for (size_t i = 0; i != count; ++i)
+            {
+                getBrickBox(i, bounds[i]);
+            }
+
+            mBVH.build(count ? &bounds[0] : 0, count);
+
+            const std::vector<size_t> &order = mBVH.getIndices();
+
+            std::vector<Brick> bricks(count);
+            std::vector<NumericType> samples(count * SamplesPerBrick);
+
+            ParallelFor(count, 1 << 8,
+                [this, &order, &bricks, &samples](size_t begin, size_t end)
+                {
+                    for (size_t i = begin; i != end; ++i)
+                    {
+                        bricks[i] = mBricks[order[i]];
+
+                        std::copy(
+                            mSamples.begin() + order[i] * SamplesPerBrick,
+                            mSamples.begin() + (order[i] + 1) * SamplesPerBrick,
+                            samples.begin() + i * SamplesPerBrick);
+                    }
+                });
+
+            mBricks.swap(bricks);
+            mSamples.swap(samples);
+
+            BoundingSphereType localBounds;
+
+            if (0 != mBVH.getNumNodes())
+            {
+                BoundingSphereFromAABBox(mBVH.getNodeBounds(0), localBounds);
+            }
+            else
+            {
+                // Empty field is never hit
+                localBounds.center = mOrigin;
+                localBounds.radius = 0;
+            }
+
+            this->setLocalBounds(localBounds);
+        }
+
+        //
+        // Box of voxels of brick within grid
+        //
+        void getBrickBox(size_t brick, AABBoxType &box) const
+        {
+            const Brick &b = mBricks[brick];
+
+            box.xMin = mOrigin[0] + NumericType(b.x) * mVoxelSize;
+            box.yMin = mOrigin[1] + NumericType(b.y) * mVoxelSize;
+            box.zMin = mOrigin[2] + NumericType(b.z) * mVoxelSize;
+
+            box.xMax = mOrigin[0] + NumericType(Min<size_t>(b.x + BrickSize, mNumSamples[0] - 1)) * mVoxelSize;
+            box.yMax = mOrigin[1] + NumericType(Min<size_t>(b.y + BrickSize, mNumSamples[1] - 1)) * mVoxelSize;
+            box.zMax = mOrigin[2] + NumericType(Min<size_t>(b.z + BrickSize, mNumSamples[2] - 1)) * mVoxelSize;
+        }
+
+        //
+        // Position in units of voxels relative to first sample of brick,
+        // clamped to brick
+        //
+        void getBrickCoordinates(size_t brick, const PointType &position, NumericType g[3]) const
+        {
+            const Brick &b = mBricks[brick];
+            const size_t first[3] = { b.x, b.y, b.z };
+
+            for (int a = 0; a != 3; ++a)
+            {
+                g[a] = (position[a] - mOrigin[a]) / mVoxelSize - NumericType(first[a]);
+                g[a] = Min(Max(g[a], NumericType(0)), NumericType(BrickSize));
+            }
+        }
+
+        //
+        // Trilinear interpolation of samples of brick
+        //
+        static NumericType interpolate(const NumericType *samples, const NumericType g[3])
+        {
+            size_t i[3];
+            NumericType f[3];
+
+            for (int a = 0; a != 3; ++a)
+            {
+                i[a] = Min<size_t>(size_t(g[a]), BrickSize - 1);
+                f[a] = g[a] - NumericType(i[a]);
+            }
+
+            const NumericType *s = samples + (i[2] * BrickSamples + i[1]) * BrickSamples + i[0];
+
+            const size_t dy = BrickSamples, dz = BrickSamples * BrickSamples;
+
+            const NumericType s00 = s[0]       + (s[1]           - s[0])       * f[0];
+            const NumericType s10 = s[dy]      + (s[dy + 1]      - s[dy])      * f[0];
+            const NumericType s01 = s[dz]      + (s[dz + 1]      - s[dz])      * f[0];
+            const NumericType s11 = s[dz + dy] + (s[dz + dy + 1] - s[dz + dy]) * f[0];
+
+            const NumericType s0 = s00 + (s10 - s00) * f[1];
+            const NumericType s1 = s01 + (s11 - s01) * f[1];
+
+            return s0 + (s1 - s0) * f[2];
+        }
+
+        //
+        // Gradient by central differences half voxel apart, or closer at
+        // border of brick
+        //
+        PointType getGradient(const NumericType *samples, const NumericType g[3]) const
+        {
+            PointType gradient;
+
+            for (int a = 0; a != 3; ++a)
+            {
+                NumericType lo[3] = { g[0], g[1], g[2] };
+                NumericType hi[3] = { g[0], g[1], g[2] };
+
+                lo[a] = Max(g[a] - NumericType(0.5), NumericType(0));
+                hi[a] = Min(g[a] + NumericType(0.5), NumericType(BrickSize));
+
+                gradient[a] = (interpolate(samples, hi) - interpolate(samples, lo)) / ((hi[a] - lo[a]) * mVoxelSize);
+            }
+
+            return gradient;
+        }
+
+        //
+        // Sphere trace ray through brick up to tMax, returns true if hit
+        // got closer
+        //
+        bool hitBrick(const RayType &ray, const PointType &invDirection, NumericType rayLength, size_t brick, NumericType tMax, RayHitType &hit) const
+        {
+            AABBoxType box;
+            getBrickBox(brick, box);
+
+            NumericType tEntry, tExit;
+
+            if (!ClipRayAABBox(ray.start, invDirection, box, tMax, tEntry, tExit))
+            {
+                return false;
+            }
+
+            const NumericType *samples = &mSamples[brick * SamplesPerBrick];
+
+            // Steps in units of ray lengths
+            const NumericType minStep = mVoxelSize / (NumericType(MinStepDivisor) * rayLength);
+            const NumericType maxStep = mVoxelSize / rayLength;
+
+            NumericType t = tEntry;
+            NumericType d = sampleAt(brick, samples, ray, t);
+
+            while (t < tExit)
+            {
+                const NumericType tPrevious = t, dPrevious = d;
+
+                // Distance is not larger than distance to surface
+                t = Min(t + Min(Max(NumericType(fabs(d)) / rayLength, minStep), maxStep), tExit);
+                d = sampleAt(brick, samples, ray, t);
+
+                if (0 < dPrevious && d <= 0)
+                {
+                    NumericType tOutside = tPrevious, tInside = t;
+
+                    for (int i = 0; i != NumRefineSteps; ++i)
+                    {
+                        const NumericType tMiddle = (tOutside + tInside) / 2;
+
+                        if (0 < sampleAt(brick, samples, ray, tMiddle))
+                        {
+                            tOutside = tMiddle;
+                        }
+                        else
+                        {
+                            tInside = tMiddle;
+                        }
+                    }
+
+                    if (tInside < 0.0001)
+                    {
+                        // Intersection was at start of ray
+                        continue;
+                    }
+
+                    if (-1 != hit.distance && hit.distance <= tInside)
+                    {
+                        return false;
+                    }
+
+                    // distance is in unit of ray lengths
+                    hit.distance = tInside;
+                    hit.u = hit.v = 0;
+                    hit.primitive = brick;
+
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        NumericType sampleAt(size_t brick, const NumericType *samples, const RayType &ray, NumericType t) const
+        {
+            NumericType g[3];
+            getBrickCoordinates(brick, ray.start + ray.direction * t, g);
+
+            return interpolate(samples, g);
+        }
+    };
+
+typedef SDFGeometry<float>  SDFGeometry3f;
+typedef SDFGeometry<double> SDFGeometry3d;
+
+#endif
@@ -2,13 +2,13 @@
 #define INCLUDED_SCENE_GRAPH_H
 
 #include "Mesh.h"
+#include "FastMath.h"
 #include "AABBox.h"
 #include "Geometry.h"
 #include "Clump.h"
 #include "Frustum.h"
 #include "TargetBuffer.h"
-
-template<class _NumericType> class Light;
+#include "LightBVH.h"
 
 template<class _NumericType>
     class SceneGraph
@@ -26,20 +26,51 @@ template<class _NumericType>
         typedef Light<NumericType>                  LightType;
         typedef std::shared_ptr<LightType>          LightPtr;
         typedef std::list<LightPtr>                 ListLights;
+        typedef LightBVH<NumericType>               LightBVHType;
 
         void addClump(const ClumpPtr &clump)
         {
             mList.push_back(clump);
         }
 
+        //
+        // Light takes effect at once, and so do its later changes, which it
+        // notifies to scene (see LightBVH). Hierarchy of lights is rebuilt
+        // by update().
+        //
         void addLight(const LightPtr &light)
         {
             mLights.push_back(light);
+            mLightBVH.addLight(light);
+        }
+
+        //
+        // Update hierarchies of clumps after geometries were added or moved,
+        // and hierarchy of lights after lights were added or moved. Until
+        // then, rays are tested against all geometries of changed clumps,
+        // and all lights are visited, if any was added or moved.
+        //
+        // Should be called before raytracing (e.g. once per frame of
+        // animation), while no other thread is accessing the scene.
+        //
+        void update()
+        {
+            typename ListType::const_iterator it = mList.begin();
+
+            for (; it != mList.end(); ++it)
+            {
+                (*it)->update();
+            }
+
+            mLightBVH.update();
         }
 
-        bool intersectRay(RayType ray, IntersectionPointType &out)
+        //
+        // Tangent of intersection point is calculated only if requested
+        //
+        bool intersectRay(RayType ray, IntersectionPointType &out, bool withTangent = false)
         {
-            return doIntersectRay(ray, out);
+            return doIntersectRay(ray, out, withTangent);
         }
 
         ColorType raytrace(RayType &ray, int recursions)
@@ -51,9 +82,8 @@ template<class _NumericType>
                 return ColorType();
             }
 
-            ray.direction /= GAL::Len(ray.direction);
-            intersectionPoint.normal /= GAL::Len(intersectionPoint.normal);
-            intersectionPoint.tangent /= GAL::Len(intersectionPoint.tangent);
+            ray.direction = GAL::Normalize<GAL::DefaultMath>(ray.direction);
+            intersectionPoint.normal = GAL::Normalize<GAL::DefaultMath>(intersectionPoint.normal);
 
             ColorType c1 = shade(ray, intersectionPoint);
 
@@ -80,57 +110,79 @@ template<class _NumericType>
 
         ColorType shade(RayType &ray, IntersectionPointType &intersectionPoint)
         {
-            ColorType c;
-            ListLights::const_iterator it = mLights.begin();
+            return mLightBVH.shade(*this, ray, intersectionPoint);
+        }
 
-            for (; it != mLights.end(); ++it)
+        //
+        // Add geometries of all clumps, which may touch volume of collector
+        // (see Clump::collectGeometries())
+        //
+        template<class Collector>
+            void collectGeometries(Collector &collector)
             {
-                c += (*it)->illuminate(*this, ray, intersectionPoint);
-            }
+                typename ListType::const_iterator it = mList.begin();
 
-            return c;
-        }
+                for (; it != mList.end(); ++it)
+                {
+                    (*it)->collectGeometries(collector);
+                }
+            }
 
         const ListLights &getLights()
         {
             return mLights;
         }
+
+        //
+        // Light culling and sampling settings (see LightBVH)
+        //
+        LightBVHType & getLightBVH()
+        {
+            return mLightBVH;
+        }
  
     protected:
-        bool doIntersectRay(const RayType &ray, IntersectionPointType &out)
+        //
+        // Closest hit is searched in all clumps, and its attributes are
+        // resolved once by its clump
+        //
+        bool doIntersectRay(const RayType &ray, IntersectionPointType &out, bool withTangent)
         {
             typedef ListType::const_iterator IteratorType;
+            typedef typename ClumpType::StoreType StoreType;
+            typedef typename ClumpType::ClosestHit ClosestHit;
 
-            IntersectionPointType tmp;
-            IteratorType closest = mList.end();
-            out.distance = -1;
+            ClosestHit closest;
+            ClumpType *closestClump = 0;
+            StoreType::beginClosestHit(closest, out);
 
             for (IteratorType it = mList.begin(); it != mList.end(); ++it)
             {
-                if (!(*it)->intersectRay(ray, tmp))
-                {
-                    continue;
-                }
+                // Hit of clump replaces hit of previous ones only if closer
+                ClosestHit tmp = closest;
+                (*it)->hitRay(ray, tmp, out);
 
-                if (-1 == out.distance || tmp.distance < out.distance)
+                if (StoreType::NoGeometry != tmp.kind &&
+                    (StoreType::NoGeometry == closest.kind || tmp.hit.distance < closest.hit.distance))
                 {
-                    out = tmp;
-                    closest = it;
+                    closest = tmp;
+                    closestClump = it->get();
                 }
             }
 
-            if (closest == mList.end())
+            if (0 == closestClump)
             {
-                return false;
+                return (-1 != out.distance);
             }
 
-            return true;
+            return closestClump->endClosestHit(closest, ray, out, withTangent);
         }
 
 
     private:
-        ListType    mList;
-        ListLights  mLights;
+        ListType        mList;
+        ListLights      mLights;
+        LightBVHType    mLightBVH;
     };
 
 typedef SceneGraph<float> SceneGraph3f;
@@ -0,0 +1,285 @@
+#ifndef INCLUDED_SHADOW_PACKET_H
+#define INCLUDED_SHADOW_PACKET_H
+
+#include <cmath>
+
+#include "Linear.h"
+#include "MinMax.h"
+#include "AABBox.h"
+#include "BoundingSphere.h"
+#include "IntersectionPoint.h"
+#include "Geometry.h"
+
+//
+// Shadow rays from square patch of light to single point
+//
+// Rays start at points center + a * axisX + b * axisY of patch, where a and
+// b are in [-1, 1], and end at the point. All of them lie in pyramid with
+// apex at the point and patch as base. Geometries, whose bounds touch it,
+// are collected (see Clump::collectGeometries()), and the rays are
+// intersected only with those:
+//
+//  - if there are none, no ray is occluded
+//  - if convex geometry occludes rays from all 4 corners of patch, it
+//    occludes rays from all points of patch too (far enough from the point,
+//    which is given by distance from it of the hits at the corners)
+//  - otherwise rays are traced one by one, but against collected geometries
+//    only
+//
+// Geometry, on which the point lies, is not collected, if it is convex and
+// patch is in front of its tangent plane at the point, as then no ray can
+// hit it before the point.
+//
+// Ray is occluded under the same condition as by Light::dropShadow() (see
+// occludes()).
+//
+template<class _NumericType>
+    class ShadowPacket
+    {
+    public:
+        typedef _NumericType                        NumericType;
+        typedef GAL_imp::Point<NumericType,3>       PointType;
+        typedef GAL_imp::Ray<NumericType,3>         RayType;
+        typedef IntersectionPoint<NumericType,3>    IntersectionPointType;
+        typedef BoundingSphere<NumericType>         BoundingSphereType;
+        typedef AABBox<NumericType>                 AABBoxType;
+        typedef Geometry<NumericType>               GeometryType;
+
+        enum
+        {
+            MaxGeometries = 16
+        };
+
+        ShadowPacket(const IntersectionPointType &receiver, const PointType &center, const PointType &axisX, const PointType &axisY):
+            mPoint(receiver.position),
+            mReceiver(0),
+            mNumGeometries(0),
+            mOverflow(false)
+        {
+            const PointType &point = receiver.position;
+
+            mCorners[0] = center - axisX - axisY;
+            mCorners[1] = center + axisX - axisY;
+            mCorners[2] = center + axisX + axisY;
+            mCorners[3] = center - axisX + axisY;
+
+            if (receiver.geometry && receiver.geometry->isConvex() &&
+                0 < GAL::Dot(receiver.normal, mCorners[0] - point) &&
+                0 < GAL::Dot(receiver.normal, mCorners[1] - point) &&
+                0 < GAL::Dot(receiver.normal, mCorners[2] - point) &&
+                0 < GAL::Dot(receiver.normal, mCorners[3] - point))
+            {
+                mReceiver = receiver.geometry;
+            }
+
+            // Side planes through the point and edges of patch, with normals
+            // pointing out of pyramid
+            for (int i = 0; i != 4; ++i)
+            {
+                PointType normal = GAL::Cross(mCorners[i] - point, mCorners[(i + 1) & 3] - point);
+                const NumericType length = GAL::Len(normal);
+
+                normal = (0 < length ? normal / length : PointType());
+
+                mSideNormals[i] = (GAL::Dot(normal, center - point) <= 0 ? normal : -normal);
+            }
+
+            const PointType toPoint = point - center;
+            const NumericType distance = GAL::Len(toPoint);
+
+            mDirection = (0 < distance ? toPoint / distance : PointType());
+            mDistance = distance;
+
+            // Closest point of patch to the point is at least this far
+            mMinDistance = distance - GAL::Len(axisX + axisY);
+        }
+
+        //
+        // Ray from lightPosition to point is occluded by its closest hit,
+        // if the hit is before the point, and not at it
+        //
+        static bool occludes(const PointType &lightPosition, const PointType &point, const PointType &hit)
+        {
+            const PointType distVect = (hit - point);
+
+            return (GAL::Dot(distVect, lightPosition - point) > 0 && 0.00001 < GAL::SqrLen(distVect));
+        }
+
+        //
+        // Test, whether bounds touch pyramid
+        //
+        bool testBounds(const BoundingSphereType &bounds) const
+        {
+            return (bounds.isInfinite() || test(bounds.center, PointType(), bounds.radius));
+        }
+
+        bool testAABBox(const AABBoxType &box) const
+        {
+            return test(box.getCenter(), box.getSize() / 2, 0);
+        }
+
+        void addGeometry(GeometryType *geometry)
+        {
+            if (geometry == mReceiver)
+            {
+                return;
+            }
+
+            if (MaxGeometries == mNumGeometries)
+            {
+                mOverflow = true;
+                return;
+            }
+
+            mGeometries[mNumGeometries++] = geometry;
+        }
+
+        size_t getNumGeometries() const
+        {
+            return mNumGeometries;
+        }
+
+        //
+        // More geometries were added than MaxGeometries, in which case rays
+        // have to be traced through the whole scene
+        //
+        bool isOverflow() const
+        {
+            return mOverflow;
+        }
+
+        //
+        // Test, whether convex geometry occludes all rays
+        //
+        bool isFullyOccluded() const
+        {
+            if (mMinDistance <= 0)
+            {
+                return false;
+            }
+
+            for (size_t i = 0; i != mNumGeometries; ++i)
+            {
+                if (mGeometries[i]->isConvex() && occludesCorners(*mGeometries[i]))
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        //
+        // Test ray from lightPosition, which should lie on patch, against
+        // collected geometries
+        //
+        bool isOccluded(const PointType &lightPosition) const
+        {
+            RayType ray;
+            ray.start = lightPosition;
+            ray.direction = (mPoint - lightPosition);
+
+            IntersectionPointType closest;
+            IntersectionPointType tmp;
+            closest.distance = -1;
+
+            for (size_t i = 0; i != mNumGeometries; ++i)
+            {
+                if (!mGeometries[i]->intersectRay(ray, tmp))
+                {
+                    continue;
+                }
+
+                if (-1 == closest.distance || tmp.distance < closest.distance)
+                {
+                    closest = tmp;
+                }
+            }
+
+            if (-1 == closest.distance)
+            {
+                return false;
+            }
+
+            return occludes(lightPosition, mPoint, closest.position);
+        }
+
+    private:
+        PointType       mPoint;
+        const GeometryType *mReceiver;      // not collected, see above
+        PointType       mCorners[4];
+        PointType       mSideNormals[4];
+        PointType       mDirection;         // from center of patch to the point
+        NumericType     mDistance;
+        NumericType     mMinDistance;
+        GeometryType   *mGeometries[MaxGeometries];
+        size_t          mNumGeometries;
+        bool            mOverflow;
+
+        //
+        // Test box given by center and half of size, expanded by radius,
+        // against pyramid between patch and the point
+        //
+        bool test(const PointType &center, const PointType &extent, NumericType radius) const
+        {
+            NumericType side[4];
+            NumericType sideRadius[4];
+
+            for (int i = 0; i != 4; ++i)
+            {
+                const PointType &n = mSideNormals[i];
+
+                side[i] = GAL::Dot(n, center - mPoint);
+                sideRadius[i] = radius + std::fabs(n[0]) * extent[0] + std::fabs(n[1]) * extent[1] + std::fabs(n[2]) * extent[2];
+            }
+
+            const NumericType along = GAL::Dot(mDirection, center - mPoint);
+            const NumericType alongRadius = radius +
+                std::fabs(mDirection[0]) * extent[0] + std::fabs(mDirection[1]) * extent[1] + std::fabs(mDirection[2]) * extent[2];
+
+            return (-mDistance - alongRadius <= along && along <= alongRadius &&
+                side[0] <= sideRadius[0] && side[1] <= sideRadius[1] &&
+                side[2] <= sideRadius[2] && side[3] <= sideRadius[3]);
+        }
+
+        //
+        // If rays from all corners hit convex geometry at fraction at least
+        // f of their way from the point, ray from any point of patch hits it
+        // at that fraction at least, hence at least f * mMinDistance from
+        // the point. Closest hit of such ray is not closer to the point.
+        //
+        bool occludesCorners(GeometryType &geometry) const
+        {
+            NumericType fraction = 1;
+
+            for (int i = 0; i != 4; ++i)
+            {
+                RayType ray;
+                ray.start = mCorners[i];
+                ray.direction = (mPoint - mCorners[i]);
+
+                IntersectionPointType hit;
+
+                if (!geometry.intersectRay(ray, hit))
+                {
+                    return false;
+                }
+
+                // Hit has to be before the point
+                const NumericType t = GAL::Dot(hit.position - ray.start, ray.direction) / GAL::Dot(ray.direction, ray.direction);
+
+                if (1 <= t)
+                {
+                    return false;
+                }
+
+                fraction = Min(fraction, 1 - t);
+            }
+
+            const NumericType distance = fraction * mMinDistance;
+
+            return (0.00001 < distance * distance);
+        }
+    };
+
+#endif
@@ -0,0 +1,390 @@
+#ifndef INCLUDED_SPHERE_SET_GEOMETRY_H
+#define INCLUDED_SPHERE_SET_GEOMETRY_H
+
+#include <vector>
+#include <limits>
+
+#include "MinMax.h"
+#include "AABBox.h"
+#include "BoundingSphere.h"
+#include "BVH.h"
+#include "Geometry.h"
+#include "Parallel.h"
+
+//
+// Set of spheres intersected as single geometry
+//
+// Centers and radii are stored in structure of arrays form, optionally
+// with color of each sphere, and spheres share transformation of geometry.
+// Hierarchy is built over spheres, and spheres of its leaves are tested by
+// one loop over lanes, which is vectorized by compiler, so that particle or
+// molecular data sets do not need geometry object per sphere.
+//
+// spheresChanged() reorders spheres in order of leaves of hierarchy, hence
+// spheres should be identified by their index only after it was called.
+// Primitive of hit is index of sphere.
+//
+template<class _NumericType>
+    class SphereSetGeometry : public Geometry<_NumericType>
+    {
+    public:
+        typedef Geometry<_NumericType>                  BaseType;
+        typedef typename BaseType::NumericType          NumericType;
+        typedef typename BaseType::PointType            PointType;
+        typedef typename BaseType::ColorType            ColorType;
+        typedef typename BaseType::RayType              RayType;
+        typedef typename BaseType::IntersectionPointType IntersectionPointType;
+        typedef typename BaseType::RayHitType           RayHitType;
+        typedef typename BaseType::BoundingSphereType   BoundingSphereType;
+        typedef AABBox<NumericType>                     AABBoxType;
+        typedef BVH<NumericType>                        BVHType;
+
+        SphereSetGeometry()
+        {
+        }
+
+        void reserve(size_t count)
+        {
+            mCenterX.reserve(count);
+            mCenterY.reserve(count);
+            mCenterZ.reserve(count);
+            mRadius.reserve(count);
+        }
+
+        //
+        // Add sphere, returns its index. spheresChanged() should be called
+        // after spheres are added.
+        //
+        // Once any sphere has color, spheres added without it are of color,
+        // which geometry has at the time.
+        //
+        size_t addSphere(const PointType &center, NumericType radius)
+        {
+            if (!mColors.empty())
+            {
+                mColors.push_back(this->getColor());
+            }
+
+            return pushSphere(center, radius);
+        }
+
+        size_t addSphere(const PointType &center, NumericType radius, const ColorType &color)
+        {
+            mColors.resize(mRadius.size(), this->getColor());
+            mColors.push_back(color);
+
+            this->setPrimitiveColors(true);
+
+            return pushSphere(center, radius);
+        }
+
+        void setSphere(size_t index, const PointType &center, NumericType radius)
+        {
+            mCenterX[index] = center[0];
+            mCenterY[index] = center[1];
+            mCenterZ[index] = center[2];
+            mRadius[index] = radius;
+        }
+
+        void clear()
+        {
+            mCenterX.clear();
+            mCenterY.clear();
+            mCenterZ.clear();
+            mRadius.clear();
+            mColors.clear();
+
+            this->setPrimitiveColors(false);
+        }
+
+        size_t getNumSpheres() const
+        {
+            return mRadius.size();
+        }
+
+        PointType getCenter(size_t index) const
+        {
+            PointType center;
+            center[0] = mCenterX[index];
+            center[1] = mCenterY[index];
+            center[2] = mCenterZ[index];
+
+            return center;
+        }
+
+        NumericType getRadius(size_t index) const
+        {
+            return mRadius[index];
+        }
+
+        bool hasSphereColors() const
+        {
+            return !mColors.empty();
+        }
+
+        const ColorType & getSphereColor(size_t index) const
+        {
+            return mColors[index];
+        }
+
+        //
+        // Rebuild hierarchy and bounds after spheres were changed
+        //
+        void spheresChanged()
+        {
+            const size_t count = mRadius.size();
+
+            std::vector<AABBoxType> bounds(count);
+
+            ParallelFor(count, 1 << 14,
+                [this, &bounds](size_t begin, size_t end)
+                {
+                    for (size_t i = begin; i != end; ++i)
+                    {
+                        AABBoxType &box = bounds[i];
+
+                        box.xMin = mCenterX[i] - mRadius[i]; box.xMax = mCenterX[i] + mRadius[i];
+                        box.yMin = mCenterY[i] - mRadius[i]; box.yMax = mCenterY[i] + mRadius[i];
+                        box.zMin = mCenterZ[i] - mRadius[i]; box.zMax = mCenterZ[i] + mRadius[i];
+                    }
+                });
+
+            mBVH.build(count ? &bounds[0] : 0, count);
+
+            reorderSpheres(mBVH.getIndices());
+
+            BoundingSphereType localBounds;
+
+            if (0 != mBVH.getNumNodes())
+            {
+                BoundingSphereFromAABBox(mBVH.getNodeBounds(0), localBounds);
+            }
+
+            this->setLocalBounds(localBounds);
+        }
+
+        const BVHType & getBVH() const
+        {
+            return mBVH;
+        }
+
+        //
+        // Memory used by spheres and hierarchy in bytes
+        //
+        size_t getMemorySize() const
+        {
+            return 4 * mRadius.size() * sizeof(NumericType) + mColors.size() * sizeof(ColorType) + mBVH.getMemorySize();
+        }
+
+        //
+        // Intersect ray given in object local coordinates
+        //
+        bool hitLocalRay(const RayType &ray, RayHitType &hit) const
+        {
+            hit.distance = -1;
+
+            LeafVisitor visitor;
+            visitor.geometry = this;
+            visitor.ray = &ray;
+            visitor.hit = &hit;
+
+            mBVH.traverse(ray, (std::numeric_limits<NumericType>::max)(), visitor);
+
+            return (-1 != hit.distance);
+        }
+
+        void resolveLocalHit(const RayType &ray, const RayHitType &hit, IntersectionPointType &out, bool withTangent) const
+        {
+            const size_t index = hit.primitive;
+
+            out.distance = hit.distance;
+            out.position = ray.start + ray.direction * hit.distance;
+            out.normal = (out.position - getCenter(index)) / mRadius[index];
+
+            if (withTangent)
+            {
+                out.tangent = GAL::Orthogonal(out.normal);
+            }
+
+            if (!mColors.empty())
+            {
+                out.color = mColors[index];
+            }
+        }
+
+    protected:
+        bool doIntersectRay(const RayType &ray, IntersectionPointType &out)
+        {
+            RayHitType hit;
+
+            if (!hitLocalRay(ray, hit))
+            {
+                return false;
+            }
+
+            resolveLocalHit(ray, hit, out, true);
+            return true;
+        }
+
+    private:
+        std::vector<NumericType>    mCenterX;
+        std::vector<NumericType>    mCenterY;
+        std::vector<NumericType>    mCenterZ;
+        std::vector<NumericType>    mRadius;
+        std::vector<ColorType>      mColors;    // empty, or color of each sphere
+        BVHType                     mBVH;
+
+        //
+        // Intersect spheres of leaf
+        //
+        struct LeafVisitor
+        {
+            const SphereSetGeometry *geometry;
+            const RayType           *ray;
+            RayHitType              *hit;
+
+            void operator () (size_t begin, size_t end, NumericType &tMax) const
+            {
+                if (geometry->hitSpheres(*ray, begin, end, *hit))
+                {
+                    tMax = hit->distance;
+                }
+            }
+        };
+
+        size_t pushSphere(const PointType &center, NumericType radius)
+        {
+            mCenterX.push_back(center[0]);
+            mCenterY.push_back(center[1]);
+            mCenterZ.push_back(center[2]);
+            mRadius.push_back(radius);
+
+            return mRadius.size() - 1;
+        }
+
+        //
+        // Intersect spheres [begin, end), returns true if hit got closer
+        //
+        // Leaf at depth limit of hierarchy may have more than MaxLeafSize
+        // spheres, so they are intersected in blocks of that size.
+        //
+        bool hitSpheres(const RayType &ray, size_t begin, size_t end, RayHitType &hit) const
+        {
+            bool closer = false;
+
+            for (; begin < end; begin += BVHType::MaxLeafSize)
+            {
+                if (hitBlock(ray, begin, Min(end, begin + size_t(BVHType::MaxLeafSize)), hit))
+                {
+                    closer = true;
+                }
+            }
+
+            return closer;
+        }
+
+        //
+        // Intersect at most MaxLeafSize spheres [begin, end)
+        //
+        // Distances of all lanes are calculated first without branches, so
+        // that the loop is vectorized, and the closest one is chosen after.
+        // Solution of quadratic equation is the same as by
+        // GAL::IntersectRaySphere(), where ray tangent to sphere misses it,
+        // and the nearer root is chosen if it is in front of ray.
+        //
+        bool hitBlock(const RayType &ray, size_t begin, size_t end, RayHitType &hit) const
+        {
+            const NumericType *cx = &mCenterX[begin];
+            const NumericType *cy = &mCenterY[begin];
+            const NumericType *cz = &mCenterZ[begin];
+            const NumericType *r  = &mRadius[begin];
+            const size_t count = end - begin;
+
+            const NumericType sx = ray.start[0], sy = ray.start[1], sz = ray.start[2];
+            const NumericType dx = ray.direction[0], dy = ray.direction[1], dz = ray.direction[2];
+            const NumericType a = dx * dx + dy * dy + dz * dz;
+            const NumericType invA = 1 / a;
+            const NumericType miss = (std::numeric_limits<NumericType>::max)();
+
+            NumericType t[BVHType::MaxLeafSize];
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                const NumericType ux = sx - cx[i], uy = sy - cy[i], uz = sz - cz[i];
+
+                // Half of linear coefficient, and constant one
+                const NumericType b = ux * dx + uy * dy + uz * dz;
+                const NumericType c = ux * ux + uy * uy + uz * uz - r[i] * r[i];
+                const NumericType discriminant = b * b - a * c;
+
+                const NumericType root = sqrt(Max(discriminant, NumericType(0)));
+                const NumericType t0 = (-b - root) * invA;
+                const NumericType t1 = (-b + root) * invA;
+                const NumericType tNear = (0 < t0 ? t0 : t1);
+
+                t[i] = (0 < discriminant && 0 < tNear ? tNear : miss);
+            }
+
+            size_t closest = count;
+            NumericType tClosest = (-1 != hit.distance ? hit.distance : miss);
+
+            for (size_t i = 0; i != count; ++i)
+            {
+                if (t[i] < tClosest)
+                {
+                    tClosest = t[i];
+                    closest = i;
+                }
+            }
+
+            if (count == closest)
+            {
+                return false;
+            }
+
+            // distance is in unit of ray lengths
+            hit.distance = tClosest;
+            hit.u = hit.v = 0;
+            hit.primitive = begin + closest;
+
+            return true;
+        }
+
+        //
+        // Move sphere order[i] to position i
+        //
+        void reorderSpheres(const std::vector<size_t> &order)
+        {
+            reorder(mCenterX, order);
+            reorder(mCenterY, order);
+            reorder(mCenterZ, order);
+            reorder(mRadius, order);
+
+            if (!mColors.empty())
+            {
+                reorder(mColors, order);
+            }
+        }
+
+        template<class T>
+            static void reorder(std::vector<T> &values, const std::vector<size_t> &order)
+            {
+                std::vector<T> reordered(order.size());
+
+                ParallelFor(order.size(), 1 << 14,
+                    [&values, &order, &reordered](size_t begin, size_t end)
+                    {
+                        for (size_t i = begin; i != end; ++i)
+                        {
+                            reordered[i] = values[order[i]];
+                        }
+                    });
+
+                values.swap(reordered);
+            }
+    };
+
+typedef SphereSetGeometry<float>  SphereSetGeometry3f;
+typedef SphereSetGeometry<double> SphereSetGeometry3d;
+
+#endif
@@ -0,0 +1,646 @@
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Test.h"
+#include "FastMath.h"
+#include "SceneGraph.h"
+#include "MeshResource.h"
+
+//
+// Benchmarks of hierarchies, mesh storage, lights and shadows
+//
+// Run by: Tests --benchmark [filter]. Sizes are fixed, so that results of
+// different builds and machines are comparable.
+//
+
+typedef GAL_imp::Point<double,3>            VertexType;
+typedef MeshResource<VertexType>            MeshResourceType;
+typedef MeshResourceType::MeshType          MeshType;
+typedef MeshResourceType::RayHitType        RayHitType;
+typedef SceneGraph<double>                  SceneGraphType;
+typedef Clump<double>                       ClumpType;
+typedef Light<double>                       LightType;
+typedef IntersectionPoint<double,3>         IntersectionPointType;
+typedef GAL_imp::Ray<double,3>              RayType;
+typedef GAL_imp::Point<double,4>            ColorType;
+
+static const size_t NumTriangles    = 500000;
+static const size_t NumSpheres      = 20000;
+static const size_t NumRays         = 200000;
+static const size_t NumCalls        = 2000000;
+static const size_t NumShadingRays  = 20000;
+
+static const BVHLayout Layouts[] =
+{
+    BinaryBVHLayout,
+    Wide4BVHLayout,
+    Wide8BVHLayout,
+    Quantized4BVHLayout,
+    Quantized8BVHLayout
+};
+
+static const char *LayoutNames[] =
+{
+    "binary",
+    "wide4",
+    "wide8",
+    "quantized4",
+    "quantized8"
+};
+
+static const size_t NumLayouts = sizeof(Layouts) / sizeof(Layouts[0]);
+
+// Results are stored, so that their computation is not optimized away
+static volatile double Sink;
+
+//
+// Small triangles at random points of box [-extent, extent]^3
+//
+static void AddTriangles(MeshType &mesh, TestRandom &random, size_t count, double extent, double size)
+{
+    for (size_t i = 0; i != count; ++i)
+    {
+        const GAL::P3d center = random.nextPoint(-extent, extent);
+
+        for (int j = 0; j != 3; ++j)
+        {
+            mesh.addVertex(center + random.nextPoint(-size, size));
+            mesh.addIndex(int(mesh.getNumVertices() - 1));
+        }
+    }
+}
+
+//
+// Small spheres at random points of box [-extent, extent]^3
+//
+static void AddSpheres(ClumpType &clump, std::vector< std::shared_ptr<SphereGeometry3d> > &spheres, TestRandom &random, size_t count, double extent)
+{
+    for (size_t i = 0; i != count; ++i)
+    {
+        std::shared_ptr<SphereGeometry3d> sphere(new SphereGeometry3d(random.next(0.1, 0.5)));
+        sphere->setTranslation(random.nextPoint(-extent, extent));
+
+        clump.addGeometry(sphere);
+        spheres.push_back(sphere);
+    }
+}
+
+static std::vector<RayType> GetRays(TestRandom &random, size_t count, double extent)
+{
+    std::vector<RayType> rays(count);
+
+    for (size_t i = 0; i != count; ++i)
+    {
+        rays[i] = random.nextRay(extent);
+    }
+
+    return rays;
+}
+
+//
+// Time of intersecting rays
+//
+static double CastRays(const MeshResourceType &resource, const std::vector<RayType> &rays)
+{
+    TestTimer timer;
+    size_t hits = 0;
+
+    for (size_t i = 0; i != rays.size(); ++i)
+    {
+        RayHitType hit;
+        hits += (resource.hitLocalRay(rays[i], hit) ? 1 : 0);
+    }
+
+    Sink = double(hits);
+    return timer.getSeconds();
+}
+
+static double CastRays(ClumpType &clump, const std::vector<RayType> &rays)
+{
+    TestTimer timer;
+    size_t hits = 0;
+
+    for (size_t i = 0; i != rays.size(); ++i)
+    {
+        IntersectionPointType out;
+        hits += (clump.intersectRay(rays[i], out) ? 1 : 0);
+    }
+
+    Sink = double(hits);
+    return timer.getSeconds();
+}
+
+//
+// Build of clump hierarchy, and refit after tenth of geometries and after
+// single geometry moved
+//
+BENCHMARK(ClumpRefit)
+{
+    TestRandom random;
+    ClumpType clump;
+
+    std::vector< std::shared_ptr<SphereGeometry3d> > spheres;
+    AddSpheres(clump, spheres, random, NumSpheres, 50);
+
+    TestTimer timer;
+    clump.update();
+    Report("build", timer.getSeconds(), double(NumSpheres), "geometries");
+
+    for (size_t i = 0; i < spheres.size(); i += 10)
+    {
+        spheres[i]->setTranslation(spheres[i]->getWorldBounds().center + random.nextPoint(-1, 1));
+    }
+
+    timer.restart();
+    clump.update();
+    Report("refit of tenth", timer.getSeconds());
+
+    spheres[0]->setTranslation(spheres[0]->getWorldBounds().center + random.nextPoint(-1, 1));
+
+    timer.restart();
+    clump.update();
+    Report("refit of one", timer.getSeconds());
+}
+
+//
+// Build of mesh hierarchy by all threads
+//
+BENCHMARK(MeshBuild)
+{
+    static const size_t counts[] = { 100000, 1000000 };
+
+    printf("  threads: %u\n", unsigned(GetNumThreads()));
+
+    for (int c = 0; c != 2; ++c)
+    {
+        TestRandom random;
+
+        MeshResourceType resource;
+        AddTriangles(resource.getMesh(), random, counts[c], 50, 0.5);
+
+        TestTimer timer;
+        resource.meshChanged();
+        const double time = timer.getSeconds();
+
+        printf("  %u triangles\n", unsigned(counts[c]));
+        Report("hierarchy", resource.getBVH().getStats().buildTime, double(counts[c]), "triangles");
+        Report("meshChanged()", time, double(counts[c]), "triangles");
+    }
+}
+
+//
+// Layout time, memory and intersection rate of each layout
+//
+BENCHMARK(MeshLayoutRays)
+{
+    TestRandom random;
+
+    MeshResourceType resource;
+    AddTriangles(resource.getMesh(), random, NumTriangles, 50, 0.5);
+    resource.meshChanged();
+
+    const std::vector<RayType> rays = GetRays(random, NumRays, 60);
+
+    for (size_t i = 0; i != NumLayouts; ++i)
+    {
+        TestTimer timer;
+        resource.setBVHLayout(Layouts[i]);
+        const double layoutTime = timer.getSeconds();
+
+        const double time = CastRays(resource, rays);
+
+        printf("  %s\n", LayoutNames[i]);
+        Report("layout", layoutTime);
+        ReportMemory("hierarchy", resource.getBVHMemorySize());
+        Report("rays", time, double(rays.size()), "rays");
+    }
+}
+
+//
+// Intersection rate of clump hierarchy of each layout
+//
+BENCHMARK(ClumpLayoutRays)
+{
+    TestRandom random;
+    ClumpType clump;
+
+    std::vector< std::shared_ptr<SphereGeometry3d> > spheres;
+    AddSpheres(clump, spheres, random, NumSpheres, 50);
+    clump.update();
+
+    const std::vector<RayType> rays = GetRays(random, NumRays, 60);
+
+    for (size_t i = 0; i != NumLayouts; ++i)
+    {
+        clump.setBVHLayout(Layouts[i]);
+
+        const double time = CastRays(clump, rays);
+
+        printf("  %s\n", LayoutNames[i]);
+        Report("rays", time, double(rays.size()), "rays");
+    }
+}
+
+//
+// Build time, memory and intersection rate of each storage of triangles
+//
+BENCHMARK(MeshStorageOptions)
+{
+    static const char *names[] = { "indexed", "precomputed", "compressed", "reordered" };
+
+    TestRandom random;
+
+    MeshType mesh;
+    AddTriangles(mesh, random, NumTriangles, 50, 0.5);
+
+    const std::vector<RayType> rays = GetRays(random, NumRays, 60);
+
+    for (int i = 0; i != 4; ++i)
+    {
+        MeshResourceType resource;
+        resource.getMesh() = mesh;
+        resource.setPrecomputeTriangles(1 == i);
+        resource.setCompressMesh(2 == i);
+        resource.setOptimizeMeshLayout(3 == i);
+
+        TestTimer timer;
+        resource.meshChanged();
+        const double buildTime = timer.getSeconds();
+
+        const double time = CastRays(resource, rays);
+
+        printf("  %s\n", names[i]);
+        Report("build", buildTime);
+        ReportMemory("mesh", resource.getMeshMemorySize());
+        Report("rays", time, double(rays.size()), "rays");
+    }
+}
+
+//
+// Build of mesh, and loading of the same mesh and its hierarchy from file
+//
+BENCHMARK(MeshFileLoad)
+{
+    static const char *path = "Benchmark.rtm";
+
+    TestRandom random;
+
+    {
+        MeshResourceType built;
+        AddTriangles(built.getMesh(), random, NumTriangles, 50, 0.5);
+
+        TestTimer timer;
+        built.meshChanged();
+        Report("build", timer.getSeconds());
+
+        timer.restart();
+        built.saveMeshFile(path);
+        Report("save", timer.getSeconds());
+
+        MeshResourceType loaded;
+
+        timer.restart();
+        loaded.loadMeshFile(path);
+        Report("load", timer.getSeconds());
+    }
+
+    std::remove(path);
+}
+
+//
+// Build with empty cache, which writes entry, and load from it
+//
+BENCHMARK(MeshCacheLoad)
+{
+    TestRandom random;
+
+    MeshType mesh;
+    AddTriangles(mesh, random, NumTriangles, 50, 0.5);
+
+    MeshCache cache;
+    cache.setDirectory(".");
+
+    const std::string path = cache.getPath(MeshCache::hash(mesh, 0));
+    std::remove(path.c_str());
+
+    {
+        MeshResourceType built;
+        built.getMesh() = mesh;
+        built.setCacheDirectory(".");
+
+        TestTimer timer;
+        built.meshChanged();
+        Report("build and store", timer.getSeconds());
+
+        MeshResourceType mapped;
+        mapped.getMesh() = mesh;
+        mapped.setCacheDirectory(".");
+
+        timer.restart();
+        mapped.meshChanged();
+        Report("load", timer.getSeconds());
+    }
+
+    std::remove(path.c_str());
+}
+
+//
+// Exact and tabulated falloff of default diffuse and specular falloff
+//
+BENCHMARK(FalloffLookup)
+{
+    TestRandom random;
+
+    std::vector<double> cosines(NumCalls);
+
+    for (size_t i = 0; i != NumCalls; ++i)
+    {
+        cosines[i] = random.next(-1, 1);
+    }
+
+    const FalloffTable<double> diffuse(2, 0.8), specular(4, 16);
+
+    TestTimer timer;
+    double sum = 0;
+
+    for (size_t i = 0; i != NumCalls; ++i)
+    {
+        sum += FalloffTable<double>::evaluate(2, 0.8, cosines[i]) + FalloffTable<double>::evaluate(4, 16, cosines[i]);
+    }
+
+    Sink = sum;
+    Report("exact", timer.getSeconds(), double(NumCalls), "cosines");
+
+    timer.restart();
+    sum = 0;
+
+    for (size_t i = 0; i != NumCalls; ++i)
+    {
+        sum += diffuse(cosines[i]) + specular(cosines[i]);
+    }
+
+    Sink = sum;
+    Report("tabulated", timer.getSeconds(), double(NumCalls), "cosines");
+}
+
+//
+// Calls of math functions of given policy for arguments in (0, 4) and, for
+// acos, in (-1, 1)
+//
+template<class Math, class N>
+    static void TimeMath(const char *name, const std::vector<N> &x, const std::vector<N> &y)
+    {
+        static const char *functions[] = { "sqrt", "rsqrt", "acos", "pow" };
+
+        for (int f = 0; f != 4; ++f)
+        {
+            TestTimer timer;
+            N sum = 0;
+
+            for (size_t i = 0; i != x.size(); ++i)
+            {
+                switch (f)
+                {
+                case 0: sum += Math::Sqrt(x[i]); break;
+                case 1: sum += Math::RSqrt(x[i]); break;
+                case 2: sum += Math::Acos(y[i]); break;
+                default: sum += Math::Pow(x[i], y[i]); break;
+                }
+            }
+
+            Sink = double(sum);
+
+            const std::string what = std::string(name) + " " + functions[f];
+            Report(what.c_str(), timer.getSeconds(), double(x.size()), "calls");
+        }
+    }
+
+template<class N>
+    static void TimeMath(TestRandom &random)
+    {
+        std::vector<N> x(NumCalls), y(NumCalls);
+
+        for (size_t i = 0; i != NumCalls; ++i)
+        {
+            x[i] = N(random.next(1e-3, 4));
+            y[i] = N(random.next(-1, 1));
+        }
+
+        TimeMath<GAL::PreciseMath>("precise", x, y);
+        TimeMath<GAL::FastMath>("fast", x, y);
+    }
+
+//
+// Precise and fast math functions, switch is predicted as it does not
+// change within loop
+//
+BENCHMARK(FastMathCalls)
+{
+    TestRandom random;
+
+    printf("  float\n");
+    TimeMath<float>(random);
+
+    printf("  double\n");
+    TimeMath<double>(random);
+}
+
+//
+// Ground sphere with smaller spheres on it
+//
+static void BuildScene(SceneGraphType &scene, TestRandom &random)
+{
+    std::shared_ptr<ClumpType> clump(new ClumpType());
+
+    std::shared_ptr<SphereGeometry3d> ground(new SphereGeometry3d(1000));
+    ground->setTranslation(GAL::P3d(0, -1000, 0));
+    clump->addGeometry(ground);
+
+    for (int i = 0; i != 200; ++i)
+    {
+        std::shared_ptr<SphereGeometry3d> sphere(new SphereGeometry3d(random.next(0.2, 0.6)));
+        sphere->setTranslation(GAL::P3d(random.next(-20, 20), 0.5, random.next(-20, 20)));
+        clump->addGeometry(sphere);
+    }
+
+    scene.addClump(clump);
+}
+
+//
+// Lights above the scene with random colors and given range, 0 for
+// unbounded lights
+//
+static void AddLights(SceneGraphType &scene, TestRandom &random, int count, double range)
+{
+    for (int i = 0; i != count; ++i)
+    {
+        std::shared_ptr<LightType> light(new LightType());
+        light->setPosition(GAL::P3d(random.next(-20, 20), random.next(1, 4), random.next(-20, 20)));
+        light->setDiffuseColor(GAL::P3d(random.next(), random.next(), random.next()) * 0.1);
+        light->setSpecularColor(GAL::P3d(random.next(), random.next(), random.next()) * 0.1);
+        light->setRange(range);
+
+        scene.addLight(light);
+    }
+}
+
+//
+// Hits of rays cast down onto the scene, prepared for shading as by
+// SceneGraph::raytrace()
+//
+static void CastShadingRays(SceneGraphType &scene, TestRandom &random, std::vector<RayType> &rays, std::vector<IntersectionPointType> &hits)
+{
+    while (rays.size() != NumShadingRays)
+    {
+        RayType ray;
+        ray.start = GAL::P3d(random.next(-20, 20), 10, random.next(-20, 20));
+        ray.direction = GAL::P3d(random.next(-0.5, 0.5), -1, random.next(-0.5, 0.5));
+
+        IntersectionPointType intersectionPoint;
+
+        if (!scene.intersectRay(ray, intersectionPoint))
+        {
+            continue;
+        }
+
+        ray.direction = GAL::Normalize<GAL::DefaultMath>(ray.direction);
+        intersectionPoint.normal = GAL::Normalize<GAL::DefaultMath>(intersectionPoint.normal);
+
+        rays.push_back(ray);
+        hits.push_back(intersectionPoint);
+    }
+}
+
+//
+// Time of shading by each light one by one
+//
+static double ShadeOneByOne(SceneGraphType &scene, std::vector<RayType> &rays, std::vector<IntersectionPointType> &hits)
+{
+    TestTimer timer;
+    ColorType sum;
+
+    for (size_t i = 0; i != rays.size(); ++i)
+    {
+        const SceneGraphType::ListLights &lights = scene.getLights();
+
+        for (SceneGraphType::ListLights::const_iterator it = lights.begin(); it != lights.end(); ++it)
+        {
+            sum += (*it)->illuminate(scene, rays[i], hits[i]);
+        }
+    }
+
+    Sink = sum[0];
+    return timer.getSeconds();
+}
+
+//
+// Time of shading by scene, through its light hierarchy
+//
+static double Shade(SceneGraphType &scene, std::vector<RayType> &rays, std::vector<IntersectionPointType> &hits)
+{
+    TestTimer timer;
+    ColorType sum;
+
+    for (size_t i = 0; i != rays.size(); ++i)
+    {
+        sum += scene.shade(rays[i], hits[i]);
+    }
+
+    Sink = sum[0];
+    return timer.getSeconds();
+}
+
+//
+// Shading by many lights with range, one by one and by hierarchy with and
+// without sampling
+//
+BENCHMARK(LightShading)
+{
+    static const int counts[] = { 64, 1024 };
+
+    for (int c = 0; c != 2; ++c)
+    {
+        TestRandom random;
+        SceneGraphType scene;
+        BuildScene(scene, random);
+        AddLights(scene, random, counts[c], 4);
+        scene.update();
+
+        std::vector<RayType> rays;
+        std::vector<IntersectionPointType> hits;
+        CastShadingRays(scene, random, rays, hits);
+
+        printf("  %d lights\n", counts[c]);
+        Report("one by one", ShadeOneByOne(scene, rays, hits), double(rays.size()), "points");
+        Report("hierarchy", Shade(scene, rays, hits), double(rays.size()), "points");
+
+        scene.getLightBVH().setNumSamples(4);
+        Report("hierarchy, 4 samples", Shade(scene, rays, hits), double(rays.size()), "points");
+    }
+}
+
+//
+// Shading by unbounded lights one by one and in batches, as all of them
+// are visited by hierarchy
+//
+BENCHMARK(LightBatchShading)
+{
+    static const int counts[] = { 8, 64 };
+
+    for (int c = 0; c != 2; ++c)
+    {
+        TestRandom random;
+        SceneGraphType scene;
+        BuildScene(scene, random);
+        AddLights(scene, random, counts[c], 0);
+        scene.update();
+
+        std::vector<RayType> rays;
+        std::vector<IntersectionPointType> hits;
+        CastShadingRays(scene, random, rays, hits);
+
+        printf("  %d lights\n", counts[c]);
+        Report("one by one", ShadeOneByOne(scene, rays, hits), double(rays.size()), "points");
+        Report("batches", Shade(scene, rays, hits), double(rays.size()), "points");
+    }
+}
+
+//
+// Shading by lights casting hard and soft shadows
+//
+BENCHMARK(ShadowShading)
+{
+    TestRandom random;
+    SceneGraphType scene;
+    BuildScene(scene, random);
+
+    std::vector< std::shared_ptr<LightType> > lights;
+
+    for (int i = 0; i != 8; ++i)
+    {
+        std::shared_ptr<LightType> light(new LightType());
+        light->setPosition(GAL::P3d(random.next(-20, 20), random.next(3, 8), random.next(-20, 20)));
+        light->setDiffuseColor(GAL::P3d(0.1, 0.1, 0.1));
+        light->setShadow(true);
+
+        scene.addLight(light);
+        lights.push_back(light);
+    }
+
+    scene.update();
+
+    std::vector<RayType> rays;
+    std::vector<IntersectionPointType> hits;
+    CastShadingRays(scene, random, rays, hits);
+
+    Report("hard", Shade(scene, rays, hits), double(rays.size()), "points");
+
+    for (size_t i = 0; i != lights.size(); ++i)
+    {
+        lights[i]->setSoftShadowWidth(0.3);
+    }
+
+    Report("soft", Shade(scene, rays, hits), double(rays.size()), "points");
+}
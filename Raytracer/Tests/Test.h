@@ -0,0 +1,233 @@
+#ifndef INCLUDED_TEST_H
+#define INCLUDED_TEST_H
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <vector>
+
+#include "Linear.h"
+#include "Intersect.h"
+
+//
+// Minimal test framework
+//
+// TEST(name) defines test function and registers it, so that it is run by
+// RunTests() (see Tests.cpp). CHECK(condition) reports failed condition
+// with its location, and test continues.
+//
+// BENCHMARK(name) defines function, which is run only by RunBenchmarks(),
+// and reports its measurements by Report().
+//
+namespace Test_imp {
+
+    typedef void (*TestFunction)();
+
+    struct TestCase
+    {
+        const char     *name;
+        TestFunction    function;
+    };
+
+    inline std::vector<TestCase> & GetTests()
+    {
+        static std::vector<TestCase> tests;
+        return tests;
+    }
+
+    inline std::vector<TestCase> & GetBenchmarks()
+    {
+        static std::vector<TestCase> benchmarks;
+        return benchmarks;
+    }
+
+    inline size_t & GetNumFailures()
+    {
+        static size_t numFailures = 0;
+        return numFailures;
+    }
+
+    struct Registrar
+    {
+        Registrar(const char *name, TestFunction function, bool isBenchmark = false)
+        {
+            TestCase test = { name, function };
+            (isBenchmark ? GetBenchmarks() : GetTests()).push_back(test);
+        }
+    };
+
+    inline void Fail(const char *file, int line, const char *condition)
+    {
+        printf("%s(%d): check failed: %s\n", file, line, condition);
+        ++GetNumFailures();
+    }
+
+} // namespace Test_imp
+
+#define TEST(name) \
+    static void name(); \
+    static Test_imp::Registrar name##Registrar(#name, name); \
+    static void name()
+
+#define CHECK(condition) \
+    ((condition) ? (void)0 : Test_imp::Fail(__FILE__, __LINE__, #condition))
+
+#define BENCHMARK(name) \
+    static void name(); \
+    static Test_imp::Registrar name##Registrar(#name, name, true); \
+    static void name()
+
+//
+// Run all registered tests, returns number of failed checks
+//
+inline size_t RunTests()
+{
+    const std::vector<Test_imp::TestCase> &tests = Test_imp::GetTests();
+
+    for (size_t i = 0; i != tests.size(); ++i)
+    {
+        const size_t before = Test_imp::GetNumFailures();
+
+        tests[i].function();
+
+        printf("%-40s %s\n", tests[i].name, before == Test_imp::GetNumFailures() ? "ok" : "FAILED");
+    }
+
+    return Test_imp::GetNumFailures();
+}
+
+//
+// Run registered benchmarks, whose name contains filter
+//
+inline void RunBenchmarks(const char *filter)
+{
+    const std::vector<Test_imp::TestCase> &benchmarks = Test_imp::GetBenchmarks();
+
+    for (size_t i = 0; i != benchmarks.size(); ++i)
+    {
+        if (0 == strstr(benchmarks[i].name, filter))
+        {
+            continue;
+        }
+
+        printf("%s\n", benchmarks[i].name);
+
+        benchmarks[i].function();
+    }
+}
+
+//
+// Wall clock time since construction, or since last restart()
+//
+class TestTimer
+{
+public:
+    TestTimer(): mStart(std::chrono::high_resolution_clock::now())
+    {
+    }
+
+    void restart()
+    {
+        mStart = std::chrono::high_resolution_clock::now();
+    }
+
+    double getSeconds() const
+    {
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - mStart;
+        return elapsed.count();
+    }
+
+private:
+    std::chrono::high_resolution_clock::time_point mStart;
+};
+
+//
+// Print measurement of benchmark, with rate in millions of count per second
+// if count is given
+//
+inline void Report(const char *what, double seconds, double count = 0, const char *unit = "")
+{
+    if (0 < count && 0 < seconds)
+    {
+        printf("    %-40s %9.3f s %9.3f M%s/s\n", what, seconds, count / seconds * 1e-6, unit);
+    }
+    else
+    {
+        printf("    %-40s %9.3f s\n", what, seconds);
+    }
+}
+
+inline void ReportMemory(const char *what, size_t bytes)
+{
+    printf("    %-40s %9.1f MB\n", what, double(bytes) / (1 << 20));
+}
+
+//
+// Deterministic random numbers, so that failures can be reproduced
+//
+class TestRandom
+{
+public:
+    explicit TestRandom(unsigned int seed = 1): mState(seed | 1)
+    {
+    }
+
+    //
+    // Uniform in [low, high)
+    //
+    double next(double low = 0, double high = 1)
+    {
+        mState ^= mState << 13;
+        mState ^= mState >> 17;
+        mState ^= mState << 5;
+
+        return low + (high - low) * double(mState >> 8) * (1.0 / (1 << 24));
+    }
+
+    GAL::P3d nextPoint(double low, double high)
+    {
+        const double x = next(low, high);
+        const double y = next(low, high);
+        const double z = next(low, high);
+
+        return GAL::P3d(x, y, z);
+    }
+
+    //
+    // Ray starting in box [-extent, extent]^3 towards another point of it
+    //
+    GAL_imp::Ray<double,3> nextRay(double extent)
+    {
+        GAL_imp::Ray<double,3> ray;
+        ray.start = nextPoint(-extent, extent);
+        ray.direction = nextPoint(-extent, extent) - ray.start;
+
+        return ray;
+    }
+
+private:
+    unsigned int mState;
+};
+
+//
+// Intersections agree in distance and position
+//
+template<class IntersectionPointType>
+    bool SameHit(bool hit, const IntersectionPointType &out, bool expectedHit, const IntersectionPointType &expected, double tolerance = 1e-9)
+    {
+        if (hit != expectedHit)
+        {
+            return false;
+        }
+
+        if (!hit)
+        {
+            return true;
+        }
+
+        return (std::fabs(out.distance - expected.distance) <= tolerance * (1 + std::fabs(expected.distance)) &&
+                GAL::Distance(out.position, expected.position) <= tolerance * (1 + GAL::Len(expected.position)));
+    }
+
+#endif
@@ -0,0 +1,599 @@
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "Test.h"
+#include "Clump.h"
+#include "GeometryStore.h"
+#include "MeshResource.h"
+#include "SceneGraph.h"
+
+typedef Clump<double>                       ClumpType;
+typedef GeometryStore<double>               StoreType;
+typedef GAL_imp::Point<double,3>            VertexType;
+typedef MeshResource<VertexType>            MeshResourceType;
+typedef MeshResourceType::MeshType          MeshType;
+typedef MeshResourceType::RayHitType        RayHitType;
+typedef MeshGeometry<VertexType>            MeshGeometryType;
+typedef IntersectionPoint<double,3>         IntersectionPointType;
+typedef GAL_imp::Ray<double,3>              RayType;
+
+static const BVHLayout Layouts[] =
+{
+    BinaryBVHLayout,
+    Wide4BVHLayout,
+    Wide8BVHLayout,
+    Quantized4BVHLayout,
+    Quantized8BVHLayout
+};
+
+static const size_t NumLayouts = sizeof(Layouts) / sizeof(Layouts[0]);
+
+//
+// Triangles with corners within size of random point of box
+// [-extent, extent]^3, both as mesh and as plain list of corners
+//
+static void AddTriangles(MeshType &mesh, std::vector<GAL::P3d> &corners, TestRandom &random, size_t count, double extent, double size)
+{
+    for (size_t i = 0; i != count; ++i)
+    {
+        const GAL::P3d center = random.nextPoint(-extent, extent);
+
+        for (int j = 0; j != 3; ++j)
+        {
+            const GAL::P3d corner = center + random.nextPoint(-size, size);
+
+            mesh.addVertex(corner);
+            mesh.addIndex(int(mesh.getNumVertices() - 1));
+            corners.push_back(corner);
+        }
+    }
+}
+
+//
+// Closest hit of all triangles, as by MeshResource::hitLocalRay()
+//
+static bool HitAllTriangles(const RayType &ray, const std::vector<GAL::P3d> &corners, double &distance)
+{
+    distance = -1;
+
+    for (size_t i = 0; i + 2 < corners.size(); i += 3)
+    {
+        GAL_imp::Solution<double,3> solution;
+
+        if (!GAL::IntersectRayTriangleByPoints(ray, corners[i], corners[i+1], corners[i+2], solution) || solution.x[0] < 0.0001)
+        {
+            continue;
+        }
+
+        if (-1 == distance || solution.x[0] < distance)
+        {
+            distance = solution.x[0];
+        }
+    }
+
+    return (-1 != distance);
+}
+
+//
+// Each layout finds the same closest hit as test of all triangles, within
+// tolerance, which allows for snapping of compressed mesh
+//
+static void CheckMeshLayouts(MeshResourceType &resource, const std::vector<GAL::P3d> &corners, TestRandom &random, double extent, double tolerance = 1e-9)
+{
+    for (size_t i = 0; i != NumLayouts; ++i)
+    {
+        resource.setBVHLayout(Layouts[i]);
+
+        for (int j = 0; j != 500; ++j)
+        {
+            const RayType ray = random.nextRay(extent);
+
+            double expected;
+            const bool expectedHit = HitAllTriangles(ray, corners, expected);
+
+            RayHitType hit;
+            const bool isHit = resource.hitLocalRay(ray, hit);
+
+            CHECK(isHit == expectedHit);
+            CHECK(!isHit || !expectedHit || std::fabs(hit.distance - expected) <= tolerance * (1 + expected));
+        }
+    }
+}
+
+//
+// Each storage of triangles and their order, compressed mesh is snapped to
+// grid of 2^20 steps across its bounds
+//
+TEST(MeshLayoutsMatchAllTriangles)
+{
+    TestRandom random;
+
+    for (int options = 0; options != 8; ++options)
+    {
+        std::vector<GAL::P3d> corners;
+
+        MeshResourceType resource;
+        AddTriangles(resource.getMesh(), corners, random, 3000, 10, 1);
+
+        const bool compress = (0 != (options & 2));
+
+        resource.setPrecomputeTriangles(0 != (options & 1));
+        resource.setCompressMesh(compress);
+        resource.setOptimizeMeshLayout(0 != (options & 4));
+        resource.meshChanged();
+
+        CheckMeshLayouts(resource, corners, random, 12, compress ? 1e-4 : 1e-9);
+    }
+}
+
+//
+// Threads casting the first rays at lazily built mesh at once find the
+// same hits as test of all triangles, while one of them builds hierarchy
+// and the others intersect all triangles until it is done
+//
+TEST(MeshLazyBuildUnderConcurrentRays)
+{
+    TestRandom random;
+
+    std::vector<GAL::P3d> corners;
+    MeshType mesh;
+    AddTriangles(mesh, corners, random, 3000, 10, 1);
+
+    const size_t numRays = 2000;
+    const size_t numChunks = 8;
+
+    std::vector<RayType> rays(numRays);
+    std::vector<double> expected(numRays);
+
+    for (size_t i = 0; i != numRays; ++i)
+    {
+        rays[i] = random.nextRay(12);
+        HitAllTriangles(rays[i], corners, expected[i]);
+    }
+
+    for (size_t i = 0; i != 2 * NumLayouts; ++i)
+    {
+        MeshResourceType resource;
+        resource.getMesh() = mesh;
+        resource.setBVHLayout(Layouts[i % NumLayouts]);
+        resource.setPrecomputeTriangles(NumLayouts <= i);
+        resource.setLazyBuild(true);
+        resource.meshChanged();
+
+        CHECK(resource.isBuildPending());
+
+        // CHECK is not thread-safe, so mismatches are counted per chunk
+        std::vector<size_t> numMismatches(numChunks, 0);
+
+        ParallelForChunks(numRays, numChunks,
+            [&resource, &rays, &expected, &numMismatches](size_t chunk, size_t begin, size_t end)
+            {
+                for (size_t j = begin; j != end; ++j)
+                {
+                    RayHitType hit;
+                    const bool isHit = resource.hitLocalRay(rays[j], hit);
+
+                    if (isHit != (-1 != expected[j]) || (isHit && 1e-9 * (1 + expected[j]) < std::fabs(hit.distance - expected[j])))
+                    {
+                        ++numMismatches[chunk];
+                    }
+                }
+            });
+
+        for (size_t chunk = 0; chunk != numChunks; ++chunk)
+        {
+            CHECK(0 == numMismatches[chunk]);
+        }
+
+        CHECK(!resource.isBuildPending());
+    }
+}
+
+//
+// Triangles at powers of two make binned hierarchy split off the farthest
+// triangle per level, so that the leaf at depth limit holds more triangles
+// than quantized node can count, and wide layout is used instead (see
+// QuantizedBVH::build()). Rays are cast at triangles, whose corners are
+// representable apart.
+//
+TEST(MeshQuantizedFallback)
+{
+    std::vector<GAL::P3d> corners;
+
+    MeshResourceType resource;
+    MeshType &mesh = resource.getMesh();
+
+    for (int i = 0; i != 900; ++i)
+    {
+        const double x = std::ldexp(1.0, i);
+        const GAL::P3d triangle[3] = { GAL::P3d(x - 0.5, -0.5, 0), GAL::P3d(x + 0.5, -0.5, 0), GAL::P3d(x, 0.5, 0) };
+
+        for (int j = 0; j != 3; ++j)
+        {
+            mesh.addVertex(triangle[j]);
+            mesh.addIndex(int(mesh.getNumVertices() - 1));
+            corners.push_back(triangle[j]);
+        }
+    }
+
+    resource.meshChanged();
+
+    for (size_t i = 0; i != NumLayouts; ++i)
+    {
+        resource.setBVHLayout(Layouts[i]);
+
+        for (int j = 0; j != 48; ++j)
+        {
+            RayType ray;
+            ray.start = GAL::P3d(std::ldexp(1.0, j), 0.1, 10);
+            ray.direction = GAL::P3d(0, 0, -1);
+
+            double expected;
+            const bool expectedHit = HitAllTriangles(ray, corners, expected);
+
+            RayHitType hit;
+            const bool isHit = resource.hitLocalRay(ray, hit);
+
+            CHECK(expectedHit);
+            CHECK(isHit && std::fabs(hit.distance - expected) <= 1e-9);
+        }
+    }
+}
+
+//
+// Rays parallel to axes, which start in planes of faces of hierarchy boxes,
+// have 0 * inf = NaN in slab test, and are still found by each layout, as
+// by test of all triangles
+//
+TEST(MeshAxisAlignedRays)
+{
+    const int size = 40;
+
+    std::vector<GAL::P3d> corners;
+
+    MeshResourceType resource;
+    MeshType &mesh = resource.getMesh();
+
+    for (int y = 0; y != size; ++y)
+    {
+        for (int x = 0; x != size; ++x)
+        {
+            const GAL::P3d p00(x, y, 0), p10(x + 1, y, 0), p01(x, y + 1, 0), p11(x + 1, y + 1, 0);
+            const GAL::P3d triangles[6] = { p00, p10, p01, p01, p10, p11 };
+
+            for (int j = 0; j != 6; ++j)
+            {
+                mesh.addVertex(triangles[j]);
+                mesh.addIndex(int(mesh.getNumVertices() - 1));
+                corners.push_back(triangles[j]);
+            }
+        }
+    }
+
+    resource.meshChanged();
+
+    for (size_t i = 0; i != NumLayouts; ++i)
+    {
+        resource.setBVHLayout(Layouts[i]);
+
+        size_t numHits = 0;
+
+        for (int line = 0; line <= size; ++line)
+        {
+            for (int j = 0; j != 2 * size; ++j)
+            {
+                // Along -z in planes x = line and y = line, and along +x in
+                // plane z = 0 of the grid
+                RayType rays[3];
+                rays[0].start = GAL::P3d(line, 0.25 + 0.5 * j, 10);
+                rays[0].direction = GAL::P3d(0, 0, -1);
+                rays[1].start = GAL::P3d(0.25 + 0.5 * j, line, 10);
+                rays[1].direction = GAL::P3d(0, 0, -1);
+                rays[2].start = GAL::P3d(-1, 0.25 + 0.5 * j, 0);
+                rays[2].direction = GAL::P3d(1, 0, 0);
+
+                for (int k = 0; k != 3; ++k)
+                {
+                    double expected;
+                    const bool expectedHit = HitAllTriangles(rays[k], corners, expected);
+
+                    RayHitType hit;
+                    const bool isHit = resource.hitLocalRay(rays[k], hit);
+
+                    CHECK(isHit == expectedHit);
+                    CHECK(!isHit || !expectedHit || std::fabs(hit.distance - expected) <= 1e-9);
+
+                    numHits += (isHit ? 1 : 0);
+                }
+            }
+        }
+
+        // Rays at grid edges hit it
+        CHECK(4 * (size + 1) * size <= numHits);
+    }
+}
+
+//
+// Clump with spheres and mesh instances, each layout finds the same closest
+// hit as test of all geometries, also after geometries were moved and
+// hierarchy refitted
+//
+TEST(ClumpLayoutsMatchAllGeometries)
+{
+    TestRandom random;
+    ClumpType clump;
+    StoreType store;
+
+    std::vector< std::shared_ptr<SphereGeometry3d> > spheres;
+
+    for (int i = 0; i != 300; ++i)
+    {
+        std::shared_ptr<SphereGeometry3d> sphere(new SphereGeometry3d(random.next(0.1, 0.5)));
+        sphere->setTranslation(random.nextPoint(-10, 10));
+
+        clump.addGeometry(sphere);
+        store.addGeometry(sphere);
+        spheres.push_back(sphere);
+    }
+
+    std::shared_ptr<MeshGeometryType> mesh(new MeshGeometryType());
+    std::vector<GAL::P3d> corners;
+
+    AddTriangles(mesh->getMesh(), corners, random, 50, 1, 0.5);
+    mesh->meshChanged();
+
+    for (int i = 0; i != 20; ++i)
+    {
+        std::shared_ptr<MeshGeometryType> instance(new MeshGeometryType(mesh->getResource()));
+        instance->setTranslation(random.nextPoint(-10, 10));
+
+        clump.addGeometry(instance);
+        store.addGeometry(instance);
+    }
+
+    clump.update();
+
+    for (int pass = 0; pass != 2; ++pass)
+    {
+        for (size_t i = 0; i != NumLayouts; ++i)
+        {
+            clump.setBVHLayout(Layouts[i]);
+
+            for (int j = 0; j != 500; ++j)
+            {
+                const RayType ray = random.nextRay(12);
+
+                IntersectionPointType out, expected;
+                const bool hit = clump.intersectRay(ray, out);
+                const bool expectedHit = store.intersectRay(ray, expected);
+
+                CHECK(SameHit(hit, out, expectedHit, expected));
+            }
+        }
+
+        // Move some of spheres, within and out of the others
+        for (size_t i = 0; i < spheres.size(); i += 7)
+        {
+            spheres[i]->setTranslation(random.nextPoint(-20, 20));
+        }
+
+        clump.update();
+    }
+}
+
+//
+// Instances share resource of mesh, hit it at their own placement, and all
+// of them follow changes of the mesh made through any of them, also after
+// some of them were destroyed
+//
+TEST(MeshInstancesShareResource)
+{
+    TestRandom random;
+
+    std::shared_ptr<MeshGeometryType> mesh(new MeshGeometryType());
+    std::vector<GAL::P3d> corners;
+
+    AddTriangles(mesh->getMesh(), corners, random, 50, 1, 0.5);
+    mesh->meshChanged();
+
+    std::vector< std::shared_ptr<MeshGeometryType> > instances;
+
+    for (int i = 0; i != 10; ++i)
+    {
+        std::shared_ptr<MeshGeometryType> instance(new MeshGeometryType(mesh->getResource()));
+        instance->setTranslation(GAL::P3d(10 * i, 0, 0));
+        instances.push_back(instance);
+
+        CHECK(mesh->getResource() == instance->getResource());
+    }
+
+    for (int pass = 0; pass != 2; ++pass)
+    {
+        for (size_t i = 0; i != instances.size(); ++i)
+        {
+            const GAL::P3d translation(10.0 * double(i), 0, 0);
+
+            CHECK(std::fabs(instances[i]->getWorldBounds().radius - mesh->getWorldBounds().radius) < 1e-9);
+
+            for (int j = 0; j != 20; ++j)
+            {
+                RayType ray = random.nextRay(2);
+
+                IntersectionPointType out, expected;
+                const bool expectedHit = mesh->intersectRay(ray, expected);
+
+                ray.start = ray.start + translation;
+                expected.position = expected.position + translation;
+
+                CHECK(SameHit(instances[i]->intersectRay(ray, out), out, expectedHit, expected));
+            }
+        }
+
+        // Mesh grows through one of instances, and one of the others is
+        // destroyed
+        AddTriangles(instances[3]->getMesh(), corners, random, 10, 4, 0.5);
+        instances[3]->meshChanged();
+
+        instances.erase(instances.begin() + 5);
+        instances.insert(instances.begin() + 5, std::shared_ptr<MeshGeometryType>(new MeshGeometryType(mesh->getResource())));
+        instances[5]->setTranslation(GAL::P3d(50, 0, 0));
+    }
+}
+
+//
+// Sphere in two clumps is moved, both of them refit to its new position
+//
+TEST(ClumpsShareMovedGeometry)
+{
+    std::shared_ptr<SphereGeometry3d> sphere(new SphereGeometry3d(1));
+    sphere->setTranslation(GAL::P3d(0, 0, 0));
+
+    ClumpType clumps[2];
+
+    for (int i = 0; i != 2; ++i)
+    {
+        std::shared_ptr<SphereGeometry3d> other(new SphereGeometry3d(1));
+        other->setTranslation(GAL::P3d(-10, 0, 0));
+
+        clumps[i].addGeometry(other);
+        clumps[i].addGeometry(sphere);
+        clumps[i].update();
+    }
+
+    sphere->setTranslation(GAL::P3d(10, 0, 0));
+
+    for (int i = 0; i != 2; ++i)
+    {
+        clumps[i].update();
+
+        RayType ray;
+        ray.start = GAL::P3d(10, 5, 0);
+        ray.direction = GAL::P3d(0, -1, 0);
+
+        IntersectionPointType out;
+        CHECK(clumps[i].intersectRay(ray, out));
+        CHECK(std::fabs(out.position[1] - 1) < 1e-9);
+    }
+}
+
+//
+// Sphere, whose normals point inwards, which is derived from built-in type
+// and so must be intersected through its virtual doIntersectRay()
+//
+class ReversedSphere : public SphereGeometry3d
+{
+public:
+    ReversedSphere(double radius): SphereGeometry3d(radius)
+    {
+    }
+
+protected:
+    bool doIntersectRay(const RayType &ray, IntersectionPointType &out)
+    {
+        if (!SphereGeometry3d::doIntersectRay(ray, out))
+        {
+            return false;
+        }
+
+        out.normal = -out.normal;
+        return true;
+    }
+};
+
+//
+// Store keeps geometries by their dynamic type, and hit of built-in type
+// wins over the same hit of other geometry
+//
+TEST(StoreDispatchesOnDynamicType)
+{
+    StoreType store;
+
+    std::shared_ptr<SphereGeometry3d> reversed(new ReversedSphere(1));
+    std::shared_ptr< Geometry<double> > sphere(new SphereGeometry3d(1));
+
+    CHECK(StoreType::Others == store.addGeometry(reversed).kind);
+    CHECK(StoreType::Spheres == store.addGeometry(sphere).kind);
+
+    RayType ray;
+    ray.start = GAL::P3d(0, 5, 0);
+    ray.direction = GAL::P3d(0, -1, 0);
+
+    IntersectionPointType out;
+    CHECK(store.intersectRay(ray, out));
+    CHECK(0 < out.normal[1]);
+
+    StoreType others;
+    others.addGeometry(reversed);
+
+    CHECK(others.intersectRay(ray, out));
+    CHECK(out.normal[1] < 0);
+}
+
+//
+// Scene of overlapping clumps finds the same closest hit as test of all
+// geometries, also with one clump, whose hierarchy is not up to date
+//
+TEST(SceneMatchesAllGeometries)
+{
+    TestRandom random;
+    SceneGraph<double> scene;
+    StoreType store;
+
+    std::shared_ptr<MeshGeometryType> mesh(new MeshGeometryType());
+    std::vector<GAL::P3d> corners;
+
+    AddTriangles(mesh->getMesh(), corners, random, 50, 1, 0.5);
+    mesh->meshChanged();
+
+    std::vector< std::shared_ptr<ClumpType> > clumps;
+
+    for (int i = 0; i != 4; ++i)
+    {
+        std::shared_ptr<ClumpType> clump(new ClumpType());
+
+        for (int j = 0; j != 100; ++j)
+        {
+            std::shared_ptr<SphereGeometry3d> sphere(new SphereGeometry3d(random.next(0.1, 0.5)));
+            sphere->setTranslation(random.nextPoint(-10, 10));
+
+            clump->addGeometry(sphere);
+            store.addGeometry(sphere);
+        }
+
+        for (int j = 0; j != 5; ++j)
+        {
+            std::shared_ptr<MeshGeometryType> instance(new MeshGeometryType(mesh->getResource()));
+            instance->setTranslation(random.nextPoint(-10, 10));
+
+            clump->addGeometry(instance);
+            store.addGeometry(instance);
+        }
+
+        scene.addClump(clump);
+        clumps.push_back(clump);
+    }
+
+    scene.update();
+
+    for (int pass = 0; pass != 2; ++pass)
+    {
+        for (int i = 0; i != 1000; ++i)
+        {
+            const RayType ray = random.nextRay(12);
+
+            IntersectionPointType out, expected;
+            const bool hit = scene.intersectRay(ray, out);
+            const bool expectedHit = store.intersectRay(ray, expected);
+
+            CHECK(SameHit(hit, out, expectedHit, expected));
+        }
+
+        // Hierarchy of the last clump is not updated
+        std::shared_ptr<SphereGeometry3d> sphere(new SphereGeometry3d(1));
+        sphere->setTranslation(random.nextPoint(-5, 5));
+
+        clumps.back()->addGeometry(sphere);
+        store.addGeometry(sphere);
+    }
+}
@@ -0,0 +1,194 @@
+#include <cmath>
+#include <vector>
+
+#include "Test.h"
+#include "ClusteredMesh.h"
+
+typedef GAL_imp::Point<double,3>                PointType;
+typedef ClusteredMesh<Vertex3d>                 ClusteredMeshType;
+typedef ClusteredMeshType::MeshType             MeshType;
+typedef ClusteredMesh<PointType>                ClusteredPointMeshType;
+typedef ClusteredPointMeshType::MeshType        PointMeshType;
+
+//
+// Heightfield of size x size cells, whose vertices are shared by
+// triangles, with random normals, and triangles far apart, which do not
+// fit into cluster with their neighbours
+//
+static void BuildMesh(MeshType &mesh, TestRandom &random, int size)
+{
+    for (int y = 0; y <= size; ++y)
+    {
+        for (int x = 0; x <= size; ++x)
+        {
+            Vertex3d vertex;
+            vertex.position = GAL::P3d(x, random.next(-1, 1), y);
+            vertex.normal = GAL::Normalize<GAL::DefaultMath>(random.nextPoint(-1, 1));
+            mesh.addVertex(vertex);
+        }
+    }
+
+    for (int y = 0; y != size; ++y)
+    {
+        for (int x = 0; x != size; ++x)
+        {
+            const int i = y * (size + 1) + x;
+
+            mesh.addIndex(i);
+            mesh.addIndex(i + 1);
+            mesh.addIndex(i + size + 1);
+
+            mesh.addIndex(i + 1);
+            mesh.addIndex(i + size + 2);
+            mesh.addIndex(i + size + 1);
+        }
+    }
+
+    for (int i = 0; i != 20; ++i)
+    {
+        const GAL::P3d center = random.nextPoint(-1000, 1000);
+
+        for (int j = 0; j != 3; ++j)
+        {
+            Vertex3d vertex;
+            vertex.position = center + random.nextPoint(-1, 1);
+            vertex.normal = GAL::Normalize<GAL::DefaultMath>(random.nextPoint(-1, 1));
+            mesh.addVertex(vertex);
+            mesh.addIndex(int(mesh.getNumVertices() - 1));
+        }
+    }
+}
+
+//
+// Random order of triangles
+//
+static std::vector<size_t> Shuffle(size_t count, TestRandom &random)
+{
+    std::vector<size_t> ordering(count);
+
+    for (size_t i = 0; i != count; ++i)
+    {
+        ordering[i] = i;
+    }
+
+    for (size_t i = count; 1 < i; --i)
+    {
+        std::swap(ordering[i - 1], ordering[size_t(random.next(0, double(i)))]);
+    }
+
+    return ordering;
+}
+
+static bool SamePosition(const PointType &a, const PointType &b)
+{
+    return (a[0] == b[0] && a[1] == b[1] && a[2] == b[2]);
+}
+
+static bool SameNormal(const PointType &a, const PointType &b)
+{
+    return (GAL::Len(a - b) < 1e-4);
+}
+
+//
+// Compressed mesh decodes to positions snapped by snapPositions() and
+// normals within precision of 16-bit octahedral encoding, by triangle and
+// by decompression of whole mesh
+//
+TEST(ClusteredMeshDecodesMesh)
+{
+    TestRandom random;
+    MeshType mesh;
+
+    BuildMesh(mesh, random, 40);
+
+    ClusteredMeshType clustered;
+    clustered.snapPositions(mesh);
+
+    const size_t numTriangles = mesh.getNumIndices() / 3;
+    const std::vector<size_t> ordering = Shuffle(numTriangles, random);
+
+    clustered.build(mesh, &ordering[0]);
+
+    CHECK(numTriangles == clustered.getNumTriangles());
+    CHECK(clustered.getMemorySize() < mesh.getNumVertices() * sizeof(Vertex3d) + mesh.getNumIndices() * sizeof(int));
+
+    const Vertex3d *vertices = mesh.getVertexPointer();
+    const int *indices = mesh.getIndexPointer();
+
+    size_t cluster = clustered.findCluster(0);
+
+    for (size_t i = 0; i != numTriangles; ++i)
+    {
+        Vertex3d decoded[3];
+        clustered.getTriangleVertices(i, decoded[0], decoded[1], decoded[2]);
+
+        cluster = clustered.advanceCluster(cluster, i);
+        CHECK(clustered.findCluster(i) == cluster);
+
+        PointType positions[3];
+        clustered.getTrianglePositions(cluster, i, positions[0], positions[1], positions[2]);
+
+        for (int k = 0; k != 3; ++k)
+        {
+            const Vertex3d &vertex = vertices[indices[3 * ordering[i] + k]];
+
+            CHECK(SamePosition(vertex.position, decoded[k].position));
+            CHECK(SamePosition(vertex.position, positions[k]));
+            CHECK(SameNormal(vertex.normal, decoded[k].normal));
+        }
+    }
+
+    MeshType decompressed;
+    clustered.decompress(decompressed);
+
+    CHECK(decompressed.getNumIndices() == mesh.getNumIndices());
+
+    for (size_t i = 0; i != numTriangles && i < decompressed.getNumIndices() / 3; ++i)
+    {
+        for (int k = 0; k != 3; ++k)
+        {
+            const Vertex3d &vertex = vertices[indices[3 * ordering[i] + k]];
+            const Vertex3d &decoded = decompressed.getVertexPointer()[decompressed.getIndexPointer()[3 * i + k]];
+
+            CHECK(SamePosition(vertex.position, decoded.position));
+            CHECK(SameNormal(vertex.normal, decoded.normal));
+        }
+    }
+}
+
+//
+// Vertices without attributes other than position
+//
+TEST(ClusteredMeshDecodesPoints)
+{
+    TestRandom random;
+    PointMeshType mesh;
+
+    for (int i = 0; i != 1000; ++i)
+    {
+        const GAL::P3d center = random.nextPoint(-100, 100);
+
+        for (int j = 0; j != 3; ++j)
+        {
+            mesh.addVertex(center + random.nextPoint(-1, 1));
+            mesh.addIndex(int(mesh.getNumVertices() - 1));
+        }
+    }
+
+    ClusteredPointMeshType clustered;
+    clustered.snapPositions(mesh);
+
+    const std::vector<size_t> ordering = Shuffle(mesh.getNumIndices() / 3, random);
+    clustered.build(mesh, &ordering[0]);
+
+    for (size_t i = 0; i != ordering.size(); ++i)
+    {
+        PointType decoded[3];
+        clustered.getTriangleVertices(i, decoded[0], decoded[1], decoded[2]);
+
+        for (int k = 0; k != 3; ++k)
+        {
+            CHECK(SamePosition(mesh.getVertexPointer()[mesh.getIndexPointer()[3 * ordering[i] + k]], decoded[k]));
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#include <cmath>
+#include <limits>
+
+#include "Test.h"
+#include "FastMath.h"
+
+//
+// Error bounds of FastMath as documented in FastMath.h
+//
+struct FloatBounds
+{
+    static double getSqrt() { return 5e-6; }
+};
+
+struct DoubleBounds
+{
+    static double getSqrt() { return 4e-11; }
+};
+
+//
+// Errors relative to C library in double precision over normal numbers of
+// exponents in [-60, 60), arguments of Acos in [-1, 1] and powers, which
+// do not overflow float
+//
+template<class N, class Bounds>
+    static void CheckFastMath()
+    {
+        typedef GAL::FastMath Math;
+
+        TestRandom random;
+
+        const double epsilon = double((std::numeric_limits<N>::epsilon)());
+        const double acosBound = 3e-8 + 1.5707963267948966 * Bounds::getSqrt() + 4 * epsilon;
+
+        for (int i = 0; i != 100000; ++i)
+        {
+            const N x = N(std::ldexp(random.next(1, 2), int(random.next(-60, 60))));
+            const double sqrtX = std::sqrt(double(x));
+
+            CHECK(std::fabs(double(Math::RSqrt(x)) - 1 / sqrtX) * sqrtX <= Bounds::getSqrt());
+            CHECK(std::fabs(double(Math::Sqrt(x)) - sqrtX) / sqrtX <= Bounds::getSqrt());
+
+            const N a = N(random.next(-1, 1));
+
+            CHECK(std::fabs(double(Math::Acos(a)) - std::acos(double(a))) <= acosBound);
+
+            const N base = N(random.next(0, 4));
+            const N exponent = N(random.next(-20, 20));
+            const double product = std::fabs(double(exponent) * std::log2(double(base)));
+
+            if (0 < base && product < 100)
+            {
+                const double power = std::pow(double(base), double(exponent));
+
+                CHECK(std::fabs(double(Math::Pow(base, exponent)) - power) / power <= 2e-7 * (1 + product));
+            }
+        }
+
+        CHECK(0 == Math::Sqrt(N(0)));
+        CHECK(0 == Math::Pow(N(0), N(2)));
+    }
+
+TEST(FastMathFloatBounds)
+{
+    CheckFastMath<float, FloatBounds>();
+}
+
+TEST(FastMathDoubleBounds)
+{
+    CheckFastMath<double, DoubleBounds>();
+}
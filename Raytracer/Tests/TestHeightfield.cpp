@@ -0,0 +1,121 @@
+#include <cmath>
+
+#include "Test.h"
+#include "HeightfieldGeometry.h"
+
+typedef HeightfieldGeometry<double>         HeightfieldType;
+typedef HeightfieldType::RayHitType         RayHitType;
+typedef GAL_imp::Ray<double,3>              RayType;
+
+static double Height(double x, double y)
+{
+    return 0.8 * std::sin(0.7 * x) * std::cos(0.5 * y) + 0.3 * std::sin(2.3 * x + 1.7 * y);
+}
+
+//
+// Closest hit of both triangles of each cell, split along diagonal as
+// described by HeightfieldGeometry
+//
+static bool HitAllCells(const HeightfieldType &heightfield, double xMin, double yMin, double dx, double dy, const RayType &ray, double &distance)
+{
+    distance = -1;
+
+    for (size_t iy = 0; iy + 1 < heightfield.getNumY(); ++iy)
+    {
+        for (size_t ix = 0; ix + 1 < heightfield.getNumX(); ++ix)
+        {
+            GAL::P3d p[2][2];
+
+            for (size_t j = 0; j != 2; ++j)
+            {
+                for (size_t i = 0; i != 2; ++i)
+                {
+                    p[j][i] = GAL::P3d(xMin + double(ix + i) * dx, yMin + double(iy + j) * dy, heightfield.getHeight(ix + i, iy + j));
+                }
+            }
+
+            GAL_imp::Solution<double,3> solution[2];
+            const bool hit[2] =
+            {
+                GAL::IntersectRayTriangleByPoints(ray, p[0][0], p[0][1], p[1][0], solution[0]),
+                GAL::IntersectRayTriangleByPoints(ray, p[1][0], p[0][1], p[1][1], solution[1])
+            };
+
+            for (int k = 0; k != 2; ++k)
+            {
+                if (hit[k] && 0.0001 <= solution[k].x[0] && (-1 == distance || solution[k].x[0] < distance))
+                {
+                    distance = solution[k].x[0];
+                }
+            }
+        }
+    }
+
+    return (-1 != distance);
+}
+
+//
+// Mip level traversal finds the same closest hit as test of all cells, for
+// rays from above of any slope, including nearly horizontal ones, which
+// cross many cells, and rays starting off the grid
+//
+TEST(HeightfieldMatchesAllCells)
+{
+    const size_t numX = 45, numY = 29;
+    const double xMin = -11, xMax = 11, yMin = -7, yMax = 7;
+    const double dx = (xMax - xMin) / double(numX - 1), dy = (yMax - yMin) / double(numY - 1);
+
+    HeightfieldType heightfield(numX, numY, xMin, xMax, yMin, yMax);
+    heightfield.sample(Height);
+
+    TestRandom random;
+    size_t numHits = 0;
+
+    for (int i = 0; i != 3000; ++i)
+    {
+        RayType ray;
+        ray.start = GAL::P3d(random.next(-15, 15), random.next(-10, 10), random.next(1.2, 4));
+        ray.direction = GAL::P3d(random.next(-1, 1), random.next(-1, 1), 0 == i % 3 ? -random.next(0.01, 0.1) : -random.next(0.1, 2));
+
+        double expected;
+        const bool expectedHit = HitAllCells(heightfield, xMin, yMin, dx, dy, ray, expected);
+
+        RayHitType hit;
+        const bool isHit = heightfield.hitLocalRay(ray, hit);
+
+        CHECK(isHit == expectedHit);
+        CHECK(!isHit || !expectedHit || std::fabs(hit.distance - expected) <= 1e-9 * (1 + expected));
+
+        numHits += (isHit ? 1 : 0);
+    }
+
+    // Most rays reach the surface
+    CHECK(1000 < numHits);
+}
+
+//
+// Heights set directly and changed afterwards are picked up by
+// heightsChanged()
+//
+TEST(HeightfieldHeightsChanged)
+{
+    HeightfieldType heightfield(17, 17, 0, 16, 0, 16);
+
+    RayType ray;
+    ray.start = GAL::P3d(5.25, 7.5, 10);
+    ray.direction = GAL::P3d(0, 0, -1);
+
+    RayHitType hit;
+    CHECK(heightfield.hitLocalRay(ray, hit) && std::fabs(hit.distance - 10) < 1e-9);
+
+    double *heights = heightfield.getWritableHeightPointer();
+
+    for (size_t i = 0; i != heightfield.getNumX() * heightfield.getNumY(); ++i)
+    {
+        heights[i] = 3;
+    }
+
+    heightfield.heightsChanged();
+
+    CHECK(heightfield.hitLocalRay(ray, hit) && std::fabs(hit.distance - 7) < 1e-9);
+}
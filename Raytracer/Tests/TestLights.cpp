@@ -0,0 +1,331 @@
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "Test.h"
+#include "SceneGraph.h"
+
+typedef SceneGraph<double>          SceneGraphType;
+typedef Light<double>               LightType;
+typedef IntersectionPoint<double,3> IntersectionPointType;
+typedef GAL_imp::Ray<double,3>      RayType;
+typedef GAL_imp::Point<double,4>    ColorType;
+
+//
+// Ground sphere with smaller spheres on it, lit by lights with and without
+// range, some of them casting shadows
+//
+static void BuildScene(SceneGraphType &scene, std::vector< std::shared_ptr<LightType> > &lights, TestRandom &random, int numLights = 40)
+{
+    std::shared_ptr< Clump<double> > clump(new Clump<double>());
+
+    std::shared_ptr<SphereGeometry3d> ground(new SphereGeometry3d(50));
+    ground->setTranslation(GAL::P3d(0, -50, 0));
+    clump->addGeometry(ground);
+
+    for (int i = 0; i != 20; ++i)
+    {
+        std::shared_ptr<SphereGeometry3d> sphere(new SphereGeometry3d(random.next(0.2, 0.6)));
+        sphere->setTranslation(GAL::P3d(random.next(-4, 4), 0.5, random.next(-4, 4)));
+        clump->addGeometry(sphere);
+    }
+
+    scene.addClump(clump);
+
+    for (int i = 0; i != numLights; ++i)
+    {
+        std::shared_ptr<LightType> light(new LightType());
+        light->setPosition(GAL::P3d(random.next(-5, 5), random.next(1, 4), random.next(-5, 5)));
+        light->setDiffuseColor(GAL::P3d(random.next(), random.next(), random.next()) * 0.1);
+        light->setSpecularColor(GAL::P3d(random.next(), random.next(), random.next()) * 0.1);
+        light->setRange(0 == i % 4 ? 0 : random.next(1, 4));
+        light->setShadow(0 == i % 3);
+        light->setSoftShadowWidth(0 == i % 2 ? 0.05 : 0);
+
+        scene.addLight(light);
+        lights.push_back(light);
+    }
+}
+
+//
+// Hit of ray cast down onto the ground, prepared for shading as by
+// SceneGraph::raytrace()
+//
+static bool CastRay(SceneGraphType &scene, TestRandom &random, RayType &ray, IntersectionPointType &intersectionPoint)
+{
+    ray.start = GAL::P3d(random.next(-5, 5), 5, random.next(-5, 5));
+    ray.direction = GAL::P3d(random.next(-0.5, 0.5), -1, random.next(-0.5, 0.5));
+
+    if (!scene.intersectRay(ray, intersectionPoint))
+    {
+        return false;
+    }
+
+    ray.direction = GAL::Normalize<GAL::DefaultMath>(ray.direction);
+    intersectionPoint.normal = GAL::Normalize<GAL::DefaultMath>(intersectionPoint.normal);
+
+    return true;
+}
+
+//
+// Sum of all lights, one by one
+//
+static ColorType ShadeByAllLights(SceneGraphType &scene, RayType &ray, IntersectionPointType &intersectionPoint)
+{
+    ColorType color;
+
+    const SceneGraphType::ListLights &lights = scene.getLights();
+
+    for (SceneGraphType::ListLights::const_iterator it = lights.begin(); it != lights.end(); ++it)
+    {
+        color += (*it)->illuminate(scene, ray, intersectionPoint);
+    }
+
+    return color;
+}
+
+static bool SameColor(const ColorType &a, const ColorType &b, double tolerance)
+{
+    return (std::fabs(a[0] - b[0]) <= tolerance &&
+            std::fabs(a[1] - b[1]) <= tolerance &&
+            std::fabs(a[2] - b[2]) <= tolerance);
+}
+
+//
+// Shade all hits of random rays by hierarchy of lights and one by one
+//
+static void CheckShading(SceneGraphType &scene, TestRandom &random, int &numLit)
+{
+    for (int i = 0; i != 500; ++i)
+    {
+        RayType ray;
+        IntersectionPointType intersectionPoint;
+
+        if (!CastRay(scene, random, ray, intersectionPoint))
+        {
+            continue;
+        }
+
+        const ColorType expected = ShadeByAllLights(scene, ray, intersectionPoint);
+
+        CHECK(SameColor(scene.shade(ray, intersectionPoint), expected, 1e-9));
+
+        numLit += (0 < expected[0] + expected[1] + expected[2] ? 1 : 0);
+    }
+}
+
+TEST(LightHierarchyMatchesAllLights)
+{
+    TestRandom random;
+    SceneGraphType scene;
+    std::vector< std::shared_ptr<LightType> > lights;
+
+    BuildScene(scene, lights, random);
+    scene.update();
+
+    int numLit = 0;
+    CheckShading(scene, random, numLit);
+
+    CHECK(100 < numLit);
+}
+
+//
+// Changes of lights take effect before update() rebuilds hierarchy
+//
+TEST(LightChangesTakeEffectAtOnce)
+{
+    TestRandom random;
+    SceneGraphType scene;
+    std::vector< std::shared_ptr<LightType> > lights;
+
+    BuildScene(scene, lights, random);
+
+    int numLit = 0;
+    CheckShading(scene, random, numLit);
+
+    scene.update();
+
+    for (size_t i = 0; i + 2 < lights.size(); i += 3)
+    {
+        lights[i]->setDiffuseColor(GAL::P3d(0.2, 0, 0));
+        lights[i + 1]->setPosition(GAL::P3d(random.next(-5, 5), random.next(1, 4), random.next(-5, 5)));
+        lights[i + 2]->setRange(random.next(2, 6));
+    }
+
+    CheckShading(scene, random, numLit);
+
+    scene.update();
+    CheckShading(scene, random, numLit);
+
+    CHECK(300 < numLit);
+}
+
+//
+// Lights below cutoff are skipped, each of which adds less than cutoff
+//
+TEST(LightCutoffSkipsOnlyDarkLights)
+{
+    TestRandom random;
+    SceneGraphType scene;
+    std::vector< std::shared_ptr<LightType> > lights;
+
+    BuildScene(scene, lights, random);
+    scene.update();
+    scene.getLightBVH().setCutoff(1e-12);
+
+    int numLit = 0;
+    CheckShading(scene, random, numLit);
+
+    CHECK(100 < numLit);
+}
+
+//
+// Sampling uses all lights, when there are not more of them than samples
+//
+TEST(LightSamplingUsesAllOfFewLights)
+{
+    TestRandom random;
+    SceneGraphType scene;
+    std::vector< std::shared_ptr<LightType> > lights;
+
+    BuildScene(scene, lights, random, 6);
+    scene.update();
+    scene.getLightBVH().setNumSamples(8);
+
+    int numLit = 0;
+    CheckShading(scene, random, numLit);
+
+    CHECK(100 < numLit);
+}
+
+//
+// Average of sampled shading over many random sequences converges to sum of
+// all lights. Sequence is seeded by shading point, which is moved by less
+// than any tolerance of shading for each sample.
+//
+TEST(LightSamplingConvergesToAllLights)
+{
+    TestRandom random;
+    SceneGraphType scene;
+    std::vector< std::shared_ptr<LightType> > lights;
+
+    BuildScene(scene, lights, random);
+    scene.update();
+    scene.getLightBVH().setNumSamples(2);
+
+    const int numSequences = 2000;
+    int numPoints = 0, numSampled = 0;
+
+    while (numPoints != 20)
+    {
+        RayType ray;
+        IntersectionPointType intersectionPoint;
+
+        if (!CastRay(scene, random, ray, intersectionPoint))
+        {
+            continue;
+        }
+
+        ++numPoints;
+
+        const ColorType expected = ShadeByAllLights(scene, ray, intersectionPoint);
+        const GAL::P3d position = intersectionPoint.position;
+
+        ColorType sum;
+        bool sampled = false;
+
+        for (int i = 0; i != numSequences; ++i)
+        {
+            intersectionPoint.position = position + GAL::P3d(1e-12, 1e-12, 1e-12) * double(i);
+
+            const ColorType color = scene.shade(ray, intersectionPoint);
+            sampled |= !SameColor(color, expected, 1e-9);
+
+            sum += color;
+        }
+
+        numSampled += (sampled ? 1 : 0);
+
+        const ColorType average = sum * (1.0 / numSequences);
+        const double scale = Max(Max(expected[0], expected[1]), expected[2]);
+
+        CHECK(SameColor(average, expected, 0.05 * scale + 1e-3));
+    }
+
+    // Most points are reached by more lights than samples
+    CHECK(10 < numSampled);
+}
+
+//
+// Light in two scene graphs is changed, both of them shade by its new
+// parameters
+//
+TEST(ScenesShareChangedLight)
+{
+    TestRandom random;
+    SceneGraphType scenes[2];
+    std::vector< std::shared_ptr<LightType> > lights;
+
+    BuildScene(scenes[0], lights, random);
+    BuildScene(scenes[1], lights, random, 0);
+
+    for (size_t i = 0; i != lights.size(); ++i)
+    {
+        scenes[1].addLight(lights[i]);
+    }
+
+    for (int i = 0; i != 2; ++i)
+    {
+        scenes[i].update();
+    }
+
+    for (size_t i = 0; i + 1 < lights.size(); i += 2)
+    {
+        lights[i]->setDiffuseColor(GAL::P3d(0.2, 0, 0));
+        lights[i + 1]->setPosition(GAL::P3d(random.next(-5, 5), random.next(1, 4), random.next(-5, 5)));
+    }
+
+    int numLit = 0;
+
+    for (int i = 0; i != 2; ++i)
+    {
+        CheckShading(scenes[i], random, numLit);
+    }
+
+    CHECK(200 < numLit);
+}
+
+//
+// Largest difference of falloff table from acos() and pow() over cosines
+// in [-1, 1] and slightly beyond, which are clamped
+//
+template<class N>
+    static double GetFalloffError(double width, double sharpness)
+    {
+        const FalloffTable<N> table = FalloffTable<N>(N(width), N(sharpness));
+        double error = 0;
+
+        for (int i = -100010; i <= 100010; ++i)
+        {
+            const double cosine = i / 100000.0;
+            const double angle = std::acos(Min(Max(cosine, -1.0), 1.0));
+            const double expected = 1 / (std::pow(width * angle, sharpness) + 1);
+
+            error = Max(error, std::fabs(double(table(N(cosine))) - expected));
+            error = Max(error, std::fabs(double(FalloffTable<N>::evaluate(N(width), N(sharpness), N(cosine))) - expected));
+        }
+
+        return error;
+    }
+
+//
+// Falloff tables of diffuse and specular light are within their documented
+// tolerance of exact falloff
+//
+TEST(FalloffTableMatchesExactFalloff)
+{
+    CHECK(GetFalloffError<double>(2, 0.8) < 1e-3);
+    CHECK(GetFalloffError<double>(4, 16) < 3e-4);
+    CHECK(GetFalloffError<float>(2, 0.8) < 1e-3);
+    CHECK(GetFalloffError<float>(4, 16) < 3e-4);
+}
@@ -0,0 +1,183 @@
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "Test.h"
+#include "MeshResource.h"
+
+typedef GAL_imp::Point<double,3>            VertexType;
+typedef MeshResource<VertexType>            MeshResourceType;
+typedef MeshResourceType::MeshType          MeshType;
+typedef MeshResourceType::RayHitType        RayHitType;
+typedef GAL_imp::Ray<double,3>              RayType;
+
+static const char *CacheDirectory = ".";
+
+static void AddTriangles(MeshType &mesh, TestRandom &random, size_t count)
+{
+    for (size_t i = 0; i != count; ++i)
+    {
+        const GAL::P3d center = random.nextPoint(-10, 10);
+
+        for (int j = 0; j != 3; ++j)
+        {
+            mesh.addVertex(center + random.nextPoint(-1, 1));
+            mesh.addIndex(int(mesh.getNumVertices() - 1));
+        }
+    }
+}
+
+static bool FileExists(const std::string &path)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+
+    if (0 == file)
+    {
+        return false;
+    }
+
+    fclose(file);
+    return true;
+}
+
+static bool CopyEntry(const std::string &from, const std::string &to)
+{
+    FILE *in = fopen(from.c_str(), "rb");
+    FILE *out = fopen(to.c_str(), "wb");
+    bool ok = (0 != in && 0 != out);
+
+    char buffer[4096];
+    size_t size;
+
+    while (ok && 0 != (size = fread(buffer, 1, sizeof(buffer), in)))
+    {
+        ok = (size == fwrite(buffer, 1, size, out));
+    }
+
+    if (0 != in)
+    {
+        fclose(in);
+    }
+
+    if (0 != out)
+    {
+        fclose(out);
+    }
+
+    return ok;
+}
+
+//
+// Both resources find the same hits
+//
+static void CheckSameHits(const MeshResourceType &resource, const MeshResourceType &expected, TestRandom &random)
+{
+    for (int i = 0; i != 500; ++i)
+    {
+        const RayType ray = random.nextRay(12);
+
+        RayHitType hit, expectedHit;
+        const bool isHit = resource.hitLocalRay(ray, hit);
+        const bool isExpectedHit = expected.hitLocalRay(ray, expectedHit);
+
+        CHECK(isHit == isExpectedHit);
+        CHECK(!isHit || !isExpectedHit || hit.distance == expectedHit.distance);
+    }
+}
+
+//
+// Entry is written by first build of mesh, and mapped by the next one
+// instead of building, for each combination of options, which change what
+// is stored in entry
+//
+TEST(MeshCacheRoundTrip)
+{
+    TestRandom random;
+
+    MeshType mesh;
+    AddTriangles(mesh, random, 2000);
+
+    MeshCache cache;
+    cache.setDirectory(CacheDirectory);
+
+    for (int options = 0; options != 4; ++options)
+    {
+        const bool optimize = (0 != (options & 1));
+        const bool compress = (0 != (options & 2));
+
+        // Seed as by MeshResource
+        const std::string path = cache.getPath(MeshCache::hash(mesh, options));
+        std::remove(path.c_str());
+
+        // Mapped entry is released before it is removed
+        {
+            MeshResourceType built;
+            built.getMesh() = mesh;
+            built.setCacheDirectory(CacheDirectory);
+            built.setOptimizeMeshLayout(optimize);
+            built.setCompressMesh(compress);
+            built.meshChanged();
+
+            CHECK(FileExists(path));
+
+            MeshResourceType mapped;
+            mapped.getMesh() = mesh;
+            mapped.setCacheDirectory(CacheDirectory);
+            mapped.setOptimizeMeshLayout(optimize);
+            mapped.setCompressMesh(compress);
+            mapped.meshChanged();
+
+            // Compressed mesh is decoded from clusters instead
+            CHECK(compress || mapped.getMesh().isView());
+            CHECK(mapped.getBVH().getIndices() == built.getBVH().getIndices());
+            CHECK(0 == GAL::Distance(mapped.getBounds().center, built.getBounds().center) && mapped.getBounds().radius == built.getBounds().radius);
+
+            CheckSameHits(mapped, built, random);
+        }
+
+        std::remove(path.c_str());
+    }
+}
+
+//
+// Entry of other mesh under name of the mesh is not used, as hash in its
+// header does not match
+//
+TEST(MeshCacheRejectsOtherEntry)
+{
+    TestRandom random;
+
+    MeshType mesh, other;
+    AddTriangles(mesh, random, 500);
+    AddTriangles(other, random, 500);
+
+    MeshCache cache;
+    cache.setDirectory(CacheDirectory);
+
+    const std::string path = cache.getPath(MeshCache::hash(mesh, 0));
+    const std::string otherPath = cache.getPath(MeshCache::hash(other, 0));
+
+    MeshResourceType built;
+    built.getMesh() = other;
+    built.setCacheDirectory(CacheDirectory);
+    built.meshChanged();
+
+    CHECK(CopyEntry(otherPath, path));
+
+    MeshResourceType resource;
+    resource.getMesh() = mesh;
+    resource.setCacheDirectory(CacheDirectory);
+    resource.meshChanged();
+
+    CHECK(!resource.getMesh().isView());
+
+    MeshResourceType uncached;
+    uncached.getMesh() = mesh;
+    uncached.meshChanged();
+
+    CheckSameHits(resource, uncached, random);
+
+    std::remove(path.c_str());
+    std::remove(otherPath.c_str());
+}
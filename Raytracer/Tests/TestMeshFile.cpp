@@ -0,0 +1,221 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "Test.h"
+#include "MeshFile.h"
+
+typedef GAL_imp::Point<double,3>            VertexType;
+typedef Mesh<VertexType>                    MeshType;
+typedef BVH<double>                         BVHType;
+typedef BVHType::AABBoxType                 AABBoxType;
+typedef BoundingSphere<double>              BoundingSphereType;
+
+static const char *MeshFilePath = "TestMeshFile.rtmf";
+static const char *ChangedFilePath = "TestMeshFileChanged.rtmf";
+
+static void AddTriangles(MeshType &mesh, TestRandom &random, size_t count)
+{
+    for (size_t i = 0; i != count; ++i)
+    {
+        const GAL::P3d center = random.nextPoint(-10, 10);
+
+        for (int j = 0; j != 3; ++j)
+        {
+            mesh.addVertex(center + random.nextPoint(-1, 1));
+            mesh.addIndex(int(mesh.getNumVertices() - 1));
+        }
+    }
+}
+
+static void BuildBVH(const MeshType &mesh, BVHType &bvh)
+{
+    const size_t numTriangles = mesh.getNumIndices() / 3;
+    std::vector<AABBoxType> bounds(numTriangles);
+
+    for (size_t i = 0; i != numTriangles; ++i)
+    {
+        const VertexType &pA = mesh.getVertexPointer()[mesh.getIndexPointer()[3*i]];
+        const VertexType &pB = mesh.getVertexPointer()[mesh.getIndexPointer()[3*i+1]];
+        const VertexType &pC = mesh.getVertexPointer()[mesh.getIndexPointer()[3*i+2]];
+
+        AABBoxType &box = bounds[i];
+
+        box.xMin = Min(pA[0], Min(pB[0], pC[0])); box.xMax = Max(pA[0], Max(pB[0], pC[0]));
+        box.yMin = Min(pA[1], Min(pB[1], pC[1])); box.yMax = Max(pA[1], Max(pB[1], pC[1]));
+        box.zMin = Min(pA[2], Min(pB[2], pC[2])); box.zMax = Max(pA[2], Max(pB[2], pC[2]));
+    }
+
+    bvh.build(&bounds[0], numTriangles);
+}
+
+static bool ReadFile(const char *path, std::vector<char> &data)
+{
+    FILE *file = fopen(path, "rb");
+
+    if (0 == file)
+    {
+        return false;
+    }
+
+    char buffer[4096];
+    size_t size;
+
+    data.clear();
+
+    while (0 != (size = fread(buffer, 1, sizeof(buffer), file)))
+    {
+        data.insert(data.end(), buffer, buffer + size);
+    }
+
+    fclose(file);
+    return true;
+}
+
+static bool WriteFile(const char *path, const std::vector<char> &data, size_t size)
+{
+    FILE *file = fopen(path, "wb");
+
+    if (0 == file)
+    {
+        return false;
+    }
+
+    const bool ok = (size == fwrite(&data[0], 1, size, file));
+
+    fclose(file);
+    return ok;
+}
+
+//
+// Mesh file with header field at offset changed to value can not be opened
+//
+template<class T>
+    static bool OpensChanged(const std::vector<char> &data, size_t offset, T value)
+    {
+        std::vector<char> changed = data;
+        memcpy(&changed[offset], &value, sizeof(T));
+
+        MeshFile file;
+        const bool isOpen = (WriteFile(ChangedFilePath, changed, changed.size()) && file.open(ChangedFilePath));
+
+        std::remove(ChangedFilePath);
+        return isOpen;
+    }
+
+//
+// Mesh, hierarchy, bounds and hash read from mapped file are the same as
+// written
+//
+TEST(MeshFileRoundTrip)
+{
+    TestRandom random;
+
+    MeshType mesh;
+    AddTriangles(mesh, random, 2000);
+
+    BVHType bvh;
+    BuildBVH(mesh, bvh);
+
+    BoundingSphereType bounds;
+    bounds.center = random.nextPoint(-1, 1);
+    bounds.radius = 17;
+
+    CHECK(MeshFile::write(MeshFilePath, mesh, &bvh, &bounds, 0x123456789abcdefULL));
+
+    // Mapped file is released before it is removed
+    {
+        MeshFile file;
+        CHECK(file.open(MeshFilePath));
+        CHECK(0x123456789abcdefULL == file.getHeader()->contentHash);
+
+        MeshType loadedMesh;
+        CHECK(file.getMesh(loadedMesh));
+        CHECK(loadedMesh.isView());
+        CHECK(mesh.getNumVertices() == loadedMesh.getNumVertices());
+        CHECK(mesh.getNumIndices() == loadedMesh.getNumIndices());
+        CHECK(0 == memcmp(mesh.getVertexPointer(), loadedMesh.getVertexPointer(), mesh.getNumVertices() * sizeof(VertexType)));
+        CHECK(0 == memcmp(mesh.getIndexPointer(), loadedMesh.getIndexPointer(), mesh.getNumIndices() * sizeof(int)));
+
+        BVHType loadedBVH;
+        CHECK(file.getBVH(loadedBVH));
+        CHECK(bvh.getNumNodes() == loadedBVH.getNumNodes());
+        CHECK(bvh.getIndices() == loadedBVH.getIndices());
+        CHECK(0 == memcmp(bvh.getNodePointer(), loadedBVH.getNodePointer(), bvh.getNumNodes() * sizeof(BVHType::Node)));
+        CHECK(bvh.getStats().numLeaves == loadedBVH.getStats().numLeaves);
+        CHECK(bvh.getStats().maxDepth == loadedBVH.getStats().maxDepth);
+        CHECK(bvh.getStats().sahCost == loadedBVH.getStats().sahCost);
+
+        BoundingSphereType loadedBounds;
+        CHECK(file.getBounds(loadedBounds));
+        CHECK(17 == loadedBounds.radius);
+
+        for (int i = 0; i != 3; ++i)
+        {
+            CHECK(bounds.center[i] == loadedBounds.center[i]);
+        }
+    }
+
+    std::remove(MeshFilePath);
+}
+
+//
+// Files of other format, version, byte order or types, and truncated ones
+// are rejected, as are hierarchy and bounds which are not stored
+//
+TEST(MeshFileRejectsMismatch)
+{
+    TestRandom random;
+
+    MeshType mesh;
+    AddTriangles(mesh, random, 500);
+
+    CHECK(MeshFile::write(MeshFilePath, mesh, static_cast<const BVHType *>(0), static_cast<const BoundingSphereType *>(0)));
+
+    {
+        MeshFile file;
+        CHECK(file.open(MeshFilePath));
+
+        MeshType loadedMesh;
+        CHECK(file.getMesh(loadedMesh));
+
+        Mesh<GAL_imp::Point<float,3> > floatMesh;
+        CHECK(!file.getMesh(floatMesh));
+
+        Mesh<VertexType, short> shortMesh;
+        CHECK(!file.getMesh(shortMesh));
+
+        BVHType loadedBVH;
+        CHECK(!file.getBVH(loadedBVH));
+
+        BoundingSphereType loadedBounds;
+        CHECK(!file.getBounds(loadedBounds));
+    }
+
+    std::vector<char> data;
+    CHECK(ReadFile(MeshFilePath, data));
+    std::remove(MeshFilePath);
+
+    CHECK(OpensChanged(data, offsetof(MeshFileHeader, version), (unsigned int)MeshFile::Version));
+    CHECK(!OpensChanged(data, offsetof(MeshFileHeader, magic), 'X'));
+    CHECK(!OpensChanged(data, offsetof(MeshFileHeader, version), (unsigned int)MeshFile::Version + 1));
+    CHECK(!OpensChanged(data, offsetof(MeshFileHeader, byteOrder), (unsigned int)0x04030201));
+    CHECK(!OpensChanged(data, offsetof(MeshFileHeader, numIndices), (unsigned long long)mesh.getNumIndices() + 1000));
+    CHECK(!OpensChanged(data, offsetof(MeshFileHeader, indexOffset), (unsigned long long)1));
+
+    // Truncated to header and to part of indices
+    const size_t sizes[] = { sizeof(MeshFileHeader) - 1, data.size() - 1 };
+
+    for (int i = 0; i != 2; ++i)
+    {
+        MeshFile file;
+        CHECK(WriteFile(ChangedFilePath, data, sizes[i]));
+        CHECK(!file.open(ChangedFilePath));
+    }
+
+    std::remove(ChangedFilePath);
+
+    MeshFile file;
+    CHECK(!file.open("TestMeshFileMissing.rtmf"));
+    CHECK(!file.isOpen());
+}
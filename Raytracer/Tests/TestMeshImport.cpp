@@ -0,0 +1,306 @@
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Test.h"
+#include "VertexTraits.h"
+#include "MeshImport.h"
+
+typedef Mesh<Vertex3d, int>     MeshType;
+
+//
+// Grid of numX by numY vertices with random heights, faces are quads of
+// neighbouring vertices, every third split into two triangles
+//
+struct Grid
+{
+    size_t                      numX;
+    size_t                      numY;
+    std::vector<GAL::P3d>       positions;
+    std::vector< std::vector<int> > faces;      // 0-based corners
+
+    Grid(size_t x, size_t y, TestRandom &random): numX(x), numY(y)
+    {
+        for (size_t iy = 0; iy != numY; ++iy)
+        {
+            for (size_t ix = 0; ix != numX; ++ix)
+            {
+                positions.push_back(GAL::P3d(double(ix) * 0.25, double(iy) * 0.25, random.next(-1, 1)));
+            }
+        }
+
+        for (size_t iy = 0; iy + 1 != numY; ++iy)
+        {
+            for (size_t ix = 0; ix + 1 != numX; ++ix)
+            {
+                const int a = int(iy * numX + ix), b = a + 1, c = a + int(numX) + 1, d = a + int(numX);
+
+                if (0 == faces.size() % 3)
+                {
+                    faces.push_back(std::vector<int>());
+                    faces.back().push_back(a);
+                    faces.back().push_back(b);
+                    faces.back().push_back(c);
+
+                    faces.push_back(std::vector<int>());
+                    faces.back().push_back(a);
+                    faces.back().push_back(c);
+                    faces.back().push_back(d);
+                }
+                else
+                {
+                    faces.push_back(std::vector<int>());
+                    faces.back().push_back(a);
+                    faces.back().push_back(b);
+                    faces.back().push_back(c);
+                    faces.back().push_back(d);
+                }
+            }
+        }
+    }
+
+    //
+    // Faces triangulated as fans
+    //
+    std::vector<int> getIndices() const
+    {
+        std::vector<int> indices;
+
+        for (size_t i = 0; i != faces.size(); ++i)
+        {
+            for (size_t j = 2; j < faces[i].size(); ++j)
+            {
+                indices.push_back(faces[i][0]);
+                indices.push_back(faces[i][j - 1]);
+                indices.push_back(faces[i][j]);
+            }
+        }
+
+        return indices;
+    }
+};
+
+//
+// Positions are as written, indices are fans of faces, and normals, which
+// are not in file, are computed
+//
+static void CheckMesh(const MeshType &mesh, const Grid &grid, double tolerance)
+{
+    CHECK(mesh.getNumVertices() == grid.positions.size());
+
+    if (mesh.getNumVertices() != grid.positions.size())
+    {
+        return;
+    }
+
+    const std::vector<int> indices = grid.getIndices();
+
+    CHECK(mesh.getNumIndices() == indices.size());
+    CHECK(mesh.getNumIndices() == indices.size() && 0 == memcmp(mesh.getIndexPointer(), &indices[0], indices.size() * sizeof(int)));
+
+    size_t numWrong = 0;
+
+    for (size_t i = 0; i != grid.positions.size(); ++i)
+    {
+        const Vertex3d &v = mesh.getVertexPointer()[i];
+
+        numWrong += (tolerance < GAL::Distance(v.position, grid.positions[i]) ? 1 : 0);
+        numWrong += (1e-6 < std::fabs(GAL::Len(v.normal) - 1) ? 1 : 0);
+    }
+
+    CHECK(0 == numWrong);
+}
+
+//
+// Large enough to be parsed in several chunks, with indices of faces given
+// in all forms allowed by OBJ
+//
+TEST(ImportOBJ)
+{
+    TestRandom random;
+    const Grid grid(300, 200, random);
+
+    const char *path = "TestImport.obj";
+    FILE *file = fopen(path, "wb");
+    CHECK(0 != file);
+
+    if (0 == file)
+    {
+        return;
+    }
+
+    fprintf(file, "# grid\r\no grid\n");
+
+    // Positions written as they go, so that negative indices can be used
+    size_t numWritten = 0;
+
+    for (size_t i = 0; i != grid.faces.size(); ++i)
+    {
+        const std::vector<int> &face = grid.faces[i];
+
+        for (size_t j = 0; j != face.size(); ++j)
+        {
+            while (numWritten <= size_t(face[j]))
+            {
+                const GAL::P3d &p = grid.positions[numWritten++];
+                fprintf(file, "v %.17g %.17g  %.17g\n", p[0], p[1], p[2]);
+            }
+        }
+
+        fprintf(file, 0 == i % 5 ? "f " : "f\t");
+
+        for (size_t j = 0; j != face.size(); ++j)
+        {
+            switch ((i + j) % 4)
+            {
+            case 0:
+                fprintf(file, " %d", face[j] + 1);
+                break;
+            case 1:
+                fprintf(file, " %d/%d", face[j] + 1, 1);
+                break;
+            case 2:
+                fprintf(file, " %d/%d", face[j] - int(numWritten), 1);
+                break;
+            default:
+                fprintf(file, " %d", face[j] - int(numWritten));
+                break;
+            }
+        }
+
+        fprintf(file, 0 == i % 7 ? "\r\n" : "\n");
+    }
+
+    while (numWritten != grid.positions.size())
+    {
+        const GAL::P3d &p = grid.positions[numWritten++];
+        fprintf(file, "v %.17g %.17g %.17g\n", p[0], p[1], p[2]);
+    }
+
+    fclose(file);
+
+    MeshType mesh;
+    CHECK(ImportMesh(path, mesh));
+    CheckMesh(mesh, grid, 1e-12);
+
+    // Index past last vertex
+    file = fopen(path, "wb");
+    fprintf(file, "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4\n");
+    fclose(file);
+
+    CHECK(!ImportOBJ(path, mesh));
+
+    std::remove(path);
+}
+
+static void WriteSwapped(FILE *file, const void *data, size_t size, bool swap)
+{
+    unsigned char bytes[8];
+    memcpy(bytes, data, size);
+
+    for (size_t i = 0; swap && i != size / 2; ++i)
+    {
+        const unsigned char tmp = bytes[i];
+        bytes[i] = bytes[size - 1 - i];
+        bytes[size - 1 - i] = tmp;
+    }
+
+    fwrite(bytes, 1, size, file);
+}
+
+//
+// Write grid as binary PLY with an extra property of vertices and extra
+// element, which are skipped, in byte order of host or the other one
+//
+static bool WritePLY(const char *path, const Grid &grid, bool swap)
+{
+    FILE *file = fopen(path, "wb");
+
+    if (0 == file)
+    {
+        return false;
+    }
+
+    const unsigned int one = 1;
+    const bool little = (1 == *reinterpret_cast<const unsigned char *>(&one));
+
+    fprintf(file, "ply\nformat binary_%s_endian 1.0\ncomment grid\n", little != swap ? "little" : "big");
+    fprintf(file, "element vertex %u\nproperty float x\nproperty float y\nproperty uchar quality\nproperty float z\n", unsigned(grid.positions.size()));
+    fprintf(file, "element face %u\nproperty list uchar int vertex_indices\n", unsigned(grid.faces.size()));
+    fprintf(file, "element edge 1\nproperty int vertex1\nproperty int vertex2\nend_header\n");
+
+    for (size_t i = 0; i != grid.positions.size(); ++i)
+    {
+        const float x = float(grid.positions[i][0]), y = float(grid.positions[i][1]), z = float(grid.positions[i][2]);
+        const unsigned char quality = 7;
+
+        WriteSwapped(file, &x, 4, swap);
+        WriteSwapped(file, &y, 4, swap);
+        WriteSwapped(file, &quality, 1, swap);
+        WriteSwapped(file, &z, 4, swap);
+    }
+
+    for (size_t i = 0; i != grid.faces.size(); ++i)
+    {
+        const unsigned char count = (unsigned char)grid.faces[i].size();
+        WriteSwapped(file, &count, 1, swap);
+
+        for (size_t j = 0; j != grid.faces[i].size(); ++j)
+        {
+            WriteSwapped(file, &grid.faces[i][j], 4, swap);
+        }
+    }
+
+    const int edge[2] = { 0, 1 };
+    WriteSwapped(file, &edge[0], 4, swap);
+    WriteSwapped(file, &edge[1], 4, swap);
+
+    fclose(file);
+    return true;
+}
+
+TEST(ImportPLY)
+{
+    TestRandom random;
+    const Grid grid(300, 200, random);
+
+    const char *path = "TestImport.ply";
+
+    for (int swap = 0; swap != 2; ++swap)
+    {
+        CHECK(WritePLY(path, grid, 0 != swap));
+
+        MeshType mesh;
+        CHECK(ImportMesh(path, mesh));
+
+        // Written as floats
+        CheckMesh(mesh, grid, 1e-6);
+    }
+
+    // Truncated file
+    {
+        FILE *file = fopen(path, "wb");
+        fprintf(file, "ply\nformat binary_little_endian 1.0\nelement vertex 3\nproperty float x\nproperty float y\nproperty float z\nend_header\n");
+        const float x = 0;
+        fwrite(&x, 4, 1, file);
+        fclose(file);
+
+        MeshType mesh;
+        CHECK(!ImportPLY(path, mesh));
+    }
+
+    // ASCII is not supported
+    {
+        FILE *file = fopen(path, "wb");
+        fprintf(file, "ply\nformat ascii 1.0\nelement vertex 3\nproperty float x\nproperty float y\nproperty float z\n"
+            "element face 1\nproperty list uchar int vertex_indices\nend_header\n0 0 0\n1 0 0\n0 1 0\n3 0 1 2\n");
+        fclose(file);
+
+        MeshType mesh;
+        CHECK(!ImportPLY(path, mesh));
+    }
+
+    std::remove(path);
+}
@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <vector>
+
+#include "Test.h"
+#include "MeshLayout.h"
+
+typedef GAL_imp::Point<double,3>            VertexType;
+typedef Mesh<VertexType>                    MeshType;
+
+//
+// Grid of size x size cells with shared vertices in random order, its
+// triangles in random order, and a few vertices not used by any triangle
+//
+static void BuildShuffledGrid(MeshType &mesh, TestRandom &random, int size)
+{
+    const int numVertices = (size + 1) * (size + 1);
+    std::vector<int> vertexOf(numVertices);
+
+    for (int i = 0; i != numVertices; ++i)
+    {
+        vertexOf[i] = i;
+    }
+
+    for (int i = numVertices; 1 < i; --i)
+    {
+        std::swap(vertexOf[i - 1], vertexOf[int(random.next(0, i))]);
+    }
+
+    std::vector<VertexType> vertices(numVertices);
+
+    for (int y = 0; y <= size; ++y)
+    {
+        for (int x = 0; x <= size; ++x)
+        {
+            vertices[vertexOf[y * (size + 1) + x]] = GAL::P3d(x, random.next(-0.1, 0.1), y);
+        }
+    }
+
+    for (int i = 0; i != numVertices; ++i)
+    {
+        mesh.addVertex(vertices[i]);
+    }
+
+    for (int i = 0; i != 5; ++i)
+    {
+        mesh.addVertex(random.nextPoint(-1, 1));
+    }
+
+    std::vector<int> cells(size * size);
+
+    for (int i = 0; i != size * size; ++i)
+    {
+        cells[i] = i;
+    }
+
+    for (int i = size * size; 1 < i; --i)
+    {
+        std::swap(cells[i - 1], cells[int(random.next(0, i))]);
+    }
+
+    for (int c = 0; c != size * size; ++c)
+    {
+        const int i = (cells[c] / size) * (size + 1) + cells[c] % size;
+
+        mesh.addIndex(vertexOf[i]);
+        mesh.addIndex(vertexOf[i + 1]);
+        mesh.addIndex(vertexOf[i + size + 1]);
+
+        mesh.addIndex(vertexOf[i + 1]);
+        mesh.addIndex(vertexOf[i + size + 2]);
+        mesh.addIndex(vertexOf[i + size + 1]);
+    }
+}
+
+static bool SameCorner(const VertexType &a, const VertexType &b)
+{
+    return (a[0] == b[0] && a[1] == b[1] && a[2] == b[2]);
+}
+
+static GAL::P3d GetCentroid(const MeshType &mesh, size_t triangle)
+{
+    const VertexType *vertices = mesh.getVertexPointer();
+    const int *indices = mesh.getIndexPointer();
+
+    return (vertices[indices[3*triangle]] + vertices[indices[3*triangle+1]] + vertices[indices[3*triangle+2]]) * (1.0 / 3);
+}
+
+//
+// Sum of distances between centroids of consecutive triangles
+//
+static double GetPathLength(const MeshType &mesh)
+{
+    double length = 0;
+
+    for (size_t i = 1; i < mesh.getNumIndices() / 3; ++i)
+    {
+        length += GAL::Distance(GetCentroid(mesh, i - 1), GetCentroid(mesh, i));
+    }
+
+    return length;
+}
+
+//
+// Reordered mesh has the same triangles in Morton order, vertices are
+// numbered in order of first use followed by unused ones, and consecutive
+// triangles are close
+//
+TEST(MeshLayoutReordersTriangles)
+{
+    TestRandom random;
+
+    MeshType mesh;
+    BuildShuffledGrid(mesh, random, 50);
+
+    const MeshType original = mesh;
+    const size_t numTriangles = mesh.getNumIndices() / 3;
+
+    std::vector<size_t> order;
+    MortonOrderTriangles(mesh, order);
+
+    std::vector<size_t> sorted = order;
+    std::sort(sorted.begin(), sorted.end());
+
+    size_t numInPlace = 0;
+
+    for (size_t i = 0; i != numTriangles; ++i)
+    {
+        numInPlace += (i == sorted[i] ? 1 : 0);
+    }
+
+    CHECK(numTriangles == order.size());
+    CHECK(numTriangles == numInPlace);
+
+    ReorderMesh(mesh, order);
+
+    CHECK(original.getNumVertices() == mesh.getNumVertices());
+    CHECK(original.getNumIndices() == mesh.getNumIndices());
+
+    const VertexType *vertices = mesh.getVertexPointer();
+    const int *indices = mesh.getIndexPointer();
+
+    for (size_t i = 0; i != numTriangles; ++i)
+    {
+        for (int k = 0; k != 3; ++k)
+        {
+            const VertexType &expected = original.getVertexPointer()[original.getIndexPointer()[3*order[i]+k]];
+
+            CHECK(SameCorner(vertices[indices[3*i+k]], expected));
+        }
+    }
+
+    // Each index is at most one past the largest before it
+    int numUsed = 0;
+
+    for (size_t i = 0; i != mesh.getNumIndices(); ++i)
+    {
+        CHECK(indices[i] <= numUsed);
+        numUsed = Max(numUsed, indices[i] + 1);
+    }
+
+    CHECK(size_t(numUsed) + 5 == mesh.getNumVertices());
+
+    for (size_t i = 0; i != 5; ++i)
+    {
+        const size_t unused = original.getNumVertices() - 5 + i;
+
+        CHECK(SameCorner(vertices[numUsed + i], original.getVertexPointer()[unused]));
+    }
+
+    CHECK(GetPathLength(mesh) * 4 < GetPathLength(original));
+
+    // Mesh in Morton order stays in it
+    MeshType optimized = mesh;
+    OptimizeMeshLayout(optimized);
+
+    size_t numSame = 0;
+
+    for (size_t i = 0; i != mesh.getNumIndices(); ++i)
+    {
+        numSame += (mesh.getIndexPointer()[i] == optimized.getIndexPointer()[i] ? 1 : 0);
+    }
+
+    CHECK(mesh.getNumIndices() == numSame);
+}
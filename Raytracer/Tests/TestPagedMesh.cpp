@@ -0,0 +1,93 @@
+#include <cstdio>
+#include <limits>
+#include <vector>
+
+#include "Test.h"
+#include "MeshResource.h"
+#include "Parallel.h"
+
+typedef GAL_imp::Point<double,3>            VertexType;
+typedef MeshResource<VertexType>            MeshResourceType;
+typedef MeshResourceType::MeshType          MeshType;
+typedef MeshResourceType::RayHitType        RayHitType;
+typedef GAL_imp::Ray<double,3>              RayType;
+
+static const char *PagedMeshPath = "TestPagedMesh.rtpm";
+
+//
+// Paged mesh finds the same hits as the mesh it was written from, while
+// rays of several threads read and evict pages at once, for budgets from
+// all pages down to a single page
+//
+TEST(PagedMeshMatchesMesh)
+{
+    TestRandom random;
+
+    MeshResourceType resource;
+    MeshType &mesh = resource.getMesh();
+
+    for (int i = 0; i != 20000; ++i)
+    {
+        const GAL::P3d center = random.nextPoint(-10, 10);
+
+        for (int j = 0; j != 3; ++j)
+        {
+            mesh.addVertex(center + random.nextPoint(-0.5, 0.5));
+            mesh.addIndex(int(mesh.getNumVertices() - 1));
+        }
+    }
+
+    resource.meshChanged();
+
+    CHECK(resource.savePagedMesh(PagedMeshPath, 256));
+
+    const size_t numRays = 4000;
+    std::vector<RayType> rays(numRays);
+
+    for (size_t i = 0; i != numRays; ++i)
+    {
+        rays[i] = random.nextRay(12);
+    }
+
+    const size_t budgets[] = { (std::numeric_limits<size_t>::max)(), 1 << 20, 1 << 16, 1 };
+
+    for (size_t b = 0; b != sizeof(budgets) / sizeof(budgets[0]); ++b)
+    {
+        MeshResourceType paged;
+        CHECK(paged.openPagedMesh(PagedMeshPath, budgets[b]));
+
+        // Threads are started even on single core, so that they contend
+        const size_t numChunks = 4;
+        std::vector<size_t> numMismatches(numChunks, 0);
+
+        ParallelForChunks(numRays, numChunks,
+            [&resource, &paged, &rays, &numMismatches](size_t chunk, size_t begin, size_t end)
+            {
+                for (size_t i = begin; i != end; ++i)
+                {
+                    RayHitType hit, expected;
+                    const bool isHit = paged.hitLocalRay(rays[i], hit);
+                    const bool isExpected = resource.hitLocalRay(rays[i], expected);
+
+                    if (isHit != isExpected || (isHit && hit.distance != expected.distance))
+                    {
+                        ++numMismatches[chunk];
+                    }
+                }
+            });
+
+        for (size_t i = 0; i != numChunks; ++i)
+        {
+            CHECK(0 == numMismatches[i]);
+        }
+
+        const size_t numPages = paged.getPagedMesh().getNumTriangles() / 256;
+
+        // Rays reach every page, and pages evicted by the smallest budget
+        // are read again
+        CHECK(numPages <= paged.getPagedMesh().getNumLoads());
+        CHECK(1 != budgets[b] || 2 * numPages < paged.getPagedMesh().getNumLoads());
+    }
+
+    std::remove(PagedMeshPath);
+}
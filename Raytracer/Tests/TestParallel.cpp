@@ -0,0 +1,99 @@
+#include <atomic>
+#include <vector>
+
+#include "Test.h"
+#include "Parallel.h"
+
+//
+// Chunks cover whole range once, and run nested work on their own thread
+//
+TEST(ParallelForCoversRange)
+{
+    const size_t count = 100000;
+    std::vector<int> visits(count, 0);
+    std::atomic<size_t> maxAvailable(0);
+
+    ParallelFor(count, 1000,
+        [&visits, &maxAvailable](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i != end; ++i)
+            {
+                ++visits[i];
+            }
+
+            size_t available = GetAvailableThreads();
+            size_t previous = maxAvailable.load();
+
+            while (previous < available && !maxAvailable.compare_exchange_weak(previous, available))
+            {
+            }
+        });
+
+    size_t numVisited = 0;
+
+    for (size_t i = 0; i != count; ++i)
+    {
+        numVisited += (1 == visits[i] ? 1 : 0);
+    }
+
+    CHECK(count == numVisited);
+    CHECK(1 == maxAvailable.load());
+    CHECK(GetNumThreads() == GetAvailableThreads());
+}
+
+//
+// Tasks of recursive ParallelInvoke() split threads of caller, so that
+// nested ParallelFor() of all tasks uses at most all hardware threads, or
+// one thread per task, if there are more tasks
+//
+static void InvokeRecursively(int depth, std::atomic<size_t> &sumOfChunks, std::atomic<size_t> &sum)
+{
+    if (0 == depth)
+    {
+        sumOfChunks += GetNumChunks(1 << 20, 1);
+
+        sum += ParallelReduce(1000, 1, size_t(0),
+            [](size_t begin, size_t end, size_t &result)
+            {
+                for (size_t i = begin; i != end; ++i)
+                {
+                    result += i;
+                }
+            },
+            [](size_t &result, size_t partial)
+            {
+                result += partial;
+            });
+
+        return;
+    }
+
+    ParallelInvoke(
+        [depth, &sumOfChunks, &sum]() { InvokeRecursively(depth - 1, sumOfChunks, sum); },
+        [depth, &sumOfChunks, &sum]() { InvokeRecursively(depth - 1, sumOfChunks, sum); });
+}
+
+TEST(ParallelInvokeSharesThreads)
+{
+    const int depth = 3;
+
+    std::atomic<size_t> sumOfChunks(0), sum(0);
+    InvokeRecursively(depth, sumOfChunks, sum);
+
+    CHECK((size_t(1) << depth) * 999 * 1000 / 2 == sum.load());
+    CHECK(sumOfChunks.load() <= Max(GetNumThreads(), size_t(1) << depth));
+    CHECK(GetNumThreads() == GetAvailableThreads());
+
+    // As if there were 16 hardware threads, each task gets 2 of them
+    {
+        Parallel_imp::BudgetScope scope(16);
+
+        sumOfChunks = 0;
+        InvokeRecursively(depth, sumOfChunks, sum);
+
+        CHECK(16 == sumOfChunks.load());
+        CHECK(16 == GetAvailableThreads());
+    }
+
+    CHECK(2 * (size_t(1) << depth) * 999 * 1000 / 2 == sum.load());
+}
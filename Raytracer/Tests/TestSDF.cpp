@@ -0,0 +1,182 @@
+#include <cmath>
+#include <vector>
+
+#include "Test.h"
+#include "SDFGeometry.h"
+
+typedef SDFGeometry<double>                 SDFType;
+typedef SDFType::RayHitType                 RayHitType;
+typedef IntersectionPoint<double,3>         IntersectionPointType;
+typedef GAL_imp::Ray<double,3>              RayType;
+
+static const size_t NumSamples = 65;
+static const double VoxelSize = 4.0 / double(NumSamples - 1);
+
+static const GAL::P3d Centers[2] = { GAL::P3d(-0.4, 0.1, 0.05), GAL::P3d(0.6, -0.3, 0.2) };
+static const double Radii[2] = { 1.1, 0.7 };
+
+//
+// Union of two spheres
+//
+static double Distance(double x, double y, double z)
+{
+    const GAL::P3d p(x, y, z);
+
+    return Min(GAL::Distance(p, Centers[0]) - Radii[0], GAL::Distance(p, Centers[1]) - Radii[1]);
+}
+
+//
+// Closest hit of spheres in units of ray length, returns false also for
+// rays, which pass too close to their silhouettes to tell hit from miss at
+// resolution of the grid, in which case ambiguous is set
+//
+static bool HitSpheres(const RayType &ray, double &distance, bool &ambiguous)
+{
+    distance = -1;
+    ambiguous = false;
+
+    const double length = GAL::Len(ray.direction);
+
+    for (int i = 0; i != 2; ++i)
+    {
+        RayType local = ray;
+        local.start -= Centers[i];
+
+        // Distance of center from line of ray
+        const double along = -GAL::Dot(local.start, ray.direction) / (length * length);
+        const double offset = GAL::Len(local.start + ray.direction * along);
+
+        if (std::fabs(offset - Radii[i]) < 2 * VoxelSize)
+        {
+            ambiguous = true;
+        }
+
+        GAL_imp::Solution<double,2> solution;
+
+        if (GAL::IntersectRaySphere(local, Radii[i], solution) && 0 < solution.x[0])
+        {
+            if (-1 == distance || solution.x[0] < distance)
+            {
+                distance = solution.x[0];
+            }
+        }
+    }
+
+    return (-1 != distance);
+}
+
+//
+// Sphere traced hits lie within fraction of voxel of exact surface, and
+// their normals are close to exact ones
+//
+TEST(SDFMatchesAnalyticSpheres)
+{
+    SDFType sdf(NumSamples, NumSamples, NumSamples, GAL::P3d(-2, -2, -2), VoxelSize);
+    sdf.sample(Distance);
+
+    // Bricks are only kept near surface
+    CHECK(0 < sdf.getNumBricks() && sdf.getNumBricks() < 8 * 8 * 8);
+
+    TestRandom random;
+    size_t numHits = 0, numMisses = 0;
+
+    for (int i = 0; i != 2000; ++i)
+    {
+        // From outside of grid towards random point of it
+        RayType ray;
+        ray.start = random.nextPoint(-1, 1);
+        ray.start *= 3 / GAL::Len(ray.start);
+        ray.direction = random.nextPoint(-1.5, 1.5) - ray.start;
+
+        double expected;
+        bool ambiguous;
+        const bool expectedHit = HitSpheres(ray, expected, ambiguous);
+
+        if (ambiguous)
+        {
+            continue;
+        }
+
+        const double length = GAL::Len(ray.direction);
+
+        IntersectionPointType out;
+        const bool hit = sdf.intersectRay(ray, out);
+
+        CHECK(hit == expectedHit);
+
+        if (!hit || !expectedHit)
+        {
+            numMisses += (!expectedHit ? 1 : 0);
+            continue;
+        }
+
+        ++numHits;
+
+        CHECK(std::fabs(out.distance - expected) * length < 0.1 * VoxelSize);
+
+        // Normal of sphere, which was hit
+        const double d0 = std::fabs(GAL::Distance(out.position, Centers[0]) - Radii[0]);
+        const double d1 = std::fabs(GAL::Distance(out.position, Centers[1]) - Radii[1]);
+        const int k = (d0 < d1 ? 0 : 1);
+
+        GAL::P3d normal = out.position - Centers[k];
+        normal /= GAL::Len(normal);
+
+        // Gradient is off near the crease, where spheres meet
+        if (2 * VoxelSize < std::fabs(d0 - d1))
+        {
+            CHECK(0.99 < GAL::Dot(normal, out.normal));
+        }
+    }
+
+    CHECK(500 < numHits);
+    CHECK(100 < numMisses);
+}
+
+//
+// Dense samples give the same field as sampled function, and rays starting
+// inside of surface do not hit it
+//
+TEST(SDFDenseSamples)
+{
+    std::vector<double> samples(NumSamples * NumSamples * NumSamples);
+
+    for (size_t iz = 0; iz != NumSamples; ++iz)
+    {
+        for (size_t iy = 0; iy != NumSamples; ++iy)
+        {
+            for (size_t ix = 0; ix != NumSamples; ++ix)
+            {
+                samples[(iz * NumSamples + iy) * NumSamples + ix] =
+                    Distance(-2 + double(ix) * VoxelSize, -2 + double(iy) * VoxelSize, -2 + double(iz) * VoxelSize);
+            }
+        }
+    }
+
+    SDFType dense(NumSamples, NumSamples, NumSamples, GAL::P3d(-2, -2, -2), VoxelSize);
+    dense.setSamples(&samples[0]);
+
+    SDFType sampled(NumSamples, NumSamples, NumSamples, GAL::P3d(-2, -2, -2), VoxelSize);
+    sampled.sample(Distance);
+
+    TestRandom random;
+
+    for (int i = 0; i != 500; ++i)
+    {
+        const RayType ray = random.nextRay(2.5);
+
+        RayHitType hit, expected;
+        const bool isHit = dense.hitLocalRay(ray, hit);
+        const bool expectedHit = sampled.hitLocalRay(ray, expected);
+
+        CHECK(isHit == expectedHit);
+        CHECK(!isHit || !expectedHit || std::fabs(hit.distance - expected.distance) < 1e-9);
+    }
+
+    RayType ray;
+    ray.start = Centers[0];
+    ray.direction = GAL::P3d(0.3, 1, -0.2);
+
+    RayHitType hit;
+    CHECK(!dense.hitLocalRay(ray, hit));
+}
@@ -0,0 +1,174 @@
+#include <cmath>
+#include <memory>
+
+#include "Test.h"
+#include "SceneGraph.h"
+
+typedef SceneGraph<double>          SceneGraphType;
+typedef Light<double>               LightType;
+typedef ShadowPacket<double>        ShadowPacketType;
+typedef IntersectionPoint<double,3> IntersectionPointType;
+typedef GAL_imp::Ray<double,3>      RayType;
+typedef GAL::P3d                    PointType;
+
+static const double SoftShadowWidth = 0.3;
+
+//
+// Ground sphere, with spheres and set of spheres floating above it
+//
+static void BuildScene(SceneGraphType &scene, TestRandom &random)
+{
+    std::shared_ptr< Clump<double> > clump(new Clump<double>());
+
+    std::shared_ptr<SphereGeometry3d> ground(new SphereGeometry3d(50));
+    ground->setTranslation(GAL::P3d(0, -50, 0));
+    clump->addGeometry(ground);
+
+    for (int i = 0; i != 30; ++i)
+    {
+        std::shared_ptr<SphereGeometry3d> sphere(new SphereGeometry3d(random.next(0.1, 0.4)));
+        sphere->setTranslation(GAL::P3d(random.next(-4, 4), random.next(0.5, 2), random.next(-4, 4)));
+        clump->addGeometry(sphere);
+    }
+
+    std::shared_ptr< SphereSetGeometry<double> > set(new SphereSetGeometry<double>());
+
+    for (int i = 0; i != 100; ++i)
+    {
+        set->addSphere(GAL::P3d(random.next(-4, 4), random.next(0.5, 2), random.next(-4, 4)), random.next(0.02, 0.1));
+    }
+
+    set->spheresChanged();
+    clump->addGeometry(set);
+
+    scene.addClump(clump);
+    scene.update();
+}
+
+//
+// Packet of 3 x 3 shadow rays from patch of light as by Light::softShadow()
+//
+struct Patch
+{
+    PointType center;
+    PointType axisX;
+    PointType axisY;
+
+    Patch(const PointType &lightPosition, const PointType &point): center(lightPosition)
+    {
+        PointType lightZ = point - lightPosition;
+        lightZ /= GAL::Len(lightZ);
+
+        const PointType lightX = GAL::Orthogonal(lightZ);
+
+        axisX = lightX * SoftShadowWidth;
+        axisY = GAL::Cross(lightZ, lightX) * SoftShadowWidth;
+    }
+
+    PointType getSample(int ix, int iy) const
+    {
+        return center + axisX * double(ix - 1) + axisY * double(iy - 1);
+    }
+};
+
+//
+// Point on ground away from floating spheres is lit by light above it, and
+// no geometry, not even the ground, is collected into its packet, hence the
+// rays are not traced at all
+//
+TEST(ShadowPacketUnoccludedPointIsLit)
+{
+    TestRandom random;
+    SceneGraphType scene;
+    BuildScene(scene, random);
+
+    const PointType lightPosition(10, 20, 0);
+
+    RayType ray;
+    ray.start = GAL::P3d(10, 10, 0.5);
+    ray.direction = GAL::P3d(0, -1, 0);
+
+    IntersectionPointType intersectionPoint;
+    CHECK(scene.intersectRay(ray, intersectionPoint));
+
+    const Patch patch(lightPosition, intersectionPoint.position);
+
+    // No floating sphere between the point and light
+    LightType light;
+
+    for (int iy = 0; iy != 3; ++iy)
+    {
+        for (int ix = 0; ix != 3; ++ix)
+        {
+            CHECK(!light.dropShadow(scene, patch.getSample(ix, iy), intersectionPoint));
+        }
+    }
+
+    ShadowPacketType packet(intersectionPoint, patch.center, patch.axisX, patch.axisY);
+    scene.collectGeometries(packet);
+
+    CHECK(!packet.isOverflow());
+    CHECK(0 == packet.getNumGeometries());
+}
+
+//
+// Classification of packet, and rays traced against collected geometries,
+// agree with shadow rays traced through whole scene one by one
+//
+TEST(ShadowPacketMatchesShadowRays)
+{
+    TestRandom random;
+    SceneGraphType scene;
+    BuildScene(scene, random);
+
+    LightType light;
+    size_t numLit = 0, numOccluded = 0, numTraced = 0;
+
+    for (int i = 0; i != 2000; ++i)
+    {
+        RayType ray;
+        ray.start = GAL::P3d(random.next(-8, 8), 6, random.next(-8, 8));
+        ray.direction = GAL::P3d(random.next(-0.3, 0.3), -1, random.next(-0.3, 0.3));
+
+        IntersectionPointType intersectionPoint;
+
+        if (!scene.intersectRay(ray, intersectionPoint))
+        {
+            continue;
+        }
+
+        const PointType lightPosition(
+            intersectionPoint.position[0] + random.next(-3, 3), 5, intersectionPoint.position[2] + random.next(-3, 3));
+        const Patch patch(lightPosition, intersectionPoint.position);
+
+        ShadowPacketType packet(intersectionPoint, patch.center, patch.axisX, patch.axisY);
+        scene.collectGeometries(packet);
+
+        if (packet.isOverflow())
+        {
+            continue;
+        }
+
+        const bool lit = (0 == packet.getNumGeometries());
+        const bool occluded = (!lit && packet.isFullyOccluded());
+
+        numLit += (lit ? 1 : 0);
+        numOccluded += (occluded ? 1 : 0);
+        numTraced += (!lit && !occluded ? 1 : 0);
+
+        for (int iy = 0; iy != 3; ++iy)
+        {
+            for (int ix = 0; ix != 3; ++ix)
+            {
+                const PointType sample = patch.getSample(ix, iy);
+                const bool expected = light.dropShadow(scene, sample, intersectionPoint);
+
+                CHECK(expected == (lit ? false : occluded ? true : packet.isOccluded(sample)));
+            }
+        }
+    }
+
+    CHECK(0 < numLit);
+    CHECK(0 < numOccluded);
+    CHECK(0 < numTraced);
+}
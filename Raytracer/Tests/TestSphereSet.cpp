@@ -0,0 +1,86 @@
+#include <cmath>
+#include <memory>
+
+#include "Test.h"
+#include "GeometryStore.h"
+#include "SphereSetGeometry.h"
+
+typedef SphereSetGeometry<double>   SphereSetType;
+typedef GeometryStore<double>       StoreType;
+typedef IntersectionPoint<double,3> IntersectionPointType;
+
+//
+// Store with SphereGeometry for each sphere of set, intersected by brute force
+//
+static void AddSpheres(const SphereSetType &set, StoreType &store)
+{
+    for (size_t i = 0; i != set.getNumSpheres(); ++i)
+    {
+        std::shared_ptr<SphereGeometry3d> sphere(new SphereGeometry3d(set.getRadius(i)));
+        sphere->setTranslation(set.getCenter(i));
+
+        store.addGeometry(sphere);
+    }
+}
+
+TEST(SphereSetMatchesSpheres)
+{
+    TestRandom random;
+    std::shared_ptr<SphereSetType> set(new SphereSetType());
+
+    for (int i = 0; i != 500; ++i)
+    {
+        set->addSphere(random.nextPoint(-10, 10), random.next(0.05, 0.5));
+    }
+
+    set->spheresChanged();
+
+    StoreType store;
+    AddSpheres(*set, store);
+
+    for (int i = 0; i != 2000; ++i)
+    {
+        GAL_imp::Ray<double,3> ray = random.nextRay(12);
+
+        IntersectionPointType out, expected;
+        const bool hit = set->intersectRay(ray, out);
+        const bool expectedHit = store.intersectRay(ray, expected);
+
+        CHECK(SameHit(hit, out, expectedHit, expected));
+    }
+}
+
+//
+// Centers at powers of two make binned hierarchy split off the farthest
+// sphere per level, so that the leaf at depth limit holds hundreds of the
+// nearest spheres, far more than MaxLeafSize. Rays are cast at spheres,
+// whose surface is representable next to their center.
+//
+TEST(SphereSetDegenerateLeaf)
+{
+    std::shared_ptr<SphereSetType> set(new SphereSetType());
+
+    for (int i = 0; i != 600; ++i)
+    {
+        set->addSphere(GAL::P3d(std::ldexp(1.0, i), 0, 0), 0.25);
+    }
+
+    set->spheresChanged();
+
+    StoreType store;
+    AddSpheres(*set, store);
+
+    for (int i = 0; i != 48; ++i)
+    {
+        GAL_imp::Ray<double,3> ray;
+        ray.start = GAL::P3d(std::ldexp(1.0, i), 0.1, 10);
+        ray.direction = GAL::P3d(0, 0, -1);
+
+        IntersectionPointType out, expected;
+        const bool hit = set->intersectRay(ray, out);
+        const bool expectedHit = store.intersectRay(ray, expected);
+
+        CHECK(expectedHit);
+        CHECK(SameHit(hit, out, expectedHit, expected));
+    }
+}
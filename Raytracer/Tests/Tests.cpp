@@ -0,0 +1,28 @@
+#include "Test.h"
+
+//
+// Runs all tests, which are linked in, and returns non-zero if any failed.
+//
+// With --benchmark runs benchmarks instead, only those, whose name contains
+// following argument, if there is one. They should be run from optimized
+// build.
+//
+int main(int argc, char **argv)
+{
+    if (1 < argc && 0 == strcmp(argv[1], "--benchmark"))
+    {
+        RunBenchmarks(2 < argc ? argv[2] : "");
+        return 0;
+    }
+
+    const size_t numFailures = RunTests();
+
+    if (0 != numFailures)
+    {
+        printf("%u check(s) failed\n", unsigned(numFailures));
+        return 1;
+    }
+
+    printf("All tests passed\n");
+    return 0;
+}
@@ -25,10 +25,22 @@ template<class N, int I>
         typedef GAL_imp::Point<N, I> VertexType;
         typedef GAL_imp::Point<N, I> PointType;
 
+        enum { HasNormal = 0 };
+
         static const PointType & getPosition(const VertexType &vertex)
         {
             return vertex;
         }
+
+        static PointType & getPosition(VertexType &vertex)
+        {
+            return vertex;
+        }
+
+        static void setNormal(VertexType &, const PointType &)
+        {
+            // normal is not stored
+        }
         
         static PointType getNormal(const VertexType &p0, const VertexType &p1, const VertexType &p2, N u, N v)
         {
@@ -47,16 +59,28 @@ template<class N, int I>
         typedef Vertex<N, I>         VertexType;
         typedef GAL_imp::Point<N, I> PointType;
 
+        enum { HasNormal = 1 };
+
         static const PointType & getPosition(const VertexType &vertex)
         {
             return vertex.position;
         }
+
+        static PointType & getPosition(VertexType &vertex)
+        {
+            return vertex.position;
+        }
         
         static const PointType & getNormal(const VertexType &vertex)
         {
             return vertex.normal;
         }
 
+        static void setNormal(VertexType &vertex, const PointType &normal)
+        {
+            vertex.normal = normal;
+        }
+
         static PointType getNormal(const VertexType &v0, const VertexType &v1, const VertexType &v2, N u, N v)
         {
             N s = 1 - u - v;
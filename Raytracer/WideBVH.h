@@ -0,0 +1,333 @@
+#ifndef INCLUDED_WIDE_BVH_H
+#define INCLUDED_WIDE_BVH_H
+
+#include <vector>
+#include <limits>
+
+#include "MinMax.h"
+#include "Intersect.h"
+#include "AABBox.h"
+
+//
+// Layout of bounding volume hierarchy used for traversal
+//
+enum BVHLayout
+{
+    BinaryBVHLayout,
+    Wide4BVHLayout,
+    Wide8BVHLayout,
+    Quantized4BVHLayout,    // see QuantizedBVH
+    Quantized8BVHLayout
+};
+
+//
+// Bounding volume hierarchy with up to Width children per node
+//
+// It is collapsed from binary hierarchy by repeatedly replacing child of
+// the largest surface area by its own children, so it has the same leaves.
+//
+// Bounds of children are stored in structure of arrays form, so that ray
+// is tested against all children of node by one loop over lanes, which is
+// vectorized by compiler. Fewer, larger nodes reduce number of dependent
+// memory accesses per ray.
+//
+template<class _NumericType, int _Width>
+    class WideBVH
+    {
+    public:
+        typedef _NumericType                        NumericType;
+        typedef GAL_imp::Point<NumericType,3>       PointType;
+        typedef GAL_imp::Ray<NumericType,3>         RayType;
+        typedef AABBox<NumericType>                 AABBoxType;
+
+        enum
+        {
+            Width       = _Width,
+            MaxDepth    = 64
+        };
+
+        //
+        // Child is leaf if count is not zero, and it references range
+        // [child, child + count) of leaves of binary hierarchy. Otherwise
+        // child is index of node. Unused children have empty bounds.
+        //
+        struct Node
+        {
+            NumericType xMin[Width]; NumericType xMax[Width];
+            NumericType yMin[Width]; NumericType yMax[Width];
+            NumericType zMin[Width]; NumericType zMax[Width];
+            size_t      child[Width];
+            size_t      count[Width];
+        };
+
+        //
+        // Collapse binary hierarchy, which provides:
+        //
+        //  isEmpty(), isLeafNode(i), getRightChild(i), getNodeBounds(i),
+        //  and getLeafRange(i, begin, end)
+        //
+        // Left child of node i is assumed to be node i+1.
+        //
+        template<class BinaryBVHType>
+            void build(const BinaryBVHType &bvh)
+            {
+                mNodes.clear();
+
+                if (!bvh.isEmpty())
+                {
+                    collapse(bvh, 0);
+                }
+            }
+
+        //
+        // Release memory of nodes
+        //
+        void clear()
+        {
+            std::vector<Node>().swap(mNodes);
+        }
+
+        bool isEmpty() const
+        {
+            return mNodes.empty();
+        }
+
+        const std::vector<Node> & getNodes() const
+        {
+            return mNodes;
+        }
+
+        //
+        // Memory used by nodes in bytes
+        //
+        size_t getMemorySize() const
+        {
+            return mNodes.size() * sizeof(Node);
+        }
+
+        //
+        // Visit leaves, whose bounds are hit by ray, in near to far order.
+        //
+        // Calls visitor(begin, end, tMax) for range of each such leaf, where
+        // tMax is distance of closest hit found so far, which visitor should
+        // lower when it finds closer hit.
+        //
+        template<class Visitor>
+            void traverse(const RayType &ray, NumericType tMax, Visitor &visitor) const
+            {
+                if (mNodes.empty())
+                {
+                    return;
+                }
+
+                PointType invDirection;
+
+                for (int i = 0; i != 3; ++i)
+                {
+                    invDirection[i] = 1 / ray.direction[i];
+                }
+
+                StackEntry stack[MaxDepth * Width];
+                size_t stackSize = 0;
+
+                stack[stackSize].child = 0;
+                stack[stackSize].count = 0;
+                stack[stackSize].tNear = 0;
+                ++stackSize;
+
+                while (0 != stackSize)
+                {
+                    const StackEntry entry = stack[--stackSize];
+
+                    if (tMax < entry.tNear)
+                    {
+                        continue;
+                    }
+
+                    if (0 != entry.count)
+                    {
+                        visitor(entry.child, entry.child + entry.count, tMax);
+                        continue;
+                    }
+
+                    const Node &node = mNodes[entry.child];
+
+                    NumericType tNear[Width];
+                    bool        hit[Width];
+
+                    testChildren(node, ray.start, invDirection, tMax, tNear, hit);
+
+                    //
+                    // Push children far to near, so that nearest is popped
+                    // first
+                    //
+                    const size_t first = stackSize;
+
+                    for (int i = 0; i != Width; ++i)
+                    {
+                        if (!hit[i])
+                        {
+                            continue;
+                        }
+
+                        StackEntry child;
+                        child.child = node.child[i];
+                        child.count = node.count[i];
+                        child.tNear = tNear[i];
+
+                        size_t j = stackSize++;
+
+                        for (; first != j && stack[j - 1].tNear < child.tNear; --j)
+                        {
+                            stack[j] = stack[j - 1];
+                        }
+
+                        stack[j] = child;
+                    }
+                }
+            }
+
+    private:
+        std::vector<Node> mNodes;
+
+        struct StackEntry
+        {
+            size_t      child;
+            size_t      count;
+            NumericType tNear;
+        };
+
+        //
+        // Slab test of all children at once
+        //
+        // Near and far planes are selected by sign of ray direction, so that
+        // unused children with empty (inverted) bounds are never hit.
+        //
+        static void testChildren(
+            const Node         &node,
+            const PointType    &start,
+            const PointType    &invDirection,
+            NumericType         tMax,
+            NumericType        *tNear,
+            bool               *hit)
+        {
+            const NumericType sx = start[0], sy = start[1], sz = start[2];
+            const NumericType ix = invDirection[0], iy = invDirection[1], iz = invDirection[2];
+
+            const NumericType *nearX = (0 <= ix ? node.xMin : node.xMax);
+            const NumericType *farX  = (0 <= ix ? node.xMax : node.xMin);
+            const NumericType *nearY = (0 <= iy ? node.yMin : node.yMax);
+            const NumericType *farY  = (0 <= iy ? node.yMax : node.yMin);
+            const NumericType *nearZ = (0 <= iz ? node.zMin : node.zMax);
+            const NumericType *farZ  = (0 <= iz ? node.zMax : node.zMin);
+
+            for (int i = 0; i != Width; ++i)
+            {
+                // NaN of ray in plane of face is ignored (see TestRayAABBox())
+                NumericType tn = Max((nearX[i] - sx) * ix, Max((nearY[i] - sy) * iy, Max((nearZ[i] - sz) * iz, NumericType(0))));
+                NumericType tf = Min((farX[i] - sx) * ix, Min((farY[i] - sy) * iy, Min((farZ[i] - sz) * iz, tMax)));
+
+                tNear[i] = tn;
+                hit[i] = (tn <= tf);
+            }
+        }
+
+        template<class BinaryBVHType>
+            size_t collapse(const BinaryBVHType &bvh, size_t binaryIndex)
+            {
+                //
+                // Gather up to Width descendants of node
+                //
+                size_t children[Width];
+                int numChildren = 0;
+
+                if (bvh.isLeafNode(binaryIndex))
+                {
+                    children[numChildren++] = binaryIndex;
+                }
+                else
+                {
+                    children[numChildren++] = binaryIndex + 1;
+                    children[numChildren++] = bvh.getRightChild(binaryIndex);
+                }
+
+                while (numChildren < Width)
+                {
+                    int largest = -1;
+                    NumericType largestArea = -1;
+
+                    for (int i = 0; i != numChildren; ++i)
+                    {
+                        if (bvh.isLeafNode(children[i]))
+                        {
+                            continue;
+                        }
+
+                        NumericType area = bvh.getNodeBounds(children[i]).getSurfaceArea();
+
+                        if (largestArea < area)
+                        {
+                            largestArea = area;
+                            largest = i;
+                        }
+                    }
+
+                    if (-1 == largest)
+                    {
+                        break;
+                    }
+
+                    const size_t expanded = children[largest];
+
+                    children[largest] = expanded + 1;
+                    children[numChildren++] = bvh.getRightChild(expanded);
+                }
+
+                //
+                // Emit node, and then its subtrees
+                //
+                const size_t index = mNodes.size();
+                mNodes.push_back(Node());
+
+                for (int i = 0; i != Width; ++i)
+                {
+                    Node &node = mNodes[index];
+
+                    if (numChildren <= i)
+                    {
+                        node.xMin[i] = node.yMin[i] = node.zMin[i] =  (std::numeric_limits<NumericType>::max)();
+                        node.xMax[i] = node.yMax[i] = node.zMax[i] = -(std::numeric_limits<NumericType>::max)();
+                        node.child[i] = 0;
+                        node.count[i] = 0;
+                        continue;
+                    }
+
+                    const AABBoxType &bounds = bvh.getNodeBounds(children[i]);
+
+                    node.xMin[i] = bounds.xMin; node.xMax[i] = bounds.xMax;
+                    node.yMin[i] = bounds.yMin; node.yMax[i] = bounds.yMax;
+                    node.zMin[i] = bounds.zMin; node.zMax[i] = bounds.zMax;
+
+                    if (bvh.isLeafNode(children[i]))
+                    {
+                        size_t begin, end;
+                        bvh.getLeafRange(children[i], begin, end);
+
+                        node.child[i] = begin;
+                        node.count[i] = end - begin;
+                    }
+                    else
+                    {
+                        node.count[i] = 0;
+
+                        // Node is not referenced across recursion, which grows the array
+                        const size_t child = collapse(bvh, children[i]);
+                        mNodes[index].child[i] = child;
+                    }
+                }
+
+                return index;
+            }
+    };
+
+#endif